@@ -188,6 +188,20 @@ public:
         this->case_weights = case_weights;
     }
 
+    uint getNumBins() const {
+        return num_bins;
+    }
+
+    /**
+     * Switches training to histogram-binned split finding.  Must be called
+     * before init.  Features are quantized once into at most num_bins bins
+     * (uint8 per cell) and nodes are split from per-bin class histograms.
+     * @param num_bins Maximum bins per feature, 0 for exact split finding
+     */
+    void setNumBins(uint num_bins) {
+        this->num_bins = num_bins;
+    }
+
 
 
 protected:
@@ -239,6 +253,7 @@ protected:
     bool predict_all;
     bool keep_inbag;
     double sample_fraction;
+    uint num_bins;
 
     // For each varID true if ordered
     std::vector<bool> is_ordered_variable;
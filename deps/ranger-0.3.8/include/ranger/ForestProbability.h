@@ -61,6 +61,22 @@ public:
         return class_values;
       }
 
+      /**
+       * Predicts the probability of class classID for each sample in
+       * prediction_data, evaluating the trees in batches of batch_size.  A
+       * sample stops early once its final probability is certain to be
+       * above threshold + margin or below threshold - margin whatever the
+       * remaining trees vote, so only samples that are close to the threshold
+       * pass through every tree.  Samples that stop early get the mean over
+       * the trees evaluated so far, which is on the same side of the
+       * threshold as their exact probability.  Does not touch the normal
+       * predictions.
+       * @param class_probabilities Output, one probability per sample
+       * @param num_trees_used Output, number of trees evaluated per sample
+       */
+      void predictEarlyExit(const Data* prediction_data, size_t classID, double threshold, double margin,
+          size_t batch_size, std::vector<double>& class_probabilities, std::vector<size_t>& num_trees_used);
+
     protected:
       void initInternal(std::string status_variable_name);
       void growInternal();
@@ -72,6 +88,10 @@ public:
       void saveToFileInternal(std::ofstream& outfile);
       void loadFromFileInternal(std::ifstream& infile);
 
+      void predictEarlyExitInThread(size_t start, size_t end, const Data* prediction_data, size_t classID,
+          double threshold, double margin, size_t batch_size, std::vector<double>* class_probabilities,
+          std::vector<size_t>* num_trees_used);
+
       // Classes of the dependent variable and classIDs for responses
       std::vector<double> class_values;
       std::vector<uint> response_classIDs;
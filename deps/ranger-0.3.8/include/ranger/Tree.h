@@ -58,6 +58,9 @@ public:
 
   void predict(const Data* prediction_data, bool oob_prediction);
 
+  // Drop a single sample down the tree and return the terminal nodeID
+  size_t dropDownSample(const Data* prediction_data, size_t sampleID) const;
+
   void computePermutationImportance(std::vector<double>* forest_importance, std::vector<double>* forest_variance);
 
   void appendToFile(std::ofstream& file);
@@ -30,6 +30,7 @@
 #define TREEPROBABILITY_H_
 
 #include <map>
+#include <unordered_map>
 
 #include "globals.h"
 #include "Tree.h"
@@ -74,6 +75,16 @@ private:
       double& best_value, size_t& best_varID, double& best_decrease);
   void findBestSplitValueUnordered(size_t nodeID, size_t varID, double sum_node, size_t num_samples_node,
       double& best_value, size_t& best_varID, double& best_decrease);
+  void findBestSplitValueHistogram(size_t nodeID, size_t varID, double sum_node, size_t num_samples_node,
+      double& best_value, size_t& best_varID, double& best_decrease);
+
+  // Per-bin sample counts followed by per-bin response sums for varID in nodeID. Derived from the parent
+  // and sibling histograms (parent - sibling) where possible, otherwise computed from the node's samples.
+  const std::vector<double>& getNodeHistogram(size_t nodeID, size_t varID);
+  void computeNodeHistogram(size_t nodeID, size_t varID, std::vector<double>& histogram);
+  void releaseNodeHistograms(size_t nodeID);
+  // Releases the histograms nobody can derive from any more once nodeID has been split or made terminal
+  void releaseFinishedHistograms(size_t nodeID, bool terminal);
 
   void addImpurityImportance(size_t nodeID, size_t varID, double decrease);
 
@@ -84,6 +95,8 @@ private:
     if (sums != 0) {
       delete[] sums;
     }
+    parent_nodeIDs.clear();
+    node_histograms.clear();
   }
 
   // Classes of the dependent variable and classIDs for responses
@@ -96,6 +109,12 @@ private:
   size_t* counter;
   double* sums;
 
+  // Histogram mode: parent of each node, histograms kept for subtraction and the node currently being split
+  std::vector<size_t> parent_nodeIDs;
+  std::vector<std::unordered_map<size_t, std::vector<double>>> node_histograms;
+  std::vector<double> histogram;
+  size_t splitting_nodeID;
+
   DISALLOW_COPY_AND_ASSIGN(TreeProbability);
 };
 
@@ -29,6 +29,8 @@ wright@imbs.uni-luebeck.de
 #ifndef GLOBALS_H_
 #define GLOBALS_H_
 
+#include <cstddef>
+
 #define DISALLOW_COPY_AND_ASSIGN(TypeName) \
     TypeName(const TypeName&);             \
     void operator=(const TypeName&)
@@ -90,4 +92,9 @@ const double STATUS_INTERVAL = 30.0;
 // Threshold for q value split method switch
 const double Q_THRESHOLD = 0.02;
 
+// Histogram mode: marker for the root's parent, and nodes must hold more than this many samples per bin to
+// keep their histograms for subtraction in their children
+const std::size_t NO_PARENT_NODE = (std::size_t) -1;
+const std::size_t HISTOGRAM_SUBTRACTION_FACTOR = 4;
+
 #endif /* GLOBALS_H_ */
@@ -37,7 +37,7 @@
 
 Data::Data() :
 num_rows(0), num_rows_rounded(0), num_cols(0), sparse_data(0), num_cols_no_sparse(0), index_data(
-0), max_num_unique_values(0) {
+0), bin_data(0), max_num_unique_values(0) {
 }
 
 Data::Data(std::vector<std::string> variable_names, size_t num_rows, size_t num_cols) : Data() {
@@ -51,6 +51,9 @@ Data::~Data() {
     if (index_data != 0) {
         delete[] index_data;
     }
+    if (bin_data != 0) {
+        delete[] bin_data;
+    }
 }
 
 size_t Data::getVariableID(std::string variable_name) {
@@ -221,6 +224,62 @@ void Data::sort() {
     }
 }
 
+void Data::bin(size_t max_bins) {
+
+    if (max_bins < 2 || max_bins > 256) {
+        throw std::runtime_error("Number of histogram bins must be between 2 and 256.");
+    }
+    if (sparse_data != 0) {
+        throw std::runtime_error("Histogram binning is not supported with sparse data.");
+    }
+
+    // Reserve memory
+    bin_data = new unsigned char[num_cols * num_rows];
+    unique_data_values.clear();
+    max_num_unique_values = 0;
+
+    std::vector<double> values(num_rows);
+    for (size_t col = 0; col < num_cols; ++col) {
+
+        // Sorted copy of the column
+        for (size_t row = 0; row < num_rows; ++row) {
+            values[row] = get(row, col);
+        }
+        std::sort(values.begin(), values.end());
+
+        // Bin edges are the unique values if they fit, otherwise the quantiles
+        std::vector<double> edges;
+        size_t num_unique = num_rows == 0 ? 0 : 1;
+        for (size_t row = 1; row < num_rows && num_unique <= max_bins; ++row) {
+            if (values[row] != values[row - 1]) {
+                ++num_unique;
+            }
+        }
+        if (num_unique <= max_bins) {
+            edges = values;
+            edges.erase(unique(edges.begin(), edges.end()), edges.end());
+        } else {
+            for (size_t i = 1; i <= max_bins; ++i) {
+                double edge = values[(i * num_rows - 1) / max_bins];
+                if (edges.empty() || edge != edges.back()) {
+                    edges.push_back(edge);
+                }
+            }
+        }
+
+        // Bin of each observation is the first edge not below its value
+        for (size_t row = 0; row < num_rows; ++row) {
+            size_t idx = std::lower_bound(edges.begin(), edges.end(), get(row, col)) - edges.begin();
+            bin_data[col * num_rows + row] = (unsigned char) idx;
+        }
+
+        if (edges.size() > max_num_unique_values) {
+            max_num_unique_values = edges.size();
+        }
+        unique_data_values.push_back(edges);
+    }
+}
+
 void Data::saveToTSV(const std::string& file) {
     std::ofstream fout(file.c_str(), std::ofstream::out);
 
@@ -94,8 +94,10 @@ void ForestClassification::initInternal(std::string status_variable_name) {
     }
   }
 
-  // Sort data if memory saving mode
-  if (!memory_saving_splitting) {
+  // Quantize data into histogram bins if requested, otherwise sort data for training if not memory saving mode
+  if (num_bins > 0 && !prediction_mode) {
+    data->bin(num_bins);
+  } else if (!memory_saving_splitting && !prediction_mode) {
     data->sort();
   }
 }
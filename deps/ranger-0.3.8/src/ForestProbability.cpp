@@ -26,7 +26,11 @@
  wright@imbs.uni-luebeck.de
  #-------------------------------------------------------------------------------*/
 
+#include <algorithm>
 #include <stdexcept>
+#ifndef WIN_R_BUILD
+#include <thread>
+#endif
 
 #include <ranger/utility.h>
 #include <ranger/ForestProbability.h>
@@ -95,8 +99,10 @@ void ForestProbability::initInternal(std::string status_variable_name) {
     }
   }
 
-  // Sort data if memory saving mode
-  if (!memory_saving_splitting) {
+  // Quantize data into histogram bins if requested, otherwise sort data for training if not memory saving mode
+  if (num_bins > 0 && !prediction_mode) {
+    data->bin(num_bins);
+  } else if (!memory_saving_splitting && !prediction_mode) {
     data->sort();
   }
 }
@@ -122,7 +128,7 @@ void ForestProbability::predictInternal() {
 
     // For each sample compute proportions in each tree and average over trees
     for (size_t tree_idx = 0; tree_idx < num_trees; ++tree_idx) {
-      std::vector<double> counts = ((TreeProbability*) trees[tree_idx])->getPrediction(sample_idx);
+      const std::vector<double>& counts = ((TreeProbability*) trees[tree_idx])->getPrediction(sample_idx);
 
       for (size_t class_idx = 0; class_idx < counts.size(); ++class_idx) {
         predictions[sample_idx][class_idx] += counts[class_idx] / num_trees;
@@ -132,6 +138,93 @@ void ForestProbability::predictInternal() {
 
 }
 
+void ForestProbability::predictEarlyExit(const Data* prediction_data, size_t classID, double threshold,
+    double margin, size_t batch_size, std::vector<double>& class_probabilities, std::vector<size_t>& num_trees_used) {
+
+  if (classID >= class_values.size()) {
+    throw std::runtime_error("Class ID out of range for early exit prediction.");
+  }
+
+  size_t num_prediction_samples = prediction_data->getNumRows();
+  class_probabilities.assign(num_prediction_samples, 0);
+  num_trees_used.assign(num_prediction_samples, 0);
+  if (num_prediction_samples == 0 || num_trees == 0) {
+    return;
+  }
+  if (batch_size == 0 || batch_size > num_trees) {
+    batch_size = num_trees;
+  }
+
+#ifdef WIN_R_BUILD
+  predictEarlyExitInThread(0, num_prediction_samples, prediction_data, classID, threshold, margin, batch_size,
+      &class_probabilities, &num_trees_used);
+#else
+  // Samples are independent so split them, rather than the trees, between threads
+  uint num_parts = std::min((size_t) num_threads, num_prediction_samples);
+  std::vector<uint> sample_ranges;
+  equalSplit(sample_ranges, 0, num_prediction_samples - 1, num_parts);
+
+  std::vector<std::thread> threads;
+  threads.reserve(num_parts);
+  for (uint i = 0; i < num_parts; ++i) {
+    threads.push_back(std::thread(&ForestProbability::predictEarlyExitInThread, this, sample_ranges[i],
+        sample_ranges[i + 1], prediction_data, classID, threshold, margin, batch_size, &class_probabilities,
+        &num_trees_used));
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+#endif
+}
+
+void ForestProbability::predictEarlyExitInThread(size_t start, size_t end, const Data* prediction_data,
+    size_t classID, double threshold, double margin, size_t batch_size, std::vector<double>* class_probabilities,
+    std::vector<size_t>* num_trees_used) {
+
+  // Samples still undecided, evaluated tree by tree within each batch to keep the tree in cache
+  std::vector<size_t> active;
+  active.reserve(end - start);
+  for (size_t sample_idx = start; sample_idx < end; ++sample_idx) {
+    active.push_back(sample_idx);
+  }
+  std::vector<double> sums(end - start, 0);
+
+  size_t tree_idx = 0;
+  while (tree_idx < num_trees && !active.empty()) {
+    size_t batch_end = std::min(tree_idx + batch_size, num_trees);
+    for (; tree_idx < batch_end; ++tree_idx) {
+      TreeProbability* tree = (TreeProbability*) trees[tree_idx];
+      const std::vector<std::vector<double>>& terminal_class_counts = tree->getTerminalClassCounts();
+
+      // Accumulate in the same order as predictInternal() so that exact results match
+      for (auto& sample_idx : active) {
+        size_t nodeID = tree->dropDownSample(prediction_data, sample_idx);
+        sums[sample_idx - start] += terminal_class_counts[nodeID][classID] / num_trees;
+      }
+    }
+
+    // Retire samples the remaining trees cannot move across the threshold
+    double remaining = (double) (num_trees - tree_idx) / num_trees;
+    size_t num_active = 0;
+    for (auto& sample_idx : active) {
+      double sum = sums[sample_idx - start];
+      if (tree_idx < num_trees && (sum > threshold + margin || sum + remaining < threshold - margin)) {
+        (*class_probabilities)[sample_idx] = sum * num_trees / tree_idx;
+        (*num_trees_used)[sample_idx] = tree_idx;
+      } else {
+        active[num_active++] = sample_idx;
+      }
+    }
+    active.resize(num_active);
+  }
+
+  // Samples that went through every tree
+  for (auto& sample_idx : active) {
+    (*class_probabilities)[sample_idx] = sums[sample_idx - start];
+    (*num_trees_used)[sample_idx] = num_trees;
+  }
+}
+
 void ForestProbability::computePredictionErrorInternal() {
 
   // For each sample sum over trees where sample is OOB
@@ -75,8 +75,10 @@ void ForestRegression::initInternal(std::string status_variable_name) {
     min_node_size = DEFAULT_MIN_NODE_SIZE_REGRESSION;
   }
 
-  // Sort data if memory saving mode
-  if (!memory_saving_splitting) {
+  // Quantize data into histogram bins if requested, otherwise sort data for training if not memory saving mode
+  if (num_bins > 0 && !prediction_mode) {
+    data->bin(num_bins);
+  } else if (!memory_saving_splitting && !prediction_mode) {
     data->sort();
   }
 }
@@ -141,42 +141,48 @@ void Tree::predict(const Data* prediction_data, bool oob_prediction) {
     } else {
       sample_idx = i;
     }
-    size_t nodeID = 0;
-    while (1) {
+    prediction_terminal_nodeIDs[i] = dropDownSample(prediction_data, sample_idx);
+  }
+}
+
+size_t Tree::dropDownSample(const Data* prediction_data, size_t sampleID) const {
+
+  // Start in root and drop down until a terminal node is reached
+  size_t nodeID = 0;
+  while (1) {
+
+    // Break if terminal node
+    if (child_nodeIDs[nodeID].empty()) {
+      break;
+    }
 
-      // Break if terminal node
-      if (child_nodeIDs[nodeID].empty()) {
-        break;
+    // Move to child
+    size_t split_varID = split_varIDs[nodeID];
+    double value = prediction_data->get(sampleID, split_varID);
+    if ((*is_ordered_variable)[split_varID]) {
+      if (value <= split_values[nodeID]) {
+        // Move to left child
+        nodeID = child_nodeIDs[nodeID][0];
+      } else {
+        // Move to right child
+        nodeID = child_nodeIDs[nodeID][1];
       }
+    } else {
+      size_t factorID = floor(value) - 1;
+      size_t splitID = floor(split_values[nodeID]);
 
-      // Move to child
-      size_t split_varID = split_varIDs[nodeID];
-      double value = prediction_data->get(sample_idx, split_varID);
-      if ((*is_ordered_variable)[split_varID]) {
-        if (value <= split_values[nodeID]) {
-          // Move to left child
-          nodeID = child_nodeIDs[nodeID][0];
-        } else {
-          // Move to right child
-          nodeID = child_nodeIDs[nodeID][1];
-        }
+      // Left if 0 found at position factorID
+      if (!(splitID & (1 << factorID))) {
+        // Move to left child
+        nodeID = child_nodeIDs[nodeID][0];
       } else {
-        size_t factorID = floor(value) - 1;
-        size_t splitID = floor(split_values[nodeID]);
-
-        // Left if 0 found at position factorID
-        if (!(splitID & (1 << factorID))) {
-          // Move to left child
-          nodeID = child_nodeIDs[nodeID][0];
-        } else {
-          // Move to right child
-          nodeID = child_nodeIDs[nodeID][1];
-        }
+        // Move to right child
+        nodeID = child_nodeIDs[nodeID][1];
       }
     }
-
-    prediction_terminal_nodeIDs[i] = nodeID;
   }
+
+  return nodeID;
 }
 
 void Tree::computePermutationImportance(std::vector<double>* forest_importance, std::vector<double>* forest_variance) {
@@ -31,14 +31,16 @@
 #include <ranger/Data.h>
 
 TreeProbability::TreeProbability(std::vector<double>* class_values, std::vector<uint>* response_classIDs) :
-    class_values(class_values), response_classIDs(response_classIDs), counter(0), sums(0) {
+    class_values(class_values), response_classIDs(response_classIDs), counter(0), sums(0), splitting_nodeID(
+        NO_PARENT_NODE) {
 }
 
 TreeProbability::TreeProbability(std::vector<std::vector<size_t>>& child_nodeIDs, std::vector<size_t>& split_varIDs,
     std::vector<double>& split_values, std::vector<double>* class_values, std::vector<uint>* response_classIDs,
     std::vector<std::vector<double>>& terminal_class_counts, std::vector<bool>* is_ordered_variable) :
     Tree(child_nodeIDs, split_varIDs, split_values, is_ordered_variable), class_values(class_values), response_classIDs(
-        response_classIDs), terminal_class_counts(terminal_class_counts), counter(0), sums(0) {
+        response_classIDs), terminal_class_counts(terminal_class_counts), counter(0), sums(0), splitting_nodeID(
+        NO_PARENT_NODE) {
 }
 
 TreeProbability::~TreeProbability() {
@@ -70,6 +72,7 @@ void TreeProbability::addToTerminalNodes(size_t nodeID) {
   for (size_t i = 0; i < terminal_class_counts[nodeID].size(); ++i) {
     terminal_class_counts[nodeID][i] /= num_samples_in_node;
   }
+
 }
 
 void TreeProbability::appendToFileInternal(std::ofstream& file) {
@@ -90,9 +93,13 @@ void TreeProbability::appendToFileInternal(std::ofstream& file) {
 
 bool TreeProbability::splitNodeInternal(size_t nodeID, std::vector<size_t>& possible_split_varIDs) {
 
+  // Children created after this call belong to this node
+  splitting_nodeID = nodeID;
+
   // Check node size, stop if maximum reached
   if (sampleIDs[nodeID].size() <= min_node_size) {
     addToTerminalNodes(nodeID);
+    releaseFinishedHistograms(nodeID, true);
     return true;
   }
 
@@ -109,6 +116,7 @@ bool TreeProbability::splitNodeInternal(size_t nodeID, std::vector<size_t>& poss
   }
   if (pure) {
     addToTerminalNodes(nodeID);
+    releaseFinishedHistograms(nodeID, true);
     return true;
   }
 
@@ -116,14 +124,18 @@ bool TreeProbability::splitNodeInternal(size_t nodeID, std::vector<size_t>& poss
   bool stop = findBestSplit(nodeID, possible_split_varIDs);
   if (stop) {
     addToTerminalNodes(nodeID);
+    releaseFinishedHistograms(nodeID, true);
     return true;
   }
 
+  releaseFinishedHistograms(nodeID, false);
   return false;
 }
 
 void TreeProbability::createEmptyNodeInternal() {
   terminal_class_counts.push_back(std::vector<double>());
+  parent_nodeIDs.push_back(splitting_nodeID);
+  node_histograms.push_back(std::unordered_map<size_t, std::vector<double>>());
 }
 
 double TreeProbability::computePredictionAccuracyInternal() {
@@ -159,8 +171,10 @@ bool TreeProbability::findBestSplit(size_t nodeID, std::vector<size_t>& possible
     // Find best split value, if ordered consider all values as split values, else all 2-partitions
     if ((*is_ordered_variable)[varID]) {
 
-      // Use memory saving method if option set
-      if (memory_saving_splitting) {
+      // Use per-bin histograms if data was quantized, memory saving method if option set
+      if (data->isBinned()) {
+        findBestSplitValueHistogram(nodeID, varID, sum_node, num_samples_node, best_value, best_varID, best_decrease);
+      } else if (memory_saving_splitting) {
         findBestSplitValueSmallQ(nodeID, varID, sum_node, num_samples_node, best_value, best_varID, best_decrease);
       } else {
         // Use faster method for both cases
@@ -311,6 +325,140 @@ void TreeProbability::findBestSplitValueLargeQ(size_t nodeID, size_t varID, doub
   }
 }
 
+void TreeProbability::findBestSplitValueHistogram(size_t nodeID, size_t varID, double sum_node,
+    size_t num_samples_node, double& best_value, size_t& best_varID, double& best_decrease) {
+
+  size_t num_bins = data->getNumUniqueDataValues(varID);
+  const std::vector<double>& node_histogram = getNodeHistogram(nodeID, varID);
+  const double* counts = node_histogram.data();
+  const double* bin_sums = counts + num_bins;
+
+  size_t n_left = 0;
+  double sum_left = 0;
+
+  // Compute decrease of impurity for each split between bins
+  for (size_t i = 0; i < num_bins - 1; ++i) {
+
+    // Stop if nothing here
+    if (counts[i] == 0) {
+      continue;
+    }
+
+    n_left += (size_t) counts[i];
+    sum_left += bin_sums[i];
+
+    // Stop if right child empty
+    size_t n_right = num_samples_node - n_left;
+    if (n_right == 0) {
+      break;
+    }
+
+    double sum_right = sum_node - sum_left;
+    double decrease = sum_left * sum_left / (double) n_left + sum_right * sum_right / (double) n_right;
+
+    // If better than before, use this
+    if (decrease > best_decrease) {
+      best_value = data->getUniqueDataValue(varID, i);
+      best_varID = varID;
+      best_decrease = decrease;
+    }
+  }
+}
+
+const std::vector<double>& TreeProbability::getNodeHistogram(size_t nodeID, size_t varID) {
+
+  auto cached = node_histograms[nodeID].find(varID);
+  if (cached != node_histograms[nodeID].end()) {
+    return cached->second;
+  }
+
+  // Find the parent histogram and the sibling, if the parent histogram is still around
+  size_t parentID = parent_nodeIDs[nodeID];
+  const std::vector<double>* parent_histogram = 0;
+  size_t siblingID = NO_PARENT_NODE;
+  if (parentID != NO_PARENT_NODE) {
+    auto parent = node_histograms[parentID].find(varID);
+    if (parent != node_histograms[parentID].end()) {
+      parent_histogram = &parent->second;
+      siblingID = child_nodeIDs[parentID][0] == nodeID ? child_nodeIDs[parentID][1] : child_nodeIDs[parentID][0];
+    }
+  }
+
+  // Keep histograms of nodes large enough for their children to gain from subtraction, and of first
+  // children that are not larger than their sibling, which is then derived from them when it is split
+  size_t num_bins = data->getNumUniqueDataValues(varID);
+  bool keep = sampleIDs[nodeID].size() > HISTOGRAM_SUBTRACTION_FACTOR * num_bins
+      || (parent_histogram != 0 && siblingID > nodeID && sampleIDs[siblingID].size() >= sampleIDs[nodeID].size());
+  std::vector<double>& result = keep ? node_histograms[nodeID][varID] : histogram;
+
+  // Derive from parent and sibling where possible
+  if (parent_histogram != 0) {
+    auto sibling = node_histograms[siblingID].find(varID);
+    const std::vector<double>* sibling_histogram = 0;
+    if (sibling != node_histograms[siblingID].end()) {
+      sibling_histogram = &sibling->second;
+    } else if (siblingID > nodeID && sampleIDs[siblingID].size() < sampleIDs[nodeID].size()) {
+      // Smaller sibling not split yet: count it now, keep it for when it is split and subtract
+      std::vector<double>& counted = node_histograms[siblingID][varID];
+      computeNodeHistogram(siblingID, varID, counted);
+      sibling_histogram = &counted;
+    }
+    if (sibling_histogram != 0) {
+      result.resize(parent_histogram->size());
+      for (size_t i = 0; i < result.size(); ++i) {
+        result[i] = (*parent_histogram)[i] - (*sibling_histogram)[i];
+      }
+      return result;
+    }
+  }
+
+  computeNodeHistogram(nodeID, varID, result);
+  return result;
+}
+
+void TreeProbability::computeNodeHistogram(size_t nodeID, size_t varID, std::vector<double>& histogram) {
+
+  size_t num_bins = data->getNumUniqueDataValues(varID);
+  histogram.assign(2 * num_bins, 0);
+  double* counts = histogram.data();
+  double* bin_sums = counts + num_bins;
+
+  for (auto& sampleID : sampleIDs[nodeID]) {
+    unsigned char bin = data->getBin(sampleID, varID);
+    ++counts[bin];
+    bin_sums[bin] += data->get(sampleID, dependent_varID);
+  }
+}
+
+void TreeProbability::releaseNodeHistograms(size_t nodeID) {
+  std::unordered_map<size_t, std::vector<double>>().swap(node_histograms[nodeID]);
+}
+
+void TreeProbability::releaseFinishedHistograms(size_t nodeID, bool terminal) {
+
+  if (!data->isBinned()) {
+    return;
+  }
+
+  // A first child's histograms are still needed to derive its sibling's
+  size_t parentID = parent_nodeIDs[nodeID];
+  if (parentID != NO_PARENT_NODE && child_nodeIDs[parentID][1] != nodeID) {
+    return;
+  }
+
+  // Both children of the parent are split now, so only nodes that will have children still need theirs
+  if (parentID != NO_PARENT_NODE) {
+    releaseNodeHistograms(parentID);
+    size_t siblingID = child_nodeIDs[parentID][0];
+    if (child_nodeIDs[siblingID].empty()) {
+      releaseNodeHistograms(siblingID);
+    }
+  }
+  if (terminal) {
+    releaseNodeHistograms(nodeID);
+  }
+}
+
 void TreeProbability::findBestSplitValueUnordered(size_t nodeID, size_t varID, double sum_node, size_t num_samples_node,
     double& best_value, size_t& best_varID, double& best_decrease) {
 
@@ -99,6 +99,31 @@ struct CigarOp {
 	}
 };
 
+/**
+ * Strand of the transcript that a read came from under the given library
+ * protocol, or UNKNOWN if the protocol doesn't tell us.  First strand reads
+ * run against the transcript and second strand reads along it, and in FR and
+ * RF libraries the other mate runs the opposite way.  With the protocol known
+ * at compile time this reduces to a couple of xors.
+ */
+template<Strandedness S, Orientation O>
+inline Strand protocolStrand(bool firstMate, bool reverse) {
+	if ((S != Strandedness::FIRSTSTRAND && S != Strandedness::SECONDSTRAND) || O == Orientation::UNKNOWN) {
+		return Strand::UNKNOWN;
+	}
+	const bool flip = (S == Strandedness::SECONDSTRAND) != (O == Orientation::FR);
+	const bool mateFlip = O == Orientation::FR || O == Orientation::RF;
+	return (reverse != flip) != (mateFlip && firstMate) ? Strand::POSITIVE : Strand::NEGATIVE;
+}
+
+typedef Strand (*StrandFunction)(bool firstMate, bool reverse);
+
+/**
+ * Looks up the protocolStrand instantiation for a protocol only known at run
+ * time
+ */
+StrandFunction strandFunction(Strandedness strandedness, Orientation orientation);
+
 class BamAlignment {
 private:
 
@@ -118,6 +143,11 @@ private:
 
 	void init();
 
+	/**
+	 * Decodes everything except the strand from the raw alignment
+	 */
+	void decode();
+
 	Strand calcStrand();
 
 public:
@@ -148,6 +178,15 @@ public:
 	 */
 	BamAlignment(const BamAlignment& other);
 
+	/**
+	 * Makes a deep copy of this alignment without its optional fields, which
+	 * for long reads can be larger than the rest of the record.  The decoded
+	 * fields, including the strand, are copied rather than worked out again,
+	 * so the copy still has the strand given by any XS tag.
+	 * @return A compact copy of this alignment
+	 */
+	shared_ptr<BamAlignment> compactCopy() const;
+
 	/**
 	 * Deletes the underlying samtools bam alignment only if it is managed (owned)
 	 * by this object
@@ -156,6 +195,30 @@ public:
 
 	void setRaw(bam1_t* b);
 
+	/**
+	 * As setRaw, but with the library protocol fixed at compile time so that
+	 * working out the strand of each record doesn't branch on it
+	 */
+	template<Strandedness S, Orientation O>
+	void setRaw(bam1_t* b) {
+		this->b = b;
+		managed = false;
+		strandedness = S;
+		orientation = O;
+		decode();
+		const Strand xs = getXSStrand();
+		strand = xs != Strand::UNKNOWN ? xs : protocolStrand<S, O>(isFirstMate(), isReverseStrand());
+	}
+
+	/**
+	 * Sets the library protocol used to work out the strand of alignments
+	 * loaded from now on
+	 */
+	void setProtocol(Strandedness strandedness, Orientation orientation) {
+		this->strandedness = strandedness;
+		this->orientation = orientation;
+	}
+
 	bam1_t* getRaw() const;
 
 	void setCigar(vector<CigarOp>& cig) {
@@ -292,6 +355,16 @@ public:
 
 	portcullis::bam::Strand getXSStrand() const;
 
+	/**
+	 * Gets the value of a string (type Z) optional field
+	 * @param tag Two character tag name, e.g. "CB"
+	 * @return The value, or nullptr if the field is missing or not a string
+	 */
+	const char* getStringTag(const char* tag) const {
+		uint8_t* res = bam_aux_get(b, tag);
+		return res != 0 ? bam_aux2Z(res) : nullptr;
+	}
+
 	/**
 	 * Calculate if the template is properly paired based on the orientations of
 	 * the alignments and the configuration passed in by the user.
@@ -300,6 +373,20 @@ public:
 	 */
 	bool calcIfProperPair(Orientation orientation) const;
 
+	/**
+	 * As calcIfProperPair, for an orientation known at compile time
+	 */
+	template<Orientation O>
+	bool calcIfProperPair() const {
+		if (O != Orientation::FR && O != Orientation::RF && O != Orientation::FF) {
+			return false;
+		}
+		const bool diffStrand = this->isReverseStrand() != this->isMateReverseStrand();
+		const bool posGap = !this->isReverseStrand() ? this->position < this->matePos : this->position > this->matePos;
+		const bool geometry = O == Orientation::FF ? !diffStrand && posGap : diffStrand && posGap == (O == Orientation::FR);
+		return this->isPaired() && this->isMateMapped() && this->refId == this->mateId && geometry;
+	}
+
 
 	string deriveName() const;
 
@@ -318,8 +405,14 @@ public:
 	uint32_t calcNbAlignedBases(int32_t start, int32_t end, bool includeSoftClips) const;
 
 	string getPaddedQuerySeq(int32_t start, int32_t end, int32_t& actual_start, int32_t& actual_end, const bool include_soft_clips) const;
-	string getPaddedQuerySeq(const string& querySeq, int32_t start, int32_t end, int32_t& actual_start, int32_t& actual_end, const bool include_soft_clips) const;
-	string getPaddedGenomeSeq(const string& fullGenomeSeq, int32_t start, int32_t end, int32_t q_start, int32_t q_end, const bool include_soft_clips) const;
+	/**
+	 * Query sequence aligned to [start, end], padded where the alignment has
+	 * deletions or skips.  Aligned ops that begin before start are normally
+	 * skipped whole.  With trim_straddling they contribute the part inside the
+	 * region instead, for regions that can start part way through an op.
+	 */
+	string getPaddedQuerySeq(const string& querySeq, int32_t start, int32_t end, int32_t& actual_start, int32_t& actual_end, const bool include_soft_clips, const bool trim_straddling = false) const;
+	string getPaddedGenomeSeq(const string& fullGenomeSeq, int32_t start, int32_t end, int32_t q_start, int32_t q_end, const bool include_soft_clips, const bool trim_straddling = false) const;
 
 	string toString() const;
 	string toString(bool afterClipping) const;
@@ -41,6 +41,7 @@ using boost::lexical_cast;
 #include <htslib/bgzf.h>
 
 #include <portcullis/bam/bam_alignment.hpp>
+#include <portcullis/bam/region_list.hpp>
 using portcullis::bam::BamAlignment;
 using portcullis::bam::BamAlignmentPtr;
 using portcullis::bam::RefSeqPtr;
@@ -64,9 +65,38 @@ private:
 	bam1_t* c;
 	hts_idx_t* index;
 	hts_itr_t * iter;
+	bool emptyRegion;	// Set when the index says the requested region holds no alignments
+
+	// Set by setRegions
+	RegionList regions;
+	size_t regionIndex;	// First region that later alignments may overlap
+	int32_t regionSeq;	// Target sequence the iterator is on
 
 	BamAlignment b;
 
+	/**
+	 * Reads the next alignment into c from the region or regions set, if any
+	 */
+	bool read() {
+		if (emptyRegion) {
+			return false;
+		}
+		return regions.empty() ? bam_iter_read(fp, iter, c) >= 0 : readRegions();
+	}
+
+	bool readRegions();
+
+	/**
+	 * Points the iterator at the regions on the same target sequence as the
+	 * given region
+	 */
+	void queryRegions(const size_t first);
+
+	/**
+	 * Replaces the chunks of the current iterator
+	 */
+	void setChunks(const vector<hts_pair64_t>& chunks);
+
 public:
 
 	BamReader(const path& _bamFile);
@@ -87,16 +117,69 @@ public:
 
 	string bamDetails() const;
 
+	/**
+	 * Opens the BAM and loads its index if there is one.  A path of "-" reads
+	 * from standard input, which can only be read through from start to end.
+	 */
 	void open();
 
 	void close();
 
 	bool next();
 
+	/**
+	 * As next, but with the library protocol fixed at compile time.  Overrides
+	 * any protocol given to setProtocol.
+	 */
+	template<Strandedness S, Orientation O>
+	bool next() {
+		if (!read()) {
+			return false;
+		}
+		b.setRaw<S, O>(c);
+		return true;
+	}
+
 	const BamAlignment& current() const;
 
+	/**
+	 * Restricts subsequent calls to next to alignments overlapping the given
+	 * region.  Requires an index.  seqIndex may also be HTS_IDX_NOCOOR to
+	 * iterate over the unplaced alignments at the end of the file.
+	 */
 	void setRegion(const int32_t seqIndex, const int32_t start, const int32_t end);
 
+	/**
+	 * As setRegion, but only reads the alignments held between each pair of
+	 * BGZF virtual file offsets, which must be in file order.  Used to skip
+	 * the parts of the region that are known to be of no interest.
+	 */
+	void setRegion(const int32_t seqIndex, const int32_t start, const int32_t end, const vector<hts_pair64_t>& chunks);
+
+	/**
+	 * Restricts subsequent calls to next to alignments overlapping any of the
+	 * given regions, which must be merged.  Each alignment is returned once,
+	 * in file order, even if it overlaps several regions.  The regions on each
+	 * target sequence are read with a single iterator, which only seeks
+	 * between them when they are in different BGZF blocks.  Requires an index.
+	 */
+	void setRegions(const RegionList& regions);
+
+	bool isIndexed() const { return index != nullptr; }
+
+	/**
+	 * Sets the library protocol given to alignments read from now on, so that
+	 * their strand can be derived when there is no XS tag
+	 */
+	void setProtocol(Strandedness strandedness, Orientation orientation) { b.setProtocol(strandedness, orientation); }
+
+	/**
+	 * Gets the number of mapped and unmapped alignments placed on the given
+	 * target sequence, as recorded in the index.  Returns false if there is no
+	 * index or it doesn't hold these statistics (CSI indexes may not).
+	 */
+	bool getIndexStats(const int32_t seqIndex, uint64_t& mapped, uint64_t& unmapped) const;
+
 	bool isCoordSortedBam();
 };
 
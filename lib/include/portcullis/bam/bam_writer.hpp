@@ -36,28 +36,200 @@ using boost::filesystem::path;
 using boost::lexical_cast;
 
 #include <htslib/faidx.h>
+#include <htslib/bgzf.h>
+#include <htslib/hts.h>
+#include <htslib/sam.h>
 
 #include <portcullis/bam/bam_alignment.hpp>
 
 namespace portcullis {
 namespace bam {
 
+/**
+ * Serialises alignments into BGZF compressed blocks held in memory, laid out
+ * exactly as a BGZF file writer would lay them out.  Lets worker threads
+ * produce finished output for a region independently, so that a BamWriter
+ * only has to append the blocks in order.  The end offset of each record is
+ * kept (relative to the start of this buffer) so the writer can index the
+ * records as it appends them.  End offsets are only known once the next
+ * record has been placed, because a record that finishes a block must point
+ * at the start of the following block for htslib to seek to it.
+ */
+class BamBlockBuffer {
+public:
+
+	struct Record {
+		int32_t tid;
+		int32_t beg;
+		int32_t end;
+		bool mapped;
+		uint64_t endOffset;	// BGZF virtual offset relative to the first block
+	};
+
+private:
+	int level;
+	vector<uint8_t> compressed;
+	vector<uint8_t> block;
+	vector<Record> records;
+
+	void flushBlock();
+
+	void append(const void* data, size_t length);
+
+public:
+
+	BamBlockBuffer() : BamBlockBuffer(-1) {}
+
+	BamBlockBuffer(int _level) : level(_level) {
+		block.reserve(BGZF_BLOCK_SIZE);
+	}
+
+	int getLevel() const {
+		return level;
+	}
+
+	void setLevel(int level) {
+		this->level = level;
+	}
+
+	/**
+	 * Virtual offset of the current write position relative to the start of
+	 * this buffer
+	 */
+	uint64_t tell() const {
+		return ((uint64_t)compressed.size() << 16) | block.size();
+	}
+
+	int write(const BamAlignment& ba) {
+		return write(ba.getRaw());
+	}
+
+	int write(const bam1_t* b);
+
+	/**
+	 * Compresses any partly filled block.  Must be called before the blocks
+	 * are handed to a BamWriter.
+	 */
+	void flush() {
+		if (!block.empty()) flushBlock();
+		if (!records.empty()) records.back().endOffset = tell();
+	}
+
+	const vector<uint8_t>& getBlocks() const {
+		return compressed;
+	}
+
+	const vector<Record>& getRecords() const {
+		return records;
+	}
+
+	bool empty() const {
+		return compressed.empty() && block.empty();
+	}
+
+	/**
+	 * Empties the buffer but keeps its memory so it can be reused
+	 */
+	void clear() {
+		compressed.clear();
+		block.clear();
+		records.clear();
+	}
+};
+
+/**
+ * Writes alignments to a BAM file, or to a SAM file if requested.  A path of
+ * "-" writes to standard output.
+ */
 class BamWriter {
 private:
 	path bamFile;
+	int level;		// BGZF compression level, -1 for the htslib default
+	bool sam;
 
 	BGZF *fp;
+	// Used instead of fp when writing SAM
+	htsFile* samFp;
+	bam_hdr_t* header;
+
+	// Index built as records are written, null if not indexing
+	hts_idx_t* idx;
+	int idxFormat;
+
+	// Last record written, which can only be indexed once we know where the
+	// next record starts
+	BamBlockBuffer::Record pending;
+	bool hasPending;
+
+	void push(int32_t tid, int32_t beg, int32_t end, uint64_t offset, bool mapped);
+
+	void pushPending();
 
 public:
 	BamWriter(const path& _bamFile) {
 		bamFile = _bamFile;
+		level = -1;
+		sam = false;
+		fp = nullptr;
+		samFp = nullptr;
+		header = nullptr;
+		idx = nullptr;
+		idxFormat = HTS_FMT_BAI;
+		hasPending = false;
+	}
+
+	virtual ~BamWriter() {
+		if (idx != nullptr) {
+			hts_idx_destroy(idx);
+		}
 	}
 
-	virtual ~BamWriter() {}
+	int getLevel() const {
+		return level;
+	}
+
+	/**
+	 * Sets the BGZF compression level, 0 writes uncompressed blocks which is
+	 * quickest when piping into another tool.  Must be set before opening.
+	 */
+	void setLevel(int level) {
+		this->level = level;
+	}
+
+	bool isSam() const {
+		return sam;
+	}
+
+	/**
+	 * Write SAM text instead of BAM.  Must be set before opening.
+	 */
+	void setSam(bool sam) {
+		this->sam = sam;
+	}
+
+	bool isStdout() const {
+		return bamFile.string() == "-";
+	}
+
+	/**
+	 * Opens the output and writes the header.  If index is true the records
+	 * must be written in coordinate order, and a BAI (or CSI if useCsi is true)
+	 * index is built as they are written and saved next to the BAM on close.
+	 * SAM and standard output can't be indexed.
+	 */
+	void open(bam_hdr_t* header, bool index = false, bool useCsi = false);
+
+	int write(const BamAlignment& ba) {
+		return write(ba.getRaw());
+	}
 
-	void open(bam_hdr_t* header);
+	int write(const bam1_t* b);
 
-	int write(const BamAlignment& ba);
+	/**
+	 * Appends blocks produced by a BamBlockBuffer, which must have been flushed.
+	 * Only possible when writing BAM.
+	 */
+	void write(const BamBlockBuffer& blocks);
 
 	void close();
 };
@@ -0,0 +1,71 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <cstdint>
+
+#include <htslib/sam.h>
+
+namespace portcullis {
+namespace bam {
+
+/**
+ * Edits the CIGAR of a raw samtools record in place.  Records only ever shrink
+ * here, so edits are done by moving the data buffer down and never allocate.
+ * The record's bin is recalculated whenever its position or span changes.  Any
+ * decoded BamAlignment wrapping the record will be out of date afterwards.
+ */
+class CigarEditor {
+public:
+
+	/**
+	 * Replaces the operation at index with another of the given type and length,
+	 * without touching the sequence or position
+	 */
+	static void replaceOp(bam1_t* b, uint32_t index, uint32_t op, uint32_t length);
+
+	/**
+	 * Number of reference bases covered by operations [from, to)
+	 */
+	static int32_t referenceLength(const bam1_t* b, uint32_t from, uint32_t to);
+
+	/**
+	 * Keeps CIGAR operations [firstKept, lastKept] and clips everything either
+	 * side of them.  Clipped query bases become a single soft or hard clip at
+	 * each end, merged with any clips already there.  The position moves to the
+	 * first kept reference base.  Hard clipping also removes the clipped bases
+	 * from the sequence and qualities.  If any aligned bases are clipped the MD
+	 * and NM tags are removed, as they can't be recalculated without the genome.
+	 * The mate fields aren't touched, so the mate's PNEXT and TLEN, and this
+	 * record's TLEN, are out of date once the position has moved.
+	 */
+	static void clip(bam1_t* b, uint32_t firstKept, uint32_t lastKept, bool hard);
+
+	/**
+	 * Merges adjacent operations of the same type
+	 */
+	static void mergeAdjacent(bam1_t* b);
+
+	/**
+	 * Recalculates the record's bin from its position and span
+	 */
+	static void updateBin(bam1_t* b);
+};
+
+}
+}
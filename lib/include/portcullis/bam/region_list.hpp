@@ -0,0 +1,113 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+#include <boost/exception/all.hpp>
+#include <boost/filesystem/path.hpp>
+using boost::filesystem::path;
+
+#include <portcullis/bam/bam_master.hpp>
+using portcullis::bam::RefSeqPtrList;
+
+namespace portcullis {
+namespace bam {
+
+typedef boost::error_info<struct RegionListError, string> RegionListErrorInfo;
+struct RegionListException: virtual boost::exception, virtual std::exception { };
+
+/**
+ * A region of a target sequence, 0-based and end exclusive as in BED files
+ */
+struct GenomicRegion {
+	int32_t seq;
+	int32_t start;
+	int32_t end;
+
+	int32_t length() const { return end - start; }
+
+	bool operator<(const GenomicRegion& other) const {
+		return seq != other.seq ? seq < other.seq : start < other.start;
+	}
+};
+
+/**
+ * A set of regions of interest, such as the loci targeted by a capture panel.
+ * Once merged the regions are sorted and none of them overlap or touch.
+ */
+class RegionList {
+private:
+
+	vector<GenomicRegion> regions;
+
+public:
+
+	RegionList() {}
+
+	/**
+	 * Loads the regions from the first three columns of a BED file.  Regions on
+	 * target sequences that aren't in refs are skipped and counted in
+	 * nbUnknown.  The result is merged.
+	 */
+	static RegionList loadBed(const path& bedFile, const RefSeqPtrList& refs, size_t& nbUnknown);
+
+	void add(const int32_t seq, const int32_t start, const int32_t end) {
+		regions.push_back({seq, start, end});
+	}
+
+	/**
+	 * Sorts the regions and combines any that overlap or touch
+	 */
+	void merge();
+
+	/**
+	 * The regions on the given target sequence.  Must be merged.
+	 */
+	RegionList getRegions(const int32_t seq) const;
+
+	/**
+	 * Whether any region overlaps [start, end) on the given target sequence.
+	 * Must be merged.
+	 */
+	bool overlaps(const int32_t seq, const int32_t start, const int32_t end) const;
+
+	/**
+	 * The target sequences that have regions, in order.  Must be merged.
+	 */
+	vector<int32_t> getSeqs() const;
+
+	uint64_t totalLength() const;
+
+	bool empty() const { return regions.empty(); }
+
+	size_t size() const { return regions.size(); }
+
+	const GenomicRegion& operator[](const size_t i) const { return regions[i]; }
+
+	vector<GenomicRegion>::const_iterator begin() const { return regions.begin(); }
+
+	vector<GenomicRegion>::const_iterator end() const { return regions.end(); }
+};
+
+}
+}
@@ -0,0 +1,114 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+#include <boost/exception/all.hpp>
+#include <boost/filesystem/path.hpp>
+using boost::filesystem::path;
+
+#include <htslib/hts.h>
+
+namespace portcullis {
+namespace bam {
+
+const string SPLICED_INDEX_EXTENSION = ".spliced";
+const string SPLICED_INDEX_MAGIC = "portcullis_spliced_index";
+const uint32_t SPLICED_INDEX_VERSION = 1;
+
+typedef boost::error_info<struct SplicedIndexError, string> SplicedIndexErrorInfo;
+struct SplicedIndexException: virtual boost::exception, virtual std::exception { };
+
+/**
+ * Where the spliced alignments on one target sequence are, as ranges of BGZF
+ * virtual file offsets in file order, plus statistics for the unspliced
+ * alignments that fall outside of those ranges
+ */
+struct SplicedRefIndex {
+	vector<hts_pair64_t> ranges;
+	uint64_t unsplicedCount = 0;
+	uint64_t sumQueryLengths = 0;
+	int32_t minQueryLength = INT32_MAX;
+	int32_t maxQueryLength = 0;
+
+	void addUnspliced(const int32_t len) {
+		unsplicedCount++;
+		sumQueryLengths += len;
+		minQueryLength = std::min(minQueryLength, len);
+		maxQueryLength = std::max(maxQueryLength, len);
+	}
+
+	void addUnspliced(const SplicedRefIndex& other) {
+		unsplicedCount += other.unsplicedCount;
+		sumQueryLengths += other.sumQueryLengths;
+		minQueryLength = std::min(minQueryLength, other.minQueryLength);
+		maxQueryLength = std::max(maxQueryLength, other.maxQueryLength);
+	}
+};
+
+/**
+ * A sidecar to a coordinate sorted BAM recording which parts of the file hold
+ * spliced alignments.  Spliced alignments sharing a BGZF block are merged into
+ * one range, so reading only the ranges skips every block that holds nothing
+ * but unspliced alignments, while their counts and query lengths are still
+ * known from the index.
+ */
+class SplicedBlockIndex {
+private:
+
+	uint64_t bamSize;
+	time_t bamTime;
+	vector<SplicedRefIndex> refs;
+
+public:
+
+	SplicedBlockIndex() : bamSize(0), bamTime(0) {}
+
+	/**
+	 * Builds the index with a single pass through a coordinate sorted BAM
+	 */
+	static SplicedBlockIndex build(const path& bamFile);
+
+	static path getIndexFile(const path& bamFile) {
+		return path(bamFile.string() + SPLICED_INDEX_EXTENSION);
+	}
+
+	void save(const path& file) const;
+
+	void load(const path& file);
+
+	/**
+	 * Whether this index was built from the given BAM as it is now, judged by
+	 * its size and modification time
+	 */
+	bool matches(const path& bamFile) const;
+
+	size_t size() const { return refs.size(); }
+
+	const SplicedRefIndex& getRef(const int32_t seqIndex) const { return refs[seqIndex]; }
+};
+
+}
+}
@@ -0,0 +1,124 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+using std::pair;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+namespace portcullis {
+
+// BAM tag holding the corrected cell barcode in 10x and Smart-seq3 data
+const string DEFAULT_BARCODE_TAG = "CB";
+
+// Barcode id used for reads without a barcode
+const uint32_t NO_BARCODE = UINT32_MAX;
+
+/**
+ * Maps cell barcodes to dense ids, numbered in order of first appearance
+ */
+class BarcodeDictionary {
+private:
+	unordered_map<string, uint32_t> ids;
+	vector<string> barcodes;
+
+public:
+
+	/**
+	 * Looks up the id of a barcode, adding it if it hasn't been seen before
+	 * @param barcode The barcode
+	 * @return The barcode's id
+	 */
+	uint32_t add(const string& barcode);
+
+	/**
+	 * Adds all the barcodes in other to this dictionary
+	 * @param other Another dictionary
+	 * @return The id in this dictionary of each of other's barcodes, indexed by
+	 * their id in other
+	 */
+	vector<uint32_t> merge(const BarcodeDictionary& other);
+
+	const string& get(uint32_t id) const {
+		return barcodes[id];
+	}
+
+	const vector<string>& getBarcodes() const {
+		return barcodes;
+	}
+
+	size_t size() const {
+		return barcodes.size();
+	}
+
+	bool empty() const {
+		return barcodes.empty();
+	}
+};
+
+/**
+ * Sparse counts of reads for each barcode at one junction.  Barcode ids are
+ * buffered as they arrive and periodically folded into (id, count) pairs
+ * sorted by id, so a junction seen in few cells costs a few bytes however
+ * many cells there are.
+ */
+class BarcodeCounts {
+private:
+	vector<pair<uint32_t, uint32_t>> counts;
+	vector<uint32_t> pending;
+
+public:
+
+	void add(uint32_t id) {
+		pending.push_back(id);
+		if (pending.size() >= 64 && pending.size() >= counts.size()) {
+			compact();
+		}
+	}
+
+	/**
+	 * Folds any buffered barcode ids into the counts
+	 */
+	void compact();
+
+	/**
+	 * Renumbers the barcodes, for example after merging the dictionary they
+	 * came from into another one
+	 * @param mapping New id for each old id
+	 */
+	void remap(const vector<uint32_t>& mapping);
+
+	/**
+	 * The (barcode id, count) pairs sorted by id.  Call compact first.
+	 */
+	const vector<pair<uint32_t, uint32_t>>& getCounts() const {
+		return counts;
+	}
+
+	bool empty() const {
+		return counts.empty() && pending.empty();
+	}
+};
+
+}
@@ -0,0 +1,182 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+using std::array;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+#include <boost/filesystem/path.hpp>
+using boost::filesystem::path;
+
+namespace portcullis {
+
+/**
+ * Call statistics for one probe on one thread.  Bucket i of the histogram
+ * counts calls that took between 2^i and 2^(i+1) nanoseconds.
+ */
+struct ProbeStats {
+	static const size_t NB_BUCKETS = 40;
+	uint64_t count = 0;
+	uint64_t totalNs = 0;
+	uint64_t maxNs = 0;
+	array<uint64_t, NB_BUCKETS> histogram{};
+
+	void add(uint64_t ns);
+};
+
+/**
+ * A completed span of work on one thread, in nanoseconds since the process
+ * started
+ */
+struct TraceEvent {
+	string name;
+	string category;
+	uint64_t start;
+	uint64_t duration;
+};
+
+/**
+ * Low level instrumentation for profiling builds.  Probes count and time calls
+ * to hot functions, trace spans record when a thread was doing what, e.g.
+ * running a thread pool task or waiting for one.  Each thread writes into its
+ * own buffers so recording never takes a lock.  Results are written as per
+ * thread histograms and as a Chrome trace-event file (load it in
+ * chrome://tracing or https://ui.perfetto.dev).
+ *
+ * Use the PORTCULLIS_PROBE and PORTCULLIS_TRACE macros rather than calling
+ * this directly.  They compile to nothing unless portcullis was configured
+ * with --enable-instrumentation.
+ */
+class Instrument {
+public:
+
+	/**
+	 * Gets the id of the named probe, adding it if necessary
+	 */
+	static size_t registerProbe(const string& name);
+
+	/**
+	 * Nanoseconds since the process started
+	 */
+	static uint64_t now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				   std::chrono::steady_clock::now() - epoch).count();
+	}
+
+	static void record(size_t probe, uint64_t ns);
+
+	static void trace(const string& name, const string& category, uint64_t start, uint64_t end);
+
+	/**
+	 * Names the calling thread in the trace output
+	 */
+	static void setThreadName(const string& name);
+
+	/**
+	 * Discards everything recorded so far.  Only call this while no other
+	 * threads are recording.
+	 */
+	static void reset();
+
+	/**
+	 * Writes the results.  Only call these while no other threads are recording.
+	 */
+	static void writeProbes(std::ostream& out);
+
+	static void writeTrace(std::ostream& out);
+
+	/**
+	 * Writes <prefix>.probes.json and <prefix>.trace.json
+	 */
+	static void save(const string& prefix);
+
+	static bool enabled() {
+#ifdef PORTCULLIS_INSTRUMENT
+		return true;
+#else
+		return false;
+#endif
+	}
+
+private:
+	static const std::chrono::steady_clock::time_point epoch;
+};
+
+/**
+ * Times the enclosing scope against a probe
+ */
+class ScopedProbe {
+private:
+	size_t id;
+	uint64_t start;
+
+public:
+	ScopedProbe(size_t id) : id(id), start(Instrument::now()) {}
+
+	~ScopedProbe() {
+		Instrument::record(id, Instrument::now() - start);
+	}
+};
+
+/**
+ * Records the enclosing scope as a span in the trace
+ */
+class TraceSpan {
+private:
+	string name;
+	string category;
+	uint64_t start;
+
+public:
+	TraceSpan(const string& name, const string& category) : name(name), category(category), start(Instrument::now()) {}
+
+	~TraceSpan() {
+		Instrument::trace(name, category, start, Instrument::now());
+	}
+};
+
+}
+
+#define PORTCULLIS_CONCAT_INNER(a, b) a ## b
+#define PORTCULLIS_CONCAT(a, b) PORTCULLIS_CONCAT_INNER(a, b)
+
+#ifdef PORTCULLIS_INSTRUMENT
+#define PORTCULLIS_PROBE(name) \
+	static const size_t PORTCULLIS_CONCAT(portcullisProbeId, __LINE__) = portcullis::Instrument::registerProbe(name); \
+	portcullis::ScopedProbe PORTCULLIS_CONCAT(portcullisProbe, __LINE__)(PORTCULLIS_CONCAT(portcullisProbeId, __LINE__))
+#define PORTCULLIS_TRACE(name, category) \
+	portcullis::TraceSpan PORTCULLIS_CONCAT(portcullisSpan, __LINE__)(name, category)
+#define PORTCULLIS_THREAD_NAME(name) portcullis::Instrument::setThreadName(name)
+#else
+#define PORTCULLIS_PROBE(name)
+#define PORTCULLIS_TRACE(name, category)
+#define PORTCULLIS_THREAD_NAME(name)
+#endif
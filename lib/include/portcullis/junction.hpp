@@ -49,6 +49,7 @@ using namespace portcullis::bam;
 using portcullis::ml::KmerMarkovModel;
 using portcullis::ml::PosMarkovModel;
 
+#include "barcode_counts.hpp"
 #include "intron.hpp"
 #include "seq_utils.hpp"
 using portcullis::Intron;
@@ -176,7 +177,13 @@ struct AlignmentInfo {
 		downstreamMismatchPositions.clear();
 	}
 
-	void calcMatchStats(const Intron& i, const uint32_t leftStart, const uint32_t rightEnd, const string& ancLeft, const string& ancRight);
+	/**
+	 * Calculates match and mismatch statistics for this alignment's anchors
+	 * within [leftStart, rightEnd].  windowed says the limits come from an anchor
+	 * window, so aligned ops straddling leftStart are trimmed to it rather than
+	 * skipped whole.
+	 */
+	void calcMatchStats(const Intron& i, const uint32_t leftStart, const uint32_t rightEnd, const string& ancLeft, const string& ancRight, const bool windowed);
 
 	uint32_t getNbMatchesFromStart(const string& query, const string& anchor);
 	uint32_t getNbMatchesFromEnd(const string& query, const string& anchor);
@@ -191,8 +198,12 @@ private:
 
 	// **** Properties that describe where the junction is ****
 	shared_ptr<Intron> intron;
-	vector<shared_ptr<AlignmentInfo>> alignments;
+	vector<shared_ptr<AlignmentInfo>> alignments;	// Possibly a sample, see addJunctionAlignment
 	vector<size_t> alignmentCodes;
+	vector<int32_t> alignmentStarts;	// Kept for every alignment so entropy is exact
+	int32_t lastAlStart;
+	int32_t lastAlEnd;
+	BarcodeCounts barcodeCounts;	// Reads per cell barcode, only in single cell mode
 
 
 	// **** Junction metrics ****
@@ -1035,7 +1046,58 @@ public:
 	 * Add an alignment to this junction and update any associated properties
 	 * @param al
 	 */
-	void addJunctionAlignment(const BamAlignment& al);
+	void addJunctionAlignment(const BamAlignment& al) {
+		addJunctionAlignment(al, 0);
+	}
+
+	/**
+	 * Add an alignment to this junction, retaining at most maxAlignments of
+	 * them for the anchor, mismatch and junction anchor depth metrics.  Once the
+	 * cap is reached the retained alignments are a uniform reservoir sample of
+	 * all the alignments seen.  The sample is deterministic for a given junction.
+	 * Alignment counts, read strand counts, the distinct alignment count,
+	 * entropy and the multiple mapping score still use every alignment.
+	 * @param al
+	 * @param maxAlignments Most alignments to retain, 0 for no limit
+	 */
+	void addJunctionAlignment(const BamAlignment& al, const uint32_t maxAlignments) {
+		BamAlignmentPtr record;
+		addJunctionAlignment(al, record, maxAlignments);
+	}
+
+	/**
+	 * As above, but the stored copy of the alignment is shared with the caller
+	 * through record.  If record is empty and the alignment is retained, a copy
+	 * is made and handed back, so that every junction in a read can refer to
+	 * the same copy.  If record is already set it is stored as is.
+	 * @param al
+	 * @param record Shared copy of al, may be empty
+	 * @param maxAlignments Most alignments to retain, 0 for no limit
+	 */
+	void addJunctionAlignment(const BamAlignment& al, BamAlignmentPtr& record, const uint32_t maxAlignments);
+
+	/**
+	 * Counts a supporting alignment against a cell barcode
+	 * @param barcode Id of the barcode in the junction system's dictionary
+	 */
+	void addBarcode(uint32_t barcode) {
+		barcodeCounts.add(barcode);
+	}
+
+	BarcodeCounts& getBarcodeCounts() {
+		return barcodeCounts;
+	}
+
+	const BarcodeCounts& getBarcodeCounts() const {
+		return barcodeCounts;
+	}
+
+	/**
+	 * Whether only a sample of the supporting alignments was retained
+	 */
+	bool isSampled() const {
+		return alignments.size() < nbAlRaw && !alignments.empty();
+	}
 
 	/**
 	 * Sets the canonical status of this junction based on the dinucleotides at the donor and acceptor
@@ -1077,7 +1139,20 @@ public:
 	 * Extracts genomic content around this junction and updates any associated properties
 	 * @param genomeMapper
 	 */
-	void processJunctionWindow(const GenomeMapper& genomeMapper);
+	void processJunctionWindow(const GenomeMapper& genomeMapper) {
+		processJunctionWindow(genomeMapper, 0);
+	}
+
+	/**
+	 * As above, but only the anchorWindow bases either side of the intron are
+	 * used for each alignment's match and mismatch statistics.  Long reads
+	 * can have anchors several kilobases long, with sequencing errors spread
+	 * along them, so comparing the whole anchor is both slow and dominated by
+	 * errors far from the splice site.
+	 * @param genomeMapper
+	 * @param anchorWindow Bases either side of the intron to use, 0 for the whole anchors
+	 */
+	void processJunctionWindow(const GenomeMapper& genomeMapper, const uint32_t anchorWindow);
 
 	/**
 	 * Process non-spliced alignments within a certain region upstream and downstream of the junction
@@ -1099,6 +1174,12 @@ public:
 	 */
 	void calcMetrics(Orientation orientation);
 
+	/**
+	 * As calcMetrics, for an orientation known at compile time
+	 */
+	template<Orientation O>
+	void calcMetrics();
+
 	/**
 	 * Shannon Entropy (definition from "Graveley et al, The developmental
 	 * transcriptome of Drosophila melanogaster, Nature, 2011")
@@ -1142,6 +1223,13 @@ public:
 	 */
 	void calcAlignmentStats(Orientation orientation);
 
+	/**
+	 * As calcAlignmentStats, for an orientation known at compile time.  This
+	 * avoids checking the orientation for every alignment.
+	 */
+	template<Orientation O>
+	void calcAlignmentStats();
+
 	/**
 	 * Metric 13 and 14: Calculates the 5' and 3' hamming distances from a genomic
 	 * region represented by this junction
@@ -1175,6 +1263,10 @@ public:
 	 */
 	double calcIntronScore(const uint32_t threshold);
 
+	/**
+	 * As calcIntronScore but doesn't store the score in this junction
+	 */
+	double computeIntronScore(const uint32_t threshold) const;
 
 	/**
 	 * Given the markov models for the exons and the introns, calculate the potential coding score for
@@ -1186,10 +1278,22 @@ public:
 	 */
 	double calcCodingPotential(GenomeMapper& gmap, KmerMarkovModel& exon, KmerMarkovModel& intron);
 
+	/**
+	 * As calcCodingPotential but doesn't store the score in this junction
+	 */
+	double computeCodingPotential(GenomeMapper& gmap, KmerMarkovModel& exon, KmerMarkovModel& intron) const;
+
 	SplicingScores calcSplicingScores(GenomeMapper& gmap, KmerMarkovModel& donorT, KmerMarkovModel& donorF,
 									  KmerMarkovModel& acceptorT, KmerMarkovModel& acceptorF,
 									  PosMarkovModel& donorP, PosMarkovModel& acceptorP);
 
+	/**
+	 * As calcSplicingScores but doesn't store the scores in this junction
+	 */
+	SplicingScores computeSplicingScores(GenomeMapper& gmap, KmerMarkovModel& donorT, KmerMarkovModel& donorF,
+										 KmerMarkovModel& acceptorT, KmerMarkovModel& acceptorF,
+										 PosMarkovModel& donorP, PosMarkovModel& acceptorP) const;
+
 
 	/**
 	 * Calculate the log deviation for the junction anchor depth count at a given location
@@ -0,0 +1,108 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+using std::vector;
+
+#include <htslib/sam.h>
+
+#include <portcullis/junction.hpp>
+using portcullis::JunctionList;
+
+namespace portcullis {
+
+/**
+ * Read only set of introns for answering "is this junction in the set?" while
+ * streaming alignments.  Introns are packed into 64 bit keys (start in the
+ * high half, end in the low half) and stored per reference in Eytzinger
+ * (breadth first) order, so a lookup is a branch free walk down an implicit
+ * binary tree whose top levels stay in cache.  Lookups take plain integers
+ * and never allocate, so they are safe to share between threads.
+ */
+class JunctionLookup {
+private:
+	// Per reference id, 1-based Eytzinger layout.  Element 0 is unused.
+	vector<vector<uint64_t>> keys;
+	// Reference lengths, so introns running off the end can be clamped the same
+	// way JunctionSystem::addJunctions does
+	vector<int32_t> refLengths;
+	size_t nbIntrons;
+
+	static void layout(const vector<uint64_t>& sorted, vector<uint64_t>& tree, size_t& i, size_t k);
+
+public:
+
+	JunctionLookup() : nbIntrons(0) {}
+
+	JunctionLookup(const JunctionList& junctions);
+
+	static inline uint64_t pack(int32_t start, int32_t end) {
+		return ((uint64_t)(uint32_t)start << 32) | (uint32_t)end;
+	}
+
+	size_t size() const {
+		return nbIntrons;
+	}
+
+	/**
+	 * @param refId Reference index of the intron (BAM target id)
+	 * @param start Position of the first intronic base (0-based)
+	 * @param end Position of the last intronic base (0-based, inclusive)
+	 * @return True if the intron is in the set
+	 */
+	inline bool contains(int32_t refId, int32_t start, int32_t end) const {
+		if (refId < 0 || (size_t)refId >= keys.size()) {
+			return false;
+		}
+		const vector<uint64_t>& tree = keys[refId];
+		const size_t n = tree.size();
+		if (n <= 1) {
+			return false;
+		}
+		const uint64_t key = pack(start, end);
+		size_t k = 1;
+		while (k < n) {
+			k = 2 * k + (tree[k] < key);
+		}
+		// Undo the right turns taken after the last left turn to find the lower bound
+		k >>= __builtin_ffsll(~k);
+		return k != 0 && tree[k] == key;
+	}
+
+	/**
+	 * Looks up the intron introduced by an N operation of the given length
+	 * starting at pos
+	 */
+	inline bool intronAt(int32_t refId, int32_t pos, int32_t length) const {
+		int32_t end = pos + length - 1;
+		if (refId >= 0 && (size_t)refId < refLengths.size() && refLengths[refId] > 0 && end >= refLengths[refId]) {
+			end = refLengths[refId] - 2;
+		}
+		return contains(refId, pos, end);
+	}
+
+	/**
+	 * Walks the raw CIGAR of a record and reports whether any of its N
+	 * operations is an intron in the set
+	 */
+	bool containsAny(const bam1_t* b) const;
+};
+
+}
@@ -28,6 +28,8 @@ using std::shared_ptr;
 #include <boost/timer/timer.hpp>
 using boost::timer::auto_cpu_timer;
 
+#include <portcullis/barcode_counts.hpp>
+#include <portcullis/instrument.hpp>
 #include <portcullis/intron.hpp>
 #include <portcullis/junction.hpp>
 #include <portcullis/seq_utils.hpp>
@@ -45,11 +47,40 @@ typedef std::shared_ptr<JunctionList> JunctionListPtr;
 
 namespace portcullis {
 
+/**
+ * Read strand counts summed over junctions, split by the strand suggested by
+ * each junction's splice sites.  Used to work out the library protocol.
+ */
+struct StrandCounts {
+	uint32_t r1PosWhenSsPos = 0;
+	uint32_t r1NegWhenSsPos = 0;
+	uint32_t r2PosWhenSsPos = 0;
+	uint32_t r2NegWhenSsPos = 0;
+	uint32_t r1PosWhenSsNeg = 0;
+	uint32_t r1NegWhenSsNeg = 0;
+	uint32_t r2PosWhenSsNeg = 0;
+	uint32_t r2NegWhenSsNeg = 0;
+};
+
 class JunctionSystem {
 private:
 	DistinctJunctions distinctJunctions;
 	JunctionList junctionList;
 
+	// Only junctions whose intron starts in [ownedStart, ownedEnd) are added
+	int32_t ownedStart;
+	int32_t ownedEnd;
+
+	// Most alignments each junction keeps for its metrics, 0 for no limit
+	uint32_t maxAlignments;
+
+	// Whether junctions keep compact copies of their alignments
+	bool compactAlignments;
+
+	// Tag holding each read's cell barcode, empty unless in single cell mode
+	string barcodeTag;
+	BarcodeDictionary barcodes;
+
 	int32_t minQueryLength;
 	double meanQueryLength;
 	int32_t maxQueryLength;
@@ -60,6 +91,9 @@ private:
 
 	void findJunctions(const int32_t refId, JunctionList& subset);
 
+	void addJunctionAlignment(const BamAlignment& al, BamAlignmentPtr& record, int64_t& barcode,
+			int32_t lStart, int32_t lEndExc, int32_t rStart, int32_t rEndExc);
+
 
 public:
 
@@ -109,12 +143,85 @@ public:
 		this->refs = refs;
 	}
 
+	/**
+	 * Restricts addJunctions to junctions whose intron starts within
+	 * [start, end).  Lets a reference sequence be split into regions that are
+	 * processed separately without any junction being found twice, provided
+	 * each region is read with every alignment overlapping it.
+	 */
+	void setOwnedRange(int32_t start, int32_t end) {
+		this->ownedStart = start;
+		this->ownedEnd = end;
+	}
+
+
+	uint32_t getMaxAlignments() const {
+		return maxAlignments;
+	}
+
+	/**
+	 * Caps the number of alignments each junction found by addJunctions keeps
+	 * for calculating its metrics.  See Junction::addJunctionAlignment.
+	 */
+	void setMaxAlignments(uint32_t maxAlignments) {
+		this->maxAlignments = maxAlignments;
+	}
+
+	bool isCompactAlignments() const {
+		return compactAlignments;
+	}
+
+	/**
+	 * Whether junctions found by addJunctions keep a compact copy of each
+	 * alignment, without its optional fields.  The copy is made once per
+	 * alignment and shared by all of its junctions.  Worth it for long reads,
+	 * where the optional fields can be larger than the rest of the record.
+	 */
+	void setCompactAlignments(bool compactAlignments) {
+		this->compactAlignments = compactAlignments;
+	}
+
+	const string& getBarcodeTag() const {
+		return barcodeTag;
+	}
+
+	/**
+	 * Turns on single cell mode.  Each alignment found by addJunctions is also
+	 * counted against the cell barcode held in this tag, if it has one.
+	 * @param barcodeTag Two character tag name, e.g. "CB", or empty to turn off
+	 */
+	void setBarcodeTag(const string& barcodeTag) {
+		this->barcodeTag = barcodeTag;
+	}
+
+	const BarcodeDictionary& getBarcodes() const {
+		return barcodes;
+	}
+
+	/**
+	 * Writes the per cell barcode read counts of each junction as a sparse
+	 * junction by cell matrix in Matrix Market format, to
+	 * <outputPrefix>.cells.mtx.  Rows are numbered in the same order as the
+	 * junction table and listed in <outputPrefix>.cells.junctions.tsv.
+	 * Columns are listed in <outputPrefix>.cells.barcodes.tsv.
+	 * @param outputPrefix
+	 */
+	void saveBarcodeMatrix(const path& outputPrefix);
 
 	void addJunction(JunctionPtr j);
 
+	/**
+	 * Removes the junctions flagged in the given vector, which is indexed in
+	 * the same order as the junction list
+	 * @param flags Junctions to remove
+	 * @return The number of junctions removed
+	 */
+	size_t remove(const vector<bool>& flags);
+
 	/**
 	 * Appends a new copy of all the junctions in the other junction system to this
-	 * junction system, without the Bam alignments associated with them.
+	 * junction system, without the Bam alignments associated with them.  Cell
+	 * barcodes are merged into this system's dictionary.
 	 * @param other The other junctions system containing junctions to be added to this.
 	 */
 	void append(JunctionSystem& other);
@@ -126,6 +233,7 @@ public:
 	 * @return Whether a junction was found in this alignment or not
 	 */
 	bool addJunctions(const BamAlignment& al) {
+		PORTCULLIS_PROBE("JunctionSystem::addJunctions");
 		return addJunctions(al, 0, al.getPosition());
 	}
 
@@ -141,14 +249,33 @@ public:
 
 	std::pair<Orientation, Strandedness> determineStrandedness(bool verbose) const;
 
+	/**
+	 * Adds the read strand counts from these junctions to the given totals
+	 */
+	void addStrandCounts(StrandCounts& counts) const;
+
+	static std::pair<Orientation, Strandedness> determineStrandedness(const StrandCounts& counts, bool verbose);
+
 	void sort();
 
 	void index();
 
+	/**
+	 * Numbers the junctions in their current order starting from firstId
+	 */
+	void index(size_t firstId);
+
 	void saveAll(const path& outputPrefix, const string& source);
 
 	void saveAll(const path& outputPrefix, const string& source, bool bedscore, bool outputExonGFF, bool outputIntronGFF);
 
+	/**
+	 * Writes the same files as saveAll, but in parts so the output can be built
+	 * up one reference sequence at a time.  The first part creates the files
+	 * and writes their headers, later parts are appended.  Prints nothing.
+	 */
+	void appendAll(const path& outputPrefix, const string& source, bool bedscore, bool outputExonGFF, bool outputIntronGFF, bool first);
+
 	void outputDescription(std::ostream &strm);
 
 	friend std::ostream& operator<<(std::ostream &strm, const JunctionSystem& js) {
@@ -0,0 +1,91 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+#include <boost/exception/all.hpp>
+
+#include <ranger/Data.h>
+
+namespace portcullis {
+namespace ml {
+
+typedef boost::error_info<struct DataViewError, string> DataViewErrorInfo;
+struct DataViewException: virtual boost::exception, virtual std::exception { };
+
+/**
+ * A read only view over a subset of rows from another ranger Data object.
+ * Allows several models (e.g. cross validation folds) to be trained and tested
+ * from a single feature matrix without copying it.  The parent data must
+ * outlive the view.
+ */
+class DataView : public Data {
+private:
+	const Data* parent;
+	vector<size_t> rowIndices;
+	// Per column replacement values in view row order, empty for columns read from the parent
+	vector<vector<double>> overrides;
+
+public:
+
+	DataView(const Data* _parent, const vector<size_t>& _rowIndices) :
+		Data(_parent->getVariableNames(), _rowIndices.size(), _parent->getNumCols()),
+		parent(_parent),
+		rowIndices(_rowIndices),
+		overrides(_parent->getNumCols()) {
+	}
+
+	virtual ~DataView() {
+	}
+
+	double get(size_t row, size_t col) const {
+		const vector<double>& o = overrides[col];
+		return o.empty() ? parent->get(rowIndices[row], col) : o[row];
+	}
+
+	/**
+	 * Replaces a column's values for the rows of this view only, leaving the
+	 * parent untouched.  Values are given in view row order.
+	 */
+	void overrideColumn(size_t col, const vector<double>& values) {
+		if (values.size() != rowIndices.size()) {
+			BOOST_THROW_EXCEPTION(DataViewException() << DataViewErrorInfo(string(
+									  "Number of override values doesn't match the number of rows in the view")));
+		}
+		overrides[col] = values;
+	}
+
+	size_t getParentRow(size_t row) const {
+		return rowIndices[row];
+	}
+
+	void reserveMemoryInternal() {
+	}
+
+	void set(size_t col, size_t row, double value, bool& error) {
+		BOOST_THROW_EXCEPTION(DataViewException() << DataViewErrorInfo(string(
+								  "Can't modify a data view")));
+	}
+};
+
+}
+}
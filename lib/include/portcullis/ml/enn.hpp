@@ -29,7 +29,8 @@ using std::vector;
 #include <boost/timer/timer.hpp>
 using boost::timer::auto_cpu_timer;
 
-#include <ranger/Data.h>
+#include <portcullis/ml/neighbour_graph.hpp>
+using portcullis::ml::NeighbourGraph;
 
 namespace portcullis {
 namespace ml {
@@ -54,16 +55,25 @@ protected:
 	uint16_t threads;
 	bool verbose;
 
-	double* data;
+	const double* data;
 	size_t rows;
 	size_t cols;
 
 	vector<bool> labels;
 
+	// Optional precomputed neighbour graph, used instead of running KNN
+	const NeighbourGraph* graph;
+
 public:
 
 	ENN(uint16_t defaultK, uint16_t _threads, double* _data, size_t _rows, size_t _cols, vector<bool>& _labels);
 
+	/**
+	 * Creates an ENN instance that uses the nearest neighbours (of any class)
+	 * from a precomputed neighbour graph.  defaultK is capped at the graph's K.
+	 */
+	ENN(uint16_t defaultK, const NeighbourGraph& _graph);
+
 	uint16_t getK() const {
 		return k;
 	}
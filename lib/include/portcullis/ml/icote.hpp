@@ -16,12 +16,19 @@
 //  *******************************************************************
 
 #pragma once
+
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
 using std::ostream;
 using std::string;
+using std::thread;
+using std::vector;
 
 #include <boost/exception/all.hpp>
+#include <boost/timer/timer.hpp>
+using boost::timer::auto_cpu_timer;
 
 namespace portcullis {
 namespace ml {
@@ -29,45 +36,92 @@ namespace ml {
 typedef boost::error_info<struct IcoteError, string> IcoteErrorInfo;
 struct IcoteException: virtual boost::exception, virtual std::exception { };
 
+const uint16_t ICOTE_DEFAULT_ITERATIONS = 10;
+const uint32_t ICOTE_DEFAULT_SEED = 12345;
+
+// Number of antibodies processed together, each block gets its own random
+// number generator so results don't depend on the number of threads
+const size_t ICOTE_BLOCK_SIZE = 64;
+// Number of antigens held in each chunk of the distance kernel
+const size_t ICOTE_CHUNK_SIZE = 256;
+const uint16_t ICOTE_MAX_CLONES = 4;
+const double ICOTE_MATURATION_RATE = 0.2;
+const double ICOTE_MUTATION_RATE = 0.1;
 
 /**
- * Object to perform classification on balanced ensembled selected from random sampling.
+ * Immune Centroids Oversampling Technique (ICOTE).
+ *
+ * Based on "ICOTE: Immune centroids oversampling technique" by Ai et al.  The
+ * minority samples are treated as antigens.  A population of random
+ * antibodies is matured over a number of generations: each antibody is
+ * matched to its closest antigen, then cloned in proportion to its affinity
+ * with the clones mutated in inverse proportion to it, keeping the best clone.
+ * The final antibodies are used as synthetic minority samples.
  *
- * It is based on the idea presented in the paper "Exploratory Undersampling
- * Class-Imbalance Learning" by Liu et al.
+ * Constant columns are ignored and the remaining features are normalised to
+ * [0,1] before maturation.  Antigens are stored column major so the distance
+ * kernel can be vectorised across a chunk of antigens, and antibodies are
+ * processed in blocks spread across threads.  Each generation compares all
+ * duplications x rows antibodies with all rows antigens, so the cost is
+ * O(iterations x duplications x rows^2 x cols), the same order as a brute
+ * force nearest neighbour search.
  */
 class Icote {
 private:
-	uint16_t k;
 	uint16_t duplications;
+	uint16_t iterations;
 	uint16_t threads;
+	uint32_t seed;
 	bool verbose;
 
-	double* data;
+	const double* data;
 	size_t rows;
 	size_t cols;
 
+	// Non-constant columns in the input, constant columns are copied straight
+	// to the output
+	vector<size_t> sel;
+	vector<double> min_col;
+	vector<double> range_col;
+
+	// Normalised antigens (sel.size() x rows, column major) and antibodies
+	// (s_rows x sel.size(), row major)
+	vector<double> antigens;
+	vector<double> antibodies;
+
+	double* synthetic;
+	size_t s_rows;
+
+	void normalise();
 
-protected:
+	void initAntibodies();
 
-	bool isConstant(size_t col);
+	void matureSlice(uint16_t slice, uint16_t generation);
 
-	void fselect();
+	void matureBlock(size_t block, uint16_t generation, vector<double>& dbuf, vector<double>& cbuf);
 
 public:
 
-	Smote(uint16_t defaultK, uint16_t _smoteness, uint16_t _threads, double* _data, size_t _rows, size_t _cols);
+	Icote(uint16_t _duplications, uint16_t _threads, const double* _data, size_t _rows, size_t _cols);
 
-	~Smote() {
+	~Icote() {
 		delete[] synthetic;
 	}
 
-	uint16_t getK() const {
-		return k;
+	uint16_t getIterations() const {
+		return iterations;
 	}
 
-	void setK(uint16_t k) {
-		this->k = k;
+	void setIterations(uint16_t iterations) {
+		this->iterations = iterations;
+	}
+
+	uint32_t getSeed() const {
+		return seed;
+	}
+
+	void setSeed(uint32_t seed) {
+		this->seed = seed;
 	}
 
 	uint16_t getThreads() const {
@@ -75,7 +129,7 @@ public:
 	}
 
 	void setThreads(uint16_t threads) {
-		this->threads = threads;
+		this->threads = threads < 1 ? 1 : threads;
 	}
 
 	bool isVerbose() const {
@@ -103,4 +157,4 @@ public:
 	void print(ostream& out) const;
 };
 }
-}
\ No newline at end of file
+}
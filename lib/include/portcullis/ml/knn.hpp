@@ -33,8 +33,6 @@ using std::shared_ptr;
 #include <boost/timer/timer.hpp>
 using boost::timer::auto_cpu_timer;
 
-#include <ranger/Data.h>
-
 namespace portcullis {
 namespace ml {
 
@@ -51,17 +49,18 @@ protected:
 	uint16_t threads;
 	bool verbose;
 
-	double* data;
+	const double* data;
 	size_t rows;
 	size_t cols;
 
-	vector<vector<uint32_t>> results;
+	// Flat rows x k matrix of nearest neighbour indices, row major
+	vector<uint32_t> results;
 
 	void doSlice( uint16_t slice );
 
 public:
 
-	KNN(uint16_t defaultK, uint16_t _threads, double* _data, size_t _rows, size_t _cols);
+	KNN(uint16_t defaultK, uint16_t _threads, const double* _data, size_t _rows, size_t _cols);
 
 	uint16_t getK() const {
 		return k;
@@ -83,15 +82,26 @@ public:
 		this->verbose = verbose;
 	}
 
-	const vector<vector<uint32_t>>& getResults() const {
+	size_t getNbRows() const {
+		return rows;
+	}
+
+	const vector<uint32_t>& getResults() const {
 		return results;
 	}
 
-	const vector<uint32_t>& getNNs(size_t index) const {
-		if (index >= results.size()) {
-			std::cerr << "ERROR: Can't request KNNs of item " << index << " as this doesn't exist." << std::endl;
+	/**
+	 * Returns a pointer to the k nearest neighbours of the given row, ordered
+	 * nearest first
+	 * @param index Row index
+	 * @return Pointer to k row indices
+	 */
+	const uint32_t* getNNs(size_t index) const {
+		if (index >= rows) {
+			BOOST_THROW_EXCEPTION(KNNException() << KNNErrorInfo(string(
+									  "Can't request KNNs of item ") + std::to_string(index) + " as this doesn't exist."));
 		}
-		return results[index];
+		return &results[index * k];
 	}
 
 	void execute();
@@ -20,11 +20,13 @@
 #include <memory>
 using std::shared_ptr;
 
+#include <boost/exception/all.hpp>
 #include <boost/filesystem/path.hpp>
 using boost::filesystem::path;
 
 #include <ranger/Data.h>
 #include <ranger/Forest.h>
+#include <ranger/ForestProbability.h>
 
 #include <portcullis/bam/genome_mapper.hpp>
 #include <portcullis/ml/markov_model.hpp>
@@ -41,6 +43,9 @@ namespace ml {
 
 typedef shared_ptr<Forest> ForestPtr;
 
+typedef boost::error_info<struct ModelFeaturesError, string> ModelFeaturesErrorInfo;
+struct ModelFeaturesException: virtual boost::exception, virtual std::exception { };
+
 // List of variable names
 const vector<string> VAR_NAMES = {
 	"Genuine",
@@ -104,9 +109,54 @@ public:
 	Data* juncs2FeatureVectors(const JunctionList& x);
 	Data* juncs2FeatureVectors(const JunctionList& xl, const JunctionList& xu);
 
-
+	/**
+	 * Columns of the feature matrix holding features calculated with the models
+	 * learned from labelled junctions (the intron size threshold, the coding
+	 * potential model and the splicing models)
+	 */
+	vector<size_t> getLabelDerivedColumns() const;
+
+	/**
+	 * Calculates the label derived features of a junction with this object's
+	 * models, in the order of getLabelDerivedColumns.  Unlike
+	 * juncs2FeatureVectors nothing is stored in the junction, so the same
+	 * junctions can be used from several threads, each with its own
+	 * ModelFeatures.
+	 */
+	void calcLabelDerivedFeatures(const JunctionPtr& j, vector<double>& values);
+
+
+	/**
+	 * Trains a random forest on the given positive and negative junctions.  If
+	 * smote is true the negative set is balanced against the positive set, by
+	 * oversampling with SMOTE (or ICOTE if icote is true) when it is smaller, or
+	 * by undersampling when it is larger.  If enn is true the training set is
+	 * cleaned with Wilson's Edited Nearest Neighbour before training.  If bins
+	 * is non-zero the forest is trained in histogram mode (see trainForest).
+	 */
 	ForestPtr trainInstance(const JunctionList& pos, const JunctionList& neg, string outputPrefix,
-                            uint16_t trees, uint16_t threads, bool probabilityMode, bool verbose, bool smote, bool enn, bool saveFeatures);
+                            uint16_t trees, uint16_t threads, bool probabilityMode, bool verbose, bool smote, bool enn, bool saveFeatures,
+                            bool icote = false, uint16_t bins = 0);
+
+	/**
+	 * Trains a random forest directly from a feature matrix (such as one
+	 * produced by juncs2FeatureVectors), without any resampling.  The caller
+	 * retains ownership of the data, which must outlive the training.  If bins
+	 * is non-zero each feature is quantized once into at most that many bins
+	 * and nodes are split from per-bin class histograms rather than from the
+	 * exact sorted values, which is much faster on large junction sets.
+	 */
+	static ForestPtr trainForest(Data* trainingData, string outputPrefix, uint16_t trees, uint16_t threads,
+                          bool probabilityMode, bool verbose, uint16_t bins = 0);
+
+	/**
+	 * Loads a probability forest saved by trainInstance or "portcullis train"
+	 * ready to predict the given data.  New data must always be predicted with
+	 * a freshly loaded forest, as ranger adds predictions onto any left in the
+	 * forest by an earlier run, such as the out of bag predictions made during
+	 * training.  The caller retains ownership of the data.
+	 */
+	static shared_ptr<ForestProbability> loadForest(const path& modelFile, Data* data, uint16_t threads);
 
 	void resetActiveFeatureIndex() {
 		fi = 0;
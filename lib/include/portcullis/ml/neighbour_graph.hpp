@@ -0,0 +1,173 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+using std::ostream;
+using std::string;
+using std::thread;
+using std::vector;
+
+#include <boost/exception/all.hpp>
+#include <boost/timer/timer.hpp>
+using boost::timer::auto_cpu_timer;
+
+namespace portcullis {
+namespace ml {
+
+typedef boost::error_info<struct NeighbourGraphError, string> NeighbourGraphErrorInfo;
+struct NeighbourGraphException: virtual boost::exception, virtual std::exception { };
+
+/**
+ * A labelled K nearest neighbour graph that can be shared between resamplers.
+ *
+ * For every row we keep the k nearest rows of each class separately, so the
+ * same graph can answer both "nearest rows of my own class" (SMOTE) and
+ * "nearest rows of any class" (ENN, by merging the two lists).  Rows can be
+ * added in batches, in which case only distances involving the new rows are
+ * computed, e.g. SMOTE's synthetic rows can be added to the graph before
+ * running ENN without recomputing distances between the original rows.
+ *
+ * As with KNN, a row is included in its own neighbour list.
+ */
+class NeighbourGraph {
+protected:
+	uint16_t k;
+	uint16_t threads;
+	bool verbose;
+
+	size_t rows;
+	size_t cols;
+	vector<double> data;
+	vector<bool> labels;
+
+	// Number of rows whose neighbour lists are up to date with respect to
+	// each other
+	size_t processed;
+
+	// Flat rows x 2 x k matrices holding neighbour indices and squared
+	// distances for the negative (0) and positive (1) class, nearest first.
+	vector<uint32_t> nns;
+	vector<double> dists;
+	// Number of filled neighbour slots for each row and class (rows x 2)
+	vector<uint16_t> counts;
+
+	void doSlice(size_t start, size_t end);
+
+	void update();
+
+public:
+
+	NeighbourGraph(uint16_t _k, uint16_t _threads, size_t _cols);
+
+	uint16_t getK() const {
+		return k;
+	}
+
+	uint16_t getThreads() const {
+		return threads;
+	}
+
+	void setThreads(uint16_t threads) {
+		this->threads = threads;
+	}
+
+	bool isVerbose() const {
+		return verbose;
+	}
+
+	void setVerbose(bool verbose) {
+		this->verbose = verbose;
+	}
+
+	size_t getNbRows() const {
+		return rows;
+	}
+
+	size_t getNbCols() const {
+		return cols;
+	}
+
+	const double* getData() const {
+		return data.data();
+	}
+
+	const double* getRow(size_t index) const {
+		return &data[index * cols];
+	}
+
+	bool getLabel(size_t index) const {
+		return labels[index];
+	}
+
+	const vector<bool>& getLabels() const {
+		return labels;
+	}
+
+	size_t getNbRows(bool label) const;
+
+	/**
+	 * Adds a batch of rows to the graph and updates the neighbour lists of both
+	 * the existing and the new rows.
+	 * @param _data Row major matrix with _rows x cols entries
+	 * @param _rows Number of rows to add
+	 * @param _labels Class of each new row
+	 */
+	void addRows(const double* _data, size_t _rows, const vector<bool>& _labels);
+
+	/**
+	 * Adds a batch of rows that all belong to the same class
+	 */
+	void addRows(const double* _data, size_t _rows, bool label) {
+		addRows(_data, _rows, vector<bool>(_rows, label));
+	}
+
+	/**
+	 * Number of neighbours of the given class that are known for this row.  This
+	 * is k unless there are fewer than k rows of that class in the graph.
+	 */
+	uint16_t getNbNNs(size_t index, bool label) const {
+		return counts[(index * 2) + label];
+	}
+
+	/**
+	 * Returns a pointer to the nearest neighbours of the given class for this
+	 * row, nearest first.  See getNbNNs for the number of valid entries.
+	 */
+	const uint32_t* getNNs(size_t index, bool label) const {
+		return &nns[((index * 2) + label) * k];
+	}
+
+	/**
+	 * Merges the per class lists to find the n nearest neighbours of this row
+	 * regardless of class.  n must not be greater than k.
+	 * @param index Row index
+	 * @param n Number of neighbours requested
+	 * @param out Buffer of at least n entries
+	 * @return Number of neighbours written to out
+	 */
+	uint16_t getNNs(size_t index, uint16_t n, uint32_t* out) const;
+
+	void print(ostream& out) const;
+};
+
+}
+}
@@ -23,6 +23,9 @@ using std::string;
 
 #include <boost/exception/all.hpp>
 
+#include <portcullis/ml/neighbour_graph.hpp>
+using portcullis::ml::NeighbourGraph;
+
 namespace portcullis {
 namespace ml {
 
@@ -43,10 +46,15 @@ private:
 	uint16_t threads;
 	bool verbose;
 
-	double* data;
+	const double* data;
 	size_t rows;
 	size_t cols;
 
+	// Optional precomputed neighbour graph, if present only rows from the graph
+	// with the given label are oversampled
+	const NeighbourGraph* graph;
+	bool label;
+
 	double* synthetic;
 	size_t s_rows;
 
@@ -54,6 +62,13 @@ public:
 
 	Smote(uint16_t defaultK, uint16_t _smoteness, uint16_t _threads, double* _data, size_t _rows, size_t _cols);
 
+	/**
+	 * Creates a SMOTE instance that oversamples all rows of the given class in
+	 * a precomputed neighbour graph, using the graph's same class neighbours
+	 * rather than running a separate KNN.
+	 */
+	Smote(const NeighbourGraph& _graph, bool _label, uint16_t _smoteness);
+
 	~Smote() {
 		delete[] synthetic;
 	}
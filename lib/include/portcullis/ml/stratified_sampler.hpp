@@ -0,0 +1,85 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <random>
+#include <vector>
+using std::vector;
+
+#include <portcullis/junction.hpp>
+using portcullis::Junction;
+using portcullis::JunctionList;
+
+namespace portcullis {
+namespace ml {
+
+const uint32_t STRATIFIED_DEFAULT_SEED = 12345;
+// Intron sizes are binned by powers of two, anything from 2^31 up shares the last bin
+const size_t STRATIFIED_INTRON_BINS = 32;
+// One slot per CanonicalSS value
+const size_t STRATIFIED_SS_TYPES = 4;
+const size_t STRATIFIED_NB_STRATA = STRATIFIED_INTRON_BINS * STRATIFIED_SS_TYPES;
+
+/**
+ * Draws a training set of bounded size from a large junction list while
+ * keeping rare kinds of junction represented.  Junctions are grouped into
+ * strata by intron size (log2 bins) and splice site type.  All strata get the
+ * same cap, chosen as large as possible without the total going over budget,
+ * so small strata are kept whole and only the large ones are thinned.  Each
+ * capped stratum is sampled by partial Fisher-Yates over its indices, so the
+ * whole draw is O(n) in the input size.
+ */
+class StratifiedSampler {
+private:
+	uint32_t seed;
+
+public:
+
+	StratifiedSampler() : StratifiedSampler(STRATIFIED_DEFAULT_SEED) {}
+
+	StratifiedSampler(uint32_t _seed) : seed(_seed) {}
+
+	uint32_t getSeed() const {
+		return seed;
+	}
+
+	void setSeed(uint32_t seed) {
+		this->seed = seed;
+	}
+
+	static size_t intronSizeBin(uint32_t intronSize);
+
+	static size_t stratumOf(const Junction& j);
+
+	/**
+	 * Largest per-stratum cap such that the capped strata sizes sum to no more
+	 * than budget.  If everything fits, this is the size of the largest stratum.
+	 */
+	static size_t capFor(const vector<size_t>& strataSizes, size_t budget);
+
+	/**
+	 * Splits in into a stratified sample of at most budget junctions and the
+	 * held out remainder.  Both outputs keep the input order.  A budget at
+	 * least as large as the input selects everything, a budget of 0 selects
+	 * nothing.
+	 */
+	void sample(const JunctionList& in, size_t budget, JunctionList& sampled, JunctionList& heldOut) const;
+};
+
+}
+}
@@ -0,0 +1,208 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+using std::map;
+using std::mutex;
+using std::set;
+using std::string;
+using std::vector;
+
+#include <boost/exception/all.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/timer/timer.hpp>
+using boost::filesystem::path;
+using boost::timer::cpu_timer;
+
+namespace portcullis {
+
+typedef boost::error_info<struct RunReportError, string> RunReportErrorInfo;
+struct RunReportException : virtual boost::exception, virtual std::exception {};
+
+/**
+ * Resources used by one stage of a run.  Stages nest, and the name is the path
+ * of enclosing stages, e.g. "findJunctions/calcJunctionStats".  Peak RSS is the
+ * process high water mark when the stage finished, so it only ever goes up.
+ */
+struct StageRecord {
+	string name;
+	double start = 0.0;		// Seconds since the run started
+	double wall = 0.0;
+	double user = 0.0;
+	double system = 0.0;
+	long peakRss = 0;		// kB
+	uint64_t records = 0;	// Alignments (or junctions) processed, 0 if not relevant
+};
+
+/**
+ * A unit of work executed by a thread pool, e.g. one target sequence in junc.
+ * CPU time is for the thread that ran the task.
+ */
+struct TaskRecord {
+	string stage;
+	string name;
+	double wall = 0.0;
+	double cpu = 0.0;
+	uint64_t records = 0;
+	uint64_t junctions = 0;
+};
+
+/**
+ * Collects per stage timings, thread pool task timings and simple counters for
+ * a single portcullis run and writes them out as JSON alongside the other
+ * outputs.  All methods are thread safe.  Stages nest per thread, so a stage
+ * opened by a worker thread is not placed inside whatever the main thread has
+ * open at the time.
+ */
+class RunReport {
+private:
+	string mode;
+	string version;
+	cpu_timer timer;
+	map<std::thread::id, vector<string>> openStages;
+	vector<StageRecord> stages;
+	vector<TaskRecord> tasks;
+	map<string, uint64_t> counters;
+	map<string, string> settings;
+	set<path> inputs;
+	set<path> outputs;
+	mutable mutex mtx;
+
+	static string escape(const string& s);
+
+	static uint64_t sizeOf(const set<path>& files);
+
+public:
+
+	RunReport() {}
+
+	/**
+	 * Clears anything recorded so far and restarts the run clock
+	 * @param mode The portcullis mode being run
+	 */
+	void begin(const string& mode);
+
+	void setVersion(const string& version) {
+		this->version = version;
+	}
+
+	/**
+	 * Opens a stage nested inside any currently open stages.  Prefer StageTimer.
+	 * @return The full name of the stage
+	 */
+	string pushStage(const string& name);
+
+	/**
+	 * Closes the innermost open stage, recording its resource usage
+	 */
+	void popStage(StageRecord& record);
+
+	void addTask(const TaskRecord& task);
+
+	void setCounter(const string& key, uint64_t value);
+
+	void addCounter(const string& key, uint64_t delta);
+
+	uint64_t getCounter(const string& key) const;
+
+	void setSetting(const string& key, const string& value);
+
+	/**
+	 * Input and output files are sized when the report is saved, giving bytes
+	 * read and written for the run.  Registering a file twice is harmless.
+	 */
+	void addInput(const path& file);
+
+	void addOutput(const path& file);
+
+	vector<StageRecord> getStages() const;
+
+	vector<TaskRecord> getTasks() const;
+
+	/**
+	 * Seconds since the run started
+	 */
+	double elapsed() const {
+		return timer.elapsed().wall / 1e9;
+	}
+
+	/**
+	 * Writes the report in JSON format
+	 */
+	void write(std::ostream& out) const;
+
+	/**
+	 * Saves the report.  Builds configured with --enable-instrumentation also
+	 * write <prefix>.probes.json and <prefix>.trace.json, where prefix is the
+	 * file name without ".report.json".
+	 */
+	void save(const path& file) const;
+
+	/**
+	 * Peak resident set size of this process so far in kB
+	 */
+	static long peakRss();
+
+	/**
+	 * CPU seconds consumed by the calling thread so far
+	 */
+	static double threadCpuTime();
+};
+
+/**
+ * The report for the current run.  Each mode's main() restarts it and the
+ * driving class saves it next to its outputs.
+ */
+extern RunReport runReport;
+
+/**
+ * Records the wall, CPU and peak memory usage of the enclosing scope as a stage
+ * in a run report
+ */
+class StageTimer {
+private:
+	RunReport& report;
+	StageRecord record;
+	cpu_timer timer;
+	bool stopped;
+
+public:
+
+	StageTimer(const string& name, RunReport& report = runReport);
+
+	~StageTimer();
+
+	void setRecords(uint64_t records) {
+		record.records = records;
+	}
+
+	/**
+	 * Ends the stage early, for when its results need to outlive the scope.
+	 * Subsequent calls, including from the destructor, do nothing.
+	 */
+	void stop();
+};
+
+}
@@ -0,0 +1,149 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+#include <boost/filesystem/path.hpp>
+using boost::filesystem::path;
+
+#include <portcullis/bam/bam_master.hpp>
+#include <portcullis/junction_system.hpp>
+using portcullis::bam::Orientation;
+using portcullis::bam::Strandedness;
+using portcullis::StrandCounts;
+
+namespace portcullis {
+
+const int32_t DEFAULT_STRAND_WINDOW_SIZE = 100000;
+const uint64_t DEFAULT_STRAND_MIN_READS = 2000;
+const uint64_t DEFAULT_STRAND_MAX_READS = 1000000;
+const uint32_t DEFAULT_STRAND_MAX_WINDOWS = 256;
+// Number of consecutive windows that must agree before sampling stops
+const uint32_t STRAND_STABLE_WINDOWS = 3;
+
+/**
+ * What the strand sampler found.  Pair counts are taken from the leftmost read
+ * of pairs with both mates on the same target sequence.
+ */
+struct StrandSample {
+	StrandCounts counts;
+	uint64_t pairedReads = 0;
+	uint64_t unpairedReads = 0;
+	uint64_t pairsFR = 0;
+	uint64_t pairsRF = 0;
+	uint64_t pairsFF = 0;
+	uint32_t windows = 0;
+	uint64_t splicedReads = 0;
+	bool converged = false;
+	Orientation orientation = Orientation::UNKNOWN;
+	Strandedness strandedness = Strandedness::UNKNOWN;
+
+	uint64_t informativeReads() const;
+};
+
+/**
+ * Quickly works out the library protocol of a prepared BAM before the main
+ * junction pass.  Windows are placed at evenly spread quantiles of the mapped
+ * reads recorded in the BAM index, so the first few already cover the genome
+ * in proportion to its coverage.  The spliced reads in each window are
+ * compared with the strand suggested by their junction's splice sites, exactly
+ * as JunctionSystem::determineStrandedness does after a full run, and pair
+ * geometry is used to tell FR from RF libraries.  Sampling stops once enough
+ * informative reads have been seen and the call has stopped changing.
+ */
+class StrandSampler {
+private:
+	path bamFile;
+	path genomeFile;
+	int32_t windowSize;
+	uint64_t minReads;
+	uint64_t maxReads;
+	uint32_t maxWindows;
+	bool verbose;
+
+public:
+
+	StrandSampler(const path& _bamFile, const path& _genomeFile);
+
+	int32_t getWindowSize() const {
+		return windowSize;
+	}
+
+	void setWindowSize(int32_t windowSize) {
+		this->windowSize = windowSize;
+	}
+
+	uint64_t getMinReads() const {
+		return minReads;
+	}
+
+	void setMinReads(uint64_t minReads) {
+		this->minReads = minReads;
+	}
+
+	uint64_t getMaxReads() const {
+		return maxReads;
+	}
+
+	void setMaxReads(uint64_t maxReads) {
+		this->maxReads = maxReads;
+	}
+
+	uint32_t getMaxWindows() const {
+		return maxWindows;
+	}
+
+	void setMaxWindows(uint32_t maxWindows) {
+		this->maxWindows = maxWindows;
+	}
+
+	bool isVerbose() const {
+		return verbose;
+	}
+
+	void setVerbose(bool verbose) {
+		this->verbose = verbose;
+	}
+
+	/**
+	 * Samples the BAM, which must be indexed.  Prints a line per window when
+	 * verbose.
+	 */
+	StrandSample sample() const;
+
+	/**
+	 * Turns strand and pair counts into a protocol.  Strandedness comes from
+	 * JunctionSystem::determineStrandedness, which assumes FR when R1 and R2
+	 * disagree, and is flipped when the pairs show an RF library so that
+	 * BamAlignment::calcStrand gives reads the right strand.  Junctions count
+	 * unpaired reads as R2, so when no paired reads were seen they are moved
+	 * over to R1 first.
+	 */
+	static void decide(StrandSample& s);
+
+	/**
+	 * Van der Corput sequence in base 2, giving well spread points in [0,1)
+	 */
+	static double vanDerCorput(uint32_t n);
+};
+
+}
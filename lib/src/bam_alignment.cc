@@ -15,6 +15,8 @@
 //  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
 //  *******************************************************************
 
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <sstream>
@@ -39,6 +41,8 @@ using boost::lexical_cast;
 #include <htslib/faidx.h>
 #include <htslib/sam.h>
 
+#include <portcullis/instrument.hpp>
+
 #include <portcullis/bam/bam_alignment.hpp>
 using portcullis::bam::CigarOp;
 
@@ -69,6 +73,22 @@ vector<CigarOp> portcullis::bam::CigarOp::createFullCigarFromString(const string
 }
 
 void portcullis::bam::BamAlignment::init() {
+	decode();
+	// Determine actual read strand
+	// Try deriving from XS tag first if it's present.  If not then try to
+	// work it all out from the protocol suggested and the reverse strand
+	// flag.
+	Strand s = getXSStrand();
+	if (s != Strand::UNKNOWN) {
+		strand = s;
+	}
+	else {
+		strand = calcStrand();
+	}
+}
+
+void portcullis::bam::BamAlignment::decode() {
+	PORTCULLIS_PROBE("BamAlignment::init");
 	alFlag = b->core.flag;
 	position = b->core.pos;
 	refId = b->core.tid;
@@ -86,66 +106,47 @@ void portcullis::bam::BamAlignment::init() {
 			alignedLength += op.length;
 		}
 	}
-	// Determine actual read strand
-	// Try deriving from XS tag first if it's present.  If not then try to
-	// work it all out from the protocol suggested and the reverse strand
-	// flag.
-	Strand s = getXSStrand();
-	if (s != Strand::UNKNOWN) {
-		strand = s;
-	}
-	else {
-		strand = calcStrand();
-	}
 }
 
 portcullis::bam::Strand portcullis::bam::BamAlignment::calcStrand() {
-	Strand strand = Strand::UNKNOWN;
-	if (strandedness == Strandedness::FIRSTSTRAND) {
-		if (orientation == Orientation::FR) {
-			// Second mate should have correct strand (flip the strand for the first mate)
-			if (isFirstMate()) {
-				strand = isReverseStrand() ? Strand::POSITIVE : Strand::NEGATIVE;
-			}
-			else {
-				strand = isReverseStrand() ? Strand::NEGATIVE : Strand::POSITIVE;
-			}
-		}
-		else if (orientation == Orientation::RF) {
-			if (isFirstMate()) {
-				strand = isReverseStrand() ? Strand::NEGATIVE : Strand::POSITIVE;
-			}
-			else {
-				strand = isReverseStrand() ? Strand::POSITIVE : Strand::NEGATIVE;
-			}
-		}
-		else if (orientation == Orientation::SE || orientation == Orientation::FF) {
-			strand = isReverseStrand() ? Strand::POSITIVE : Strand::NEGATIVE;
-		}
+	return strandFunction(strandedness, orientation)(isFirstMate(), isReverseStrand());
+}
+
+namespace {
+
+using portcullis::bam::Orientation;
+using portcullis::bam::Strandedness;
+using portcullis::bam::StrandFunction;
+using portcullis::bam::protocolStrand;
+
+template<Strandedness S>
+StrandFunction strandFunctionFor(Orientation orientation) {
+	switch (orientation) {
+	case Orientation::SE:
+		return &protocolStrand<S, Orientation::SE>;
+	case Orientation::FR:
+		return &protocolStrand<S, Orientation::FR>;
+	case Orientation::RF:
+		return &protocolStrand<S, Orientation::RF>;
+	case Orientation::FF:
+		return &protocolStrand<S, Orientation::FF>;
+	default:
+		return &protocolStrand<S, Orientation::UNKNOWN>;
 	}
-	else if (strandedness == Strandedness::SECONDSTRAND) {
-		if (orientation == Orientation::FR) {
-			// First mate should have correct strand (flip the strand for the second mate)
-			if (isFirstMate()) {
-				strand = isReverseStrand() ? Strand::NEGATIVE : Strand::POSITIVE;
-			}
-			else {
-				strand = isReverseStrand() ? Strand::POSITIVE : Strand::NEGATIVE;
-			}
-		}
-		else if (orientation == Orientation::RF) {
-			if (isFirstMate()) {
-				strand = isReverseStrand() ? Strand::POSITIVE : Strand::NEGATIVE;
-			}
-			else {
-				strand = isReverseStrand() ? Strand::NEGATIVE : Strand::POSITIVE;
-			}
-		}
-		else if (orientation == Orientation::SE || orientation == Orientation::FF) {
-			strand = isReverseStrand() ? Strand::NEGATIVE : Strand::POSITIVE;
-		}
+}
+
+}
+
+portcullis::bam::StrandFunction portcullis::bam::strandFunction(Strandedness strandedness, Orientation orientation) {
+	switch (strandedness) {
+	case Strandedness::FIRSTSTRAND:
+		return strandFunctionFor<Strandedness::FIRSTSTRAND>(orientation);
+	case Strandedness::SECONDSTRAND:
+		return strandFunctionFor<Strandedness::SECONDSTRAND>(orientation);
+	default:
+		// Reads from other protocols don't tell us the transcript strand
+		return &protocolStrand<Strandedness::UNKNOWN, Orientation::UNKNOWN>;
 	}
-	return strand;
 }
 
 /**
@@ -200,6 +201,29 @@ portcullis::bam::BamAlignment::BamAlignment(const BamAlignment& other) {
 	init();
 }
 
+portcullis::bam::BamAlignmentPtr portcullis::bam::BamAlignment::compactCopy() const {
+	BamAlignmentPtr copy = make_shared<BamAlignment>();
+	// Name, cigar, sequence and qualities all come before the optional fields
+	const int32_t length = bam_get_aux(b) - b->data;
+	bam1_t* c = copy->b;
+	c->core = b->core;
+	c->l_data = length;
+	c->m_data = length;
+	c->data = (uint8_t*) realloc(c->data, length);
+	memcpy(c->data, b->data, length);
+	copy->alFlag = alFlag;
+	copy->position = position;
+	copy->alignedLength = alignedLength;
+	copy->refId = refId;
+	copy->mateId = mateId;
+	copy->matePos = matePos;
+	copy->cigar = cigar;
+	copy->strandedness = strandedness;
+	copy->orientation = orientation;
+	copy->strand = strand;
+	return copy;
+}
+
 /**
  * Deletes the underlying samtools bam alignment only if it is managed (owned)
  * by this object
@@ -269,24 +293,14 @@ string portcullis::bam::BamAlignment::getQuerySeqAfterClipping(const string& seq
  * @return
  */
 bool portcullis::bam::BamAlignment::calcIfProperPair(Orientation orientation) const {
-	if (!this->isPaired() || !this->isMateMapped()) {
-		return false;
-	}
-	if (this->refId != this->mateId) {
-		return false;
-	}
-	bool diffStrand = this->isReverseStrand() != this->isMateReverseStrand();
-	bool posGap = !this->isReverseStrand() ? this->position < this->matePos : this->position > this->matePos;
-	if (orientation == Orientation::FR) {
-		return diffStrand && posGap;
-	}
-	else if (orientation == Orientation::RF) {
-		return diffStrand && !posGap;
-	}
-	else if (orientation == Orientation::FF) {
-		return !diffStrand && posGap;
-	}
-	else {
+	switch (orientation) {
+	case Orientation::FR:
+		return calcIfProperPair<Orientation::FR>();
+	case Orientation::RF:
+		return calcIfProperPair<Orientation::RF>();
+	case Orientation::FF:
+		return calcIfProperPair<Orientation::FF>();
+	default:
 		return false;
 	}
 }
@@ -338,7 +352,7 @@ string portcullis::bam::BamAlignment::getPaddedQuerySeq(int32_t start, int32_t e
 	return getPaddedQuerySeq(this->getQuerySeq(), start, end, actual_start, actual_end, include_soft_clips);
 }
 
-string portcullis::bam::BamAlignment::getPaddedQuerySeq(const string& query_seq, int32_t start, int32_t end, int32_t& actual_start, int32_t& actual_end, const bool include_soft_clips) const {
+string portcullis::bam::BamAlignment::getPaddedQuerySeq(const string& query_seq, int32_t start, int32_t end, int32_t& actual_start, int32_t& actual_end, const bool include_soft_clips, const bool trim_straddling) const {
 	if (start > getEnd() || end < position)
 		BOOST_THROW_EXCEPTION(BamException() << BamErrorInfo(string(
 								  "Found an alignment that does not have a presence in the requested region")));
@@ -349,17 +363,27 @@ string portcullis::bam::BamAlignment::getPaddedQuerySeq(const string& query_seq,
 	for (const auto & op : cigar) {
 		bool consumesRef = CigarOp::opConsumesReference(op.type);
 		bool consumesQuery = CigarOp::opConsumesQuery(op.type) && (include_soft_clips || op.type != BAM_CIGAR_SOFTCLIP_CHAR);
-		// Skips any cigar ops before start position
+		int32_t opLength = op.length;
+		// Skips any cigar ops before start position.  If requested, aligned ops
+		// straddling the start position contribute the part inside the region.
 		if (rPos < start) {
-			if (consumesRef) rPos += op.length;
-			if (consumesQuery) qPos += op.length;
-			continue;
+			if (trim_straddling && consumesRef && consumesQuery && rPos + opLength > start) {
+				const int32_t skip = start - rPos;
+				rPos += skip;
+				qPos += skip;
+				opLength -= skip;
+			}
+			else {
+				if (consumesRef) rPos += opLength;
+				if (consumesQuery) qPos += opLength;
+				continue;
+			}
 		}
 		// Stop once we get to the end of the region, and make sure we don't end on a refskip that exceeds our limit
-		if (((rPos > end && op.type != BAM_CIGAR_INS_CHAR) || (op.type == BAM_CIGAR_REFSKIP_CHAR && rPos + op.length > end))) break;
+		if (((rPos > end && op.type != BAM_CIGAR_INS_CHAR) || (op.type == BAM_CIGAR_REFSKIP_CHAR && rPos + opLength > end))) break;
 		if (consumesQuery) {
 			// Don't return anything that runs off the end cap
-			int32_t len = rPos + op.length > end && op.type != BAM_CIGAR_INS_CHAR ? end - rPos + 1 : op.length;
+			int32_t len = rPos + opLength > end && op.type != BAM_CIGAR_INS_CHAR ? end - rPos + 1 : opLength;
 			if (len == 0) {
 				BOOST_THROW_EXCEPTION(BamException() << BamErrorInfo(string(
 										  "Can't extract cigar op sequence from query string when length has been calculated as 0.")
@@ -388,21 +412,21 @@ string portcullis::bam::BamAlignment::getPaddedQuerySeq(const string& query_seq,
 			ss << query.substr(qPos, len);
 		}
 		else if (consumesRef) {   // i.e. consumes reference but not query (DEL or REF_SKIP ops)
-			uint32_t len = rPos + op.length > end ? end - rPos + 1 : op.length; // Make sure we don't exceed our ref end limit
+			uint32_t len = rPos + opLength > end ? end - rPos + 1 : opLength; // Make sure we don't exceed our ref end limit
 			string s;
 			s.resize(len);
 			std::fill(s.begin(), s.end(), BAM_CIGAR_DIFF_CHAR);
 			ss << s;
 		}
-		if (consumesRef) rPos += op.length;
-		if (consumesQuery) qPos += op.length;
+		if (consumesRef) rPos += opLength;
+		if (consumesQuery) qPos += opLength;
 	}
 	actual_start = position > start ? position : start;
 	actual_end = rPos <= end ? rPos - 1 : end;
 	return ss.str();
 }
 
-string portcullis::bam::BamAlignment::getPaddedGenomeSeq(const string& genomeSeq, int32_t start, int32_t end, int32_t q_start, int32_t q_end, const bool include_soft_clips) const {
+string portcullis::bam::BamAlignment::getPaddedGenomeSeq(const string& genomeSeq, int32_t start, int32_t end, int32_t q_start, int32_t q_end, const bool include_soft_clips, const bool trim_straddling) const {
 	if (start > getEnd() || end < position)
 		BOOST_THROW_EXCEPTION(BamException() << BamErrorInfo(string(
 								  "Found an alignment that does not have a presence in the requested region")));
@@ -423,17 +447,25 @@ string portcullis::bam::BamAlignment::getPaddedGenomeSeq(const string& genomeSeq
 	for (const auto & op : cigar) {
 		bool consumesRef = CigarOp::opConsumesReference(op.type);
 		bool consumesQuery = CigarOp::opConsumesQuery(op.type) && (include_soft_clips || op.type != BAM_CIGAR_SOFTCLIP_CHAR);
-		// Skips any cigar ops before start position
+		int32_t opLength = op.length;
+		// Skips any cigar ops before start position.  As with the query, aligned
+		// ops straddling the start position are trimmed only if requested.
 		if (rPos < q_start) {
-			if (consumesRef) rPos += op.length;
-			//if (consumesQuery) qPos += op.length;
-			continue;
+			if (trim_straddling && consumesRef && consumesQuery && rPos + opLength > q_start) {
+				opLength -= q_start - rPos;
+				rPos = q_start;
+			}
+			else {
+				if (consumesRef) rPos += opLength;
+				//if (consumesQuery) qPos += op.length;
+				continue;
+			}
 		}
 		// Ends cigar loop once we reach the end of the region (unless we have an insertion op here... then proceed)
 		if (rPos > q_end && op.type != BAM_CIGAR_INS_CHAR) break;
 		if (consumesRef) {
 			int32_t seqOffset = rPos - start;
-			int32_t len = rPos + op.length > q_end ? q_end - rPos + 1 : op.length;
+			int32_t len = rPos + opLength > q_end ? q_end - rPos + 1 : opLength;
 			if (seqOffset < 0 || seqOffset + len > (int32_t)genomeSeq.size()) {
 				BOOST_THROW_EXCEPTION(BamException() << BamErrorInfo(string(
 										  "Can't extract cigar op sequence from extracted genome region.\nCurrent position in extracted genome region: ")
@@ -455,7 +487,7 @@ string portcullis::bam::BamAlignment::getPaddedGenomeSeq(const string& genomeSeq
 			std::fill(s.begin(), s.end(), BAM_CIGAR_DIFF_CHAR);
 			ss << s;
 		}
-		if (consumesRef) rPos += op.length;
+		if (consumesRef) rPos += opLength;
 		//if (consumesQuery) qPos += op.length;
 	}
 	return ss.str();
@@ -15,6 +15,8 @@
 //  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
 //  *******************************************************************
 
+#include <algorithm>
+#include <cstdlib>
 #include <memory>
 #include <iostream>
 #include <sstream>
@@ -46,6 +48,9 @@ using boost::lexical_cast;
 using portcullis::bam::BamAlignment;
 using portcullis::bam::BamAlignmentPtr;
 
+#include <portcullis/run_report.hpp>
+using portcullis::runReport;
+
 #include <portcullis/bam/bam_reader.hpp>
 
 // ****** BamReader methods *********
@@ -55,6 +60,9 @@ portcullis::bam::BamReader::BamReader(const path& _bamFile) {
 	header = nullptr;
 	index = nullptr;
 	iter = nullptr;
+	emptyRegion = false;
+	regionIndex = 0;
+	regionSeq = -1;
 	c = nullptr;
 }
 
@@ -69,9 +77,7 @@ portcullis::bam::BamReader::~BamReader() {
 		hts_idx_destroy(index);
 	}
 	if (iter != nullptr) {
-		free(iter->off);
-		free(iter->bins.a);
-		free(iter);
+		hts_itr_destroy(iter);
 	}
 }
 
@@ -84,8 +90,11 @@ void portcullis::bam::BamReader::open() {
 	}
 	// Load header
 	header = bam_hdr_read(fp);
-	// Load the index
-	index = bam_index_load(bamFile.c_str());
+	// Load the index, unless we are streaming from standard input
+	if (bamFile.string() != "-") {
+		index = bam_index_load(bamFile.c_str());
+		runReport.addInput(bamFile);
+	}
 	// Initialise an empty bam alignment
 	c = bam_init1();
 	b.setRaw(c);
@@ -132,9 +141,11 @@ shared_ptr<RefSeqPtrIndexMap> portcullis::bam::BamReader::createRefMap(const Ref
 }
 
 bool portcullis::bam::BamReader::next() {
-	bool res = bam_iter_read(fp, iter, c) >= 0;
+	if (!read()) {
+		return false;
+	}
 	b.setRaw(c);
-	return res;
+	return true;
 }
 
 const BamAlignment& portcullis::bam::BamReader::current() const {
@@ -142,7 +153,135 @@ const BamAlignment& portcullis::bam::BamReader::current() const {
 }
 
 void portcullis::bam::BamReader::setRegion(const int32_t seqIndex, const int32_t start, const int32_t end) {
+	if (index == nullptr) {
+		BOOST_THROW_EXCEPTION(BamException() << BamErrorInfo(string(
+								  "Can't query a region without an index: ") + bamFile.string()));
+	}
+	if (iter != nullptr) {
+		hts_itr_destroy(iter);
+	}
+	regions = RegionList();
 	iter = sam_itr_queryi(index, seqIndex, start, end);
+	// htslib doesn't return an iterator for targets without any alignments
+	emptyRegion = iter == nullptr;
+}
+
+void portcullis::bam::BamReader::setRegion(const int32_t seqIndex, const int32_t start, const int32_t end, const vector<hts_pair64_t>& chunks) {
+	setRegion(seqIndex, start, end);
+	if (emptyRegion || chunks.empty()) {
+		emptyRegion = true;
+		return;
+	}
+	setChunks(chunks);
+}
+
+void portcullis::bam::BamReader::setChunks(const vector<hts_pair64_t>& chunks) {
+	// Swap the chunks found from the index for those given.  The iterator
+	// still filters out alignments outside of its region, and only seeks
+	// between chunks that aren't adjacent.
+	hts_pair64_t* off = (hts_pair64_t*) malloc(chunks.size() * sizeof(hts_pair64_t));
+	std::copy(chunks.begin(), chunks.end(), off);
+	free(iter->off);
+	iter->off = off;
+	iter->n_off = (int) chunks.size();
+	iter->i = -1;
+	iter->curr_off = 0;
+	iter->finished = 0;
+}
+
+void portcullis::bam::BamReader::setRegions(const RegionList& regions) {
+	if (index == nullptr) {
+		BOOST_THROW_EXCEPTION(BamException() << BamErrorInfo(string(
+								  "Can't query regions without an index: ") + bamFile.string()));
+	}
+	if (iter != nullptr) {
+		hts_itr_destroy(iter);
+		iter = nullptr;
+	}
+	this->regions = regions;
+	regionIndex = 0;
+	regionSeq = -1;
+	emptyRegion = regions.empty();
+}
+
+bool portcullis::bam::BamReader::readRegions() {
+	while (true) {
+		if (iter != nullptr && regionIndex < regions.size() && regions[regionIndex].seq == regionSeq &&
+				bam_iter_read(fp, iter, c) >= 0) {
+			// Alignments come in order of position, so regions ending before
+			// this one starts can't overlap any later alignments either
+			while (regionIndex < regions.size() && regions[regionIndex].seq == regionSeq &&
+					regions[regionIndex].end <= c->core.pos) {
+				regionIndex++;
+			}
+			if (regionIndex < regions.size() && regions[regionIndex].seq == regionSeq &&
+					regions[regionIndex].start < bam_endpos(c)) {
+				return true;
+			}
+			// Otherwise the alignment lies between two regions, in a chunk
+			// that was read for one of them
+			continue;
+		}
+		// Move on to the regions of the next target sequence
+		while (regionIndex < regions.size() && regions[regionIndex].seq == regionSeq) {
+			regionIndex++;
+		}
+		if (regionIndex >= regions.size()) {
+			return false;
+		}
+		queryRegions(regionIndex);
+	}
+}
+
+void portcullis::bam::BamReader::queryRegions(const size_t first) {
+	regionSeq = regions[first].seq;
+	size_t last = first;
+	while (last + 1 < regions.size() && regions[last + 1].seq == regionSeq) {
+		last++;
+	}
+	// Gather the chunks of the file holding alignments for each region
+	vector<hts_pair64_t> chunks;
+	for (size_t i = first; i <= last; i++) {
+		hts_itr_t* it = sam_itr_queryi(index, regionSeq, regions[i].start, regions[i].end);
+		if (it != nullptr) {
+			chunks.insert(chunks.end(), it->off, it->off + it->n_off);
+			hts_itr_destroy(it);
+		}
+	}
+	// Merge chunks that overlap, so alignments shared by neighbouring regions
+	// are only read once, and chunks that share a BGZF block, so the block is
+	// only decompressed once
+	std::sort(chunks.begin(), chunks.end(), [](const hts_pair64_t& a, const hts_pair64_t& b) {
+		return a.u < b.u;
+	});
+	vector<hts_pair64_t> merged;
+	for (const auto & chunk : chunks) {
+		if (!merged.empty() && (chunk.u <= merged.back().v || (chunk.u >> 16) == (merged.back().v >> 16))) {
+			merged.back().v = std::max(merged.back().v, chunk.v);
+		}
+		else {
+			merged.push_back(chunk);
+		}
+	}
+	if (iter != nullptr) {
+		hts_itr_destroy(iter);
+	}
+	// One iterator spanning all the regions on this target, reading only the
+	// merged chunks
+	iter = sam_itr_queryi(index, regionSeq, regions[first].start, regions[last].end);
+	if (iter != nullptr && !merged.empty()) {
+		setChunks(merged);
+	}
+	else if (iter != nullptr) {
+		hts_itr_destroy(iter);
+		iter = nullptr;
+	}
+}
+
+bool portcullis::bam::BamReader::getIndexStats(const int32_t seqIndex, uint64_t& mapped, uint64_t& unmapped) const {
+	mapped = 0;
+	unmapped = 0;
+	return index != nullptr && hts_idx_get_stat(index, seqIndex, &mapped, &unmapped) >= 0;
 }
 
 
@@ -15,6 +15,7 @@
 //  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
 //  *******************************************************************
 
+#include <algorithm>
 #include <memory>
 #include <sstream>
 #include <string>
@@ -40,11 +41,87 @@ using boost::lexical_cast;
 #include <portcullis/bam/bam_alignment.hpp>
 using portcullis::bam::BamAlignment;
 
+#include <portcullis/run_report.hpp>
+using portcullis::runReport;
+
 #include <portcullis/bam/bam_writer.hpp>
 
-void portcullis::bam::BamWriter::open(bam_hdr_t* header) {
-	// split
-	fp = bgzf_open(bamFile.c_str(), "w");
+void portcullis::bam::BamBlockBuffer::flushBlock() {
+	size_t offset = compressed.size();
+	compressed.resize(offset + BGZF_MAX_BLOCK_SIZE);
+	size_t length = BGZF_MAX_BLOCK_SIZE;
+	if (bgzf_compress(compressed.data() + offset, &length, block.data(), block.size(), level) != 0) {
+		BOOST_THROW_EXCEPTION(BamException() << BamErrorInfo(string(
+								  "Could not compress BGZF block")));
+	}
+	compressed.resize(offset + length);
+	block.clear();
+}
+
+void portcullis::bam::BamBlockBuffer::append(const void* data, size_t length) {
+	const uint8_t* d = (const uint8_t*)data;
+	while (length > 0) {
+		size_t n = std::min(length, BGZF_BLOCK_SIZE - block.size());
+		block.insert(block.end(), d, d + n);
+		d += n;
+		length -= n;
+		if (block.size() == BGZF_BLOCK_SIZE) {
+			flushBlock();
+		}
+	}
+}
+
+int portcullis::bam::BamBlockBuffer::write(const bam1_t* b) {
+	// Same record layout as bam_write1 (little endian hosts only)
+	const bam1_core_t* c = &b->core;
+	uint32_t blockLen = b->l_data + 32;
+	uint32_t x[8];
+	x[0] = c->tid;
+	x[1] = c->pos;
+	x[2] = (uint32_t)c->bin << 16 | c->qual << 8 | c->l_qname;
+	x[3] = (uint32_t)c->flag << 16 | c->n_cigar;
+	x[4] = c->l_qseq;
+	x[5] = c->mtid;
+	x[6] = c->mpos;
+	x[7] = c->isize;
+	// Start a new block rather than split a record that would fit in one
+	if (block.size() + 4 + blockLen > BGZF_BLOCK_SIZE && !block.empty()) {
+		flushBlock();
+	}
+	// The previous record ends where this one starts
+	if (!records.empty()) {
+		records.back().endOffset = tell();
+	}
+	append(&blockLen, 4);
+	append(x, 32);
+	append(b->data, b->l_data);
+	records.push_back(Record{c->tid, c->pos, bam_endpos(b), !(c->flag & BAM_FUNMAP), 0});
+	return 4 + blockLen;
+}
+
+void portcullis::bam::BamWriter::open(bam_hdr_t* header, bool index, bool useCsi) {
+	this->header = header;
+	if (index && (sam || isStdout())) {
+		BOOST_THROW_EXCEPTION(BamException() << BamErrorInfo(string(
+								  "Can only index BAM files: ") + bamFile.string()));
+	}
+	if (!isStdout()) {
+		runReport.addOutput(bamFile);
+	}
+	if (sam) {
+		samFp = hts_open(bamFile.c_str(), "w");
+		if (samFp == NULL) {
+			BOOST_THROW_EXCEPTION(BamException() << BamErrorInfo(string(
+									  "Could not open output SAM file: ") + bamFile.string()));
+		}
+		if (sam_hdr_write(samFp, header) != 0) {
+			BOOST_THROW_EXCEPTION(BamException() << BamErrorInfo(string(
+									  "Could not write header into: ") + bamFile.string()));
+		}
+		return;
+	}
+	string mode = level < 0 ? string("w") : string("w") + lexical_cast<string>(std::min(level, 9));
+	fp = bgzf_open(bamFile.c_str(), mode.c_str());
 	if (fp == NULL) {
 		BOOST_THROW_EXCEPTION(BamException() << BamErrorInfo(string(
 								  "Could not open output BAM file: ") + bamFile.string()));
@@ -53,13 +130,104 @@ void portcullis::bam::BamWriter::open(bam_hdr_t* header) {
 		BOOST_THROW_EXCEPTION(BamException() << BamErrorInfo(string(
 								  "Could not write header into: ") + bamFile.string()));
 	}
+	if (index) {
+		// Same index parameters as samtools index
+		int minShift = 14;
+		int nLvls = 5;
+		idxFormat = HTS_FMT_BAI;
+		if (useCsi) {
+			int64_t maxLen = 0;
+			for (int32_t i = 0; i < header->n_targets; i++) {
+				maxLen = std::max(maxLen, (int64_t)header->target_len[i]);
+			}
+			maxLen += 256;
+			nLvls = 0;
+			for (int64_t s = 1 << minShift; maxLen > s; s <<= 3) {
+				nLvls++;
+			}
+			idxFormat = HTS_FMT_CSI;
+		}
+		idx = hts_idx_init(header->n_targets, idxFormat, bgzf_tell(fp), minShift, nLvls);
+	}
+}
+
+void portcullis::bam::BamWriter::push(int32_t tid, int32_t beg, int32_t end, uint64_t offset, bool mapped) {
+	if (hts_idx_push(idx, tid, beg, end, offset, mapped) < 0) {
+		BOOST_THROW_EXCEPTION(BamException() << BamErrorInfo(string(
+								  "Could not index ") + bamFile.string() + ". Records are not in coordinate order."));
+	}
+}
+
+void portcullis::bam::BamWriter::pushPending() {
+	if (hasPending) {
+		push(pending.tid, pending.beg, pending.end, bgzf_tell(fp), pending.mapped);
+		hasPending = false;
+	}
+}
+
+int portcullis::bam::BamWriter::write(const bam1_t* b) {
+	if (samFp != nullptr) {
+		return sam_write1(samFp, header, b);
+	}
+	if (idx != nullptr) {
+		// Do the block flush bam_write1 would do, so the previous record's end
+		// offset is known
+		bgzf_flush_try(fp, 4 + 32 + b->l_data);
+		pushPending();
+	}
+	int res = bam_write1(fp, b);
+	if (idx != nullptr && res >= 0) {
+		pending = BamBlockBuffer::Record{b->core.tid, b->core.pos, bam_endpos(b), !(b->core.flag & BAM_FUNMAP), 0};
+		hasPending = true;
+	}
+	return res;
 }
 
-int portcullis::bam::BamWriter::write(const BamAlignment& ba) {
-	return bam_write1(fp, ba.getRaw());
+void portcullis::bam::BamWriter::write(const BamBlockBuffer& blocks) {
+	if (fp == nullptr) {
+		BOOST_THROW_EXCEPTION(BamException() << BamErrorInfo(string(
+								  "Can only append BGZF blocks to a BAM file: ") + bamFile.string()));
+	}
+	// Finish the current block so the new blocks start on a block boundary
+	if (bgzf_flush(fp) != 0) {
+		BOOST_THROW_EXCEPTION(BamException() << BamErrorInfo(string(
+								  "Could not write to: ") + bamFile.string()));
+	}
+	const uint64_t base = (uint64_t)fp->block_address;
+	if (idx != nullptr) {
+		pushPending();
+		for (auto & r : blocks.getRecords()) {
+			push(r.tid, r.beg, r.end, r.endOffset + (base << 16), r.mapped);
+		}
+	}
+	const vector<uint8_t>& data = blocks.getBlocks();
+	if (!data.empty() && bgzf_raw_write(fp, data.data(), data.size()) != (ssize_t)data.size()) {
+		BOOST_THROW_EXCEPTION(BamException() << BamErrorInfo(string(
+								  "Could not write to: ") + bamFile.string()));
+	}
+	// Raw writes bypass BGZF's own bookkeeping of where the next block starts
+	fp->block_address += data.size();
 }
 
 void portcullis::bam::BamWriter::close() {
+	if (samFp != nullptr) {
+		hts_close(samFp);
+		samFp = nullptr;
+		return;
+	}
+	if (idx != nullptr) {
+		bgzf_flush(fp);
+		pushPending();
+		hts_idx_finish(idx, bgzf_tell(fp));
+	}
 	bgzf_close(fp);
+	if (idx != nullptr) {
+		if (hts_idx_save(idx, bamFile.c_str(), idxFormat) != 0) {
+			BOOST_THROW_EXCEPTION(BamException() << BamErrorInfo(string(
+									  "Could not save index for: ") + bamFile.string()));
+		}
+		hts_idx_destroy(idx);
+		idx = nullptr;
+		runReport.addOutput(path(bamFile.string() + (idxFormat == HTS_FMT_CSI ? ".csi" : ".bai")));
+	}
 }
-
@@ -0,0 +1,85 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+using std::make_pair;
+using std::pair;
+using std::sort;
+using std::string;
+using std::vector;
+
+#include <portcullis/barcode_counts.hpp>
+
+uint32_t portcullis::BarcodeDictionary::add(const string& barcode) {
+	auto it = ids.find(barcode);
+	if (it != ids.end()) {
+		return it->second;
+	}
+	const uint32_t id = barcodes.size();
+	ids[barcode] = id;
+	barcodes.push_back(barcode);
+	return id;
+}
+
+vector<uint32_t> portcullis::BarcodeDictionary::merge(const BarcodeDictionary& other) {
+	vector<uint32_t> mapping;
+	mapping.reserve(other.size());
+	for (const auto & barcode : other.barcodes) {
+		mapping.push_back(add(barcode));
+	}
+	return mapping;
+}
+
+void portcullis::BarcodeCounts::compact() {
+	if (pending.empty()) {
+		return;
+	}
+	sort(pending.begin(), pending.end());
+	vector<pair<uint32_t, uint32_t>> merged;
+	merged.reserve(counts.size() + pending.size());
+	auto c = counts.begin();
+	for (size_t i = 0; i < pending.size();) {
+		const uint32_t id = pending[i];
+		uint32_t n = 0;
+		for (; i < pending.size() && pending[i] == id; i++) {
+			n++;
+		}
+		for (; c != counts.end() && c->first < id; ++c) {
+			merged.push_back(*c);
+		}
+		if (c != counts.end() && c->first == id) {
+			n += c->second;
+			++c;
+		}
+		merged.push_back(make_pair(id, n));
+	}
+	merged.insert(merged.end(), c, counts.end());
+	merged.shrink_to_fit();
+	counts.swap(merged);
+	vector<uint32_t>().swap(pending);
+}
+
+void portcullis::BarcodeCounts::remap(const vector<uint32_t>& mapping) {
+	compact();
+	for (auto & c : counts) {
+		c.first = mapping[c.first];
+	}
+	sort(counts.begin(), counts.end());
+}
@@ -0,0 +1,168 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <cstring>
+
+#include <htslib/hts.h>
+#include <htslib/sam.h>
+
+#include <portcullis/bam/cigar_editor.hpp>
+
+void portcullis::bam::CigarEditor::replaceOp(bam1_t* b, uint32_t index, uint32_t op, uint32_t length) {
+	bam_get_cigar(b)[index] = bam_cigar_gen(length, op);
+	updateBin(b);
+}
+
+int32_t portcullis::bam::CigarEditor::referenceLength(const bam1_t* b, uint32_t from, uint32_t to) {
+	const uint32_t* cigar = bam_get_cigar(b);
+	int32_t len = 0;
+	for (uint32_t i = from; i < to; i++) {
+		if (bam_cigar_type(bam_cigar_op(cigar[i])) & 2) {
+			len += bam_cigar_oplen(cigar[i]);
+		}
+	}
+	return len;
+}
+
+void portcullis::bam::CigarEditor::clip(bam1_t* b, uint32_t firstKept, uint32_t lastKept, bool hard) {
+	uint32_t* cigar = bam_get_cigar(b);
+	const uint32_t nbOps = b->core.n_cigar;
+	if (nbOps == 0 || (firstKept == 0 && lastKept + 1 >= nbOps)) {
+		return;
+	}
+	// Tally what's being clipped from each end
+	uint32_t leftHard = 0, leftQuery = 0, rightHard = 0, rightQuery = 0;
+	int32_t leftRef = 0;
+	bool alignedClipped = false;
+	for (uint32_t i = 0; i < nbOps; i++) {
+		if (i >= firstKept && i <= lastKept) {
+			continue;
+		}
+		const int op = bam_cigar_op(cigar[i]);
+		const uint32_t len = bam_cigar_oplen(cigar[i]);
+		uint32_t& h = i < firstKept ? leftHard : rightHard;
+		uint32_t& q = i < firstKept ? leftQuery : rightQuery;
+		if (op == BAM_CHARD_CLIP) {
+			h += len;
+		}
+		else if (bam_cigar_type(op) & 1) {
+			q += len;
+		}
+		if (i < firstKept && (bam_cigar_type(op) & 2)) {
+			leftRef += len;
+		}
+		if (op != BAM_CSOFT_CLIP && op != BAM_CHARD_CLIP && op != BAM_CREF_SKIP && op != BAM_CPAD) {
+			alignedClipped = true;
+		}
+	}
+	// Each clip op is derived from at least one of the ops it replaces, so the
+	// new CIGAR is never longer than the old one and can be written in place
+	uint32_t left[2], right[2];
+	uint32_t nbLeft = 0, nbRight = 0;
+	if (hard) {
+		if (leftHard + leftQuery > 0) left[nbLeft++] = bam_cigar_gen(leftHard + leftQuery, BAM_CHARD_CLIP);
+		if (rightHard + rightQuery > 0) right[nbRight++] = bam_cigar_gen(rightHard + rightQuery, BAM_CHARD_CLIP);
+	}
+	else {
+		if (leftHard > 0) left[nbLeft++] = bam_cigar_gen(leftHard, BAM_CHARD_CLIP);
+		if (leftQuery > 0) left[nbLeft++] = bam_cigar_gen(leftQuery, BAM_CSOFT_CLIP);
+		if (rightQuery > 0) right[nbRight++] = bam_cigar_gen(rightQuery, BAM_CSOFT_CLIP);
+		if (rightHard > 0) right[nbRight++] = bam_cigar_gen(rightHard, BAM_CHARD_CLIP);
+	}
+	// Remember where everything after the CIGAR currently lives
+	const int32_t oldLen = b->core.l_qseq;
+	const uint8_t* oldSeq = bam_get_seq(b);
+	const uint8_t* oldQual = bam_get_qual(b);
+	const uint8_t* oldAux = bam_get_aux(b);
+	const int auxLen = bam_get_l_aux(b);
+	// Rewrite the CIGAR
+	const uint32_t nbKept = lastKept - firstKept + 1;
+	memmove(cigar + nbLeft, cigar + firstKept, nbKept * sizeof(uint32_t));
+	memcpy(cigar, left, nbLeft * sizeof(uint32_t));
+	memcpy(cigar + nbLeft + nbKept, right, nbRight * sizeof(uint32_t));
+	b->core.n_cigar = nbLeft + nbKept + nbRight;
+	// Shift the sequence, qualities and tags down after the shorter CIGAR,
+	// dropping hard clipped bases.  Each destination starts at or before its
+	// source, so copying forwards is safe.
+	const int32_t trimLeft = hard && oldLen > 0 ? leftQuery : 0;
+	const int32_t newLen = hard && oldLen > 0 ? oldLen - leftQuery - rightQuery : oldLen;
+	uint8_t* seq = (uint8_t*)(cigar + b->core.n_cigar);
+	if (trimLeft % 2 == 0) {
+		memmove(seq, oldSeq + trimLeft / 2, (newLen + 1) / 2);
+	}
+	else {
+		for (int32_t i = 0; i < newLen; i += 2) {
+			uint8_t hi = bam_seqi(oldSeq, i + trimLeft);
+			uint8_t lo = i + 1 < newLen ? bam_seqi(oldSeq, i + 1 + trimLeft) : 0;
+			seq[i / 2] = hi << 4 | lo;
+		}
+	}
+	if (newLen % 2 == 1) {
+		// Keep the unused low nibble of the last byte zeroed
+		seq[newLen / 2] &= 0xf0;
+	}
+	uint8_t* qual = seq + (newLen + 1) / 2;
+	memmove(qual, oldQual + trimLeft, newLen);
+	uint8_t* aux = qual + newLen;
+	memmove(aux, oldAux, auxLen);
+	b->core.l_qseq = newLen;
+	b->l_data = (aux + auxLen) - b->data;
+	b->core.pos += leftRef;
+	mergeAdjacent(b);
+	// MD and NM describe the aligned bases before clipping and the genome isn't
+	// at hand to recalculate them, so drop them rather than leave them wrong
+	if (alignedClipped) {
+		uint8_t* tag = bam_aux_get(b, "MD");
+		if (tag != NULL) {
+			bam_aux_del(b, tag);
+		}
+		tag = bam_aux_get(b, "NM");
+		if (tag != NULL) {
+			bam_aux_del(b, tag);
+		}
+	}
+}
+
+void portcullis::bam::CigarEditor::mergeAdjacent(bam1_t* b) {
+	uint32_t* cigar = bam_get_cigar(b);
+	const uint32_t nbOps = b->core.n_cigar;
+	if (nbOps > 1) {
+		uint32_t n = 0;
+		for (uint32_t i = 1; i < nbOps; i++) {
+			if (bam_cigar_op(cigar[i]) == bam_cigar_op(cigar[n])) {
+				cigar[n] = bam_cigar_gen(bam_cigar_oplen(cigar[n]) + bam_cigar_oplen(cigar[i]), bam_cigar_op(cigar[n]));
+			}
+			else {
+				cigar[++n] = cigar[i];
+			}
+		}
+		n++;
+		if (n < nbOps) {
+			// Close the gap left by the merged ops
+			uint8_t* end = (uint8_t*)(cigar + nbOps);
+			const size_t rest = (b->data + b->l_data) - end;
+			memmove(cigar + n, end, rest);
+			b->l_data -= (nbOps - n) * sizeof(uint32_t);
+			b->core.n_cigar = n;
+		}
+	}
+	updateBin(b);
+}
+
+void portcullis::bam::CigarEditor::updateBin(bam1_t* b) {
+	b->core.bin = hts_reg2bin(b->core.pos, bam_endpos(b), 14, 5);
+}
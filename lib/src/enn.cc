@@ -15,13 +15,20 @@
 //  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
 //  *******************************************************************
 
+#include <algorithm>
 #include <iostream>
+#include <memory>
 using std::cout;
 using std::endl;
+using std::make_shared;
+using std::shared_ptr;
 
 #include <portcullis/ml/knn.hpp>
 using portcullis::ml::KNN;
 
+#include <portcullis/run_report.hpp>
+using portcullis::StageTimer;
+
 #include <portcullis/ml/enn.hpp>
 
 portcullis::ml::ENN::ENN(uint16_t defaultK, uint16_t _threads, double* _data, size_t _rows, size_t _cols, vector<bool>& _labels) {
@@ -40,13 +47,32 @@ portcullis::ml::ENN::ENN(uint16_t defaultK, uint16_t _threads, double* _data, si
 	threads = _threads;
 	verbose = false;
 	threshold = k / 2;
+	graph = nullptr;
+}
+
+portcullis::ml::ENN::ENN(uint16_t defaultK, const NeighbourGraph& _graph) {
+	data = _graph.getData();
+	rows = _graph.getNbRows();
+	cols = _graph.getNbCols();
+	labels = _graph.getLabels();
+	k = std::min(defaultK, _graph.getK());
+	threads = _graph.getThreads();
+	verbose = false;
+	threshold = k / 2;
+	graph = &_graph;
 }
 
 uint32_t portcullis::ml::ENN::execute(vector<bool>& results) const {
 	auto_cpu_timer timer(1, "ENN Time taken: %ws\n\n");
-	KNN knn(k, threads, data, rows, cols);
-	knn.setVerbose(verbose);
-	knn.execute();
+	StageTimer stage("enn");
+	// Only run KNN if we weren't given a precomputed neighbour graph
+	shared_ptr<KNN> knn = nullptr;
+	if (graph == nullptr) {
+		knn = make_shared<KNN>(k, threads, data, rows, cols);
+		knn->setVerbose(verbose);
+		knn->execute();
+	}
+	vector<uint32_t> buf(k);
 	if (verbose) {
 		cout << "Finding outliers" << endl;
 	}
@@ -58,8 +84,9 @@ uint32_t portcullis::ml::ENN::execute(vector<bool>& results) const {
 		uint16_t pos_count = 0;
 		uint16_t neg_count = 0;
 		bool pos = labels[i];
-		const vector<uint32_t> nn = knn.getNNs(i);
-		for (size_t j = 0; j < k; j++) {
+		const uint32_t* nn = graph == nullptr ? knn->getNNs(i) : buf.data();
+		const uint16_t nbNNs = graph == nullptr ? k : graph->getNNs(i, k, buf.data());
+		for (size_t j = 0; j < nbNNs; j++) {
 			uint32_t index = nn[j];
 			if (labels[index]) {
 				pos_count++;
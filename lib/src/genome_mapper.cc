@@ -36,6 +36,8 @@ using boost::lexical_cast;
 #include <htslib/faidx.h>
 #include <htslib/sam.h>
 
+#include <portcullis/instrument.hpp>
+
 #include <portcullis/bam/genome_mapper.hpp>
 
 // ******** Genome mapper ********
@@ -93,6 +95,7 @@ void portcullis::bam::GenomeMapper::loadFastaIndex() {
 * @return      The sequence as a string; empty string if no seq found
 */
 string portcullis::bam::GenomeMapper::fetchBases(const char* reg) const {
+	PORTCULLIS_PROBE("GenomeMapper::fetchBases");
 	int len = 0;
 	char* cseq = fai_fetch(fastaIndex, reg, &len);
 	string strseq = cseq == NULL ? string("") : string(cseq);
@@ -109,6 +112,7 @@ string portcullis::bam::GenomeMapper::fetchBases(const char* reg) const {
  * @return      The sequence as a string; empty string if no seq found
  */
 string portcullis::bam::GenomeMapper::fetchBases(const char* name, int start, int end) const {
+	PORTCULLIS_PROBE("GenomeMapper::fetchBases");
 	int len = 0;
 	char* cseq = faidx_fetch_seq(fastaIndex, name, start, end, &len);
 	string strseq = cseq == NULL ? string("") : string(cseq);
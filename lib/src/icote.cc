@@ -15,121 +15,203 @@
 //  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
 //  *******************************************************************
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <limits>
+#include <random>
 using std::cout;
 using std::endl;
 
-#include <portcullis/ml/knn.hpp>
-using portcullis::ml::KNN;
+#include <portcullis/run_report.hpp>
+using portcullis::StageTimer;
 
 #include <portcullis/ml/icote.hpp>
 
-portcullis::ml::Icote::Icote(uint16_t defaultK, uint16_t _duplications, uint16_t _threads, double* _data, size_t _rows, size_t _cols) {
+portcullis::ml::Icote::Icote(uint16_t _duplications, uint16_t _threads, const double* _data, size_t _rows, size_t _cols) {
 	data = _data;
 	rows = _rows;
 	cols = _cols;
-	if (_rows < defaultK && _rows < 100)
-		k = _rows;
-	else
-		k = defaultK;
 	duplications = _duplications < 1 ? 1 : _duplications;
-	threads = _threads;
+	iterations = ICOTE_DEFAULT_ITERATIONS;
+	threads = _threads < 1 ? 1 : _threads;
+	seed = ICOTE_DEFAULT_SEED;
 	verbose = false;
 	s_rows = duplications * rows;
+	synthetic = new double[s_rows * cols];
 }
 
-void portcullis::ml::Smote::execute() {
-	auto_cpu_timer timer(1, "ICOTE Time taken: %ws\n\n");
-	if (verbose) {
-		cout << "Starting Immume Centroids Oversampling Technique (ICOTE)" << endl;
-	}
-	// Attribute selection
-	// To reduce computational cost remove constant attributes
-	if (verbose) cout << "Selecting non-constant features" << endl;
-	vector<bool> is_const(cols);
-	vector<double> const_val(cols);
-	uint16_t nb_const_col = 0;
-	for (size_t k = 0; k < cols; k++) {
-		is_const[k] = this->isConstant(k);
-		if (is_const[k]) {
-			nb_const_col++;
-			const_val[k] = data[k];
-		}
-	}
-	uint16_t sel_col = cols - nb_const_col;
-	if (verbose) cout << "Ignoring " << const_col << " columns as values are constant across all samples" << endl;
-	double* ag = new double[rows * sel_col];
-	for (size_t i = 0; i < rows; i++) {
-		size_t new_col = 0;
-		for (size_t j = 0; j < cols; j++) {
-			if (!is_const[j]) {
-				ag[(i * sel_col) + new_col++] = data[(i * cols) + j];
-			}
-		}
-	}
-	if (verbose) cout << "Created non-constant feature matrix" << endl;
-	// Normalisation
-	if (verbose) cout << "Normalising feature matrix" << endl;
-	vector<double> min_col(sel_col);
-	vector<double> max_col(sel_col);
-	for (size_t j = 0; j < sel_col; j++) {
+void portcullis::ml::Icote::normalise() {
+	// Attribute selection: to reduce computational cost remove constant attributes
+	sel.clear();
+	min_col.assign(cols, 0.0);
+	range_col.assign(cols, 0.0);
+	for (size_t j = 0; j < cols; j++) {
 		double min_v = std::numeric_limits<double>::max();
-		double max_v = std::numeric_limits<double>::min();
+		double max_v = std::numeric_limits<double>::lowest();
 		for (size_t i = 0; i < rows; i++) {
-			double x = ag[(i * sel_col) + j];
+			const double x = data[(i * cols) + j];
 			min_v = std::min(min_v, x);
 			max_v = std::max(max_v, x);
 		}
 		min_col[j] = min_v;
-		max_col[j] = max_v;
+		range_col[j] = max_v - min_v;
+		if (max_v > min_v) {
+			sel.push_back(j);
+		}
 	}
-	for (size_t j = 0; j < sel_col; j++) {
-		double min_x = min_col[j];
-		double max_x = max_col[j];
+	if (verbose) cout << "Ignoring " << (cols - sel.size()) << " columns as values are constant across all samples" << endl;
+	// Normalise into [0,1], stored column major so that the distance kernel
+	// walks contiguous antigens for each feature
+	const size_t sc = sel.size();
+	antigens.resize(sc * rows);
+	for (size_t c = 0; c < sc; c++) {
+		const size_t j = sel[c];
 		for (size_t i = 0; i < rows; i++) {
-			double x = ag[(i * sel_col) + j];
-			ag[(i * sel_col) + j] = (x - min_x) / (max_x - min_x);
+			antigens[(c * rows) + i] = (data[(i * cols) + j] - min_col[j]) / range_col[j];
 		}
 	}
-	if (verbose) cout << "Normalised feature matrix" << endl;
-	if (verbose) cout << "Generating Random Antibodies" << endl;
-	vector<double> ab(k * sel_col);
-	std::mt19937 rng(12345);
+}
+
+void portcullis::ml::Icote::initAntibodies() {
+	const size_t sc = sel.size();
+	antibodies.resize(s_rows * sc);
+	const size_t nbBlocks = (s_rows + ICOTE_BLOCK_SIZE - 1) / ICOTE_BLOCK_SIZE;
 	std::uniform_real_distribution<double> dgen(0.0, 1.0);
-	for (size_t i = 0; i < k; i++) {
-		for (size_t j = 0; j < sel_col; j++) {
-			ab[(i * sel_col) + j] = dgen(rng);
+	for (size_t b = 0; b < nbBlocks; b++) {
+		std::seed_seq ss{seed, (uint32_t)0, (uint32_t)b};
+		std::mt19937 rng(ss);
+		const size_t end = std::min(s_rows, (b + 1) * ICOTE_BLOCK_SIZE);
+		for (size_t i = b * ICOTE_BLOCK_SIZE; i < end; i++) {
+			for (size_t c = 0; c < sc; c++) {
+				antibodies[(i * sc) + c] = dgen(rng);
+			}
 		}
 	}
-	if (verbose) cout << "Random Antibodies generated" << endl;
-	uint16_t N = 0;
-	while (N < 10) {
-		vector<double> M(duplications * rows * sel_col);
-		for (size_t i = 0; i < rows; i++) {
-			vector<double> dist(rows * duplications * sel_col);
-			for (size_t j = 0; j < duplications; j++) {
-				double s = 0.0;
-				for (size_t c = 0; c < sel_cols; c++) {
-					s += std::pow(ag[i * sel_cols + c] - ab[i * sel_cols + c], 2.0);
+}
+
+void portcullis::ml::Icote::matureBlock(size_t block, uint16_t generation, vector<double>& dbuf, vector<double>& cbuf) {
+	const size_t sc = sel.size();
+	const size_t a0 = block * ICOTE_BLOCK_SIZE;
+	const size_t a1 = std::min(s_rows, a0 + ICOTE_BLOCK_SIZE);
+	const size_t nb = a1 - a0;
+	double best_d[ICOTE_BLOCK_SIZE];
+	size_t best_i[ICOTE_BLOCK_SIZE];
+	std::fill(best_d, best_d + nb, std::numeric_limits<double>::max());
+	std::fill(best_i, best_i + nb, 0);
+	// Find closest antigen for each antibody in the block.  Antigens are
+	// processed a chunk at a time so the chunk stays in cache for the whole
+	// block, the inner loop runs over contiguous antigens so it vectorises.
+	for (size_t j0 = 0; j0 < rows; j0 += ICOTE_CHUNK_SIZE) {
+		const size_t nj = std::min(ICOTE_CHUNK_SIZE, rows - j0);
+		for (size_t a = 0; a < nb; a++) {
+			const double* x = &antibodies[(a0 + a) * sc];
+			double* d = dbuf.data();
+			std::fill(d, d + nj, 0.0);
+			for (size_t c = 0; c < sc; c++) {
+				const double xc = x[c];
+				const double* col = &antigens[(c * rows) + j0];
+				for (size_t j = 0; j < nj; j++) {
+					const double diff = col[j] - xc;
+					d[j] += diff * diff;
+				}
+			}
+			for (size_t j = 0; j < nj; j++) {
+				if (d[j] < best_d[a]) {
+					best_d[a] = d[j];
+					best_i[a] = j0 + j;
 				}
-				dist[(i * sel_cols) + j] = std::sqrt(s);
 			}
-			// Clone K antibodies in proportion to antigen-antibody affinity
 		}
-		if (verbose) cout << "Mutating antibodies" << endl;
-		double s = 0.0;
-		for (size_t j = 0; j < sel_cols; j++) {
-			s += std::pow(antibodies[i * sel_cols + j] - attr_sel[i * sel_cols + j], 2.0);
+	}
+	// Clone and mutate.  Each block has its own generator seeded from the
+	// global seed, the generation and the block index.
+	std::seed_seq ss{seed, (uint32_t)generation, (uint32_t)block};
+	std::mt19937 rng(ss);
+	std::normal_distribution<double> ngen(0.0, 1.0);
+	const double maxDist = (double)sc;
+	for (size_t a = 0; a < nb; a++) {
+		double* x = &antibodies[(a0 + a) * sc];
+		const size_t ag = best_i[a];
+		// Affinity in [0,1], 1 meaning the antibody sits on the antigen
+		const double affinity = 1.0 - std::sqrt(best_d[a] / maxDist);
+		const uint16_t clones = 1 + (uint16_t)(affinity * ICOTE_MAX_CLONES);
+		const double sigma = ICOTE_MUTATION_RATE * (1.0 - affinity);
+		double bestCloneDist = std::numeric_limits<double>::max();
+		double* best = &cbuf[sc];
+		for (uint16_t n = 0; n < clones; n++) {
+			double* clone = cbuf.data();
+			double s = 0.0;
+			for (size_t c = 0; c < sc; c++) {
+				const double target = antigens[(c * rows) + ag];
+				double v = x[c] + ICOTE_MATURATION_RATE * (target - x[c]) + sigma * ngen(rng);
+				v = std::min(1.0, std::max(0.0, v));
+				clone[c] = v;
+				const double diff = target - v;
+				s += diff * diff;
+			}
+			if (s < bestCloneDist) {
+				bestCloneDist = s;
+				std::copy(clone, clone + sc, best);
+			}
 		}
-		double ak = (1.0 / sel_cols) * std::sqrt(ak);
+		std::copy(best, best + sc, x);
 	}
-	if (verbose) cout << "Antibodies mutated" << endl;
 }
 
+void portcullis::ml::Icote::matureSlice(uint16_t slice, uint16_t generation) {
+	const size_t sc = sel.size();
+	// Buffers are allocated once per slice and reused for every block
+	vector<double> dbuf(ICOTE_CHUNK_SIZE);
+	vector<double> cbuf(sc * 2);
+	const size_t nbBlocks = (s_rows + ICOTE_BLOCK_SIZE - 1) / ICOTE_BLOCK_SIZE;
+	for (size_t b = slice; b < nbBlocks; b += threads) {
+		matureBlock(b, generation, dbuf, cbuf);
+	}
+}
 
+void portcullis::ml::Icote::execute() {
+	auto_cpu_timer timer(1, "ICOTE Time taken: %ws\n\n");
+	StageTimer stage("icote");
+	if (verbose) {
+		cout << "Starting Immune Centroids Oversampling Technique (ICOTE)" << endl;
+	}
+	if (rows == 0) {
+		return;
+	}
+	normalise();
+	if (verbose) cout << "Generating " << s_rows << " random antibodies" << endl;
+	initAntibodies();
+	if (!sel.empty()) {
+		for (uint16_t g = 1; g <= iterations; g++) {
+			if (verbose) cout << "Maturing antibodies: generation " << g << " of " << iterations << endl;
+			vector<thread> t(threads);
+			for (uint16_t i = 0; i < threads; i++) {
+				t[i] = thread(&Icote::matureSlice, this, i, g);
+			}
+			for (uint16_t i = 0; i < threads; i++) {
+				t[i].join();
+			}
+		}
+	}
+	// Map antibodies back to the original feature space
+	const size_t sc = sel.size();
+	for (size_t i = 0; i < s_rows; i++) {
+		double* r = &synthetic[i * cols];
+		for (size_t j = 0; j < cols; j++) {
+			r[j] = min_col[j];
+		}
+		for (size_t c = 0; c < sc; c++) {
+			const size_t j = sel[c];
+			r[j] = min_col[j] + antibodies[(i * sc) + c] * range_col[j];
+		}
+	}
+	// Release working memory
+	vector<double>().swap(antigens);
+	vector<double>().swap(antibodies);
 }
 
-void portcullis::ml::Smote::print(ostream& out) const {
+void portcullis::ml::Icote::print(ostream& out) const {
 	out << "Input:" << endl;
 	for (size_t i = 0; i < rows; i++) {
 		for (size_t j = 0; j < cols; j++) {
@@ -145,4 +227,4 @@ void portcullis::ml::Smote::print(ostream& out) const {
 		out << endl;
 	}
 	out << endl;
-}
\ No newline at end of file
+}
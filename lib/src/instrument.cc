@@ -0,0 +1,201 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+using std::endl;
+using std::lock_guard;
+using std::make_shared;
+using std::mutex;
+using std::ofstream;
+using std::ostream;
+using std::unordered_map;
+
+#include <boost/exception/all.hpp>
+
+#include <portcullis/run_report.hpp>
+using portcullis::RunReportException;
+using portcullis::RunReportErrorInfo;
+
+#include <portcullis/instrument.hpp>
+
+namespace {
+
+struct ThreadData {
+	uint32_t tid;
+	string name;
+	vector<portcullis::ProbeStats> probes;
+	vector<portcullis::TraceEvent> events;
+};
+
+// Everything below is guarded by registryMutex, except the contents of each
+// ThreadData which are only touched by their own thread while recording
+mutex registryMutex;
+vector<string> probeNames;
+unordered_map<string, size_t> probeIds;
+vector<shared_ptr<ThreadData>> threads;
+
+// Registry keeps the data alive after the thread exits
+thread_local shared_ptr<ThreadData> local;
+
+ThreadData& threadData() {
+	if (!local) {
+		lock_guard<mutex> lock(registryMutex);
+		local = make_shared<ThreadData>();
+		local->tid = threads.size();
+		local->name = "thread " + std::to_string(threads.size());
+		threads.push_back(local);
+	}
+	return *local;
+}
+
+string escape(const string& s) {
+	string e;
+	for (char c : s) {
+		if (c == '"' || c == '\\') {
+			e += '\\';
+		}
+		e += ((unsigned char)c < 0x20) ? ' ' : c;
+	}
+	return e;
+}
+}
+
+const std::chrono::steady_clock::time_point portcullis::Instrument::epoch = std::chrono::steady_clock::now();
+
+void portcullis::ProbeStats::add(uint64_t ns) {
+	count++;
+	totalNs += ns;
+	maxNs = std::max(maxNs, ns);
+	size_t bucket = 0;
+	while (ns > 1 && bucket < NB_BUCKETS - 1) {
+		ns >>= 1;
+		bucket++;
+	}
+	histogram[bucket]++;
+}
+
+size_t portcullis::Instrument::registerProbe(const string& name) {
+	lock_guard<mutex> lock(registryMutex);
+	auto it = probeIds.find(name);
+	if (it != probeIds.end()) {
+		return it->second;
+	}
+	size_t id = probeNames.size();
+	probeNames.push_back(name);
+	probeIds[name] = id;
+	return id;
+}
+
+void portcullis::Instrument::record(size_t probe, uint64_t ns) {
+	ThreadData& td = threadData();
+	if (probe >= td.probes.size()) {
+		td.probes.resize(probe + 1);
+	}
+	td.probes[probe].add(ns);
+}
+
+void portcullis::Instrument::trace(const string& name, const string& category, uint64_t start, uint64_t end) {
+	threadData().events.push_back(TraceEvent{name, category, start, end - start});
+}
+
+void portcullis::Instrument::setThreadName(const string& name) {
+	threadData().name = name;
+}
+
+void portcullis::Instrument::reset() {
+	lock_guard<mutex> lock(registryMutex);
+	for (auto& t : threads) {
+		t->probes.clear();
+		t->events.clear();
+	}
+}
+
+void portcullis::Instrument::writeProbes(ostream& out) {
+	lock_guard<mutex> lock(registryMutex);
+	out << "{" << endl
+		<< "  \"histogram\": \"bucket i counts calls taking between 2^i and 2^(i+1) ns\"," << endl
+		<< "  \"threads\": [";
+	bool firstThread = true;
+	for (const auto& t : threads) {
+		if (t->probes.empty()) {
+			continue;
+		}
+		out << (firstThread ? "" : ",") << endl
+			<< "    {\"tid\": " << t->tid << ", \"name\": \"" << escape(t->name) << "\", \"probes\": {";
+		firstThread = false;
+		bool firstProbe = true;
+		for (size_t i = 0; i < t->probes.size(); i++) {
+			const ProbeStats& p = t->probes[i];
+			if (p.count == 0) {
+				continue;
+			}
+			size_t last = ProbeStats::NB_BUCKETS;
+			while (last > 0 && p.histogram[last - 1] == 0) {
+				last--;
+			}
+			out << (firstProbe ? "" : ",") << endl
+				<< "      \"" << escape(probeNames[i]) << "\": {\"count\": " << p.count
+				<< ", \"total_ns\": " << p.totalNs
+				<< ", \"mean_ns\": " << p.totalNs / p.count
+				<< ", \"max_ns\": " << p.maxNs
+				<< ", \"histogram\": [";
+			for (size_t b = 0; b < last; b++) {
+				out << (b == 0 ? "" : ", ") << p.histogram[b];
+			}
+			out << "]}";
+			firstProbe = false;
+		}
+		out << endl << "    }}";
+	}
+	out << endl << "  ]" << endl << "}" << endl;
+}
+
+void portcullis::Instrument::writeTrace(ostream& out) {
+	lock_guard<mutex> lock(registryMutex);
+	out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+	bool first = true;
+	out << std::fixed << std::setprecision(3);
+	for (const auto& t : threads) {
+		out << (first ? "" : ",") << endl
+			<< "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << t->tid
+			<< ", \"args\": {\"name\": \"" << escape(t->name) << "\"}}";
+		first = false;
+		for (const auto& e : t->events) {
+			// Trace event timestamps are in microseconds
+			out << "," << endl
+				<< "{\"name\": \"" << escape(e.name) << "\", \"cat\": \"" << escape(e.category)
+				<< "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << t->tid
+				<< ", \"ts\": " << e.start / 1000.0 << ", \"dur\": " << e.duration / 1000.0 << "}";
+		}
+	}
+	out << endl << "]}" << endl;
+}
+
+void portcullis::Instrument::save(const string& prefix) {
+	ofstream probes(prefix + ".probes.json");
+	ofstream trace(prefix + ".trace.json");
+	if (!probes.is_open() || !trace.is_open()) {
+		BOOST_THROW_EXCEPTION(RunReportException() << RunReportErrorInfo(string(
+								  "Could not open instrumentation output files with prefix: ") + prefix));
+	}
+	writeProbes(probes);
+	writeTrace(trace);
+}
@@ -45,8 +45,22 @@ using portcullis::bam::CigarOp;
 using portcullis::bam::GenomeMapper;
 using portcullis::bam::Strand;
 
+#include <portcullis/instrument.hpp>
 #include <portcullis/junction.hpp>
 
+namespace {
+
+// SplitMix64 finaliser.  A cheap, well mixed hash used to draw the reservoir
+// sample of alignments kept by each junction.
+uint64_t sampleHash(uint64_t x) {
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+}
+
 const vector<string> portcullis::Junction::METRIC_NAMES({
 	"canonical_ss",
 	"score",
@@ -144,7 +158,8 @@ const vector<string> portcullis::Junction::STRAND_NAMES = {
 	"consensus-strand"
 };
 
-void portcullis::AlignmentInfo::calcMatchStats(const Intron& i, const uint32_t leftStart, const uint32_t rightEnd, const string& ancLeft, const string& ancRight) {
+void portcullis::AlignmentInfo::calcMatchStats(const Intron& i, const uint32_t leftStart, const uint32_t rightEnd, const string& ancLeft, const string& ancRight, const bool windowed) {
+    PORTCULLIS_PROBE("AlignmentInfo::calcMatchStats");
 
     if (leftStart > std::numeric_limits<int32_t>::max()) {
         BOOST_THROW_EXCEPTION(JunctionException() << JunctionErrorInfo(string(
@@ -184,10 +199,10 @@ void portcullis::AlignmentInfo::calcMatchStats(const Intron& i, const uint32_t l
 
     }
     else {
-        string qAnchorLeft = ba->getPaddedQuerySeq(query, leftStart, leftEnd, qLeftStart, qLeftEnd, false);
-        string qAnchorRight = ba->getPaddedQuerySeq(query, rightStart, rightEnd, qRightStart, qRightEnd, false);
-        string gAnchorLeft = ba->getPaddedGenomeSeq(ancLeft, leftStart, leftEnd, qLeftStart, qLeftEnd, false);
-        string gAnchorRight = ba->getPaddedGenomeSeq(ancRight, rightStart, rightEnd, qRightStart, qRightEnd, false);
+        string qAnchorLeft = ba->getPaddedQuerySeq(query, leftStart, leftEnd, qLeftStart, qLeftEnd, false, windowed);
+        string qAnchorRight = ba->getPaddedQuerySeq(query, rightStart, rightEnd, qRightStart, qRightEnd, false, windowed);
+        string gAnchorLeft = ba->getPaddedGenomeSeq(ancLeft, leftStart, leftEnd, qLeftStart, qLeftEnd, false, windowed);
+        string gAnchorRight = ba->getPaddedGenomeSeq(ancRight, rightStart, rightEnd, qRightStart, qRightEnd, false, windowed);
         bool error = false;
         if (qAnchorLeft.size() != gAnchorLeft.size() || qAnchorLeft.empty()) {
             error = true;
@@ -382,6 +397,9 @@ portcullis::Junction::Junction(shared_ptr<Intron> _location, int32_t _leftAncSta
 	}
 	alignments.clear();
 	alignmentCodes.clear();
+	alignmentStarts.clear();
+	lastAlStart = -1;
+	lastAlEnd = -1;
 	trimmedCoverage.clear();
 	trimmedLogDevCov.clear();
 }
@@ -438,11 +456,15 @@ portcullis::Junction::Junction(const Junction& j, bool withAlignments) {
 	nbUpstreamFlankingAlignments = j.nbUpstreamFlankingAlignments;
 	nbDownstreamFlankingAlignments = j.nbDownstreamFlankingAlignments;
 	nbSamples = j.nbSamples;
+	lastAlStart = j.lastAlStart;
+	lastAlEnd = j.lastAlEnd;
+	barcodeCounts = j.barcodeCounts;
 	if (withAlignments) {
 		for (size_t i = 0; i < j.alignments.size(); i++) {
 			this->alignments.push_back(make_shared<AlignmentInfo>(j.alignments[i]->ba));
-			this->alignmentCodes.push_back(j.alignments[i]->nameCode);
 		}
+		this->alignmentCodes = j.alignmentCodes;
+		this->alignmentStarts = j.alignmentStarts;
 	}
 	trimmedCoverage.clear();
 	for (auto & x : j.trimmedCoverage) {
@@ -472,14 +494,42 @@ portcullis::Junction::~Junction() {
 
 void portcullis::Junction::clearAlignments() {
 	alignments.clear();
+	vector<int32_t>().swap(alignmentStarts);
 }
 
-void portcullis::Junction::addJunctionAlignment(const BamAlignment& al) {
-	// Make sure we take a proper copy of this alignment for safe storage
-	AlignmentInfoPtr aip = make_shared<AlignmentInfo>(make_shared<BamAlignment>(al));
-	this->alignments.push_back(aip);
-	this->alignmentCodes.push_back(aip->nameCode);
-	this->nbAlRaw = this->alignments.size();
+void portcullis::Junction::addJunctionAlignment(const BamAlignment& al, BamAlignmentPtr& record, const uint32_t maxAlignments) {
+	this->nbAlRaw++;
+	// Alignments arrive in coordinate order so distinct alignments can be
+	// counted as they come in
+	const int32_t start = al.getStart();
+	const int32_t end = al.getEnd();
+	if (start != lastAlStart || end != lastAlEnd) {
+		this->nbAlDistinct++;
+		lastAlStart = start;
+		lastAlEnd = end;
+	}
+	this->alignmentStarts.push_back(start);
+	if (maxAlignments == 0 || this->alignments.size() < maxAlignments) {
+		// Make sure we take a proper copy of this alignment for safe storage.  The
+		// copy is shared with any other junctions this alignment supports
+		if (!record) record = make_shared<BamAlignment>(al);
+		AlignmentInfoPtr aip = make_shared<AlignmentInfo>(record);
+		this->alignments.push_back(aip);
+		this->alignmentCodes.push_back(aip->nameCode);
+	}
+	else {
+		this->alignmentCodes.push_back(std::hash<std::string>()(al.deriveName()));
+		// Reservoir sampling (algorithm R): keep this alignment with probability
+		// maxAlignments / nbAlRaw, replacing a retained one at random.  The random
+		// number is derived from the junction location and alignment count so the
+		// sample does not depend on threading or region splitting.
+		const uint64_t r = sampleHash(((uint64_t) intron->ref.index << 48) ^ ((uint64_t) intron->start << 24) ^
+									  (uint64_t) intron->end ^ ((uint64_t) this->nbAlRaw << 32)) % this->nbAlRaw;
+		if (r < maxAlignments) {
+			if (!record) record = make_shared<BamAlignment>(al);
+			this->alignments[r] = make_shared<AlignmentInfo>(record);
+		}
+	}
 	if (al.isFirstMate()) {
 		if (!al.isReverseStrand()) {
 			this->nbAlR1Pos++;
@@ -558,7 +608,7 @@ void portcullis::Junction::determineStrandFromReads() {
 	}
 }
 
-void portcullis::Junction::processJunctionWindow(const GenomeMapper& genomeMapper) {
+void portcullis::Junction::processJunctionWindow(const GenomeMapper& genomeMapper, const uint32_t anchorWindow) {
 	if (intron == nullptr)
 		BOOST_THROW_EXCEPTION(JunctionException() << JunctionErrorInfo(string(
 								  "Can't find genomic sequence for this junction as no intron is defined")));
@@ -586,9 +636,12 @@ void portcullis::Junction::processJunctionWindow(const GenomeMapper& genomeMappe
 	boost::to_upper(donor); // Removes any lowercase bases representing repeats
 	boost::to_upper(acceptor); // Removes any lowercase bases representing repeats
 	this->setDonorAndAcceptorMotif(donor, acceptor);
-	// Just access the whole junction region
-	string leftAnc = genomeMapper.fetchBases(intron->ref.name.c_str(), leftAncStart, intron->start - 1);
-	string rightAnc = genomeMapper.fetchBases(intron->ref.name.c_str(), intron->end + 1, rightAncEnd);
+	// Just access the whole junction region, or the part of it within the
+	// anchor window if one is set
+	const int32_t windowStart = anchorWindow > 0 ? std::max(leftAncStart, intron->start - (int32_t)anchorWindow) : leftAncStart;
+	const int32_t windowEnd = anchorWindow > 0 ? std::min(rightAncEnd, intron->end + (int32_t)anchorWindow) : rightAncEnd;
+	string leftAnc = genomeMapper.fetchBases(intron->ref.name.c_str(), windowStart, intron->start - 1);
+	string rightAnc = genomeMapper.fetchBases(intron->ref.name.c_str(), intron->end + 1, windowEnd);
 	string leftInt = genomeMapper.fetchBases(intron->ref.name.c_str(), intron->start, intron->start + 9);
 	string rightInt = genomeMapper.fetchBases(intron->ref.name.c_str(), intron->end - 9, intron->end);
 	int leftAncLen = leftAnc.length();
@@ -607,14 +660,14 @@ void portcullis::Junction::processJunctionWindow(const GenomeMapper& genomeMappe
 	if (rightIntLen == -1)
 		BOOST_THROW_EXCEPTION(JunctionException() << JunctionErrorInfo(string(
 								  "Can't find right intron region for junction: ") + this->intron->toString()));
-	int expLeftLen = intron->start - leftAncStart;
+	int expLeftLen = intron->start - windowStart;
 	if (leftAncLen != expLeftLen && expLeftLen > 0)
 		BOOST_THROW_EXCEPTION(JunctionException() << JunctionErrorInfo(string(
 								  "Retrieved sequence for left anchor of junction ") + this->intron->toString() + " is not the expected length" +
 							  "\nRetrieved sequence Length: " + lexical_cast<string>(leftAncLen) +
 							  "\nExpected sequence length: " + lexical_cast<string>(expLeftLen) +
 							  "\nRetrieved sequence: " + leftAnc));
-	int expRightLen = rightAncEnd - intron->end;
+	int expRightLen = windowEnd - intron->end;
 	if (rightAncLen != expRightLen && expRightLen > 0)
 		BOOST_THROW_EXCEPTION(JunctionException() << JunctionErrorInfo(string(
 								  "Retrieved sequence for right anchor of junction ") + this->intron->toString() + " is not the expected length" +
@@ -641,7 +694,7 @@ void portcullis::Junction::processJunctionWindow(const GenomeMapper& genomeMappe
 	this->calcHammingScores(leftAnchor10, leftInt, rightInt, rightAnchor10);
 	// Update match statistics for each alignment
 	for (const auto & a : alignments) {
-		a->calcMatchStats(*getIntron(), this->getLeftAncStart(), this->getRightAncEnd(), leftAnc, rightAnc);
+		a->calcMatchStats(*getIntron(), windowStart, windowEnd, leftAnc, rightAnc, anchorWindow > 0);
 		// a->calcAJadVector(*getIntron(), this->getLeftAncStart(), this->getRightAncEnd(), leftAnc, rightAnc);
 	}
 	// MaxMMES can now use info in alignments
@@ -686,6 +739,19 @@ void portcullis::Junction::calcMetrics(Orientation orientation) {
 	calcAlignmentStats(orientation);
 }
 
+template<Orientation O>
+void portcullis::Junction::calcMetrics() {
+	determineStrandFromReads();
+	calcEntropy();
+	calcAlignmentStats<O>();
+}
+
+template void portcullis::Junction::calcMetrics<Orientation::SE>();
+template void portcullis::Junction::calcMetrics<Orientation::FR>();
+template void portcullis::Junction::calcMetrics<Orientation::RF>();
+template void portcullis::Junction::calcMetrics<Orientation::FF>();
+template void portcullis::Junction::calcMetrics<Orientation::UNKNOWN>();
+
 /**
  * Shannon Entropy (definition from "Graveley et al, The developmental
  * transcriptome of Drosophila melanogaster, Nature, 2011")
@@ -716,10 +782,7 @@ void portcullis::Junction::calcMetrics(Orientation orientation) {
  * @return The entropy of this junction
  */
 double portcullis::Junction::calcEntropy() {
-	vector<int32_t> junctionPositions;
-	for (const auto & a : alignments) {
-		junctionPositions.push_back(a->ba->getStart());
-	}
+	vector<int32_t> junctionPositions = alignmentStarts;
 	// Should already be sorted but let's be sure.  This is critical to the rest
 	// of the algorithm.  It's possible after soft clips are removed that the reads
 	// are not strictly in the correct order.
@@ -753,22 +816,35 @@ double portcullis::Junction::calcEntropy(const vector<int32_t> junctionPositions
  * @return
  */
 void portcullis::Junction::calcAlignmentStats(Orientation orientation) {
-	int32_t lastStart = -1, lastEnd = -1;
-	nbAlDistinct = 0;
+	switch (orientation) {
+	case Orientation::SE:
+		calcAlignmentStats<Orientation::SE>();
+		break;
+	case Orientation::FR:
+		calcAlignmentStats<Orientation::FR>();
+		break;
+	case Orientation::RF:
+		calcAlignmentStats<Orientation::RF>();
+		break;
+	case Orientation::FF:
+		calcAlignmentStats<Orientation::FF>();
+		break;
+	default:
+		calcAlignmentStats<Orientation::UNKNOWN>();
+		break;
+	}
+}
+
+template<Orientation O>
+void portcullis::Junction::calcAlignmentStats() {
 	nbAlReliable = 0;
 	nbUpstreamJunctions = 0;
 	nbDownstreamJunctions = 0;
-	const bool properPairedCheck = doProperPairCheck(orientation);
+	const bool properPairedCheck = doProperPairCheck(O);
 	//cout << junctionAlignments.size() << endl;
 	for (const auto & a : alignments) {
 		BamAlignmentPtr ba = a->ba;
 		const int32_t start = ba->getStart();
-		const int32_t end = ba->getEnd();
-		if (start != lastStart || end != lastEnd) {
-			nbAlDistinct++;
-			lastStart = start;
-			lastEnd = end;
-		}
 		bool reliable = true;
 		if (ba->getMapQuality() >= MAP_QUALITY_THRESHOLD) {
 			nbAlUniquelyMapped++;
@@ -781,7 +857,7 @@ void portcullis::Junction::calcAlignmentStats(Orientation orientation) {
 			nbAlBamProperlyPaired++;
 		}
 		if (properPairedCheck) {
-			bool pp = ba->calcIfProperPair(orientation);
+			bool pp = ba->calcIfProperPair<O>();
 			if (pp) {
 				nbAlPortcullisProperlyPaired++;
 			}
@@ -811,8 +887,22 @@ void portcullis::Junction::calcAlignmentStats(Orientation orientation) {
 		nbUpstreamJunctions = max(nbUpstreamJunctions, upjuncs);
 		nbDownstreamJunctions = max(nbDownstreamJunctions, downjuncs);
 	}
+	// Scale counts from a sample up to all the alignments
+	if (isSampled()) {
+		const double scale = (double) nbAlRaw / (double) alignments.size();
+		nbAlUniquelyMapped = (uint32_t) std::lround(nbAlUniquelyMapped * scale);
+		nbAlBamProperlyPaired = (uint32_t) std::lround(nbAlBamProperlyPaired * scale);
+		nbAlPortcullisProperlyPaired = (uint32_t) std::lround(nbAlPortcullisProperlyPaired * scale);
+		nbAlReliable = (uint32_t) std::lround(nbAlReliable * scale);
+	}
 }
 
+template void portcullis::Junction::calcAlignmentStats<Orientation::SE>();
+template void portcullis::Junction::calcAlignmentStats<Orientation::FR>();
+template void portcullis::Junction::calcAlignmentStats<Orientation::RF>();
+template void portcullis::Junction::calcAlignmentStats<Orientation::FF>();
+template void portcullis::Junction::calcAlignmentStats<Orientation::UNKNOWN>();
+
 /**
  * Metric 13 and 14: Calculates the 5' and 3' hamming distances from a genomic
  * region represented by this junction
@@ -891,6 +981,13 @@ void portcullis::Junction::calcMismatchStats() {
 	}
 
 	meanMismatches = (double) nbMismatches / (double) alignments.size();
+	// Junction anchor depth is a count of alignments so scale it up from a sample
+	if (isSampled()) {
+		const double scale = (double) nbAlRaw / (double) alignments.size();
+		for (auto & jad : junctionAnchorDepth) {
+			jad = (uint32_t) std::lround(jad * scale);
+		}
+	}
 	// Assuming we have some mismatches determine if this junction has no overhangs
 	// extending beyond first mismatch.  If so determine if that distance is small
 	// enough to consider the junction as suspicious
@@ -951,10 +1048,14 @@ double portcullis::Junction::calcCoverage(const vector<uint32_t>& coverageLevels
 }
 
 double portcullis::Junction::calcIntronScore(const uint32_t threshold) {
-	this->setIntronScore((uint32_t)this->intron->size() <= threshold ? 0.0 : log(this->intron->size() - threshold));
+	this->setIntronScore(computeIntronScore(threshold));
 	return this->intronScore;
 }
 
+double portcullis::Junction::computeIntronScore(const uint32_t threshold) const {
+	return (uint32_t)this->intron->size() <= threshold ? 0.0 : log(this->intron->size() - threshold);
+}
+
 double portcullis::Junction::getValueFromName(const string& name) const {
 	double val = 0.0;
 	JuncUint32FuncMap::const_iterator uif = JunctionUint32FunctionMap.find(name);
@@ -1326,6 +1427,11 @@ shared_ptr<portcullis::Junction> portcullis::Junction::parse(const string& line)
 }
 
 double portcullis::Junction::calcCodingPotential(GenomeMapper& gmap, KmerMarkovModel& exon, KmerMarkovModel& intron) {
+	this->codingPotential = computeCodingPotential(gmap, exon, intron);
+	return this->codingPotential;
+}
+
+double portcullis::Junction::computeCodingPotential(GenomeMapper& gmap, KmerMarkovModel& exon, KmerMarkovModel& intron) const {
 	const char* ref = this->intron->ref.name.c_str();
 	const bool neg = getConsensusStrand() == Strand::NEGATIVE;
 	string left_exon = gmap.fetchBases(ref, this->intron->start - 82, this->intron->start - 2);
@@ -1350,16 +1456,24 @@ double portcullis::Junction::calcCodingPotential(GenomeMapper& gmap, KmerMarkovM
 	cout << "Right intron: " << this->consensusStrand << " : " << right_intron << endl;
 	cout << "Right exon  : " << this->consensusStrand << " : " << right_exon << endl;
 	 */
-	this->codingPotential = (exon.getScore(left_exon) - intron.getScore(left_exon))
-							+ (intron.getScore(left_intron) - exon.getScore(left_intron))
-							+ (intron.getScore(right_intron) - exon.getScore(right_intron))
-							+ (exon.getScore(right_exon) - intron.getScore(right_exon));
-	return this->codingPotential;
+	return (exon.getScore(left_exon) - intron.getScore(left_exon))
+		   + (intron.getScore(left_intron) - exon.getScore(left_intron))
+		   + (intron.getScore(right_intron) - exon.getScore(right_intron))
+		   + (exon.getScore(right_exon) - intron.getScore(right_exon));
 }
 
 portcullis::SplicingScores portcullis::Junction::calcSplicingScores(GenomeMapper& gmap, KmerMarkovModel& donorT, KmerMarkovModel& donorF,
 		KmerMarkovModel& acceptorT, KmerMarkovModel& acceptorF,
 		PosMarkovModel& donorP, PosMarkovModel& acceptorP) {
+	SplicingScores ss = computeSplicingScores(gmap, donorT, donorF, acceptorT, acceptorF, donorP, acceptorP);
+	this->setPositionWeightScore(ss.positionWeighting);
+	this->setSplicingSignal(ss.splicingSignal);
+	return ss;
+}
+
+portcullis::SplicingScores portcullis::Junction::computeSplicingScores(GenomeMapper& gmap, KmerMarkovModel& donorT, KmerMarkovModel& donorF,
+		KmerMarkovModel& acceptorT, KmerMarkovModel& acceptorF,
+		PosMarkovModel& donorP, PosMarkovModel& acceptorP) const {
 	const char* ref = this->intron->ref.name.c_str();
 	const bool neg = getConsensusStrand() == Strand::NEGATIVE;
 	string left = gmap.fetchBases(ref, intron->start - 3, intron->start + 20);
@@ -1376,8 +1490,6 @@ portcullis::SplicingScores portcullis::Junction::calcSplicingScores(GenomeMapper
 	ss.positionWeighting = donorP.getScore(donorseq) + acceptorP.getScore(acceptorseq);
 	ss.splicingSignal = (donorT.getScore(donorseq) - donorF.getScore(donorseq))
 						+ (acceptorT.getScore(acceptorseq) - acceptorF.getScore(acceptorseq));
-	this->setPositionWeightScore(ss.positionWeighting);
-	this->setSplicingSignal(ss.splicingSignal);
 	return ss;
 }
 
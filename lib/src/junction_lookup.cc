@@ -0,0 +1,86 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <algorithm>
+#include <vector>
+using std::sort;
+using std::unique;
+using std::vector;
+
+#include <htslib/sam.h>
+
+#include <portcullis/intron.hpp>
+#include <portcullis/junction.hpp>
+using portcullis::Intron;
+using portcullis::JunctionList;
+
+#include <portcullis/junction_lookup.hpp>
+
+portcullis::JunctionLookup::JunctionLookup(const JunctionList& junctions) {
+	vector<vector<uint64_t>> sorted;
+	for (const auto& j : junctions) {
+		shared_ptr<Intron> i = j->getIntron();
+		if (i->ref.index < 0) {
+			continue;
+		}
+		if ((size_t)i->ref.index >= sorted.size()) {
+			sorted.resize(i->ref.index + 1);
+			refLengths.resize(i->ref.index + 1, 0);
+		}
+		sorted[i->ref.index].push_back(pack(i->start, i->end));
+		refLengths[i->ref.index] = i->ref.length;
+	}
+	nbIntrons = 0;
+	keys.resize(sorted.size());
+	for (size_t r = 0; r < sorted.size(); r++) {
+		vector<uint64_t>& s = sorted[r];
+		sort(s.begin(), s.end());
+		s.erase(unique(s.begin(), s.end()), s.end());
+		if (s.empty()) {
+			continue;
+		}
+		keys[r].resize(s.size() + 1);
+		size_t i = 0;
+		layout(s, keys[r], i, 1);
+		nbIntrons += s.size();
+	}
+}
+
+void portcullis::JunctionLookup::layout(const vector<uint64_t>& sorted, vector<uint64_t>& tree, size_t& i, size_t k) {
+	// In order traversal of the implicit tree visits the nodes in sorted order
+	if (k < tree.size()) {
+		layout(sorted, tree, i, 2 * k);
+		tree[k] = sorted[i++];
+		layout(sorted, tree, i, 2 * k + 1);
+	}
+}
+
+bool portcullis::JunctionLookup::containsAny(const bam1_t* b) const {
+	const uint32_t* cigar = bam_get_cigar(b);
+	int32_t pos = b->core.pos;
+	for (uint32_t i = 0; i < b->core.n_cigar; i++) {
+		const int op = bam_cigar_op(cigar[i]);
+		const int32_t len = bam_cigar_oplen(cigar[i]);
+		if (op == BAM_CREF_SKIP && intronAt(b->core.tid, pos, len)) {
+			return true;
+		}
+		if (bam_cigar_type(op) & 2) {
+			pos += len;
+		}
+	}
+	return false;
+}
@@ -50,6 +50,9 @@ using portcullis::Junction;
 using portcullis::JunctionPtr;
 using portcullis::SeqUtils;
 
+#include <portcullis/run_report.hpp>
+using portcullis::runReport;
+
 #include <portcullis/junction_system.hpp>
 
 size_t portcullis::JunctionSystem::createJunctionGroup(size_t index, vector<JunctionPtr>& group) {
@@ -79,6 +82,10 @@ void portcullis::JunctionSystem::findJunctions(const int32_t refId, JunctionList
 }
 
 portcullis::JunctionSystem::JunctionSystem() {
+	ownedStart = 0;
+	ownedEnd = INT32_MAX;
+	maxAlignments = 0;
+	compactAlignments = false;
 	minQueryLength = 0;
 	meanQueryLength = 0.0;
 	maxQueryLength = 0;
@@ -126,87 +133,135 @@ void portcullis::JunctionSystem::addJunction(JunctionPtr j) {
 	junctionList.push_back(j);
 }
 
+size_t portcullis::JunctionSystem::remove(const vector<bool>& flags) {
+	JunctionList kept;
+	kept.reserve(junctionList.size());
+	for (size_t i = 0; i < junctionList.size(); i++) {
+		if (i < flags.size() && flags[i]) {
+			distinctJunctions.erase(*(junctionList[i]->getIntron()));
+		}
+		else {
+			kept.push_back(junctionList[i]);
+		}
+	}
+	const size_t removed = junctionList.size() - kept.size();
+	junctionList.swap(kept);
+	return removed;
+}
+
 /**
  * Appends a new copy of all the junctions in the other junction system to this
  * junction system, without the Bam alignments associated with them.
  * @param other The other junctions system containing junctions to be added to this.
  */
 void portcullis::JunctionSystem::append(JunctionSystem& other) {
+	const vector<uint32_t> mapping = barcodes.merge(other.barcodes);
 	for (const auto & j : other.getJunctions()) {
+		if (!other.barcodes.empty()) {
+			j->getBarcodeCounts().remap(mapping);
+		}
 		this->addJunction(j);
 	}
 }
 
+void portcullis::JunctionSystem::addJunctionAlignment(const BamAlignment& al, BamAlignmentPtr& record, int64_t& barcode,
+		int32_t lStart, int32_t lEndExc, int32_t rStart, int32_t rEndExc) {
+	const int32_t refId = al.getReferenceId();
+	const int32_t refLength = refs->at(refId)->length;
+	// Do some sanity checking... make sure there are not any strange N cigar ops that
+	// drift over the edge of a reference sequence... seems like this can actually
+	// happen in GSNAP!  I guess this is referring to reads that map over
+	// target sequence boundaries
+	if (rStart - 1 >= refLength) {
+		rStart = refLength - 1;
+	}
+	if (rEndExc - 1 >= refLength) {
+		rEndExc = refLength;
+	}
+	// Junctions starting outside the owned range are left to whoever
+	// is processing that part of the reference
+	if (lEndExc < ownedStart || lEndExc >= ownedEnd) {
+		return;
+	}
+	// In compact mode the copy shared by this read's junctions is made up
+	// front, without the optional fields
+	if (compactAlignments && !record) {
+		record = al.compactCopy();
+	}
+	// Likewise the barcode is looked up once per read, and only for reads
+	// with junctions
+	if (barcode < 0) {
+		const char* tag = al.getStringTag(barcodeTag.c_str());
+		barcode = tag != nullptr ? barcodes.add(tag) : NO_BARCODE;
+	}
+	// Create the intron
+	shared_ptr<Intron> location = make_shared<Intron>(
+									  RefSeq(refId, refs->at(refId)->name, refLength),
+									  lEndExc,
+									  rStart - 1);
+	// We should now have the complete junction location information
+	JunctionMapIterator it = distinctJunctions.find(*location);
+	// If we couldn't find this location in the hashmap, add a new
+	// location / junction pair.  If we've seen this location before
+	// then add this alignment to the existing junction
+	if (it == distinctJunctions.end()) {
+		JunctionPtr junction = make_shared<Junction>(location, lStart, rEndExc - 1);
+		junction->addJunctionAlignment(al, record, maxAlignments);
+		if (barcode != NO_BARCODE) junction->addBarcode((uint32_t) barcode);
+		distinctJunctions[*location] = junction;
+		junctionList.push_back(junction);
+	}
+	else {
+		JunctionPtr junction = it->second;
+		junction->addJunctionAlignment(al, record, maxAlignments);
+		if (barcode != NO_BARCODE) junction->addBarcode((uint32_t) barcode);
+		junction->extendAnchors(lStart, rEndExc - 1);
+	}
+}
+
 bool portcullis::JunctionSystem::addJunctions(const BamAlignment& al, const size_t startOp, const int32_t offset) {
-	bool foundJunction = false;
+	// Walk the cigar once.  Each junction is only added when the next N op, or
+	// the end of the cigar, is reached, at which point its right anchor is
+	// known.  The right anchor of one junction starts the left anchor of the
+	// next.
 	const size_t nbOps = al.getNbCigarOps();
-	const int32_t refId = al.getReferenceId();
+	const int32_t refLength = refs->at(al.getReferenceId())->length;
+	BamAlignmentPtr record;
+	// Not looked up yet, or NO_BARCODE outside single cell mode
+	int64_t barcode = barcodeTag.empty() ? (int64_t) NO_BARCODE : -1;
+	bool pending = false;
 	int32_t lStart = offset;
-	int32_t lEndExc = lStart; // End of left anchor exclusive (i.e. +1)
-	int32_t rStart = lStart;
-	int32_t rEndExc = lStart; // End of right anchor exclusive (i.e. +1)
+	int32_t pos = offset; // Current position in the reference, exclusive
+	int32_t pendingLStart = 0;
+	int32_t pendingLEndExc = 0;
+	int32_t pendingRStart = 0;
+	int32_t pendingREndExc = 0;
 	for (size_t i = startOp; i < nbOps; i++) {
-		CigarOp op = al.getCigarOpAt(i);
+		const CigarOp op = al.getCigarOpAt(i);
 		if (op.type == BAM_CIGAR_REFSKIP_CHAR) {
-			foundJunction = true;
-			const int32_t refLength = refs->at(refId)->length;
-			rStart = lEndExc + op.length;
-			rEndExc = rStart;
-			// Establish end position of right anchor in genomic coordinates
-			size_t j = i + 1;
-			while (j < nbOps
-					&& rEndExc <= refLength
-					&& al.getCigarOpAt(j).type != BAM_CIGAR_REFSKIP_CHAR) {
-				CigarOp rOp = al.getCigarOpAt(j++);
-				if (CigarOp::opConsumesReference(rOp.type)) {
-					rEndExc += rOp.length;
-				}
-			}
-			// Do some sanity checking... make sure there are not any strange N cigar ops that
-			// drift over the edge of a reference sequence... seems like this can actually
-			// happen in GSNAP!  I guess this is referring to reads that map over
-			// target sequence boundaries
-			if (rStart - 1 >= refLength) {
-				rStart = refLength - 1;
-			}
-			if (rEndExc - 1 >= refLength) {
-				rEndExc = refLength;
-			}
-			// Create the intron
-			shared_ptr<Intron> location = make_shared<Intron>(
-											  RefSeq(refId, refs->at(refId)->name, refLength),
-											  lEndExc,
-											  rStart - 1);
-			// We should now have the complete junction location information
-			JunctionMapIterator it = distinctJunctions.find(*location);
-			// If we couldn't find this location in the hashmap, add a new
-			// location / junction pair.  If we've seen this location before
-			// then add this alignment to the existing junction
-			if (it == distinctJunctions.end()) {
-				JunctionPtr junction = make_shared<Junction>(location, lStart, rEndExc - 1);
-				junction->addJunctionAlignment(al);
-				distinctJunctions[*location] = junction;
-				junctionList.push_back(junction);
-			}
-			else {
-				JunctionPtr junction = it->second;
-				junction->addJunctionAlignment(al);
-				junction->extendAnchors(lStart, rEndExc - 1);
-			}
-			// Check if we have fully processed the cigar or not.  If not, then
-			// that means that this cigar contains additional junctions, so
-			// process those using recursion
-			if (j < nbOps) {
-				addJunctions(al, i + 1, rStart);
-				break;
+			if (pending) {
+				addJunctionAlignment(al, record, barcode, pendingLStart, pendingLEndExc, pendingRStart, pendingREndExc);
 			}
+			pending = true;
+			pendingLStart = lStart;
+			pendingLEndExc = pos;
+			pendingRStart = pos + op.length;
+			pendingREndExc = pendingRStart;
+			// The next left anchor starts where this right anchor does, after
+			// clipping to the end of the reference
+			pos = pendingRStart - 1 >= refLength ? refLength - 1 : pendingRStart;
+			lStart = pos;
 		}
 		else if (CigarOp::opConsumesReference(op.type)) {
-			lEndExc += op.length;
+			pos += op.length;
+			pendingREndExc += op.length;
 		}
 		// Ignore any other op types not already covered
 	}
-	return foundJunction;
+	if (pending) {
+		addJunctionAlignment(al, record, barcode, pendingLStart, pendingLEndExc, pendingRStart, pendingREndExc);
+	}
+	return pending;
 }
 
 void portcullis::JunctionSystem::findFlankingAlignments(const path& alignmentsFile) {
@@ -324,8 +379,12 @@ void portcullis::JunctionSystem::sort() {
 }
 
 void portcullis::JunctionSystem::index() {
+	index(0);
+}
+
+void portcullis::JunctionSystem::index(size_t firstId) {
 	for (size_t i = 0; i < this->size(); i++) {
-		junctionList[i]->setId(i);
+		junctionList[i]->setId(firstId + i);
 	}
 }
 
@@ -340,6 +399,10 @@ void portcullis::JunctionSystem::saveAll(const path& outputPrefix, const string&
 	string junctionGFFPath = outputPrefix.string() + ".junctions.exon.gff3";
 	string intronGFFPath = outputPrefix.string() + ".junctions.intron.gff3";
 	string junctionBEDAllPath = outputPrefix.string() + ".junctions.bed";
+	runReport.addOutput(junctionFilePath);
+	runReport.addOutput(junctionBEDAllPath);
+	if (outputExonGFF) runReport.addOutput(junctionGFFPath);
+	if (outputIntronGFF) runReport.addOutput(intronGFFPath);
 	/*cout << " - Saving junction report to: " << junctionReportPath << " ... ";
 	cout.flush();
 
@@ -382,6 +445,85 @@ void portcullis::JunctionSystem::saveAll(const path& outputPrefix, const string&
 	cout << "done." << endl;
 }
 
+void portcullis::JunctionSystem::saveBarcodeMatrix(const path& outputPrefix) {
+	const string matrixPath = outputPrefix.string() + ".cells.mtx";
+	const string barcodesPath = outputPrefix.string() + ".cells.barcodes.tsv";
+	const string junctionsPath = outputPrefix.string() + ".cells.junctions.tsv";
+	runReport.addOutput(matrixPath);
+	runReport.addOutput(barcodesPath);
+	runReport.addOutput(junctionsPath);
+	cout << " - Saving junction by cell matrix to: " << matrixPath << " ... ";
+	cout.flush();
+	uint64_t nnz = 0;
+	for (const auto & j : junctionList) {
+		j->getBarcodeCounts().compact();
+		nnz += j->getBarcodeCounts().getCounts().size();
+	}
+	// Matrix Market coordinate format, indices are 1-based
+	ofstream matrixStream(matrixPath.c_str());
+	matrixStream << "%%MatrixMarket matrix coordinate integer general" << endl
+				 << "% Reads supporting each junction (rows) from each cell barcode (columns)" << endl
+				 << junctionList.size() << " " << barcodes.size() << " " << nnz << endl;
+	for (size_t i = 0; i < junctionList.size(); i++) {
+		for (const auto & c : junctionList[i]->getBarcodeCounts().getCounts()) {
+			matrixStream << i + 1 << " " << c.first + 1 << " " << c.second << "\n";
+		}
+	}
+	matrixStream.close();
+	ofstream barcodesStream(barcodesPath.c_str());
+	for (const auto & barcode : barcodes.getBarcodes()) {
+		barcodesStream << barcode << "\n";
+	}
+	barcodesStream.close();
+	ofstream junctionsStream(junctionsPath.c_str());
+	for (const auto & j : junctionList) {
+		junctionsStream << j->getId() << "\t" << j->locationAsString() << "\n";
+	}
+	junctionsStream.close();
+	runReport.setCounter("cell_barcodes", barcodes.size());
+	runReport.setCounter("cell_matrix_entries", nnz);
+	cout << "done." << endl
+		 << " - " << barcodes.size() << " cell barcodes, " << nnz << " non-zero entries" << endl;
+}
+
+void portcullis::JunctionSystem::appendAll(const path& outputPrefix, const string& source, bool bedscore, bool outputExonGFF, bool outputIntronGFF, bool first) {
+	string junctionFilePath = outputPrefix.string() + ".junctions.tab";
+	string junctionGFFPath = outputPrefix.string() + ".junctions.exon.gff3";
+	string intronGFFPath = outputPrefix.string() + ".junctions.intron.gff3";
+	string junctionBEDAllPath = outputPrefix.string() + ".junctions.bed";
+	runReport.addOutput(junctionFilePath);
+	runReport.addOutput(junctionBEDAllPath);
+	if (outputExonGFF) runReport.addOutput(junctionGFFPath);
+	if (outputIntronGFF) runReport.addOutput(intronGFFPath);
+	const std::ios_base::openmode mode = first ? std::ios_base::out : std::ios_base::app;
+	ofstream junctionFileStream(junctionFilePath.c_str(), mode);
+	if (first) {
+		junctionFileStream << Junction::junctionOutputHeader() << endl;
+	}
+	for (const auto & j : junctionList) {
+		junctionFileStream << *j << endl;
+	}
+	junctionFileStream.close();
+	if (outputExonGFF) {
+		ofstream junctionGFFStream(junctionGFFPath.c_str(), mode);
+		writeExonGFF(junctionGFFStream, source);
+		junctionGFFStream.close();
+	}
+	if (outputIntronGFF) {
+		ofstream intronGFFStream(intronGFFPath.c_str(), mode);
+		writeIntronGFF(intronGFFStream, source);
+		intronGFFStream.close();
+	}
+	ofstream junctionBEDStream(junctionBEDAllPath.c_str(), mode);
+	if (first) {
+		junctionBEDStream << "track name=\"junctions\" description=\"Portcullis V" << (version.empty() ? "X.X.X" : version) << " junctions\"" << endl;
+	}
+	for (JunctionPtr j : junctionList) {
+		j->outputBED(junctionBEDStream, source, bedscore);
+	}
+	junctionBEDStream.close();
+}
+
 void portcullis::JunctionSystem::outputDescription(std::ostream &strm) {
 	for (JunctionPtr j : junctionList) {
 		strm << "Junction " << j->getId() << ":" << endl;
@@ -427,6 +569,7 @@ void portcullis::JunctionSystem::load(const path& junctionTabFile, const bool si
         BOOST_THROW_EXCEPTION(JunctionException() << JunctionErrorInfo(string(
                                   "Could not find Portcullis junction tab file at: ") + junctionTabFile.string()));
     }
+    runReport.addInput(junctionTabFile);
     ifstream ifs(junctionTabFile.c_str());
 	string line;
 	// Loop through until end of file or we move onto the next ref seq
@@ -453,29 +596,37 @@ JunctionPtr portcullis::JunctionSystem::getJunction(Intron& intron) const {
 }
 
 std::pair<Orientation, Strandedness> portcullis::JunctionSystem::determineStrandedness(bool verbose) const {
-	uint32_t tot_r1_pos_when_ss_pos = 0;
-	uint32_t tot_r1_neg_when_ss_pos = 0;
-	uint32_t tot_r2_pos_when_ss_pos = 0;
-	uint32_t tot_r2_neg_when_ss_pos = 0;
-	uint32_t tot_r1_pos_when_ss_neg = 0;
-	uint32_t tot_r1_neg_when_ss_neg = 0;
-	uint32_t tot_r2_pos_when_ss_neg = 0;
-	uint32_t tot_r2_neg_when_ss_neg = 0;
+	StrandCounts counts;
+	addStrandCounts(counts);
+	return determineStrandedness(counts, verbose);
+}
 
+void portcullis::JunctionSystem::addStrandCounts(StrandCounts& counts) const {
 	for (JunctionPtr j : junctionList) {
 		if (j->getSpliceSiteStrand() == Strand::POSITIVE) {
-			tot_r1_pos_when_ss_pos += j->getNbR1PosAlignments();
-			tot_r1_neg_when_ss_pos += j->getNbR1NegAlignments();
-			tot_r2_pos_when_ss_pos += j->getNbR2PosAlignments();
-			tot_r2_neg_when_ss_pos += j->getNbR2NegAlignments();
+			counts.r1PosWhenSsPos += j->getNbR1PosAlignments();
+			counts.r1NegWhenSsPos += j->getNbR1NegAlignments();
+			counts.r2PosWhenSsPos += j->getNbR2PosAlignments();
+			counts.r2NegWhenSsPos += j->getNbR2NegAlignments();
 		}
 		else if (j->getSpliceSiteStrand() == Strand::NEGATIVE) {
-			tot_r1_pos_when_ss_neg += j->getNbR1PosAlignments();
-			tot_r1_neg_when_ss_neg += j->getNbR1NegAlignments();
-			tot_r2_pos_when_ss_neg += j->getNbR2PosAlignments();
-			tot_r2_neg_when_ss_neg += j->getNbR2NegAlignments();
+			counts.r1PosWhenSsNeg += j->getNbR1PosAlignments();
+			counts.r1NegWhenSsNeg += j->getNbR1NegAlignments();
+			counts.r2PosWhenSsNeg += j->getNbR2PosAlignments();
+			counts.r2NegWhenSsNeg += j->getNbR2NegAlignments();
 		}
 	}
+}
+
+std::pair<Orientation, Strandedness> portcullis::JunctionSystem::determineStrandedness(const StrandCounts& counts, bool verbose) {
+	const uint32_t tot_r1_pos_when_ss_pos = counts.r1PosWhenSsPos;
+	const uint32_t tot_r1_neg_when_ss_pos = counts.r1NegWhenSsPos;
+	const uint32_t tot_r2_pos_when_ss_pos = counts.r2PosWhenSsPos;
+	const uint32_t tot_r2_neg_when_ss_pos = counts.r2NegWhenSsPos;
+	const uint32_t tot_r1_pos_when_ss_neg = counts.r1PosWhenSsNeg;
+	const uint32_t tot_r1_neg_when_ss_neg = counts.r1NegWhenSsNeg;
+	const uint32_t tot_r2_pos_when_ss_neg = counts.r2PosWhenSsNeg;
+	const uint32_t tot_r2_neg_when_ss_neg = counts.r2NegWhenSsNeg;
 
 	double posr1 = ((double)((int32_t)tot_r1_pos_when_ss_pos - (int32_t)tot_r1_neg_when_ss_pos)) / ((double)(tot_r1_pos_when_ss_pos + tot_r1_neg_when_ss_pos));
 	double negr1 = ((double)((int32_t)tot_r1_neg_when_ss_neg - (int32_t)tot_r1_pos_when_ss_neg)) / ((double)(tot_r1_pos_when_ss_neg + tot_r1_neg_when_ss_neg));
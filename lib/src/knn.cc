@@ -24,9 +24,11 @@ using std::cerr;
 using std::endl;
 using std::make_shared;
 
+#include <portcullis/instrument.hpp>
+
 #include <portcullis/ml/knn.hpp>
 
-portcullis::ml::KNN::KNN(uint16_t defaultK, uint16_t _threads, double* _data, size_t _rows, size_t _cols) {
+portcullis::ml::KNN::KNN(uint16_t defaultK, uint16_t _threads, const double* _data, size_t _rows, size_t _cols) {
 	data = _data;
 	rows = _rows;
 	cols = _cols;
@@ -36,14 +38,11 @@ portcullis::ml::KNN::KNN(uint16_t defaultK, uint16_t _threads, double* _data, si
 		k = defaultK;
 	threads = _threads;
 	verbose = false;
-	results.resize(_rows);
-        for (size_t i = 0; i < results.size(); i++) {
-            results[i].resize(k, 0);
-        }
-        
+	results.resize(_rows * k, 0);
 }
 
 void portcullis::ml::KNN::doSlice(uint16_t slice) {
+	PORTCULLIS_PROBE("KNN::doSlice");
 	// Get coordinates of entries to search through in this slice
 	uint32_t slice_size = rows / threads;
 	uint32_t start = slice_size * slice;
@@ -53,16 +52,20 @@ void portcullis::ml::KNN::doSlice(uint16_t slice) {
 	}
 	uint32_t testcount = end - start + 1;
 	vector<double> dbuf(testcount * k, std::numeric_limits<double>::max());
-	vector<uint32_t> rbuf(testcount * k, 0);
+	// Write neighbour indices straight into this slice's section of the results
+	uint32_t* rbuf = &results[start * k];
 	// Get feature space values for KNN for each sample in slice
 	for (uint32_t baseidx = 0; baseidx < rows; baseidx++) {
 		for (uint32_t testidx = start; testidx <= end; testidx++) {
 			const uint32_t ri = (testidx - start) * k;
 			// Get sum of squared differences (no need to do the sqrt to get
 			// the Euclidean distance... this saves about 20% runtime)
+			const double* b = &data[baseidx * cols];
+			const double* t = &data[testidx * cols];
 			double s = 0.0;
-			for (uint16_t i = 0; i < cols; i++) {
-				s += std::pow(data[baseidx * cols + i] - data[testidx * cols + i], 2.0);
+			for (size_t i = 0; i < cols; i++) {
+				const double d = b[i] - t[i];
+				s += d * d;
 			}
 			// Find position to add entry...
 			int i = k;
@@ -82,20 +85,6 @@ void portcullis::ml::KNN::doSlice(uint16_t slice) {
 			rbuf[ri + i] = baseidx;
 		}
 	}
-	// Store final results (we could probably optimise this part away by replacing
-	// rbuf with results)
-	for (uint32_t testidx = start; testidx <= end; testidx++) {
-		for (size_t i = 0; i < k; i++) {
-			uint32_t index = rbuf[((testidx - start) * k) + i];
-			if (testidx >= results.size()) {
-				cerr << "ERROR: item has index larger than results array" << endl;
-			}
-			if (i >= results[testidx].size()) {
-				cerr << "ERROR: item is trying to set a value larger than k" << endl;
-			}
-			results[testidx][i] = index;
-		}		 
-	}
 }
 
 void portcullis::ml::KNN::execute() {
@@ -104,6 +93,13 @@ void portcullis::ml::KNN::execute() {
 		cout << "Performing K Nearest Neighbour (KNN) ...";
 		cout.flush();
 	}
+	if (rows == 0) {
+		return;
+	}
+	// Don't create empty slices
+	if (threads > rows) {
+		threads = rows;
+	}
 	vector<thread> t(threads);
 	for (uint16_t i = 0; i < threads; i++) {
 		t[i] = thread(&KNN::doSlice, this, i);
@@ -114,9 +110,9 @@ void portcullis::ml::KNN::execute() {
 }
 
 void portcullis::ml::KNN::print(ostream& out) {
-	for (auto & i : results) {
-		for (auto j : i) {
-			out << j << " ";
+	for (size_t i = 0; i < rows; i++) {
+		for (size_t j = 0; j < k; j++) {
+			out << results[(i * k) + j] << " ";
 		}
 		out << endl;
 	}
@@ -25,6 +25,8 @@ using std::endl;
 #include <portcullis/seq_utils.hpp>
 using portcullis::SeqUtils;
 
+#include <portcullis/instrument.hpp>
+
 #include <portcullis/ml/markov_model.hpp>
 using portcullis::ml::KMMU;
 
@@ -54,6 +56,7 @@ void portcullis::ml::KmerMarkovModel::train(const vector<string>& input, const u
 
 
 double portcullis::ml::KmerMarkovModel::getScore(const string& seq) {
+	PORTCULLIS_PROBE("KmerMarkovModel::getScore");
 	string s = SeqUtils::makeClean(seq);
 	double score = 1.0;
 	uint32_t no_count = 0;
@@ -15,6 +15,7 @@
 //  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
 //  *******************************************************************
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <memory>
@@ -29,12 +30,18 @@ using std::make_shared;
 #include <ranger/ForestClassification.h>
 
 #include <portcullis/ml/enn.hpp>
+#include <portcullis/ml/icote.hpp>
+#include <portcullis/ml/neighbour_graph.hpp>
 #include <portcullis/ml/smote.hpp>
 using portcullis::ml::ENN;
+using portcullis::ml::Icote;
+using portcullis::ml::NeighbourGraph;
 using portcullis::ml::Smote;
 
 #include <portcullis/junction.hpp>
+#include <portcullis/run_report.hpp>
 using portcullis::Junction;
+using portcullis::StageTimer;
 
 #include <portcullis/ml/model_features.hpp>
 
@@ -211,7 +218,48 @@ void portcullis::ml::ModelFeatures::setRow(Data* d, size_t row, JunctionPtr j) {
 	}
 }
 
+vector<size_t> portcullis::ml::ModelFeatures::getLabelDerivedColumns() const {
+	// Features 9 (intron score), 11 (coding potential), 12 and 13 (splicing scores)
+	vector<size_t> cols;
+	size_t col = 0;
+	for (size_t i = 0; i < features.size(); i++) {
+		if (!features[i].active) {
+			continue;
+		}
+		if (i == 9 || i == 11 || i == 12 || i == 13) {
+			cols.push_back(col);
+		}
+		col++;
+	}
+	return cols;
+}
+
+void portcullis::ml::ModelFeatures::calcLabelDerivedFeatures(const JunctionPtr& j, vector<double>& values) {
+	values.clear();
+	if (features[9].active) {
+		values.push_back(L95 == 0 ? 0.0 : j->computeIntronScore(L95));
+	}
+	if (features[11].active) {
+		values.push_back(isCodingPotentialModelEmpty() ? 0.0 : j->computeCodingPotential(gmap, exonModel, intronModel));
+	}
+	if (features[12].active || features[13].active) {
+		SplicingScores ss;
+		if (!isPWModelEmpty()) {
+			ss = j->computeSplicingScores(gmap, donorTModel, donorFModel, acceptorTModel, acceptorFModel,
+										  donorPWModel, acceptorPWModel);
+		}
+		if (features[12].active) {
+			values.push_back(isPWModelEmpty() ? 0.0 : ss.positionWeighting);
+		}
+		if (features[13].active) {
+			values.push_back(isPWModelEmpty() ? 0.0 : ss.splicingSignal);
+		}
+	}
+}
+
 Data* portcullis::ml::ModelFeatures::juncs2FeatureVectors(const JunctionList& x) {
+	StageTimer stage("featureExtraction");
+	stage.setRecords(x.size());
 	vector<string> headers;
 	for (auto & f : features) {
 		if (f.active) {
@@ -229,6 +277,8 @@ Data* portcullis::ml::ModelFeatures::juncs2FeatureVectors(const JunctionList& x)
 }
 
 Data* portcullis::ml::ModelFeatures::juncs2FeatureVectors(const JunctionList& xl, const JunctionList& xu) {
+	StageTimer stage("featureExtraction");
+	stage.setRecords(xl.size() + xu.size());
 	vector<string> headers;
 	for (auto & f : features) {
 		if (f.active) {
@@ -250,17 +300,23 @@ Data* portcullis::ml::ModelFeatures::juncs2FeatureVectors(const JunctionList& xl
 }
 
 portcullis::ml::ForestPtr portcullis::ml::ModelFeatures::trainInstance(const JunctionList& pos, const JunctionList& neg,
-        string outputPrefix, uint16_t trees, uint16_t threads, bool probabilityMode, bool verbose, bool smote, bool enn, bool saveFeatures) {
+        string outputPrefix, uint16_t trees, uint16_t threads, bool probabilityMode, bool verbose, bool smote, bool enn, bool saveFeatures, bool icote, uint16_t bins) {
 	// Work out number of times to duplicate negative set
 	const int N = (pos.size() / neg.size()) - 1;
 	// Duplicate pointers to negative set
 	JunctionList neg2;
 	neg2.reserve(neg.size());
 	neg2.insert(neg2.end(), neg.begin(), neg.end());
+	// If we are both oversampling and cleaning we build a single labelled
+	// neighbour graph over the real training rows, use it for SMOTE, then add the
+	// synthetic rows to it for ENN.  This way negative vs negative distances are
+	// only computed once.
+	const bool shareGraph = N > 0 && smote && enn && !icote;
+	shared_ptr<NeighbourGraph> graph = nullptr;
 	uint32_t smote_rows = 0;
 	double* smote_data = 0;
-	if (N > 0 && smote) {
-		cout << "Oversampling negative set to balance with positive set using SMOTE" << endl;
+	if (N > 0 && smote && !shareGraph) {
+		cout << "Oversampling negative set to balance with positive set using " << (icote ? "ICOTE" : "SMOTE") << endl;
 		Data* negData = juncs2FeatureVectors(neg);
 		const int SC = negData->getNumCols() - 1;
 		size_t nelements = negData->getNumRows() * SC;
@@ -269,28 +325,40 @@ portcullis::ml::ForestPtr portcullis::ml::ModelFeatures::trainInstance(const Jun
 			double* r = &nm[baseidx * SC];
 			for (size_t c = 1; c < negData->getNumCols(); c++) {
 				r[c - 1] = negData->get(baseidx, c);
-				//cout << r[c-1];
 			}
-			//cout << endl;
 		}
-		Smote smote(5, N, threads, nm, negData->getNumRows(), negData->getNumCols() - 1);
-                smote.setVerbose(verbose);
-		smote.execute();
-		smote_rows = smote.getNbSynthRows();
-		smote_data = new double[smote_rows * SC];
-		double* sd = smote.getSynthetic();
-		for (size_t i = 0; i < smote_rows * SC; i++) {
-			smote_data[i] = sd[i];
+		if (icote) {
+			Icote icote(N, threads, nm, negData->getNumRows(), SC);
+			icote.setVerbose(verbose);
+			icote.execute();
+			smote_rows = icote.getNbSynthRows();
+			smote_data = new double[smote_rows * SC];
+			double* sd = icote.getSynthetic();
+			std::copy(sd, sd + (smote_rows * SC), smote_data);
 		}
-		cout << "Number of synthesized entries: " << smote.getNbSynthRows() << endl;
+		else {
+			Smote smote(5, N, threads, nm, negData->getNumRows(), SC);
+			smote.setVerbose(verbose);
+			smote.execute();
+			smote_rows = smote.getNbSynthRows();
+			smote_data = new double[smote_rows * SC];
+			double* sd = smote.getSynthetic();
+			std::copy(sd, sd + (smote_rows * SC), smote_data);
+		}
+		delete[] nm;
+		delete negData;
+		cout << "Number of synthesized entries: " << smote_rows << endl;
 	}
 	else if (N <= 0 && smote) {
 		cout << "Undersampling negative set to balance with positive set" << endl;
-		std::mt19937 rng(12345);
-		while (neg2.size() > pos.size()) {
-			std::uniform_int_distribution<int> gen(0, neg2.size()); // uniform, unbiased
-			int i = gen(rng);
-			neg2.erase(neg2.begin() + i);
+		// Partial Fisher-Yates: the first pos.size() entries end up a uniform sample
+		if (neg2.size() > pos.size()) {
+			std::mt19937 rng(12345);
+			for (size_t i = 0; i < pos.size(); i++) {
+				std::uniform_int_distribution<size_t> gen(i, neg2.size() - 1);
+				std::swap(neg2[i], neg2[gen(rng)]);
+			}
+			neg2.resize(pos.size());
 		}
 	}
 	if (verbose) cout << endl << "Combining positive, negative " << (N > 0 ? "and synthetic negative " : "") << "datasets." << endl;
@@ -302,6 +370,32 @@ portcullis::ml::ForestPtr portcullis::ml::ModelFeatures::trainInstance(const Jun
 	trainingSystem.sort();
 	JunctionList x = trainingSystem.getJunctions();
 	Data* otd = juncs2FeatureVectors(x);
+	if (shareGraph) {
+		cout << "Oversampling negative set to balance with positive set using SMOTE" << endl;
+		const size_t SC = otd->getNumCols() - 1;
+		double* m = new double[otd->getNumRows() * SC];
+		vector<bool> labels(otd->getNumRows());
+		for (size_t i = 0; i < otd->getNumRows(); i++) {
+			labels[i] = otd->get(i, 0) == 1.0;
+			for (size_t c = 1; c < otd->getNumCols(); c++) {
+				m[(i * SC) + c - 1] = otd->get(i, c);
+			}
+		}
+		graph = make_shared<NeighbourGraph>(5, threads, SC);
+		graph->setVerbose(verbose);
+		graph->addRows(m, otd->getNumRows(), labels);
+		delete[] m;
+		Smote smote(*graph, false, N);
+		smote.setVerbose(verbose);
+		smote.execute();
+		smote_rows = smote.getNbSynthRows();
+		smote_data = new double[smote_rows * SC];
+		double* sd = smote.getSynthetic();
+		for (size_t i = 0; i < smote_rows * SC; i++) {
+			smote_data[i] = sd[i];
+		}
+		cout << "Number of synthesized entries: " << smote.getNbSynthRows() << endl;
+	}
 	// Create data to correct size
 	Data* trainingData = N > 0 && smote ?
 						 new DataDouble(
@@ -325,17 +419,24 @@ portcullis::ml::ForestPtr portcullis::ml::ModelFeatures::trainInstance(const Jun
 			}
 			k++;
 		}
-		delete[] smote_data;
 	}
 	vector<bool> results;
 	if (enn) {
-		if (verbose) cout << endl << "Converting training data for ENN" << endl;
-		size_t elements = trainingData->getNumRows() * (trainingData->getNumCols() - 1);
-		double* m = new double[elements];
-		for (uint32_t baseidx = 0; baseidx < trainingData->getNumRows(); baseidx++) {
-			double* r = &m[baseidx * (trainingData->getNumCols() - 1)];
-			for (size_t c = 1; c < trainingData->getNumCols(); c++) {
-				r[c - 1] = trainingData->get(baseidx, c);
+		double* m = nullptr;
+		if (shareGraph) {
+			// Only distances involving the synthetic rows need computing here
+			if (verbose) cout << endl << "Adding synthetic entries to neighbour graph for ENN" << endl;
+			graph->addRows(smote_data, smote_rows, false);
+		}
+		else {
+			if (verbose) cout << endl << "Converting training data for ENN" << endl;
+			size_t elements = trainingData->getNumRows() * (trainingData->getNumCols() - 1);
+			m = new double[elements];
+			for (uint32_t baseidx = 0; baseidx < trainingData->getNumRows(); baseidx++) {
+				double* r = &m[baseidx * (trainingData->getNumCols() - 1)];
+				for (size_t c = 1; c < trainingData->getNumCols(); c++) {
+					r[c - 1] = trainingData->get(baseidx, c);
+				}
 			}
 		}
 		if (verbose) cout << "Extracting labels for ENN" << endl;
@@ -355,11 +456,14 @@ portcullis::ml::ForestPtr portcullis::ml::ModelFeatures::trainInstance(const Jun
 		}
 		cout << "P: " << p << "; N: " << n << "; O: " << o << endl;
 		cout << endl << "Starting Wilson's Edited Nearest Neighbour (ENN) to clean decision region" << endl;
-		ENN enn(3, threads, m, trainingData->getNumRows(), trainingData->getNumCols() - 1, labels);
+		ENN enn = shareGraph ?
+				  ENN(3, *graph) :
+				  ENN(3, threads, m, trainingData->getNumRows(), trainingData->getNumCols() - 1, labels);
 		enn.setThreshold(3);
 		enn.setVerbose(true);
 		uint32_t count = enn.execute(results);
 		delete[] m;
+		graph = nullptr;
 		uint32_t pcount = 0, ncount = 0;
         for (size_t i = 0; i < trainingData->getNumRows(); i++) {
 			if (trainingData->get(i, 0) == 1.0 && !results[i]) {
@@ -371,6 +475,9 @@ portcullis::ml::ForestPtr portcullis::ml::ModelFeatures::trainInstance(const Jun
 		}
 		cout << "Should discard " << pcount << " + entries and " << ncount << " - entries (Total=" << count << ")" << endl << endl;
 	}
+	if (N > 0 && smote) {
+		delete[] smote_data;
+	}
 	uint32_t pcount = 0, ncount = 0;
 	Data* trainingData2 = enn ?
 						  new DataDouble(
@@ -410,7 +517,15 @@ portcullis::ml::ForestPtr portcullis::ml::ModelFeatures::trainInstance(const Jun
         fout.close();
     }
 
-	if (verbose) cout << "Initialising random forest" << endl;
+	ForestPtr f = trainForest(trainingData2, outputPrefix, trees, threads, probabilityMode, verbose, bins);
+    cout << "Out of box Error (OOBE): " << f->getOverallPredictionError() << endl;
+	delete trainingData2;
+	return f;
+}
+
+portcullis::ml::ForestPtr portcullis::ml::ModelFeatures::trainForest(Data* trainingData, string outputPrefix,
+		uint16_t trees, uint16_t threads, bool probabilityMode, bool verbose, uint16_t bins) {
+	if (verbose) cout << "Initialising random forest" << (bins > 0 ? " in histogram mode with up to " + std::to_string(bins) + " bins per feature" : "") << endl;
 	ForestPtr f = nullptr;
 	if (probabilityMode) {
 		f = make_shared<ForestProbability>();
@@ -418,11 +533,18 @@ portcullis::ml::ForestPtr portcullis::ml::ModelFeatures::trainInstance(const Jun
 	else {
 		f = make_shared<ForestClassification>();
 	}
+	if (bins > 0) {
+		if (bins < 2 || bins > 256) {
+			BOOST_THROW_EXCEPTION(ModelFeaturesException() << ModelFeaturesErrorInfo(string(
+					"Number of histogram bins must be between 2 and 256: ") + std::to_string(bins)));
+		}
+		f->setNumBins(bins);
+	}
 	vector<string> catVars;
 	f->init(
 		"Genuine", // Dependant variable name
 		MEM_DOUBLE, // Memory mode
-		trainingData2, // Data object
+		trainingData, // Data object
 		0, // M Try (0 == use default)
 		outputPrefix, // Output prefix
 		trees, // Number of trees
@@ -440,8 +562,36 @@ portcullis::ml::ForestPtr portcullis::ml::ModelFeatures::trainInstance(const Jun
 		1.0); // Sample fraction
 	if (verbose) cout << "Training" << endl;
 	f->setVerboseOut(&cerr);
+	StageTimer stage("trainForest");
+	stage.setRecords(trainingData->getNumRows());
 	f->run(verbose);
-    cout << "Out of box Error (OOBE): " << f->getOverallPredictionError() << endl;
-	delete trainingData2;
+	return f;
+}
+
+shared_ptr<ForestProbability> portcullis::ml::ModelFeatures::loadForest(const path& modelFile, Data* data, uint16_t threads) {
+	shared_ptr<ForestProbability> f = make_shared<ForestProbability>();
+	vector<string> catVars;
+	f->init(
+		"Genuine", // Dependant variable name
+		MEM_DOUBLE, // Memory mode
+		data, // Data object
+		0, // M Try (0 == use default)
+		"", // Output prefix
+		DEFAULT_NUM_TREE, // Number of trees (will be overwritten when loading the model)
+		1234567890, // Seed for random generator
+		threads, // Number of threads
+		IMP_GINI, // Importance measure
+		DEFAULT_MIN_NODE_SIZE_PROBABILITY, // Min node size (only used for training)
+		"", // Status var name
+		true, // Prediction mode
+		true, // Replace
+		catVars, // Unordered categorical variable names (vector<string>)
+		false, // Memory saving
+		DEFAULT_SPLITRULE, // Split rule
+		false, // predall
+		1.0); // Sample fraction
+	f->setVerboseOut(&cerr);
+	// Load trees from saved model
+	f->loadFromFile(modelFile.string());
 	return f;
 }
@@ -0,0 +1,153 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <iostream>
+#include <limits>
+using std::cout;
+using std::endl;
+
+#include <portcullis/ml/neighbour_graph.hpp>
+
+portcullis::ml::NeighbourGraph::NeighbourGraph(uint16_t _k, uint16_t _threads, size_t _cols) {
+	if (_k == 0) {
+		BOOST_THROW_EXCEPTION(NeighbourGraphException() << NeighbourGraphErrorInfo(string(
+								  "K must be greater than 0")));
+	}
+	k = _k;
+	threads = _threads < 1 ? 1 : _threads;
+	verbose = false;
+	rows = 0;
+	cols = _cols;
+	processed = 0;
+}
+
+size_t portcullis::ml::NeighbourGraph::getNbRows(bool label) const {
+	size_t count = 0;
+	for (size_t i = 0; i < rows; i++) {
+		if (labels[i] == label) count++;
+	}
+	return count;
+}
+
+void portcullis::ml::NeighbourGraph::addRows(const double* _data, size_t _rows, const vector<bool>& _labels) {
+	if (_rows != _labels.size()) {
+		BOOST_THROW_EXCEPTION(NeighbourGraphException() << NeighbourGraphErrorInfo(string(
+								  "The supplied number of rows does not match the number of labels")));
+	}
+	data.insert(data.end(), _data, _data + (_rows * cols));
+	labels.insert(labels.end(), _labels.begin(), _labels.end());
+	rows += _rows;
+	nns.resize(rows * 2 * k, 0);
+	dists.resize(rows * 2 * k, std::numeric_limits<double>::max());
+	counts.resize(rows * 2, 0);
+	update();
+}
+
+void portcullis::ml::NeighbourGraph::doSlice(size_t start, size_t end) {
+	for (size_t testidx = start; testidx < end; testidx++) {
+		const double* t = &data[testidx * cols];
+		// Rows that were already processed only need comparing against the new
+		// rows, new rows need comparing against everything
+		const size_t first = testidx < processed ? processed : 0;
+		for (size_t baseidx = first; baseidx < rows; baseidx++) {
+			// Sum of squared differences, no need for the sqrt
+			const double* b = &data[baseidx * cols];
+			double s = 0.0;
+			for (size_t i = 0; i < cols; i++) {
+				const double d = b[i] - t[i];
+				s += d * d;
+			}
+			const size_t li = (testidx * 2) + labels[baseidx];
+			const size_t ri = li * k;
+			uint16_t& c = counts[li];
+			// Find position to add entry... entries with equal distance keep
+			// their existing (lower index) position
+			int i = c;
+			for (; i > 0; i--)
+				if (s >= dists[ri + i - 1])
+					break;
+			// ... or skip if not if this pair is not in the current set of KNN
+			if (i >= k)
+				continue;
+			// Shift back entries after i
+			const int last = c < k ? c : k - 1;
+			for (int j = last - 1; j >= i; j--) {
+				dists[ri + j + 1] = dists[ri + j];
+				nns[ri + j + 1] = nns[ri + j];
+			}
+			dists[ri + i] = s;
+			nns[ri + i] = baseidx;
+			if (c < k) c++;
+		}
+	}
+}
+
+void portcullis::ml::NeighbourGraph::update() {
+	if (rows == processed) {
+		return;
+	}
+	auto_cpu_timer timer(1, "  Time taken: %ws\n");
+	if (verbose) {
+		cout << "Updating neighbour graph with " << (rows - processed) << " new rows (" << rows << " rows in total) ...";
+		cout.flush();
+	}
+	const size_t nbSlices = threads < rows ? threads : rows;
+	const size_t slice_size = rows / nbSlices;
+	vector<thread> t(nbSlices);
+	for (size_t i = 0; i < nbSlices; i++) {
+		const size_t start = i * slice_size;
+		const size_t end = i == nbSlices - 1 ? rows : start + slice_size;
+		t[i] = thread(&NeighbourGraph::doSlice, this, start, end);
+	}
+	for (size_t i = 0; i < nbSlices; i++) {
+		t[i].join();
+	}
+	processed = rows;
+}
+
+uint16_t portcullis::ml::NeighbourGraph::getNNs(size_t index, uint16_t n, uint32_t* out) const {
+	if (n > k) {
+		BOOST_THROW_EXCEPTION(NeighbourGraphException() << NeighbourGraphErrorInfo(string(
+								  "Can't request more than ") + std::to_string(k) + " neighbours from graph"));
+	}
+	const size_t ni = index * 2 * k;
+	const size_t pi = ni + k;
+	const uint16_t nc = counts[index * 2];
+	const uint16_t pc = counts[(index * 2) + 1];
+	uint16_t a = 0, b = 0, w = 0;
+	while (w < n && (a < nc || b < pc)) {
+		bool takeNeg = b >= pc ||
+					   (a < nc && (dists[ni + a] < dists[pi + b] ||
+								   (dists[ni + a] == dists[pi + b] && nns[ni + a] < nns[pi + b])));
+		out[w++] = takeNeg ? nns[ni + a++] : nns[pi + b++];
+	}
+	return w;
+}
+
+void portcullis::ml::NeighbourGraph::print(ostream& out) const {
+	for (size_t i = 0; i < rows; i++) {
+		out << i << (labels[i] ? " +" : " -");
+		for (size_t l = 0; l < 2; l++) {
+			out << "\t";
+			const uint32_t* nn = getNNs(i, l);
+			for (size_t j = 0; j < getNbNNs(i, l); j++) {
+				out << nn[j] << " ";
+			}
+		}
+		out << endl;
+	}
+}
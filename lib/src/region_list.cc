@@ -0,0 +1,147 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using std::ifstream;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+#include <boost/algorithm/string.hpp>
+#include <boost/exception/all.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/lexical_cast.hpp>
+using boost::filesystem::path;
+using boost::lexical_cast;
+
+#include <portcullis/bam/region_list.hpp>
+
+
+portcullis::bam::RegionList portcullis::bam::RegionList::loadBed(const path& bedFile, const RefSeqPtrList& refs, size_t& nbUnknown) {
+	if (!boost::filesystem::exists(bedFile)) {
+		BOOST_THROW_EXCEPTION(RegionListException() << RegionListErrorInfo(string(
+								  "Could not find regions file at: ") + bedFile.string()));
+	}
+	unordered_map<string, RefSeqPtr> byName;
+	for (const auto & ref : refs) {
+		if (ref) {
+			byName[ref->name] = ref;
+		}
+	}
+	RegionList list;
+	nbUnknown = 0;
+	ifstream ifs(bedFile.c_str());
+	string line;
+	uint64_t lineNb = 0;
+	while (std::getline(ifs, line)) {
+		lineNb++;
+		boost::trim(line);
+		// Ignore blank lines, comments and the header lines used by genome browsers
+		if (line.empty() || line[0] == '#' || boost::starts_with(line, "track") || boost::starts_with(line, "browser")) {
+			continue;
+		}
+		vector<string> parts;
+		boost::split(parts, line, boost::is_any_of("\t "), boost::token_compress_on);
+		int64_t start = -1;
+		int64_t end = -1;
+		if (parts.size() >= 3) {
+			try {
+				start = lexical_cast<int64_t>(parts[1]);
+				end = lexical_cast<int64_t>(parts[2]);
+			}
+			catch (boost::bad_lexical_cast&) {
+				start = -1;
+			}
+		}
+		if (start < 0 || end <= start) {
+			BOOST_THROW_EXCEPTION(RegionListException() << RegionListErrorInfo(string(
+									  "Invalid region on line ") + lexical_cast<string>(lineNb) + " of regions file " + bedFile.string() + ": " + line));
+		}
+		auto it = byName.find(parts[0]);
+		if (it == byName.end()) {
+			nbUnknown++;
+			continue;
+		}
+		const RefSeqPtr& ref = it->second;
+		// Clip to the end of the sequence, where its length is known
+		if (ref->length > 0) {
+			end = std::min(end, (int64_t) ref->length);
+			if (start >= end) {
+				continue;
+			}
+		}
+		list.add(ref->index, (int32_t) start, (int32_t) end);
+	}
+	list.merge();
+	return list;
+}
+
+void portcullis::bam::RegionList::merge() {
+	std::sort(regions.begin(), regions.end());
+	vector<GenomicRegion> merged;
+	for (const auto & r : regions) {
+		if (!merged.empty() && merged.back().seq == r.seq && r.start <= merged.back().end) {
+			merged.back().end = std::max(merged.back().end, r.end);
+		}
+		else {
+			merged.push_back(r);
+		}
+	}
+	regions.swap(merged);
+}
+
+portcullis::bam::RegionList portcullis::bam::RegionList::getRegions(const int32_t seq) const {
+	RegionList list;
+	auto first = std::lower_bound(regions.begin(), regions.end(), GenomicRegion{seq, INT32_MIN, 0});
+	for (auto it = first; it != regions.end() && it->seq == seq; ++it) {
+		list.regions.push_back(*it);
+	}
+	return list;
+}
+
+bool portcullis::bam::RegionList::overlaps(const int32_t seq, const int32_t start, const int32_t end) const {
+	// First region on this sequence that ends after start.  As merged regions
+	// don't overlap, their ends are in the same order as their starts.
+	auto it = std::lower_bound(regions.begin(), regions.end(), GenomicRegion{seq, start, 0},
+			[](const GenomicRegion& r, const GenomicRegion& key) {
+				return r.seq != key.seq ? r.seq < key.seq : r.end <= key.start;
+			});
+	return it != regions.end() && it->seq == seq && it->start < end;
+}
+
+vector<int32_t> portcullis::bam::RegionList::getSeqs() const {
+	vector<int32_t> seqs;
+	for (const auto & r : regions) {
+		if (seqs.empty() || seqs.back() != r.seq) {
+			seqs.push_back(r.seq);
+		}
+	}
+	return seqs;
+}
+
+uint64_t portcullis::bam::RegionList::totalLength() const {
+	uint64_t total = 0;
+	for (const auto & r : regions) {
+		total += r.length();
+	}
+	return total;
+}
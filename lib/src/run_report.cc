@@ -0,0 +1,288 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <sys/resource.h>
+#include <time.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+using std::endl;
+using std::lock_guard;
+using std::ofstream;
+using std::ostream;
+using std::stringstream;
+
+#include <boost/filesystem.hpp>
+namespace bfs = boost::filesystem;
+
+#include <portcullis/instrument.hpp>
+#include <portcullis/run_report.hpp>
+using portcullis::Instrument;
+
+portcullis::RunReport portcullis::runReport;
+
+void portcullis::RunReport::begin(const string& mode) {
+	lock_guard<mutex> lock(mtx);
+	this->mode = mode;
+	openStages.clear();
+	stages.clear();
+	tasks.clear();
+	counters.clear();
+	settings.clear();
+	inputs.clear();
+	outputs.clear();
+	timer.start();
+	Instrument::reset();
+}
+
+string portcullis::RunReport::pushStage(const string& name) {
+	lock_guard<mutex> lock(mtx);
+	vector<string>& open = openStages[std::this_thread::get_id()];
+	string full = open.empty() ? name : open.back() + "/" + name;
+	open.push_back(full);
+	return full;
+}
+
+void portcullis::RunReport::popStage(StageRecord& record) {
+	lock_guard<mutex> lock(mtx);
+	auto it = openStages.find(std::this_thread::get_id());
+	if (it != openStages.end()) {
+		it->second.pop_back();
+		if (it->second.empty()) {
+			openStages.erase(it);
+		}
+	}
+	stages.push_back(record);
+}
+
+void portcullis::RunReport::addTask(const TaskRecord& task) {
+	lock_guard<mutex> lock(mtx);
+	tasks.push_back(task);
+}
+
+void portcullis::RunReport::setCounter(const string& key, uint64_t value) {
+	lock_guard<mutex> lock(mtx);
+	counters[key] = value;
+}
+
+void portcullis::RunReport::addCounter(const string& key, uint64_t delta) {
+	lock_guard<mutex> lock(mtx);
+	counters[key] += delta;
+}
+
+uint64_t portcullis::RunReport::getCounter(const string& key) const {
+	lock_guard<mutex> lock(mtx);
+	auto it = counters.find(key);
+	return it == counters.end() ? 0 : it->second;
+}
+
+void portcullis::RunReport::setSetting(const string& key, const string& value) {
+	lock_guard<mutex> lock(mtx);
+	settings[key] = value;
+}
+
+void portcullis::RunReport::addInput(const path& file) {
+	lock_guard<mutex> lock(mtx);
+	inputs.insert(file);
+}
+
+void portcullis::RunReport::addOutput(const path& file) {
+	lock_guard<mutex> lock(mtx);
+	outputs.insert(file);
+}
+
+vector<portcullis::StageRecord> portcullis::RunReport::getStages() const {
+	lock_guard<mutex> lock(mtx);
+	return stages;
+}
+
+vector<portcullis::TaskRecord> portcullis::RunReport::getTasks() const {
+	lock_guard<mutex> lock(mtx);
+	return tasks;
+}
+
+string portcullis::RunReport::escape(const string& s) {
+	stringstream ss;
+	for (char c : s) {
+		switch (c) {
+		case '"':
+			ss << "\\\"";
+			break;
+		case '\\':
+			ss << "\\\\";
+			break;
+		case '\n':
+			ss << "\\n";
+			break;
+		case '\t':
+			ss << "\\t";
+			break;
+		default:
+			if ((unsigned char)c < 0x20) {
+				ss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c << std::dec;
+			}
+			else {
+				ss << c;
+			}
+		}
+	}
+	return ss.str();
+}
+
+uint64_t portcullis::RunReport::sizeOf(const set<path>& files) {
+	uint64_t total = 0;
+	for (const auto& f : files) {
+		boost::system::error_code ec;
+		uintmax_t size = bfs::file_size(f, ec);
+		if (!ec) {
+			total += size;
+		}
+	}
+	return total;
+}
+
+void portcullis::RunReport::write(ostream& out) const {
+	lock_guard<mutex> lock(mtx);
+	boost::timer::cpu_times t = timer.elapsed();
+	// Inner stages finish first, so put them back into the order they started
+	vector<StageRecord> ordered = stages;
+	std::stable_sort(ordered.begin(), ordered.end(), [](const StageRecord& a, const StageRecord& b) {
+		return a.start < b.start;
+	});
+	out << std::fixed << std::setprecision(3);
+	out << "{" << endl
+		<< "  \"mode\": \"" << escape(mode) << "\"," << endl
+		<< "  \"version\": \"" << escape(version) << "\"," << endl
+		<< "  \"wall_s\": " << t.wall / 1e9 << "," << endl
+		<< "  \"user_s\": " << t.user / 1e9 << "," << endl
+		<< "  \"system_s\": " << t.system / 1e9 << "," << endl
+		<< "  \"peak_rss_kb\": " << peakRss() << "," << endl
+		<< "  \"bytes_read\": " << sizeOf(inputs) << "," << endl
+		<< "  \"bytes_written\": " << sizeOf(outputs) << "," << endl;
+	out << "  \"settings\": {";
+	for (auto it = settings.begin(); it != settings.end(); ++it) {
+		out << (it == settings.begin() ? "" : ",") << endl
+			<< "    \"" << escape(it->first) << "\": \"" << escape(it->second) << "\"";
+	}
+	out << (settings.empty() ? "" : "\n  ") << "}," << endl;
+	out << "  \"counters\": {";
+	for (auto it = counters.begin(); it != counters.end(); ++it) {
+		out << (it == counters.begin() ? "" : ",") << endl
+			<< "    \"" << escape(it->first) << "\": " << it->second;
+	}
+	out << (counters.empty() ? "" : "\n  ") << "}," << endl;
+	out << "  \"stages\": [";
+	for (size_t i = 0; i < ordered.size(); i++) {
+		const StageRecord& s = ordered[i];
+		out << (i == 0 ? "" : ",") << endl
+			<< "    {\"name\": \"" << escape(s.name) << "\""
+			<< ", \"start_s\": " << s.start
+			<< ", \"wall_s\": " << s.wall
+			<< ", \"user_s\": " << s.user
+			<< ", \"system_s\": " << s.system
+			<< ", \"peak_rss_kb\": " << s.peakRss;
+		if (s.records > 0) {
+			out << ", \"records\": " << s.records
+				<< ", \"records_per_s\": " << (s.wall > 0.0 ? (double)s.records / s.wall : 0.0);
+		}
+		out << "}";
+	}
+	out << (ordered.empty() ? "" : "\n  ") << "]," << endl;
+	out << "  \"tasks\": [";
+	for (size_t i = 0; i < tasks.size(); i++) {
+		const TaskRecord& k = tasks[i];
+		out << (i == 0 ? "" : ",") << endl
+			<< "    {\"stage\": \"" << escape(k.stage) << "\""
+			<< ", \"name\": \"" << escape(k.name) << "\""
+			<< ", \"wall_s\": " << k.wall
+			<< ", \"cpu_s\": " << k.cpu
+			<< ", \"records\": " << k.records
+			<< ", \"junctions\": " << k.junctions << "}";
+	}
+	out << (tasks.empty() ? "" : "\n  ") << "]" << endl
+		<< "}" << endl;
+}
+
+void portcullis::RunReport::save(const path& file) const {
+	ofstream out(file.string());
+	if (!out.is_open()) {
+		BOOST_THROW_EXCEPTION(RunReportException() << RunReportErrorInfo(string(
+								  "Could not open run report for writing: ") + file.string()));
+	}
+	write(out);
+	out.close();
+	// Profiling builds also dump their probes and trace next to the report
+	if (Instrument::enabled()) {
+		string prefix = file.string();
+		const string ext = ".report.json";
+		if (prefix.size() > ext.size() && prefix.compare(prefix.size() - ext.size(), ext.size(), ext) == 0) {
+			prefix.erase(prefix.size() - ext.size());
+		}
+		Instrument::save(prefix);
+	}
+}
+
+long portcullis::RunReport::peakRss() {
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0;
+	}
+	// ru_maxrss is reported in kB on linux but in bytes on mac
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024;
+#else
+	return usage.ru_maxrss;
+#endif
+}
+
+double portcullis::RunReport::threadCpuTime() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+		return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+	}
+#endif
+	return 0.0;
+}
+
+
+portcullis::StageTimer::StageTimer(const string& name, RunReport& report) : report(report), stopped(false) {
+	record.name = report.pushStage(name);
+	record.start = report.elapsed();
+	timer.start();
+}
+
+portcullis::StageTimer::~StageTimer() {
+	stop();
+}
+
+void portcullis::StageTimer::stop() {
+	if (stopped) {
+		return;
+	}
+	stopped = true;
+	boost::timer::cpu_times t = timer.elapsed();
+	record.wall = t.wall / 1e9;
+	record.user = t.user / 1e9;
+	record.system = t.system / 1e9;
+	record.peakRss = RunReport::peakRss();
+	report.popStage(record);
+}
@@ -15,14 +15,21 @@
 //  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
 //  *******************************************************************
 
+#include <algorithm>
 #include <iostream>
+#include <memory>
 #include <random>
 using std::cout;
 using std::endl;
+using std::make_shared;
+using std::shared_ptr;
 
 #include <portcullis/ml/knn.hpp>
 using portcullis::ml::KNN;
 
+#include <portcullis/run_report.hpp>
+using portcullis::StageTimer;
+
 #include <portcullis/ml/smote.hpp>
 
 portcullis::ml::Smote::Smote(uint16_t defaultK, uint16_t _smoteness, uint16_t _threads, double* _data, size_t _rows, size_t _cols) {
@@ -36,26 +43,51 @@ portcullis::ml::Smote::Smote(uint16_t defaultK, uint16_t _smoteness, uint16_t _t
 	smoteness = _smoteness < 1 ? 1 : _smoteness;
 	threads = _threads;
 	verbose = false;
+	graph = nullptr;
+	label = false;
 	s_rows = smoteness * rows;
 	synthetic = new double[s_rows * cols];
 }
 
+portcullis::ml::Smote::Smote(const NeighbourGraph& _graph, bool _label, uint16_t _smoteness) {
+	data = _graph.getData();
+	rows = _graph.getNbRows();
+	cols = _graph.getNbCols();
+	k = _graph.getK();
+	smoteness = _smoteness < 1 ? 1 : _smoteness;
+	threads = _graph.getThreads();
+	verbose = false;
+	graph = &_graph;
+	label = _label;
+	s_rows = smoteness * _graph.getNbRows(_label);
+	synthetic = new double[s_rows * cols];
+}
+
 void portcullis::ml::Smote::execute() {
 	auto_cpu_timer timer(1, "SMOTE Time taken: %ws\n\n");
+	StageTimer stage("smote");
 	if (verbose) {
 		cout << "Starting Synthetic Minority Oversampling Technique (SMOTE)" << endl;
 	}
 	uint32_t new_index = 0;
-	KNN knn(k, threads, data, rows, cols);
-	knn.setVerbose(verbose);
-	knn.execute();
+	// Only run KNN if we weren't given a precomputed neighbour graph
+	shared_ptr<KNN> knn = nullptr;
+	if (graph == nullptr) {
+		knn = make_shared<KNN>(k, threads, data, rows, cols);
+		knn->setVerbose(verbose);
+		knn->execute();
+	}
 	std::mt19937 rng(12345);
-	std::uniform_int_distribution<uint16_t> igen(0, k-1);
 	std::uniform_real_distribution<double> dgen(0, 1);
 	for (size_t i = 0; i < rows; i++) {
+		if (graph != nullptr && graph->getLabel(i) != label) {
+			continue;
+		}
+		const uint32_t* nns = graph == nullptr ? knn->getNNs(i) : graph->getNNs(i, label);
+		const uint16_t nbNNs = graph == nullptr ? k : std::min(k, graph->getNbNNs(i, label));
+		std::uniform_int_distribution<uint16_t> igen(0, nbNNs - 1);
 		uint16_t N = smoteness;
 		while (N > 0) {
-			const vector<uint32_t> nns = knn.getNNs(i);
 			uint32_t nn = nns[igen(rng)];    // Nearest neighbour row index
 			for (size_t j = 0; j < cols; j++) {
 				double dif = data[(nn * cols) + j] - data[(i * cols) + j];
@@ -71,6 +103,9 @@ void portcullis::ml::Smote::execute() {
 void portcullis::ml::Smote::print(ostream& out) const {
 	out << "Input:" << endl;
 	for (size_t i = 0; i < rows; i++) {
+		if (graph != nullptr && graph->getLabel(i) != label) {
+			continue;
+		}
 		for (size_t j = 0; j < cols; j++) {
 			out << data[(i * cols) + j] << " ";
 		}
@@ -0,0 +1,171 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <fstream>
+#include <string>
+#include <vector>
+using std::endl;
+using std::ifstream;
+using std::ofstream;
+using std::string;
+using std::vector;
+
+#include <boost/exception/all.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/lexical_cast.hpp>
+using boost::filesystem::path;
+using boost::lexical_cast;
+
+#include <htslib/bgzf.h>
+#include <htslib/sam.h>
+
+#include <portcullis/bam/spliced_index.hpp>
+
+
+portcullis::bam::SplicedBlockIndex portcullis::bam::SplicedBlockIndex::build(const path& bamFile) {
+	SplicedBlockIndex idx;
+	BGZF* fp = bgzf_open(bamFile.c_str(), "r");
+	if (fp == NULL) {
+		BOOST_THROW_EXCEPTION(SplicedIndexException() << SplicedIndexErrorInfo(string(
+								  "Could not open BAM file: ") + bamFile.string()));
+	}
+	bam_hdr_t* header = bam_hdr_read(fp);
+	if (header == NULL) {
+		bgzf_close(fp);
+		BOOST_THROW_EXCEPTION(SplicedIndexException() << SplicedIndexErrorInfo(string(
+								  "Could not read header from BAM file: ") + bamFile.string()));
+	}
+	idx.refs.resize(header->n_targets);
+	bam1_t* b = bam_init1();
+	// Unspliced alignments since the last range.  These only count as outside
+	// of the ranges if the next spliced alignment starts a new range.
+	SplicedRefIndex pending;
+	int32_t lastTid = -1;
+	int64_t start = bgzf_tell(fp);
+	while (bam_read1(fp, b) >= 0) {
+		const int64_t end = bgzf_tell(fp);
+		const int32_t tid = b->core.tid;
+		if (tid < 0) {
+			// Unplaced alignments are at the end of a sorted BAM
+			break;
+		}
+		if (tid != lastTid) {
+			if (lastTid >= 0) {
+				idx.refs[lastTid].addUnspliced(pending);
+			}
+			pending = SplicedRefIndex();
+			lastTid = tid;
+		}
+		bool spliced = false;
+		const uint32_t* cigar = bam_get_cigar(b);
+		for (uint32_t i = 0; i < b->core.n_cigar; i++) {
+			if (bam_cigar_op(cigar[i]) == BAM_CREF_SKIP) {
+				spliced = true;
+				break;
+			}
+		}
+		if (spliced) {
+			vector<hts_pair64_t>& ranges = idx.refs[tid].ranges;
+			// Seeking back into the block the last range ended in would mean
+			// inflating it again, so extend the range instead
+			if (!ranges.empty() && (ranges.back().v >> 16) == ((uint64_t) start >> 16)) {
+				ranges.back().v = end;
+			}
+			else {
+				idx.refs[tid].addUnspliced(pending);
+				ranges.push_back({(uint64_t) start, (uint64_t) end});
+			}
+			pending = SplicedRefIndex();
+		}
+		else {
+			pending.addUnspliced(b->core.l_qseq);
+		}
+		start = end;
+	}
+	if (lastTid >= 0) {
+		idx.refs[lastTid].addUnspliced(pending);
+	}
+	bam_destroy1(b);
+	bam_hdr_destroy(header);
+	bgzf_close(fp);
+	idx.bamSize = boost::filesystem::file_size(bamFile);
+	idx.bamTime = boost::filesystem::last_write_time(bamFile);
+	return idx;
+}
+
+void portcullis::bam::SplicedBlockIndex::save(const path& file) const {
+	ofstream out(file.string());
+	if (!out) {
+		BOOST_THROW_EXCEPTION(SplicedIndexException() << SplicedIndexErrorInfo(string(
+								  "Could not open spliced index for writing: ") + file.string()));
+	}
+	out << SPLICED_INDEX_MAGIC << "\t" << SPLICED_INDEX_VERSION << endl
+		<< "bam_size\t" << bamSize << endl
+		<< "bam_time\t" << bamTime << endl
+		<< "targets\t" << refs.size() << endl;
+	// One line per target: unspliced count, sum, min and max query length
+	// outside of the ranges, then the number of ranges and their offsets
+	for (size_t i = 0; i < refs.size(); i++) {
+		const SplicedRefIndex& r = refs[i];
+		out << i << "\t" << r.unsplicedCount << "\t" << r.sumQueryLengths << "\t"
+			<< r.minQueryLength << "\t" << r.maxQueryLength << "\t" << r.ranges.size();
+		for (const auto & range : r.ranges) {
+			out << "\t" << range.u << "\t" << range.v;
+		}
+		out << endl;
+	}
+	out.close();
+}
+
+void portcullis::bam::SplicedBlockIndex::load(const path& file) {
+	ifstream in(file.string());
+	string magic, key;
+	uint32_t version = 0;
+	size_t nbTargets = 0;
+	in >> magic >> version;
+	if (!in || magic != SPLICED_INDEX_MAGIC || version != SPLICED_INDEX_VERSION) {
+		BOOST_THROW_EXCEPTION(SplicedIndexException() << SplicedIndexErrorInfo(string(
+								  "Not a spliced index, or from an incompatible version of portcullis: ") + file.string()));
+	}
+	in >> key >> bamSize >> key >> bamTime >> key >> nbTargets;
+	refs.assign(nbTargets, SplicedRefIndex());
+	for (size_t i = 0; i < nbTargets; i++) {
+		size_t seq = 0, nbRanges = 0;
+		in >> seq;
+		if (!in || seq != i) {
+			BOOST_THROW_EXCEPTION(SplicedIndexException() << SplicedIndexErrorInfo(string(
+									  "Corrupt spliced index: ") + file.string()));
+		}
+		SplicedRefIndex& r = refs[i];
+		in >> r.unsplicedCount >> r.sumQueryLengths >> r.minQueryLength >> r.maxQueryLength >> nbRanges;
+		r.ranges.resize(nbRanges);
+		for (auto & range : r.ranges) {
+			in >> range.u >> range.v;
+		}
+	}
+	if (!in) {
+		BOOST_THROW_EXCEPTION(SplicedIndexException() << SplicedIndexErrorInfo(string(
+								  "Corrupt spliced index: ") + file.string()));
+	}
+}
+
+bool portcullis::bam::SplicedBlockIndex::matches(const path& bamFile) const {
+	return boost::filesystem::exists(bamFile) &&
+		   boost::filesystem::file_size(bamFile) == bamSize &&
+		   boost::filesystem::last_write_time(bamFile) == bamTime;
+}
@@ -0,0 +1,221 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <utility>
+using std::cout;
+using std::endl;
+using std::max;
+using std::min;
+using std::pair;
+using std::set;
+
+#include <boost/algorithm/string.hpp>
+#include <boost/exception/all.hpp>
+
+#include <portcullis/bam/bam_reader.hpp>
+#include <portcullis/bam/genome_mapper.hpp>
+using portcullis::bam::BamException;
+using portcullis::bam::BamErrorInfo;
+using portcullis::bam::BamReader;
+using portcullis::bam::GenomeMapper;
+
+#include <portcullis/strand_sampler.hpp>
+
+uint64_t portcullis::StrandSample::informativeReads() const {
+	return (uint64_t)counts.r1PosWhenSsPos + counts.r1NegWhenSsPos + counts.r2PosWhenSsPos + counts.r2NegWhenSsPos +
+		   counts.r1PosWhenSsNeg + counts.r1NegWhenSsNeg + counts.r2PosWhenSsNeg + counts.r2NegWhenSsNeg;
+}
+
+portcullis::StrandSampler::StrandSampler(const path& _bamFile, const path& _genomeFile) {
+	bamFile = _bamFile;
+	genomeFile = _genomeFile;
+	windowSize = DEFAULT_STRAND_WINDOW_SIZE;
+	minReads = DEFAULT_STRAND_MIN_READS;
+	maxReads = DEFAULT_STRAND_MAX_READS;
+	maxWindows = DEFAULT_STRAND_MAX_WINDOWS;
+	verbose = false;
+}
+
+double portcullis::StrandSampler::vanDerCorput(uint32_t n) {
+	double q = 0.0;
+	double bk = 0.5;
+	while (n > 0) {
+		if (n & 1) q += bk;
+		n >>= 1;
+		bk /= 2.0;
+	}
+	return q;
+}
+
+void portcullis::StrandSampler::decide(StrandSample& s) {
+	StrandCounts counts = s.counts;
+	if (s.pairedReads == 0) {
+		counts.r1PosWhenSsPos += counts.r2PosWhenSsPos;
+		counts.r1NegWhenSsPos += counts.r2NegWhenSsPos;
+		counts.r1PosWhenSsNeg += counts.r2PosWhenSsNeg;
+		counts.r1NegWhenSsNeg += counts.r2NegWhenSsNeg;
+		counts.r2PosWhenSsPos = counts.r2NegWhenSsPos = counts.r2PosWhenSsNeg = counts.r2NegWhenSsNeg = 0;
+	}
+	std::pair<Orientation, Strandedness> config = JunctionSystem::determineStrandedness(counts, false);
+	Orientation o = config.first;
+	Strandedness st = config.second;
+	const uint64_t pairs = s.pairsFR + s.pairsRF + s.pairsFF;
+	if (o != Orientation::SE && pairs > 0) {
+		const Orientation geometry =
+			s.pairsFR >= s.pairsRF && s.pairsFR >= s.pairsFF ? Orientation::FR :
+			s.pairsRF >= s.pairsFF ? Orientation::RF :
+			Orientation::FF;
+		const bool sameStrandMates = geometry == Orientation::FF;
+		if (st == Strandedness::FIRSTSTRAND || st == Strandedness::SECONDSTRAND) {
+			if (sameStrandMates != (o == Orientation::FF)) {
+				// Read strands and pair geometry tell different stories
+				st = Strandedness::UNKNOWN;
+			}
+			else if (geometry == Orientation::RF) {
+				// calcStrand names the RF protocols from the other mate
+				st = st == Strandedness::FIRSTSTRAND ? Strandedness::SECONDSTRAND : Strandedness::FIRSTSTRAND;
+			}
+		}
+		o = geometry;
+	}
+	s.orientation = o;
+	s.strandedness = st;
+}
+
+portcullis::StrandSample portcullis::StrandSampler::sample() const {
+	StrandSample s;
+	BamReader reader(bamFile);
+	reader.open();
+	if (!reader.isIndexed()) {
+		BOOST_THROW_EXCEPTION(BamException() << BamErrorInfo(string(
+								  "Strand sampling requires an indexed BAM: ") + bamFile.string()));
+	}
+	GenomeMapper gmap(genomeFile);
+	gmap.loadFastaIndex();
+	shared_ptr<RefSeqPtrList> refs = reader.createRefList();
+	// Weight target sequences by mapped reads, or by length if the index
+	// doesn't say
+	vector<double> cumulative;
+	double total = 0.0;
+	bool haveStats = true;
+	for (auto & ref : *refs) {
+		uint64_t mapped = 0;
+		uint64_t unmapped = 0;
+		if (!reader.getIndexStats(ref->index, mapped, unmapped)) {
+			haveStats = false;
+			break;
+		}
+		total += mapped;
+		cumulative.push_back(total);
+	}
+	if (!haveStats || total == 0.0) {
+		cumulative.clear();
+		total = 0.0;
+		for (auto & ref : *refs) {
+			total += ref->length;
+			cumulative.push_back(total);
+		}
+	}
+	if (total == 0.0) {
+		reader.close();
+		return s;
+	}
+	set<pair<int32_t, int32_t>> seen;
+	vector<pair<Orientation, Strandedness>> history;
+	// Small genomes run out of distinct windows before the window limit, so
+	// bound the number of points tried too
+	const uint64_t maxPoints = (uint64_t)maxWindows * 16;
+	for (uint64_t n = 1; n <= maxPoints && s.windows < maxWindows && s.splicedReads < maxReads; n++) {
+		const double target = vanDerCorput(n) * total;
+		const size_t r = std::upper_bound(cumulative.begin(), cumulative.end(), target) - cumulative.begin();
+		if (r >= refs->size()) continue;
+		const RefSeqPtr ref = refs->at(r);
+		const double before = r == 0 ? 0.0 : cumulative[r - 1];
+		const double weight = cumulative[r] - before;
+		if (weight <= 0.0 || ref->length == 0) continue;
+		const int64_t length = ref->length;
+		const int64_t centre = (int64_t)((target - before) / weight * length);
+		const int32_t bin = (int32_t)(centre / windowSize);
+		if (!seen.insert(std::make_pair(ref->index, bin)).second) continue;
+		const int32_t start = (int32_t)max((int64_t)0, centre - windowSize / 2);
+		const int32_t end = (int32_t)min(length, (int64_t)start + windowSize);
+		JunctionSystem js(refs);
+		js.setOwnedRange(start, end);
+		js.setMaxAlignments(1);
+		reader.setRegion(ref->index, start, end);
+		uint64_t windowReads = 0;
+		while (reader.next() && s.splicedReads < maxReads) {
+			const BamAlignment& al = reader.current();
+			if (!al.isMapped() || !al.isPrimaryAlignment() || al.getPosition() < start) continue;
+			if (al.isPaired()) {
+				s.pairedReads++;
+			}
+			else {
+				s.unpairedReads++;
+			}
+			// Pair geometry, judged from the leftmost mate
+			if (al.isPaired() && al.isMateMapped() && al.getMateReferenceId() == al.getReferenceId() &&
+					al.getPosition() < al.getMatePos()) {
+				if (al.isReverseStrand() == al.isMateReverseStrand()) {
+					s.pairsFF++;
+				}
+				else if (al.isReverseStrand()) {
+					s.pairsRF++;
+				}
+				else {
+					s.pairsFR++;
+				}
+			}
+			if (al.isSplicedRead() && js.addJunctions(al)) {
+				s.splicedReads++;
+				windowReads++;
+			}
+		}
+		for (auto & j : js.getJunctions()) {
+			const string& name = j->getIntron()->ref.name;
+			string donor = gmap.fetchBases(name.c_str(), j->getIntron()->start, j->getIntron()->start + 1);
+			string acceptor = gmap.fetchBases(name.c_str(), j->getIntron()->end - 1, j->getIntron()->end);
+			if (donor.length() != 2 || acceptor.length() != 2) continue;
+			boost::to_upper(donor);
+			boost::to_upper(acceptor);
+			j->setDonorAndAcceptorMotif(donor, acceptor);
+		}
+		js.addStrandCounts(s.counts);
+		s.windows++;
+		decide(s);
+		history.push_back(std::make_pair(s.orientation, s.strandedness));
+		if (verbose) {
+			cout << " - " << ref->name << ":" << start << "-" << end << "\t" << windowReads << " spliced reads; "
+				 << orientationToString(s.orientation) << ", " << strandednessToString(s.strandedness) << endl;
+		}
+		if (s.informativeReads() >= minReads && history.size() >= STRAND_STABLE_WINDOWS) {
+			bool stable = true;
+			for (size_t i = history.size() - STRAND_STABLE_WINDOWS; i < history.size(); i++) {
+				stable = stable && history[i] == history.back();
+			}
+			if (stable) {
+				s.converged = true;
+				break;
+			}
+		}
+	}
+	reader.close();
+	return s;
+}
@@ -0,0 +1,107 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <algorithm>
+#include <random>
+using std::min;
+
+#include <portcullis/ml/stratified_sampler.hpp>
+
+size_t portcullis::ml::StratifiedSampler::intronSizeBin(uint32_t intronSize) {
+	size_t bin = 0;
+	while (intronSize > 1 && bin < STRATIFIED_INTRON_BINS - 1) {
+		intronSize >>= 1;
+		bin++;
+	}
+	return bin;
+}
+
+size_t portcullis::ml::StratifiedSampler::stratumOf(const Junction& j) {
+	return intronSizeBin(j.getIntronSize()) * STRATIFIED_SS_TYPES + static_cast<size_t>(j.getSpliceSiteType());
+}
+
+size_t portcullis::ml::StratifiedSampler::capFor(const vector<size_t>& strataSizes, size_t budget) {
+	vector<size_t> sizes;
+	for (auto s : strataSizes) {
+		if (s > 0) sizes.push_back(s);
+	}
+	std::sort(sizes.begin(), sizes.end());
+	// Water filling: strata smaller than an equal share of what is left are
+	// kept whole, the rest share the remainder equally
+	size_t remaining = budget;
+	for (size_t i = 0; i < sizes.size(); i++) {
+		const size_t share = remaining / (sizes.size() - i);
+		if (sizes[i] > share) {
+			return share;
+		}
+		remaining -= sizes[i];
+	}
+	return sizes.empty() ? 0 : sizes.back();
+}
+
+void portcullis::ml::StratifiedSampler::sample(const JunctionList& in, size_t budget, JunctionList& sampled, JunctionList& heldOut) const {
+	if (budget >= in.size()) {
+		sampled.insert(sampled.end(), in.begin(), in.end());
+		return;
+	}
+	if (budget == 0) {
+		heldOut.insert(heldOut.end(), in.begin(), in.end());
+		return;
+	}
+	// Counting sort of junction indices by stratum
+	vector<size_t> stratum(in.size());
+	vector<size_t> sizes(STRATIFIED_NB_STRATA, 0);
+	for (size_t i = 0; i < in.size(); i++) {
+		stratum[i] = stratumOf(*in[i]);
+		sizes[stratum[i]]++;
+	}
+	vector<size_t> offsets(STRATIFIED_NB_STRATA + 1, 0);
+	for (size_t s = 0; s < STRATIFIED_NB_STRATA; s++) {
+		offsets[s + 1] = offsets[s] + sizes[s];
+	}
+	vector<size_t> indices(in.size());
+	vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < in.size(); i++) {
+		indices[fill[stratum[i]]++] = i;
+	}
+	// Keep small strata whole, pick cap indices at random from the others
+	const size_t cap = capFor(sizes, budget);
+	vector<bool> keep(in.size(), false);
+	std::mt19937 rng(seed);
+	for (size_t s = 0; s < STRATIFIED_NB_STRATA; s++) {
+		size_t* first = indices.data() + offsets[s];
+		const size_t n = sizes[s];
+		const size_t k = min(n, cap);
+		for (size_t i = 0; i < k; i++) {
+			if (k < n) {
+				std::uniform_int_distribution<size_t> gen(i, n - 1);
+				std::swap(first[i], first[gen(rng)]);
+			}
+			keep[first[i]] = true;
+		}
+	}
+	sampled.reserve(sampled.size() + budget);
+	heldOut.reserve(heldOut.size() + in.size() - budget);
+	for (size_t i = 0; i < in.size(); i++) {
+		if (keep[i]) {
+			sampled.push_back(in[i]);
+		}
+		else {
+			heldOut.push_back(in[i]);
+		}
+	}
+}
@@ -16,15 +16,24 @@
 //  *******************************************************************
 
 #include <sys/ioctl.h>
+#include <algorithm>
+#include <condition_variable>
 #include <fstream>
+#include <mutex>
 #include <string>
 #include <iostream>
+#include <thread>
 #include <vector>
 using std::boolalpha;
+using std::condition_variable;
 using std::cout;
 using std::endl;
 using std::ifstream;
+using std::min;
+using std::mutex;
 using std::string;
+using std::thread;
+using std::unique_lock;
 using std::vector;
 
 #include <boost/exception/all.hpp>
@@ -38,8 +47,16 @@ namespace po = boost::program_options;
 
 #include <portcullis/bam/bam_reader.hpp>
 #include <portcullis/bam/bam_writer.hpp>
+#include <portcullis/bam/cigar_editor.hpp>
 using namespace portcullis::bam;
 
+#include <portcullis/instrument.hpp>
+#include <portcullis/run_report.hpp>
+using portcullis::RunReport;
+using portcullis::StageTimer;
+using portcullis::TaskRecord;
+using portcullis::runReport;
+
 #include "bam_filter.hpp"
 
 
@@ -53,197 +70,400 @@ portcullis::BamFilter::BamFilter(const path& _junctionFile, const path& _bamFile
 	clipMode = ClipMode::HARD;
 	saveMSRs = false;
 	useCsi = false;
+	threads = DEFAULT_BAMFILT_THREADS;
+	regionSize = DEFAULT_BAMFILT_REGION_SIZE;
+	toStdout = false;
+	sam = false;
+	level = -1;
 	// Test if provided genome exists
 	if (!bfs::exists(junctionFile)) {
 		BOOST_THROW_EXCEPTION(BamFilterException() << BamFilterErrorInfo(string(
 								  "Could not find junction file at: ") + junctionFile.string()));
 	}
-	// Test if provided BAM exists
-	if (!bfs::exists(bamFile)) {
+	// Test if provided BAM exists, unless we are reading from standard input
+	if (bamFile.string() != "-" && !bfs::exists(bamFile)) {
 		BOOST_THROW_EXCEPTION(BamFilterException() << BamFilterErrorInfo(string(
 								  "Could not find BAM file at: ") + bamFile.string()));
 	}
 }
 
 /**
- * Checks a given alignment to see if it exists in the given junction system
+ * Checks a given alignment to see if it exists in the given junction lookup
  * @param al Alignment to check
- * @param refs References
- * @param js The junction system containing good junctions to keep
- * @return Whether or not the alignment contains a junction found in the junction system
+ * @param lookup The good junctions to keep
+ * @return Whether or not the alignment contains a junction found in the lookup
  */
-bool portcullis::BamFilter::containsJunctionInSystem(const BamAlignment& al, const RefSeqPtrList& refs, JunctionSystem& js) {
-	int32_t refId = al.getReferenceId();
-	string refName = refs[refId]->name;
-	int32_t refLength = refs[refId]->length;
-	int32_t lStart = al.getPosition();
-	int32_t lEnd = lStart;
-	int32_t rStart = lStart;
-	//int32_t rEnd = lStart;
-	for (size_t i = 0; i < al.getNbCigarOps(); i++) {
-		CigarOp op = al.getCigarOpAt(i);
-		if (op.type == BAM_CIGAR_REFSKIP_CHAR) {
-			rStart = lEnd + op.length;
-			// Create the intron
-			shared_ptr<Intron> location = make_shared<Intron>(RefSeq(refId, refName, refLength), lEnd, rStart - 1);
-			if (js.getJunction(*location) != nullptr) {
-				// Break out of the loop leaving write set to true
-				return true;
+bool portcullis::BamFilter::containsJunctionInSystem(const BamAlignment& al, const JunctionLookup& lookup) {
+	return lookup.containsAny(al.getRaw());
+}
+
+bool portcullis::BamFilter::clipMSR(const bam1_t* b, const JunctionLookup& lookup, uint32_t& firstKept, uint32_t& lastKept) const {
+	const uint32_t* cigar = bam_get_cigar(b);
+	const uint32_t nbOps = b->core.n_cigar;
+	int32_t pos = b->core.pos;
+	// Index of the N op before the current anchor, or -1 for the first anchor
+	int64_t prevSkip = -1;
+	bool found = false;
+	for (uint32_t i = 0; i < nbOps; i++) {
+		const int op = bam_cigar_op(cigar[i]);
+		const int32_t len = bam_cigar_oplen(cigar[i]);
+		if (op == BAM_CREF_SKIP) {
+			if (lookup.intronAt(b->core.tid, pos, len)) {
+				// Keep from the left anchor of the first good junction...
+				if (!found) {
+					firstKept = prevSkip + 1;
+					found = true;
+				}
+				// ... up to the right anchor of the last good junction
+				lastKept = nbOps - 1;
+				for (uint32_t j = i + 1; j < nbOps; j++) {
+					if (bam_cigar_op(cigar[j]) == BAM_CREF_SKIP) {
+						lastKept = j - 1;
+						break;
+					}
+				}
 			}
+			prevSkip = i;
 		}
-		else if (CigarOp::opConsumesReference(op.type)) {
-			lEnd += op.length;
+		if (bam_cigar_type(op) & 2) {
+			pos += len;
 		}
 	}
-	return false;
+	return found;
 }
 
-BamAlignmentPtr portcullis::BamFilter::clipMSR(const BamAlignment& al, const RefSeqPtrList& refs, JunctionSystem& js, bool& allBad) {
-	int32_t refId = al.getReferenceId();
-	string refName = refs[refId]->name;
-	int32_t refLength = refs[refId]->length;
-	int32_t lStart = al.getPosition();
-	int32_t lEnd = lStart;
-	int32_t rStart = lStart;
-	//int32_t rEnd = lStart;
-	size_t opStart = 0;
-	bool lastGood = false;
-	bool ab = true;
-	BamAlignmentPtr modifiedAlignment = make_shared<BamAlignment>(al);
-	const char modOp = clipMode == ClipMode::HARD ? BAM_CIGAR_HARDCLIP_CHAR :
-					   clipMode == ClipMode::SOFT ? BAM_CIGAR_SOFTCLIP_CHAR :
-					   BAM_CIGAR_DEL_CHAR;
-	for (size_t i = 0; i < al.getNbCigarOps(); i++) {
-		CigarOp op = al.getCigarOpAt(i);
-		if (op.type == BAM_CIGAR_REFSKIP_CHAR) {
-			rStart = lEnd + op.length;
-			// Create the intron
-			shared_ptr<Intron> location = make_shared<Intron>(RefSeq(refId, refName, refLength), lEnd, rStart - 1);
-			if (js.getJunction(*location) != nullptr) {
-				// Found a good junction, so region from start should be left as is, reset start to after junction
-				ab = false;
-				lastGood = true;
+template<typename W>
+void portcullis::BamFilter::filterAlignment(const BamAlignment& al, const RegionTask* task, const JunctionLookup& lookup,
+		ClipReorderBuffer& pending, W& out, W& mod, W& unmod, FilterCounts& counts) {
+	bam1_t* b = al.getRaw();
+	// Alignments starting before the region are only of interest if clipping
+	// moves their start into it
+	const bool inRegion = task == nullptr || task->tid < 0 || b->core.pos >= task->start;
+	const bool clippable = al.isSplicedRead() && clipMode != ClipMode::COMPLETE && al.isMultiplySplicedRead();
+	if (!inRegion && !clippable) {
+		return;
+	}
+	if (inRegion) {
+		counts.nbReadsIn++;
+	}
+	if (clippable) {
+		// We are in HARD or SOFT clip mode and this is an MSR
+		uint32_t firstKept = 0;
+		uint32_t lastKept = 0;
+		if (!clipMSR(b, lookup, firstKept, lastKept)) {
+			return;
+		}
+		const bool clipped = firstKept > 0 || lastKept + 1 < b->core.n_cigar;
+		const int32_t start = b->core.pos + CigarEditor::referenceLength(b, 0, firstKept);
+		// Written by the region that holds its clipped start
+		if (task != nullptr && task->tid >= 0 && (start < task->start || start >= task->end)) {
+			return;
+		}
+		if (clipped) {
+			if (saveMSRs) {
+				unmod.write(b);
 			}
-			else {
-				if (lastGood) {
-					opStart = i;
-				}
-				for (size_t j = opStart; j < i; j++) {
-					modifiedAlignment->setCigarOpAt(j, CigarOp(modOp, al.getCigarOpAt(j).length));
-				}
-				lastGood = false;
+			CigarEditor::clip(b, firstKept, lastKept, clipMode == ClipMode::HARD);
+			if (saveMSRs) {
+				mod.write(b);
 			}
-			opStart = i + 1;
+			counts.nbReadsModifiedOut++;
+		}
+		counts.nbReadsOut++;
+		if (firstKept > 0) {
+			// The start moved right, so hold it back until the reads before it are out
+			pending.push(b);
+			return;
+		}
+	}
+	// If we are in complete clip mode, or this is a single spliced read, then keep the alignment
+	// if its junction is found in the junctions system, otherwise discard it
+	else if (al.isSplicedRead()) {
+		if (!containsJunctionInSystem(al, lookup)) {
+			return;
+		}
+		counts.nbReadsOut++;
+	}
+	// Unspliced read so add it to the output
+	else {
+		counts.nbReadsOut++;
+	}
+	pending.flushTo(b->core.tid, b->core.pos, out);
+	out.write(b);
+}
+
+vector<portcullis::BamFilter::RegionTask> portcullis::BamFilter::createRegionTasks(bam_hdr_t* header) const {
+	vector<RegionTask> tasks;
+	if (!targetRegions.empty()) {
+		for (const int32_t seq : targetRegions.getSeqs()) {
+			tasks.push_back(RegionTask{seq, 0, (int32_t) header->target_len[seq]});
 		}
-		else if (CigarOp::opConsumesReference(op.type)) {
-			lEnd += op.length;
+		return tasks;
+	}
+	for (int32_t i = 0; i < header->n_targets; i++) {
+		const int32_t len = header->target_len[i];
+		for (int64_t start = 0; start < len; start += regionSize) {
+			tasks.push_back(RegionTask{i, (int32_t)start, (int32_t)min<int64_t>(start + regionSize, len)});
 		}
 	}
-	if (!lastGood) {
-		for (size_t j = opStart; j < al.getNbCigarOps(); j++) {
-			modifiedAlignment->setCigarOpAt(j, CigarOp(modOp, al.getCigarOpAt(j).length));
+	// Unplaced reads come last in a coordinate sorted BAM
+	tasks.push_back(RegionTask{HTS_IDX_NOCOOR, 0, 0});
+	return tasks;
+}
+
+void portcullis::BamFilter::filterRegion(BamReader& reader, const RegionTask& task, const JunctionLookup& lookup,
+		RegionResult& result) {
+	cpu_timer timer;
+	double cpuStart = RunReport::threadCpuTime();
+	ClipReorderBuffer pending;
+	if (!targetRegions.empty()) {
+		reader.setRegions(targetRegions.getRegions(task.tid));
+	}
+	else {
+		reader.setRegion(task.tid, task.start, task.end);
+	}
+	while (reader.next()) {
+		const BamAlignment& al = reader.current();
+		// htslib may start the unplaced iterator from the beginning of the file
+		// if the last target has no alignments
+		if (task.tid < 0 && al.getReferenceId() >= 0) {
+			continue;
 		}
+		filterAlignment(al, &task, lookup, pending, result.out, result.mod, result.unmod, result.counts);
 	}
-	allBad = ab;
-	return modifiedAlignment;
+	pending.flush(result.out);
+	result.out.flush();
+	result.mod.flush();
+	result.unmod.flush();
+	TaskRecord record;
+	record.stage = "filter";
+	record.name = task.tid < 0 ? string("*") :
+				  string(reader.getHeader()->target_name[task.tid]) + ":" + lexical_cast<string>(task.start) + "-" + lexical_cast<string>(task.end);
+	record.wall = timer.elapsed().wall / 1e9;
+	record.cpu = RunReport::threadCpuTime() - cpuStart;
+	record.records = result.counts.nbReadsIn;
+	runReport.addTask(record);
 }
 
+void portcullis::BamFilter::filterSerial(BamReader& reader, const JunctionLookup& lookup,
+		BamWriter& writer, BamWriter& mod, BamWriter& unmod, FilterCounts& counts) {
+	ClipReorderBuffer pending;
+	while (reader.next()) {
+		filterAlignment(reader.current(), nullptr, lookup, pending, writer, mod, unmod, counts);
+	}
+	pending.flush(writer);
+}
+
+void portcullis::BamFilter::filterParallel(bam_hdr_t* header, const JunctionLookup& lookup,
+		BamWriter& writer, BamWriter& mod, BamWriter& unmod, FilterCounts& counts) {
+	const vector<RegionTask> tasks = createRegionTasks(header);
+	// Only a bounded number of regions may be in flight at once, so memory use
+	// doesn't depend on how far the workers get ahead of the writer.  Result
+	// buffers are recycled round robin so they aren't reallocated for each region.
+	const size_t window = (size_t)threads * 4;
+	vector<RegionResult> results(window);
+	for (auto& r : results) {
+		r.setLevel(level);
+	}
+	mutex mtx;
+	condition_variable taskDone;
+	condition_variable slotFree;
+	size_t nextTask = 0;
+	size_t written = 0;
+	auto worker = [&]() {
+		PORTCULLIS_THREAD_NAME("bamfilt worker");
+		BamReader reader(bamFile);
+		reader.open();
+		while (true) {
+			size_t id;
+			{
+				// Covers contention on the mutex and waiting for the writer to free a slot
+				PORTCULLIS_TRACE("wait", "queue");
+				unique_lock<mutex> lock(mtx);
+				if (nextTask >= tasks.size()) {
+					break;
+				}
+				id = nextTask++;
+				slotFree.wait(lock, [&] {
+					return id < written + window;
+				});
+			}
+			RegionResult& result = results[id % window];
+			PORTCULLIS_TRACE("region " + lexical_cast<string>(id), "task");
+			filterRegion(reader, tasks[id], lookup, result);
+			{
+				unique_lock<mutex> lock(mtx);
+				result.done = true;
+			}
+			taskDone.notify_all();
+		}
+		reader.close();
+	};
+	vector<thread> pool;
+	for (uint16_t i = 0; i < threads; i++) {
+		pool.emplace_back(worker);
+	}
+	// Write out regions in coordinate order as they complete
+	for (size_t id = 0; id < tasks.size(); id++) {
+		RegionResult& result = results[id % window];
+		{
+			PORTCULLIS_TRACE("wait", "queue");
+			unique_lock<mutex> lock(mtx);
+			taskDone.wait(lock, [&] {
+				return result.done;
+			});
+		}
+		{
+			PORTCULLIS_TRACE("write", "output");
+			writer.write(result.out);
+			if (saveMSRs) {
+				mod.write(result.mod);
+				unmod.write(result.unmod);
+			}
+		}
+		counts.add(result.counts);
+		{
+			unique_lock<mutex> lock(mtx);
+			result.clear();
+			written++;
+		}
+		slotFree.notify_all();
+	}
+	for (thread& t : pool) {
+		t.join();
+	}
+}
 
 void portcullis::BamFilter::filter() {
 	cout << "Loading junctions from: " << junctionFile << endl;
-	// Load junction system
-	JunctionSystem js(junctionFile);
-	cout << " - Found " << js.size() << " junctions" << endl << endl;
+	// Alignments are only checked against the junction locations, so keep a
+	// compact read only lookup and let the full junction system go
+	JunctionLookup lookup;
+	{
+		StageTimer stage("loadJunctions");
+		JunctionSystem js(junctionFile);
+		cout << " - Found " << js.size() << " junctions" << endl << endl;
+		lookup = JunctionLookup(js.getJunctions());
+		stage.setRecords(js.size());
+	}
 	BamReader reader(bamFile);
 	reader.open();
-	shared_ptr<RefSeqPtrList> refs = reader.createRefList();
-	js.setRefs(refs);
-        path outDir = outputBam.parent_path();
-        if (outDir.empty()) {
-            outDir = ".";
-        }
-	if (!exists(outDir)) {
-		if (!bfs::create_directories(outDir)) {
+	if (!toStdout || saveMSRs) {
+		path outDir = outputBam.parent_path();
+		if (outDir.empty()) {
+			outDir = ".";
+		}
+		if (!exists(outDir)) {
+			if (!bfs::create_directories(outDir)) {
+				BOOST_THROW_EXCEPTION(BamFilterException() << BamFilterErrorInfo(string(
+										  "Could not create output directory at: ") + outDir.string()));
+			}
+		}
+		else if (!bfs::is_directory(outDir)) {
 			BOOST_THROW_EXCEPTION(BamFilterException() << BamFilterErrorInfo(string(
-									  "Could not create output directory at: ") + outDir.string()));
+									  "File exists with name of suggested output directory: ") + outDir.string()));
 		}
 	}
-	else if (!bfs::is_directory(outDir)) {
-		BOOST_THROW_EXCEPTION(BamFilterException() << BamFilterErrorInfo(string(
-								  "File exists with name of suggested output directory: ") + outDir.string()));
+	// Regions can only be processed independently if we can seek to them, and
+	// only BAM output can be assembled from compressed blocks.  The output can
+	// only be indexed if it's a BAM file in coordinate order.
+	const bool sorted = reader.isCoordSortedBam();
+	if (!regionsFile.empty()) {
+		if (!sorted || !reader.isIndexed()) {
+			BOOST_THROW_EXCEPTION(BamFilterException() << BamFilterErrorInfo(string(
+									  "Filtering target regions requires a coordinate sorted and indexed BAM: ") + bamFile.string()));
+		}
+		size_t nbUnknown = 0;
+		targetRegions = RegionList::loadBed(regionsFile, *reader.createRefList(), nbUnknown);
+		if (nbUnknown > 0) {
+			cout << "WARNING: Ignoring " << nbUnknown << " regions on target sequences that are not in the BAM." << endl;
+		}
+		if (targetRegions.empty()) {
+			BOOST_THROW_EXCEPTION(BamFilterException() << BamFilterErrorInfo(string(
+									  "No usable regions found in: ") + regionsFile.string()));
+		}
+		cout << " - Only processing alignments overlapping " << targetRegions.size() << " regions from: " << regionsFile << endl;
+		reader.setRegions(targetRegions);
+	}
+	const bool parallel = threads > 1 && sorted && reader.isIndexed() && !sam;
+	const bool index = sorted && !toStdout && !sam;
+	if (threads > 1 && !parallel) {
+		cout << "WARNING: Input is not a coordinate sorted and indexed BAM, or output is SAM.  Filtering with a single thread." << endl;
 	}
-	cout << " - Processing alignments from: " << bamFile << endl;
-	BamWriter writer(outputBam);
-	writer.open(reader.getHeader());
-	cout << " - Saving filtered alignments to: " << outputBam << endl;
+	cout << " - Processing alignments from: " << (bamFile.string() == "-" ? string("standard input") : bamFile.string()) << endl;
+	BamWriter writer(toStdout ? path("-") : outputBam);
+	writer.setLevel(level);
+	writer.setSam(sam);
+	writer.open(reader.getHeader(), index, useCsi);
+	cout << " - Saving filtered alignments to: " << (toStdout ? string("standard output") : outputBam.string()) << endl;
 	BamWriter mod(outputBam.string() + ".mod.bam");
 	BamWriter unmod(outputBam.string() + ".unmod.bam");
 	if (saveMSRs) {
+		mod.setLevel(level);
+		unmod.setLevel(level);
 		mod.open(reader.getHeader());
 		unmod.open(reader.getHeader());
 		cout << " - Saving modified MSRs to: " << outputBam << ".mod.bam" << endl;
 		cout << " - Saving unmodified MSRs to: " << outputBam << ".unmod.bam" << endl;
 	}
-	uint64_t nbReadsIn = 0;
-	uint64_t nbReadsOut = 0;
-	uint64_t nbReadsModifiedOut = 0;
-	while (reader.next()) {
-		const BamAlignment& al = reader.current();
-		nbReadsIn++;
-		//bool write = false;
-		if (al.isSplicedRead()) {
-			// If we are in complete clip mode, or this is a single spliced read, then keep the alignment
-			// if its junction is found in the junctions system, otherwise discard it
-			if (clipMode == ClipMode::COMPLETE || !al.isMultiplySplicedRead()) {
-				if (containsJunctionInSystem(al, *refs, js)) {
-					writer.write(al);
-					nbReadsOut++;
-				}
-			}
-			// Else we are in HARD or SOFT clip mode and this is an MSR
-			else {
-				bool allBad = false;
-				BamAlignmentPtr clipped = clipMSR(al, *refs, js, allBad);
-				if (!allBad) {
-					writer.write(*clipped);
-					if (saveMSRs) {
-						mod.write(*clipped);
-						unmod.write(al);
-					}
-					nbReadsModifiedOut++;
-					nbReadsOut++;
-				}
-			}
-		}
-		else {  // Unspliced read so add it to the output
-			writer.write(al);
-			nbReadsOut++;
-		}
+	FilterCounts counts;
+	StageTimer stage("filter");
+	if (parallel) {
+		cout << " - Using " << threads << " threads over " << regionSize << "bp regions" << endl;
+		filterParallel(reader.getHeader(), lookup, writer, mod, unmod, counts);
+	}
+	else {
+		filterSerial(reader, lookup, writer, mod, unmod, counts);
 	}
 	reader.close();
+	// Index for the filtered alignments is built as they are written and saved on close
 	writer.close();
 	if (saveMSRs) {
 		mod.close();
 		unmod.close();
 	}
+	stage.setRecords(counts.nbReadsIn);
+	stage.stop();
 	cout << "done." << endl;
-	uint32_t diff = nbReadsIn - nbReadsOut;
-	cout << "Filtered out " << diff << " alignments.  In: " << nbReadsIn << "; Out: " << nbReadsOut << " (Modified: " << nbReadsModifiedOut << ");" << endl << endl;
-	cout << "Indexing:" << endl;
-	cout << " - filtered alignments ... ";
-	cout.flush();
-	// Create BAM index
-	string indexCmd = BamHelper::createIndexBamCmd(outputBam, useCsi);
-	int indexExitCode = system(indexCmd.c_str());
-	if (indexExitCode != 0) {
-        BOOST_THROW_EXCEPTION(BamFilterException() << BamFilterErrorInfo(string(
-									  "Problem indexing output BAM: ") + outputBam.string()));
-    }
-    
-    cout << "done." << endl;
+	uint64_t diff = counts.nbReadsIn - counts.nbReadsOut;
+	cout << "Filtered out " << diff << " alignments.  In: " << counts.nbReadsIn << "; Out: " << counts.nbReadsOut << " (Modified: " << counts.nbReadsModifiedOut << ");" << endl << endl;
+	if (!sorted && !toStdout && !sam) {
+		cout << "WARNING: Input BAM is not coordinate sorted, so the filtered BAM has not been indexed." << endl << endl;
+	}
+	runReport.setCounter("junctions", lookup.size());
+	runReport.setCounter("alignments_in", counts.nbReadsIn);
+	runReport.setCounter("alignments_out", counts.nbReadsOut);
+	runReport.setCounter("alignments_modified", counts.nbReadsModifiedOut);
+	runReport.setSetting("threads", lexical_cast<string>(threads));
+	if (!targetRegions.empty()) {
+		runReport.setSetting("regions", regionsFile.string());
+	}
+	// When streaming there may be nowhere sensible to put the report
+	if (!toStdout) {
+		runReport.save(outputBam.string() + ".report.json");
+	}
 }
 
 
+namespace {
+/**
+ * Points cout at stderr for as long as this is in scope
+ */
+class StdoutToStderr {
+private:
+	std::streambuf* original;
+
+public:
+	StdoutToStderr(bool enable) : original(enable ? cout.rdbuf(std::cerr.rdbuf()) : nullptr) {}
+
+	~StdoutToStderr() {
+		if (original != nullptr) {
+			cout.rdbuf(original);
+		}
+	}
+};
+}
+
 int portcullis::BamFilter::main(int argc, char *argv[]) {
 	// Portcullis args
 	path junctionFile;
@@ -254,6 +474,12 @@ int portcullis::BamFilter::main(int argc, char *argv[]) {
 	string clipMode;
 	bool saveMSRs;
 	bool useCsi;
+	uint16_t threads;
+	int32_t regionSize;
+	bool toStdout;
+	bool sam;
+	int level;
+	string regionsFile;
 	bool verbose;
 	bool help;
 	struct winsize w;
@@ -275,6 +501,16 @@ int portcullis::BamFilter::main(int argc, char *argv[]) {
 	 "Whether or not to output modified MSRs to a separate file.  If true will output to a file with name specified by output with \".msr.bam\" extension")
 	("use_csi,c", po::bool_switch(&useCsi)->default_value(false),
 	 "Whether to use CSI indexing rather than BAI indexing.  CSI has the advantage that it supports very long target sequences (probably not an issue unless you are working on huge genomes).  BAI has the advantage that it is more widely supported (useful for viewing in genome browsers).")
+	("stdout", po::bool_switch(&toStdout)->default_value(false),
+	 "Stream the filtered alignments to standard output instead of the output file, for piping into another tool.  Progress messages go to standard error.  Streamed output is written with uncompressed BGZF blocks unless --level is given, and isn't indexed.")
+	("sam", po::bool_switch(&sam)->default_value(false),
+	 "Write SAM rather than BAM.  SAM output isn't indexed and is filtered with a single thread.")
+	("level", po::value<int>(&level)->default_value(-1),
+	 "BGZF compression level (0-9) for BAM output.  -1 uses the htslib default, or 0 when streaming to standard output.")
+	("regions", po::value<string>(&regionsFile)->default_value(""),
+	 "Only filter and output the alignments overlapping the regions in this BED file, such as the loci targeted by a capture or amplicon panel.  Only the first three columns are used.  Requires a coordinate sorted and indexed input BAM.")
+	("threads,t", po::value<uint16_t>(&threads)->default_value(DEFAULT_BAMFILT_THREADS),
+	 "The number of threads to use.  Requires a coordinate sorted and indexed input BAM.  Regions of the BAM are filtered in parallel and written out in coordinate order.")
 	("verbose,v", po::bool_switch(&verbose)->default_value(false),
 	 "Print extra information")
 	("help", po::bool_switch(&help)->default_value(false), "Produce help message")
@@ -285,6 +521,7 @@ int portcullis::BamFilter::main(int argc, char *argv[]) {
 	hidden_options.add_options()
 	("junction-file,g", po::value<path>(&junctionFile), "Path to the junction file containing good junctions.")
 	("bam-file,g", po::value<path>(&bamFile), "Path to the BAM file to filter.")
+	("region_size", po::value<int32_t>(&regionSize)->default_value(DEFAULT_BAMFILT_REGION_SIZE), "Size in bp of the regions filtered by each thread.")
 	;
 	// Positional option for the input bam file
 	po::positional_options_description p;
@@ -305,7 +542,28 @@ int portcullis::BamFilter::main(int argc, char *argv[]) {
 			 << generic_options << endl;
 		return 1;
 	}
+	if (threads == 0) {
+		BOOST_THROW_EXCEPTION(BamFilterException() << BamFilterErrorInfo(string(
+								  "Number of threads must be at least 1")));
+	}
+	if (regionSize <= 0) {
+		BOOST_THROW_EXCEPTION(BamFilterException() << BamFilterErrorInfo(string(
+								  "Region size must be greater than 0")));
+	}
+	if (level < -1 || level > 9) {
+		BOOST_THROW_EXCEPTION(BamFilterException() << BamFilterErrorInfo(string(
+								  "Compression level must be between -1 and 9")));
+	}
+	// Streamed BAM is normally read straight away by the next tool, so don't
+	// spend time compressing it unless asked to
+	if (toStdout && vm["level"].defaulted()) {
+		level = 0;
+	}
+	// Standard output carries the alignments, so send messages to standard error
+	// until we are done
+	StdoutToStderr redirect(toStdout);
 	auto_cpu_timer timer(1, "\nPortcullis BAM filter completed.\nTotal runtime: %ws\n\n");
+	runReport.begin("bamfilt");
 	cout << "Running portcullis in BAM filter mode" << endl
 		 << "-------------------------------------" << endl << endl;
 	// Create the prepare class
@@ -315,6 +573,12 @@ int portcullis::BamFilter::main(int argc, char *argv[]) {
 	filter.setClipMode(clipFromString(clipMode));
 	filter.setSaveMSRs(saveMSRs);
 	filter.setUseCsi(useCsi);
+	filter.setThreads(threads);
+	filter.setRegionSize(regionSize);
+	filter.setToStdout(toStdout);
+	filter.setSam(sam);
+	filter.setLevel(level);
+	filter.setRegionsFile(regionsFile);
 	filter.setVerbose(verbose);
 	filter.filter();
 	return 0;
@@ -17,7 +17,9 @@
 
 #pragma once
 
+#include <algorithm>
 #include <fstream>
+#include <functional>
 #include <string>
 #include <iostream>
 #include <vector>
@@ -36,14 +38,25 @@ namespace bfs = boost::filesystem;
 namespace po = boost::program_options;
 
 #include <portcullis/bam/bam_alignment.hpp>
+#include <portcullis/bam/bam_reader.hpp>
+#include <portcullis/bam/bam_writer.hpp>
+#include <portcullis/bam/region_list.hpp>
 using portcullis::bam::BamAlignment;
 using portcullis::bam::BamAlignmentPtr;
+using portcullis::bam::BamReader;
+using portcullis::bam::BamWriter;
+using portcullis::bam::BamBlockBuffer;
+using portcullis::bam::RegionList;
 
+#include <portcullis/junction_lookup.hpp>
 #include <portcullis/junction_system.hpp>
 
 
 namespace portcullis {
 
+const uint16_t DEFAULT_BAMFILT_THREADS = 1;
+const int32_t DEFAULT_BAMFILT_REGION_SIZE = 1000000;
+
 typedef boost::error_info<struct BamFilterError, string> BamFilterErrorInfo;
 struct BamFilterException: virtual boost::exception, virtual std::exception { };
 
@@ -79,10 +92,142 @@ static ClipMode clipFromString(string cm) {
 							  "Unrecognised clip mode: ") + cm));
 }
 
+/**
+ * Holds clipped alignments whose start moved right until the alignments read
+ * after them have caught up, so output stays in coordinate order.  Records are
+ * copied into a pool of samtools records that is reused, so steady state
+ * filtering doesn't allocate.
+ */
+class ClipReorderBuffer {
+private:
+
+	struct Entry {
+		uint64_t key;	// Reference (unplaced last) then position
+		uint64_t order;	// Arrival order, keeps ties stable
+		bam1_t* b;
+
+		bool operator>(const Entry& other) const {
+			return key != other.key ? key > other.key : order > other.order;
+		}
+	};
+
+	vector<Entry> heap;
+	vector<bam1_t*> pool;
+	uint64_t arrivals;
+
+	static uint64_t keyOf(int32_t tid, int32_t pos) {
+		return ((uint64_t)(uint32_t)tid << 32) | (uint32_t)pos;
+	}
+
+	template<typename W>
+	void pop(W& out) {
+		std::pop_heap(heap.begin(), heap.end(), std::greater<Entry>());
+		bam1_t* b = heap.back().b;
+		heap.pop_back();
+		out.write(b);
+		pool.push_back(b);
+	}
+
+public:
+
+	ClipReorderBuffer() : arrivals(0) {}
+
+	ClipReorderBuffer(const ClipReorderBuffer&) = delete;
+
+	~ClipReorderBuffer() {
+		for (auto& e : heap) {
+			bam_destroy1(e.b);
+		}
+		for (auto b : pool) {
+			bam_destroy1(b);
+		}
+	}
+
+	void push(const bam1_t* b) {
+		bam1_t* copy = nullptr;
+		if (pool.empty()) {
+			copy = bam_init1();
+		}
+		else {
+			copy = pool.back();
+			pool.pop_back();
+		}
+		bam_copy1(copy, b);
+		heap.push_back(Entry{keyOf(b->core.tid, b->core.pos), arrivals++, copy});
+		std::push_heap(heap.begin(), heap.end(), std::greater<Entry>());
+	}
+
+	/**
+	 * Writes out everything that sorts at or before the given location
+	 */
+	template<typename W>
+	void flushTo(int32_t tid, int32_t pos, W& out) {
+		const uint64_t key = keyOf(tid, pos);
+		while (!heap.empty() && heap.front().key <= key) {
+			pop(out);
+		}
+	}
+
+	template<typename W>
+	void flush(W& out) {
+		while (!heap.empty()) {
+			pop(out);
+		}
+	}
+};
+
 class BamFilter {
 
 private:
 
+	/**
+	 * A window of the input BAM that can be filtered independently of the
+	 * others.  A tid of HTS_IDX_NOCOOR represents the unplaced reads at the end
+	 * of the file.
+	 */
+	struct RegionTask {
+		int32_t tid;
+		int32_t start;
+		int32_t end;
+	};
+
+	struct FilterCounts {
+		uint64_t nbReadsIn = 0;
+		uint64_t nbReadsOut = 0;
+		uint64_t nbReadsModifiedOut = 0;
+
+		void add(const FilterCounts& other) {
+			nbReadsIn += other.nbReadsIn;
+			nbReadsOut += other.nbReadsOut;
+			nbReadsModifiedOut += other.nbReadsModifiedOut;
+		}
+	};
+
+	/**
+	 * Output produced by filtering a single region
+	 */
+	struct RegionResult {
+		BamBlockBuffer out;
+		BamBlockBuffer mod;
+		BamBlockBuffer unmod;
+		FilterCounts counts;
+		bool done = false;
+
+		void setLevel(int level) {
+			out.setLevel(level);
+			mod.setLevel(level);
+			unmod.setLevel(level);
+		}
+
+		void clear() {
+			out.clear();
+			mod.clear();
+			unmod.clear();
+			counts = FilterCounts();
+			done = false;
+		}
+	};
+
 	path junctionFile;
 	path bamFile;
 	path outputBam;
@@ -91,7 +236,16 @@ private:
 	ClipMode clipMode;
 	bool saveMSRs;
 	bool useCsi;
+	uint16_t threads;
+	int32_t regionSize;
+	bool toStdout;
+	bool sam;
+	int level;
 	bool verbose;
+	path regionsFile;
+
+	// Loaded from regionsFile
+	RegionList targetRegions;
 
 public:
 
@@ -104,15 +258,50 @@ public:
 protected:
 
 	/**
-	 * Checks a given alignment to see if it exists in the given junction system
+	 * Checks a given alignment to see if it exists in the given junction lookup
 	 * @param al Alignment to check
-	 * @param refs References
-	 * @param js The junction system containing good junctions to keep
-	 * @return Whether or not the alignment contains a junction found in the junction system
+	 * @param lookup The good junctions to keep
+	 * @return Whether or not the alignment contains a junction found in the lookup
 	 */
-	bool containsJunctionInSystem(const BamAlignment& al, const RefSeqPtrList& refs, JunctionSystem& js);
+	bool containsJunctionInSystem(const BamAlignment& al, const JunctionLookup& lookup);
 
-	BamAlignmentPtr clipMSR(const BamAlignment& al, const RefSeqPtrList& refs, JunctionSystem& js, bool& allBad);
+	/**
+	 * Works out which CIGAR operations of a multiply spliced read survive
+	 * clipping: everything from the anchor before the first good junction to the
+	 * anchor after the last good junction.  Bad junctions in between are kept.
+	 * @param b The raw alignment
+	 * @param lookup The good junctions to keep
+	 * @param firstKept Set to the index of the first op to keep
+	 * @param lastKept Set to the index of the last op to keep
+	 * @return False if none of the read's junctions are good
+	 */
+	bool clipMSR(const bam1_t* b, const JunctionLookup& lookup, uint32_t& firstKept, uint32_t& lastKept) const;
+
+	/**
+	 * Decides what to do with a single alignment and writes it to the relevant
+	 * outputs.  Shared by the serial and parallel filters.  When filtering a
+	 * region, alignments are written by the region containing their (possibly
+	 * clipped) start, so reads overlapping the start of the region are passed
+	 * in too.  Clipping edits the reader's record in place.
+	 */
+	template<typename W>
+	void filterAlignment(const BamAlignment& al, const RegionTask* task, const JunctionLookup& lookup,
+						 ClipReorderBuffer& pending, W& out, W& mod, W& unmod, FilterCounts& counts);
+
+	/**
+	 * Splits the input BAM into windows of roughly regionSize bases in coordinate
+	 * order.  With target regions, there is one window for each target sequence
+	 * that has any.
+	 */
+	vector<RegionTask> createRegionTasks(bam_hdr_t* header) const;
+
+	void filterRegion(BamReader& reader, const RegionTask& task, const JunctionLookup& lookup, RegionResult& result);
+
+	void filterSerial(BamReader& reader, const JunctionLookup& lookup,
+					  BamWriter& writer, BamWriter& mod, BamWriter& unmod, FilterCounts& counts);
+
+	void filterParallel(bam_hdr_t* header, const JunctionLookup& lookup,
+						BamWriter& writer, BamWriter& mod, BamWriter& unmod, FilterCounts& counts);
 
 
 public:
@@ -181,6 +370,65 @@ public:
 		this->useCsi = useCsi;
 	}
 
+	uint16_t getThreads() const {
+		return threads;
+	}
+
+	void setThreads(uint16_t threads) {
+		this->threads = threads;
+	}
+
+	int32_t getRegionSize() const {
+		return regionSize;
+	}
+
+	void setRegionSize(int32_t regionSize) {
+		this->regionSize = regionSize;
+	}
+
+	const path& getRegionsFile() const {
+		return regionsFile;
+	}
+
+	/**
+	 * Only filters and outputs the alignments overlapping the regions in this
+	 * BED file.  Empty for the whole BAM.
+	 */
+	void setRegionsFile(const path& regionsFile) {
+		this->regionsFile = regionsFile;
+	}
+
+	bool isToStdout() const {
+		return toStdout;
+	}
+
+	/**
+	 * Stream the filtered alignments to standard output rather than the output
+	 * file.  Streamed output isn't indexed.
+	 */
+	void setToStdout(bool toStdout) {
+		this->toStdout = toStdout;
+	}
+
+	bool isSam() const {
+		return sam;
+	}
+
+	void setSam(bool sam) {
+		this->sam = sam;
+	}
+
+	int getLevel() const {
+		return level;
+	}
+
+	/**
+	 * BGZF compression level for the BAM outputs, -1 for the htslib default
+	 */
+	void setLevel(int level) {
+		this->level = level;
+	}
+
 	bool isVerbose() const {
 		return verbose;
 	}
@@ -204,7 +452,7 @@ public:
 	}
 
 	static string usage() {
-		return string("portcullis bamfilt [options] <junction-file> <bam-file>");
+		return string("portcullis bamfilt [options] <junction-file> <bam-file>\n\nUse \"-\" as the BAM file to read from standard input.");
 	}
 
 
@@ -30,6 +30,7 @@ using std::endl;
 using std::ofstream;
 using std::unique_lock;
 
+#include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/exception/all.hpp>
@@ -47,6 +48,8 @@ namespace po = boost::program_options;
 #include <portcullis/bam/bam_writer.hpp>
 #include <portcullis/bam/depth_parser.hpp>
 #include <portcullis/bam/genome_mapper.hpp>
+#include <portcullis/bam/region_list.hpp>
+#include <portcullis/bam/spliced_index.hpp>
 #include <portcullis/seq_utils.hpp>
 using namespace portcullis::bam;
 
@@ -56,9 +59,38 @@ using namespace portcullis::bam;
 using portcullis::Intron;
 using portcullis::Junction;
 using portcullis::JunctionSystem;
+using portcullis::StrandCounts;
+
+#include <portcullis/strand_sampler.hpp>
+using portcullis::StrandSample;
+using portcullis::StrandSampler;
+
+#include <portcullis/instrument.hpp>
+#include <portcullis/run_report.hpp>
+using portcullis::RunReport;
+using portcullis::StageTimer;
+using portcullis::TaskRecord;
+using portcullis::runReport;
 
 #include "junction_builder.hpp"
 using portcullis::JBThreadPool;
+using portcullis::MemoryPlan;
+
+namespace {
+
+string formatMemory(uint64_t bytes) {
+	std::stringstream ss;
+	ss << std::fixed << std::setprecision(1);
+	if (bytes >= 1024ULL * 1024 * 1024) {
+		ss << (double)bytes / (1024.0 * 1024.0 * 1024.0) << " GB";
+	}
+	else {
+		ss << (double)bytes / (1024.0 * 1024.0) << " MB";
+	}
+	return ss.str();
+}
+
+}
 
 portcullis::JunctionBuilder::JunctionBuilder(const path& _prepDir, const path& _output) {
 	prepData = PreparedFiles(_prepDir);
@@ -68,8 +100,17 @@ portcullis::JunctionBuilder::JunctionBuilder(const path& _prepDir, const path& _
 	extra = false;
 	useCsi = false;
 	strandSpecific = Strandedness::UNKNOWN;
+	orientation = Orientation::UNKNOWN;
 	source = "portcullis";
 	verbose = false;
+	maxMemory = 0;
+	checkpoint = false;
+	detectStrand = false;
+	maxAlignments = DEFAULT_JUNC_MAX_ALIGNMENTS;
+	longReads = false;
+	anchorWindow = 0;
+	barcodeTag = "";
+	skipUnspliced = false;
 }
 
 portcullis::JunctionBuilder::~JunctionBuilder() {
@@ -106,15 +147,47 @@ void portcullis::JunctionBuilder::process() {
 	refMap = reader.createRefMap(*refs);
 	reader.close();
 	junctionSystem.setRefs(refs);
-	if (refs->size() < threads) {
-		cerr << "Warning: User requested " << threads << " threads but there are only " << refs->size() << " target sequences to process.  Setting number of threads to " << refs->size() << "." << endl << endl;
-		threads = refs->size();
+	if (!regionsFile.empty()) {
+		loadTargetRegions();
 	}
+	// Work out how to split the work up, which may reduce the number of threads
+	// to stay within the memory budget
+	planMemory();
+	threads = plan.threads;
+	// Targeted runs only read the regions of interest, so there's no need to
+	// split up the target sequences they're on
+	if (!targetRegions.empty()) {
+		plan.regionSize = 0;
+	}
+	createRegions();
 	// Must separate BAMs if extra metrics are requested
 	if (extra && !separate) {
 		separate = true;
 		cerr << "Warning: User requested that separated BAMS should not be output but user did request extra metrics to be calculated.  This requires separated BAMs to be produced." << endl << endl;
 	}
+	// Saved junctions lose the alignment names needed for the extra metrics
+	if (extra && checkpoint) {
+		checkpoint = false;
+		cerr << "Warning: Checkpointing is not supported when calculating extra metrics.  Disabling checkpoints." << endl << endl;
+	}
+	// Saved junctions lose their per cell counts too
+	if (!barcodeTag.empty() && checkpoint) {
+		checkpoint = false;
+		cerr << "Warning: Checkpointing is not supported in single cell mode.  Disabling checkpoints." << endl << endl;
+	}
+	if (skipUnspliced && !targetRegions.empty()) {
+		skipUnspliced = false;
+		cerr << "Warning: The spliced block index can't be used with --regions.  Reading just the target regions." << endl << endl;
+	}
+	if (skipUnspliced) {
+		loadSplicedIndex();
+	}
+	// Fill in whatever the user didn't tell us about the library protocol
+	// before the main pass, which needs it to work out read strands
+	if (detectStrand && (strandSpecific == Strandedness::UNKNOWN || orientation == Orientation::UNKNOWN)) {
+		StageTimer stage("detectStrand");
+		detectProtocol();
+	}
 	// Output settings requested
 	cout << "Settings:" << endl
 		 << std::boolalpha
@@ -122,24 +195,86 @@ void portcullis::JunctionBuilder::process() {
 		 << " - BAM Read Orientation: " << orientationToString(orientation) << endl
 		 << " - BAM Indexing mode: " << (useCsi ? "CSI" : "BAI") << endl
 		 << " - Threads: " << threads << endl
-		 << " - Separate BAMs: " << separate << endl
+		 << " - Separate BAMs: " << separate << endl;
 		 //<< " - Calculate additional metrics: " << extra << endl
-		 << endl;
+	if (plan.budget > 0) {
+		cout << " - Memory budget: " << formatMemory(plan.budget) << endl
+			 << " - Estimated alignments: " << plan.alignments << endl
+			 << " - Estimated junctions: " << plan.junctions << endl
+			 << " - Planned peak memory: " << formatMemory(plan.peak) << endl
+			 << " - Region size: " << (plan.regionSize == 0 ? string("whole target sequences") : lexical_cast<string>(plan.regionSize) + "bp") << endl
+			 << " - Spill regions to disk: " << plan.spill << endl;
+	}
+	if (maxAlignments > 0) {
+		cout << " - Max alignments kept per junction: " << maxAlignments << endl;
+	}
+	if (longReads) {
+		cout << " - Long reads: true" << endl;
+	}
+	if (getEffectiveAnchorWindow() > 0) {
+		cout << " - Anchor window: " << getEffectiveAnchorWindow() << "bp" << endl;
+	}
+	if (!barcodeTag.empty()) {
+		cout << " - Single cell mode, barcode tag: " << barcodeTag << endl;
+	}
+	if (prune.enabled()) {
+		cout << " - Prune junctions with:";
+		if (prune.minReads > 0) cout << " reads < " << prune.minReads << ";";
+		if (prune.minAnchor > 0) cout << " max_min_anc < " << prune.minAnchor << ";";
+		if (prune.minIntron > 0) cout << " intron < " << prune.minIntron << "bp;";
+		if (prune.maxIntron > 0) cout << " intron > " << prune.maxIntron << "bp;";
+		cout << endl;
+	}
+	if (skipUnspliced) {
+		cout << " - Skip unspliced blocks: true" << endl;
+	}
+	if (!targetRegions.empty()) {
+		cout << " - Target regions: " << targetRegions.size() << " covering " << targetRegions.totalLength() << "bp on "
+			 << targetRegions.getSeqs().size() << " target sequences, from " << regionsFile << endl;
+	}
+	cout << " - Checkpoint regions: " << checkpoint << endl;
+	cout << endl;
 	cout << reader.bamDetails() << endl;
+	if (plan.spill || checkpoint) {
+		prepareRegionDir();
+	}
 	// Separate spliced from unspliced reads and save to file if requested
 	if (separate) {
+		StageTimer stage("separateBams");
 		separateBams();
 	}
 	// The core interesting work is done here
-	findJunctions();
+	{
+		StageTimer stage("findJunctions");
+		findJunctions();
+		stage.setRecords(runReport.getCounter("alignments"));
+	}
 	if (extra) {
+		StageTimer stage("calcExtraMetrics");
 		calcExtraMetrics();
 	}
 	cout << "Saving junctions: " << endl;
-	junctionSystem.saveAll(path(outputDir.string() + "/" + outputPrefix), source, false, this->outputExonGFF, this->outputIntronGFF);
+	StrandCounts strandCounts;
+	{
+		StageTimer stage("saveAll");
+		if (plan.spill) {
+			strandCounts = saveSpilled();
+		}
+		else {
+			junctionSystem.saveAll(path(outputDir.string() + "/" + outputPrefix), source, false, this->outputExonGFF, this->outputIntronGFF);
+			junctionSystem.addStrandCounts(strandCounts);
+		}
+		if (!barcodeTag.empty()) {
+			junctionSystem.saveBarcodeMatrix(path(outputDir.string() + "/" + outputPrefix));
+		}
+	}
+	// The output is complete so the per region results are no longer needed
+	if (bfs::exists(getRegionDir())) {
+		bfs::remove_all(getRegionDir());
+	}
 
 	// Also do a strand analysis as this is cheap and quick to do.
-	std::pair<Orientation, Strandedness> actual_config = junctionSystem.determineStrandedness(true);
+	std::pair<Orientation, Strandedness> actual_config = JunctionSystem::determineStrandedness(strandCounts, true);
 	Orientation actual_orientation = actual_config.first;
 	Strandedness actual_strandedness = actual_config.second;
 	cout << "Determined sequence orientation to be: " << orientationToLongString(actual_orientation) << endl;
@@ -147,6 +282,105 @@ void portcullis::JunctionBuilder::process() {
 	if (strandSpecific != Strandedness::UNKNOWN && strandSpecific != actual_strandedness) {
 		cerr << "Warning!  User input and portcullis disagree about the strandedness of the dataset" << endl << endl;
 	}
+	if (plan.budget > 0) {
+		const uint64_t actualPeak = RunReport::peakRss() * 1024;
+		cout << "Memory: budget " << formatMemory(plan.budget) << "; planned peak " << formatMemory(plan.peak)
+			 << "; actual peak " << formatMemory(actualPeak) << endl << endl;
+		if (actualPeak > plan.budget) {
+			cerr << "Warning: peak memory usage exceeded the budget given by --max_memory" << endl << endl;
+		}
+		runReport.setCounter("memory_budget_bytes", plan.budget);
+		runReport.setCounter("memory_planned_peak_bytes", plan.peak);
+		runReport.setCounter("memory_actual_peak_bytes", actualPeak);
+		runReport.setSetting("region_size", lexical_cast<string>(plan.regionSize));
+		runReport.setSetting("spill", plan.spill ? "true" : "false");
+	}
+	runReport.setSetting("threads", lexical_cast<string>(threads));
+	runReport.setSetting("strandedness", strandednessToString(strandSpecific));
+	runReport.setSetting("orientation", orientationToString(orientation));
+	runReport.setSetting("max_alignments", lexical_cast<string>(maxAlignments));
+	runReport.setSetting("long_reads", longReads ? "true" : "false");
+	runReport.setSetting("anchor_window", lexical_cast<string>(getEffectiveAnchorWindow()));
+	runReport.setSetting("skip_unspliced", skipUnspliced ? "true" : "false");
+	if (!targetRegions.empty()) {
+		runReport.setSetting("regions", regionsFile.string());
+		runReport.setCounter("target_regions", targetRegions.size());
+		runReport.setCounter("target_bases", targetRegions.totalLength());
+	}
+	if (!barcodeTag.empty()) {
+		runReport.setSetting("barcode_tag", barcodeTag);
+	}
+	if (prune.enabled()) {
+		runReport.setSetting("prune_min_reads", lexical_cast<string>(prune.minReads));
+		runReport.setSetting("prune_min_anchor", lexical_cast<string>(prune.minAnchor));
+		runReport.setSetting("prune_min_intron", lexical_cast<string>(prune.minIntron));
+		runReport.setSetting("prune_max_intron", lexical_cast<string>(prune.maxIntron));
+	}
+	runReport.save(getReportFile());
+	cout << "Run report saved to: " << getReportFile() << endl << endl;
+}
+
+void portcullis::JunctionBuilder::loadTargetRegions() {
+	size_t nbUnknown = 0;
+	targetRegions = RegionList::loadBed(regionsFile, *refs, nbUnknown);
+	if (nbUnknown > 0) {
+		cerr << "Warning: Ignoring " << nbUnknown << " regions on target sequences that are not in the BAM." << endl << endl;
+	}
+	if (targetRegions.empty()) {
+		BOOST_THROW_EXCEPTION(JunctionBuilderException() << JunctionBuilderErrorInfo(string(
+								  "No usable regions found in: ") + regionsFile.string()));
+	}
+}
+
+void portcullis::JunctionBuilder::loadSplicedIndex() {
+	// The index only covers whole target sequences
+	if (plan.regionSize > 0) {
+		skipUnspliced = false;
+		cerr << "Warning: Target sequences are being split into regions to stay within the memory budget, which the spliced block index doesn't support.  Reading the whole BAM." << endl << endl;
+		return;
+	}
+	const path indexFile = prepData.getSplicedIndexFilePath();
+	if (!bfs::exists(indexFile)) {
+		skipUnspliced = false;
+		cerr << "Warning: Could not find spliced block index at: " << indexFile << ".  Rerun portcullis prep to create it.  Reading the whole BAM." << endl << endl;
+		return;
+	}
+	try {
+		splicedIndex.load(indexFile);
+	}
+	catch (SplicedIndexException& e) {
+		skipUnspliced = false;
+		cerr << "Warning: " << *boost::get_error_info<SplicedIndexErrorInfo>(e) << ".  Reading the whole BAM." << endl << endl;
+		return;
+	}
+	if (!splicedIndex.matches(prepData.getSortedBamFilePath()) || splicedIndex.size() != refs->size()) {
+		skipUnspliced = false;
+		cerr << "Warning: Spliced block index is out of date: " << indexFile << ".  Rerun portcullis prep to update it.  Reading the whole BAM." << endl << endl;
+	}
+}
+
+void portcullis::JunctionBuilder::detectProtocol() {
+	cout << "Sampling spliced reads to detect the library protocol ...";
+	cout.flush();
+	StrandSampler sampler(prepData.getSortedBamFilePath(), prepData.getGenomeFilePath());
+	StrandSample s = sampler.sample();
+	cout << " done." << endl
+		 << " - Sampled " << s.splicedReads << " spliced reads (" << s.informativeReads() << " at junctions with a known splice site strand) from " << s.windows << " windows" << endl
+		 << " - Detected orientation: " << orientationToString(s.orientation) << endl
+		 << " - Detected strandedness: " << strandednessToString(s.strandedness) << endl;
+	if (!s.converged) {
+		cerr << "Warning: strand sampling did not converge.  Consider setting --strandedness and --orientation explicitly." << endl;
+	}
+	cout << endl;
+	if (strandSpecific == Strandedness::UNKNOWN) {
+		strandSpecific = s.strandedness;
+	}
+	if (orientation == Orientation::UNKNOWN) {
+		orientation = s.orientation;
+	}
+	runReport.setCounter("strand_sample_windows", s.windows);
+	runReport.setCounter("strand_sample_reads", s.splicedReads);
+	runReport.setSetting("strand_sample_converged", s.converged ? "true" : "false");
 }
 
 void portcullis::JunctionBuilder::separateBams() {
@@ -162,6 +396,9 @@ void portcullis::JunctionBuilder::separateBams() {
 	BamWriter unmappedWriter(unmappedFile);
 	BamReader reader(prepData.getSortedBamFilePath());
 	reader.open();
+	if (!targetRegions.empty()) {
+		reader.setRegions(targetRegions);
+	}
 	cout << "Splitting BAM:" << endl;
 	if (threads > 1) {
 		cerr << " - Note: this part of the pipeline is single threaded." << endl;
@@ -198,6 +435,9 @@ void portcullis::JunctionBuilder::separateBams() {
 	cout << " - Found " << splicedCount << " spliced alignments." << endl;
 	cout << " - Found " << unsplicedCount << " unspliced alignments." << endl;
 	cout << " - Found " << unmappedCount << " unmapped reads." << endl;
+	runReport.setCounter("spliced_alignments", splicedCount);
+	runReport.setCounter("unspliced_alignments", unsplicedCount);
+	runReport.setCounter("unmapped_reads", unmappedCount);
 	reader.close();
 	unsplicedWriter.close();
 	splicedWriter.close();
@@ -227,21 +467,40 @@ void portcullis::JunctionBuilder::separateBams() {
 
 void portcullis::JunctionBuilder::findJunctions() {
 	auto_cpu_timer timer(1, " = Wall time taken: %ws\n\n");
-	// Add each target sequence as a chunk of work for the thread pool
-	results.clear();
-	results.resize(refs->size());
+	size_t nbDone = 0;
+	for (const auto & res : results) {
+		if (res.done) nbDone++;
+	}
+	// Spare threads beyond the number of regions calculate junction metrics
+	// alongside the threads reading the BAM
+	const size_t nbPending = max(results.size() - nbDone, (size_t) 1);
+	const uint16_t readers = (uint16_t) min((size_t) threads, nbPending);
+	const uint16_t finalisers = (threads - readers) / readers;
 	// Create the thread pool and start the threads
-	cout << "Creating " << threads << " threads, each with BAM and genome indicies loaded ...";
+	cout << "Creating " << readers << " threads, each with BAM and genome indicies loaded";
+	if (finalisers > 0) {
+		cout << " and " << finalisers << " junction finalising threads";
+	}
+	cout << " ...";
 	cout.flush();
-	JBThreadPool pool(this, threads);
+	JBThreadPool pool(this, readers, finalisers);
 	cout << " done." << endl;
 	cout << "Finding junctions and calculating basic metrics:" << endl;
-	cout << " - Queueing " << refs->size() << " target sequences for processing in the thread pool" << endl;
+	if (plan.regionSize > 0) {
+		cout << " - Queueing " << results.size() << " regions of up to " << plan.regionSize << "bp for processing in the thread pool" << endl;
+	}
+	else {
+		cout << " - Queueing " << results.size() << " target sequences for processing in the thread pool" << endl;
+	}
 	cout << " - Processing: " << endl;
-	for (size_t i = 0; i < refs->size(); i++) {
-		results[i].js.setRefs(refs); // Make sure junction system has reference sequence list available
-		results[i].name = refs->at(i)->name;
-		pool.enqueue(refs->at(i)->index);
+	if (nbDone > 0) {
+		cout << " - Resuming from checkpoint: " << nbDone << " of " << results.size() << " regions already complete" << endl;
+	}
+	// Add each outstanding region as a chunk of work for the thread pool
+	for (size_t i = 0; i < results.size(); i++) {
+		if (!results[i].done) {
+			pool.enqueue(i);
+		}
 	}
 	// Waits for all threads to complete
 	pool.shutDown();
@@ -255,36 +514,69 @@ void portcullis::JunctionBuilder::findJunctions() {
 		 << std::right << std::setw(12) << "unspliced" << "\t"
 		 << std::right << std::setw(12) << "spliced" << "\t"
 		 << std::right << std::setw(12) << "total" << endl;
-	for (auto & res : results) {
-		junctionSystem.append(res.js);
-		unsplicedCount += res.unsplicedCount;
-		splicedCount += res.splicedCount;
-		sumQueryLengths += res.sumQueryLengths;
-		minQueryLength = min(minQueryLength, res.minQueryLength);
-		maxQueryLength = max(maxQueryLength, res.maxQueryLength);
-		cout << std::left << std::setw(12) << res.name << "\t"
-			 << std::right << std::setw(12) << res.unsplicedCount << "\t"
-			 << std::right << std::setw(12) << res.splicedCount << "\t"
-			 << std::right << std::setw(12) << res.splicedCount + res.unsplicedCount << endl;
-	}
-	cout << endl << "Sorting and reindexing merged junctions...";
-	cout.flush();
-	junctionSystem.sort(); // Make sure the output is properly ordered
-	junctionSystem.index(); // Add unique identifiers to each junction
-	cout << " done." << endl << endl;
+	size_t nbJunctions = 0;
+	size_t nbPruned = 0;
+	for (size_t i = 0; i < results.size(); i++) {
+		// Regions are in reference order, so combine the counts for each sequence
+		const int32_t seq = results[i].seq;
+		uint64_t seqUnspliced = 0;
+		uint64_t seqSpliced = 0;
+		for (; i < results.size() && results[i].seq == seq; i++) {
+			RegionResult& res = results[i];
+			if (!plan.spill) {
+				junctionSystem.append(res.js);
+				nbJunctions += res.js.size();
+			}
+			else {
+				nbJunctions += res.nbJunctions;
+			}
+			nbPruned += res.nbPruned;
+			seqUnspliced += res.unsplicedCount;
+			seqSpliced += res.splicedCount;
+			sumQueryLengths += res.sumQueryLengths;
+			minQueryLength = min(minQueryLength, res.minQueryLength);
+			maxQueryLength = max(maxQueryLength, res.maxQueryLength);
+		}
+		i--;
+		unsplicedCount += seqUnspliced;
+		splicedCount += seqSpliced;
+		cout << std::left << std::setw(12) << refs->at(seq)->name << "\t"
+			 << std::right << std::setw(12) << seqUnspliced << "\t"
+			 << std::right << std::setw(12) << seqSpliced << "\t"
+			 << std::right << std::setw(12) << seqSpliced + seqUnspliced << endl;
+	}
+	if (!plan.spill) {
+		cout << endl << "Sorting and reindexing merged junctions...";
+		cout.flush();
+		junctionSystem.sort(); // Make sure the output is properly ordered
+		junctionSystem.index(); // Add unique identifiers to each junction
+		cout << " done." << endl;
+	}
+	cout << endl;
 	// Calculate some alignment stats
 	uint64_t totalAlignments = splicedCount + unsplicedCount;
+	runReport.setCounter("alignments", totalAlignments);
 	double meanQueryLength = (double) sumQueryLengths / (double) totalAlignments;
 	junctionSystem.setQueryLengthStats(minQueryLength, meanQueryLength, maxQueryLength);
+	runReport.setCounter("junctions", nbJunctions);
+	if (prune.enabled()) {
+		runReport.setCounter("pruned_junctions", nbPruned);
+	}
 	cout << "Final stats:" << endl
 		 << " - Processed " << totalAlignments << " alignments." << endl
 		 << " - Alignment query length statistics: min: " << minQueryLength << "; mean: " << meanQueryLength << "; max: " << maxQueryLength << ";" << endl
-		 << " - Found " << junctionSystem.size() << " junctions from " << splicedCount << " spliced alignments." << endl
+		 << " - Found " << nbJunctions << " junctions from " << splicedCount << " spliced alignments." << endl
 		 << " - Found " << unsplicedCount << " unspliced alignments." << endl;
-	// Calculate additional junction stats
-	if (junctionSystem.size() > 1) {
+	if (prune.enabled()) {
+		cout << " - Pruned " << nbPruned << " junctions before calculating metrics." << endl;
+	}
+	// Calculate additional junction stats.  Spilled junctions get these as
+	// they are reloaded.
+	if (!plan.spill && junctionSystem.size() > 1) {
 		cout << " - Calculating junctions stats that require comparisons with other junctions...";
 		cout.flush();
+		StageTimer stage("calcJunctionStats");
+		stage.setRecords(junctionSystem.size());
 		junctionSystem.calcJunctionStats();
 		cout << " done." << endl;
 	}
@@ -311,49 +603,481 @@ void portcullis::JunctionBuilder::calcExtraMetrics() {
 	junctionSystem.calcCoverage(getUnsplicedBamFile(), strandSpecific);
 }
 
-void portcullis::JunctionBuilder::findJuncs(BamReader& reader, GenomeMapper& gmap, int32_t seq) {
+void portcullis::JunctionBuilder::findJuncs(BamReader& reader, GenomeMapper& gmap, JunctionFinaliser* finaliser, const size_t region) {
+	switch (strandSpecific) {
+	case Strandedness::FIRSTSTRAND:
+		findJuncsFor<Strandedness::FIRSTSTRAND>(reader, gmap, finaliser, region);
+		break;
+	case Strandedness::SECONDSTRAND:
+		findJuncsFor<Strandedness::SECONDSTRAND>(reader, gmap, finaliser, region);
+		break;
+	case Strandedness::UNSTRANDED:
+		findJuncsFor<Strandedness::UNSTRANDED>(reader, gmap, finaliser, region);
+		break;
+	default:
+		findJuncsFor<Strandedness::UNKNOWN>(reader, gmap, finaliser, region);
+		break;
+	}
+}
+
+template<Strandedness S>
+void portcullis::JunctionBuilder::findJuncsFor(BamReader& reader, GenomeMapper& gmap, JunctionFinaliser* finaliser, const size_t region) {
+	switch (orientation) {
+	case Orientation::SE:
+		findJuncsFor<S, Orientation::SE>(reader, gmap, finaliser, region);
+		break;
+	case Orientation::FR:
+		findJuncsFor<S, Orientation::FR>(reader, gmap, finaliser, region);
+		break;
+	case Orientation::RF:
+		findJuncsFor<S, Orientation::RF>(reader, gmap, finaliser, region);
+		break;
+	case Orientation::FF:
+		findJuncsFor<S, Orientation::FF>(reader, gmap, finaliser, region);
+		break;
+	default:
+		findJuncsFor<S, Orientation::UNKNOWN>(reader, gmap, finaliser, region);
+		break;
+	}
+}
+
+template<Strandedness S, Orientation O>
+void portcullis::JunctionBuilder::findJuncsFor(BamReader& reader, GenomeMapper& gmap, JunctionFinaliser* finaliser, const size_t region) {
+	cpu_timer timer;
+	double cpuStart = RunReport::threadCpuTime();
+	RegionResult& res = results[region];
 	uint64_t splicedCount = 0;
 	uint64_t unsplicedCount = 0;
 	uint32_t lastCalculatedJunctionIndex = 0;
 	uint64_t sumQueryLengths = 0;
 	int32_t minQueryLength = INT32_MAX;
 	int32_t maxQueryLength = 0;
-	reader.setRegion(seq, 0, refs->at(seq)->length);
-	while (reader.next()) {
+	vector<bool> pruned;
+	if (!targetRegions.empty()) {
+		reader.setRegions(targetRegions.getRegions(res.seq));
+	}
+	else if (skipUnspliced) {
+		reader.setRegion(res.seq, res.start, res.end, splicedIndex.getRef(res.seq).ranges);
+	}
+	else {
+		reader.setRegion(res.seq, res.start, res.end);
+	}
+	while (reader.next<S, O>()) {
 		const BamAlignment& al = reader.current();
-		while (results[seq].js.size() > 0 && lastCalculatedJunctionIndex < results[seq].js.size() &&
-				al.getPosition() > results[seq].js.getJunctionAt(lastCalculatedJunctionIndex)->getIntron()->end) {
-			JunctionPtr j = results[seq].js.getJunctionAt(lastCalculatedJunctionIndex);
-			j->calcMetrics(this->orientation);
-			j->processJunctionWindow(gmap);
-			j->clearAlignments();
+		while (res.js.size() > 0 && lastCalculatedJunctionIndex < res.js.size() &&
+				al.getPosition() > res.js.getJunctionAt(lastCalculatedJunctionIndex)->getIntron()->end) {
+			JunctionPtr j = res.js.getJunctionAt(lastCalculatedJunctionIndex);
+			if (prune.enabled() && !prune.keep(*j)) {
+				pruned.resize(res.js.size(), false);
+				pruned[lastCalculatedJunctionIndex] = true;
+				j->clearAlignments();
+			}
+			else if (finaliser != nullptr) {
+				finaliser->push(j);
+			}
+			else {
+				j->calcMetrics<O>();
+				j->processJunctionWindow(gmap, getEffectiveAnchorWindow());
+				j->clearAlignments();
+			}
 			lastCalculatedJunctionIndex++;
 		}
-		// Calc alignment stats
-		int32_t len = al.getLength();
-		minQueryLength = min(minQueryLength, len);
-		maxQueryLength = max(maxQueryLength, len);
-		sumQueryLengths += len;
-		if (results[seq].js.addJunctions(al)) {
-			splicedCount++;
+		// Alignments starting before this region also overlap the previous
+		// one, so only count them there
+		const bool owned = al.getPosition() >= res.start;
+		if (owned) {
+			// Calc alignment stats
+			int32_t len = al.getLength();
+			minQueryLength = min(minQueryLength, len);
+			maxQueryLength = max(maxQueryLength, len);
+			sumQueryLengths += len;
 		}
-		else {
+		if (res.js.addJunctions(al)) {
+			if (owned) splicedCount++;
+		}
+		else if (owned) {
 			unsplicedCount++;
 		}
 	}
-	while (results[seq].js.size() > 0 && lastCalculatedJunctionIndex < results[seq].js.size()) {
-		JunctionPtr j = results[seq].js.getJunctionAt(lastCalculatedJunctionIndex);
-		j->calcMetrics(this->orientation);
-		j->processJunctionWindow(gmap);
-		j->clearAlignments();
+	while (res.js.size() > 0 && lastCalculatedJunctionIndex < res.js.size()) {
+		JunctionPtr j = res.js.getJunctionAt(lastCalculatedJunctionIndex);
+		if (prune.enabled() && !prune.keep(*j)) {
+			pruned.resize(res.js.size(), false);
+			pruned[lastCalculatedJunctionIndex] = true;
+			j->clearAlignments();
+		}
+		else if (finaliser != nullptr) {
+			finaliser->push(j);
+		}
+		else {
+			j->calcMetrics<O>();
+			j->processJunctionWindow(gmap, getEffectiveAnchorWindow());
+			j->clearAlignments();
+		}
 		lastCalculatedJunctionIndex++;
 	}
+	if (finaliser != nullptr) {
+		finaliser->wait();
+	}
+	res.nbPruned = pruned.empty() ? 0 : res.js.remove(pruned);
+	const uint64_t recordsRead = splicedCount + unsplicedCount;
+	if (skipUnspliced) {
+		// Add the unspliced alignments that were skipped over
+		const SplicedRefIndex& skipped = splicedIndex.getRef(res.seq);
+		unsplicedCount += skipped.unsplicedCount;
+		sumQueryLengths += skipped.sumQueryLengths;
+		minQueryLength = min(minQueryLength, skipped.minQueryLength);
+		maxQueryLength = max(maxQueryLength, skipped.maxQueryLength);
+	}
 	// Update result vector
-	results[seq].splicedCount = splicedCount;
-	results[seq].unsplicedCount = unsplicedCount;
-	results[seq].minQueryLength = minQueryLength;
-	results[seq].maxQueryLength = maxQueryLength;
-	results[seq].sumQueryLengths = sumQueryLengths;
+	res.splicedCount = splicedCount;
+	res.unsplicedCount = unsplicedCount;
+	res.minQueryLength = minQueryLength;
+	res.maxQueryLength = maxQueryLength;
+	res.sumQueryLengths = sumQueryLengths;
+	res.nbJunctions = res.js.size();
+	if (plan.spill || checkpoint) {
+		saveRegion(region);
+	}
+	if (plan.spill) {
+		// Free up the junctions for the next region
+		res.js = JunctionSystem();
+	}
+	TaskRecord task;
+	task.stage = "findJunctions";
+	task.name = getRegionName(region);
+	task.wall = timer.elapsed().wall / 1e9;
+	task.cpu = RunReport::threadCpuTime() - cpuStart;
+	task.records = recordsRead;
+	task.junctions = res.nbJunctions;
+	runReport.addTask(task);
+}
+
+uint64_t portcullis::JunctionBuilder::parseMemory(const string& size) {
+	string s = boost::to_upper_copy(boost::trim_copy(size));
+	if (!s.empty() && s.back() == 'B') {
+		s.pop_back();
+	}
+	uint64_t multiplier = 1024ULL * 1024;
+	if (!s.empty() && !std::isdigit(s.back())) {
+		switch (s.back()) {
+		case 'K':
+			multiplier = 1024ULL;
+			break;
+		case 'M':
+			multiplier = 1024ULL * 1024;
+			break;
+		case 'G':
+			multiplier = 1024ULL * 1024 * 1024;
+			break;
+		case 'T':
+			multiplier = 1024ULL * 1024 * 1024 * 1024;
+			break;
+		default:
+			BOOST_THROW_EXCEPTION(JunctionBuilderException() << JunctionBuilderErrorInfo(string(
+									  "Unrecognised memory size: ") + size));
+		}
+		s.pop_back();
+	}
+	double value = 0.0;
+	try {
+		value = lexical_cast<double>(s);
+	}
+	catch (boost::bad_lexical_cast&) {
+		BOOST_THROW_EXCEPTION(JunctionBuilderException() << JunctionBuilderErrorInfo(string(
+								  "Unrecognised memory size: ") + size));
+	}
+	if (value <= 0.0) {
+		BOOST_THROW_EXCEPTION(JunctionBuilderException() << JunctionBuilderErrorInfo(string(
+								  "Memory size must be positive: ") + size));
+	}
+	return (uint64_t) (value * multiplier);
+}
+
+void portcullis::JunctionBuilder::planMemory() {
+	plan = MemoryPlan();
+	plan.threads = threads;
+	if (maxMemory == 0) {
+		return;
+	}
+	plan.budget = maxMemory;
+	// Get the number of mapped alignments on each reference from the BAM index
+	// if possible, otherwise guess from the size of the BAM
+	const path bamFile = prepData.getSortedBamFilePath();
+	const path indexFile = prepData.getBamIndexFilePath(useCsi);
+	vector<uint64_t> mapped(refs->size(), 0);
+	BamReader reader(bamFile);
+	reader.open();
+	bool haveStats = true;
+	for (size_t i = 0; i < refs->size() && haveStats; i++) {
+		uint64_t unmapped = 0;
+		haveStats = reader.getIndexStats(i, mapped[i], unmapped);
+	}
+	reader.close();
+	if (!haveStats) {
+		uint64_t genomeSize = 0;
+		for (const auto & r : *refs) {
+			genomeSize += r->length;
+		}
+		const uint64_t alignments = bfs::file_size(bamFile) / JUNC_MEM_BAM_BYTES_PER_ALIGNMENT;
+		for (size_t i = 0; i < refs->size(); i++) {
+			mapped[i] = genomeSize == 0 ? 0 : (uint64_t) ((double) alignments * (double) refs->at(i)->length / (double) genomeSize);
+		}
+	}
+	// Memory needed to hold the junctions of the whole genome and of the
+	// largest reference, plus the densest region of alignments per base
+	uint64_t largestAlignments = 0;
+	double maxDensity = 0.0;
+	for (size_t i = 0; i < refs->size(); i++) {
+		plan.alignments += mapped[i];
+		largestAlignments = max(largestAlignments, mapped[i]);
+		if (refs->at(i)->length > 0) {
+			maxDensity = max(maxDensity, (double) mapped[i] / (double) refs->at(i)->length);
+		}
+	}
+	plan.junctions = (uint64_t) (plan.alignments * JUNC_MEM_JUNCTIONS_PER_ALIGNMENT);
+	const uint64_t resident = plan.junctions * JUNC_MEM_PER_JUNCTION;
+	const uint64_t largestResident = (uint64_t) (largestAlignments * JUNC_MEM_JUNCTIONS_PER_ALIGNMENT) * JUNC_MEM_PER_JUNCTION;
+	uint64_t base = JUNC_MEM_BASE;
+	if (extra) {
+		base += (uint64_t) (plan.alignments * JUNC_MEM_SPLICED_FRACTION) * JUNC_MEM_PER_SPLICED_READ;
+	}
+	const uint64_t indexSize = bfs::exists(indexFile) ? bfs::file_size(indexFile) : 0;
+	const uint64_t worker = JUNC_MEM_WORKER + indexSize +
+		(uint64_t) (maxDensity * JUNC_MEM_RETAINED_WINDOW * JUNC_MEM_SPLICED_FRACTION * JUNC_MEM_PER_RETAINED_ALIGNMENT);
+	// Size regions so that the junctions each one holds are no bigger than the
+	// fixed cost of a worker
+	const double bytesPerBase = maxDensity * JUNC_MEM_JUNCTIONS_PER_ALIGNMENT * JUNC_MEM_PER_JUNCTION;
+	int64_t regionSize = bytesPerBase > 0.0 ? (int64_t) (worker / bytesPerBase) : INT32_MAX;
+	regionSize = max((int64_t) JUNC_MIN_REGION_SIZE, min((int64_t) INT32_MAX, regionSize));
+	regionSize = ((regionSize + JUNC_MIN_REGION_SIZE - 1) / JUNC_MIN_REGION_SIZE) * JUNC_MIN_REGION_SIZE;
+	regionSize = min((int64_t) INT32_MAX, regionSize);
+	const uint64_t regionResident = (uint64_t) (regionSize * bytesPerBase);
+	auto wholePeak = [&](uint16_t t) {
+		return base + resident + t * worker;
+	};
+	auto spillPeak = [&](uint16_t t) {
+		return base + max(largestResident, t * (worker + regionResident));
+	};
+	// Find the most threads each approach can use within the budget
+	uint16_t wholeThreads = 0;
+	uint16_t spillThreads = 0;
+	for (uint16_t t = threads; t >= 1 && wholeThreads == 0; t--) {
+		if (wholePeak(t) <= maxMemory) wholeThreads = t;
+	}
+	// Spill mode needs the whole junction system for the extra metrics, and
+	// doesn't keep per cell counts
+	const bool canSpill = !extra && barcodeTag.empty();
+	for (uint16_t t = threads; t >= 1 && spillThreads == 0 && canSpill; t--) {
+		if (spillPeak(t) <= maxMemory) spillThreads = t;
+	}
+	if (wholeThreads > 0 && (wholeThreads == threads || wholeThreads >= spillThreads)) {
+		plan.threads = wholeThreads;
+		plan.peak = wholePeak(wholeThreads);
+	}
+	else if (spillThreads > 0) {
+		plan.threads = spillThreads;
+		plan.regionSize = (int32_t) regionSize;
+		plan.spill = true;
+		plan.peak = spillPeak(spillThreads);
+	}
+	else {
+		plan.threads = 1;
+		if (canSpill && spillPeak(1) < wholePeak(1)) {
+			plan.regionSize = (int32_t) regionSize;
+			plan.spill = true;
+			plan.peak = spillPeak(1);
+		}
+		else {
+			plan.peak = wholePeak(1);
+		}
+		cerr << "Warning: estimated peak memory of " << formatMemory(plan.peak) << " exceeds the budget of "
+			 << formatMemory(maxMemory) << " even with a single thread.  Continuing anyway." << endl << endl;
+	}
+	if (plan.threads < threads) {
+		cerr << "Warning: User requested " << threads << " threads but only " << plan.threads
+			 << " fit within the memory budget.  Setting number of threads to " << plan.threads << "." << endl << endl;
+	}
+}
+
+void portcullis::JunctionBuilder::createRegions() {
+	results.clear();
+	for (const auto & ref : *refs) {
+		if (!targetRegions.empty() && targetRegions.getRegions(ref->index).empty()) {
+			continue;
+		}
+		const int64_t length = ref->length;
+		const int64_t step = plan.regionSize > 0 ? plan.regionSize : max(length, (int64_t) 1);
+		int32_t start = 0;
+		do {
+			RegionResult res;
+			res.seq = ref->index;
+			res.start = start;
+			res.end = (int32_t) min(length, start + step);
+			res.name = ref->name;
+			res.js.setRefs(refs); // Make sure junction system has reference sequence list available
+			res.js.setMaxAlignments(maxAlignments);
+			res.js.setCompactAlignments(longReads);
+			res.js.setBarcodeTag(barcodeTag);
+			if (plan.regionSize > 0) {
+				res.js.setOwnedRange(res.start, res.end);
+			}
+			results.push_back(res);
+			start = res.end;
+		}
+		while (start < length);
+	}
+}
+
+StrandCounts portcullis::JunctionBuilder::saveSpilled() {
+	StrandCounts counts;
+	const path outputPrefix = outputDir / this->outputPrefix;
+	size_t nbJunctions = 0;
+	for (const auto & res : results) {
+		nbJunctions += res.nbJunctions;
+	}
+	cout << " - Assembling output from spilled regions in: " << getRegionDir() << " ... ";
+	cout.flush();
+	size_t nextId = 0;
+	bool first = true;
+	for (size_t i = 0; i < results.size(); i++) {
+		// Load all regions for this reference sequence
+		const int32_t seq = results[i].seq;
+		JunctionSystem js(refs);
+		for (; i < results.size() && results[i].seq == seq; i++) {
+			JunctionSystem part(refs);
+			part.load(getRegionFile(i));
+			js.append(part);
+		}
+		i--;
+		js.sort();
+		js.index(nextId);
+		nextId += js.size();
+		js.setQueryLengthStats(junctionSystem.getMinQueryLength(), junctionSystem.getMeanQueryLength(), junctionSystem.getMaxQueryLength());
+		if (nbJunctions > 1) {
+			js.calcJunctionStats();
+			if (js.size() == 1) {
+				// A junction alone on its sequence has no neighbours
+				JunctionPtr j = js.getJunctionAt(0);
+				j->setDistanceToNextUpstreamJunction(-1);
+				j->setDistanceToNextDownstreamJunction(-1);
+				j->setDistanceToNearestJunction(-1);
+			}
+		}
+		js.appendAll(outputPrefix, source, false, this->outputExonGFF, this->outputIntronGFF, first);
+		js.addStrandCounts(counts);
+		first = false;
+	}
+	cout << "done." << endl;
+	return counts;
+}
+
+string portcullis::JunctionBuilder::fingerprint() {
+	const path bamFile = prepData.getSortedBamFilePath();
+	std::stringstream ss;
+	ss << "version\t" << (JunctionSystem::version.empty() ? "X.X.X" : JunctionSystem::version) << endl
+	   << "bam\t" << bfs::canonical(bamFile).string() << endl
+	   << "bam_size\t" << bfs::file_size(bamFile) << endl
+	   << "bam_time\t" << bfs::last_write_time(bamFile) << endl
+	   << "orientation\t" << orientationToString(orientation) << endl
+	   << "strandedness\t" << strandednessToString(strandSpecific) << endl
+	   << "max_alignments\t" << maxAlignments << endl
+	   << "anchor_window\t" << getEffectiveAnchorWindow() << endl
+	   << "prune\t" << prune.minReads << "," << prune.minAnchor << "," << prune.minIntron << "," << prune.maxIntron << endl
+	   << "region_size\t" << plan.regionSize << endl
+	   << "target_regions\t" << (regionsFile.empty() ? string("") : bfs::canonical(regionsFile).string()) << ","
+	   << targetRegions.size() << "," << targetRegions.totalLength() << endl
+	   << "regions\t" << results.size() << endl;
+	return ss.str();
+}
+
+void portcullis::JunctionBuilder::prepareRegionDir() {
+	const path dir = getRegionDir();
+	const string fp = fingerprint();
+	if (bfs::exists(dir)) {
+		bool valid = false;
+		if (checkpoint && bfs::exists(getFingerprintFile())) {
+			std::ifstream ifs(getFingerprintFile().c_str());
+			std::stringstream saved;
+			saved << ifs.rdbuf();
+			valid = saved.str() == fp;
+		}
+		if (valid) {
+			cout << "Found checkpoint from a previous run in: " << dir << endl;
+			size_t nbLoaded = 0;
+			for (size_t i = 0; i < results.size(); i++) {
+				if (loadRegion(i)) {
+					nbLoaded++;
+				}
+			}
+			cout << " - Reusing " << nbLoaded << " of " << results.size() << " regions" << endl << endl;
+			return;
+		}
+		if (checkpoint) {
+			cerr << "Warning: Discarding checkpoint in " << dir << " as it does not match the prepared BAM or settings of this run." << endl << endl;
+		}
+		bfs::remove_all(dir);
+	}
+	if (!bfs::create_directories(dir)) {
+		BOOST_THROW_EXCEPTION(JunctionBuilderException() << JunctionBuilderErrorInfo(string(
+								  "Could not create region directory at: ") + dir.string()));
+	}
+	std::ofstream ofs(getFingerprintFile().c_str());
+	ofs << fp;
+	ofs.close();
+}
+
+void portcullis::JunctionBuilder::saveRegion(const size_t region) {
+	const RegionResult& res = results[region];
+	std::ofstream junctions(getRegionFile(region).c_str());
+	junctions << res.js;
+	junctions.close();
+	if (!checkpoint) {
+		return;
+	}
+	// Write the counters to a temporary file and then move it into place so
+	// that an interrupted write never looks like a finished region
+	const path doneFile = getRegionDoneFile(region);
+	const path tmpFile = path(doneFile.string() + ".tmp");
+	std::ofstream done(tmpFile.c_str());
+	done << res.seq << "\t" << res.start << "\t" << res.end << "\t"
+		 << res.splicedCount << "\t" << res.unsplicedCount << "\t" << res.sumQueryLengths << "\t"
+		 << res.minQueryLength << "\t" << res.maxQueryLength << "\t" << res.nbJunctions << "\t" << res.nbPruned << endl;
+	done.close();
+	bfs::rename(tmpFile, doneFile);
+}
+
+bool portcullis::JunctionBuilder::loadRegion(const size_t region) {
+	RegionResult& res = results[region];
+	const path doneFile = getRegionDoneFile(region);
+	if (!bfs::exists(doneFile) || !bfs::exists(getRegionFile(region))) {
+		return false;
+	}
+	std::ifstream ifs(doneFile.c_str());
+	int32_t seq = -1, start = -1, end = -1;
+	RegionResult saved;
+	ifs >> seq >> start >> end >> saved.splicedCount >> saved.unsplicedCount >> saved.sumQueryLengths
+		>> saved.minQueryLength >> saved.maxQueryLength >> saved.nbJunctions >> saved.nbPruned;
+	if (!ifs || seq != res.seq || start != res.start || end != res.end) {
+		return false;
+	}
+	res.splicedCount = saved.splicedCount;
+	res.unsplicedCount = saved.unsplicedCount;
+	res.sumQueryLengths = saved.sumQueryLengths;
+	res.minQueryLength = saved.minQueryLength;
+	res.maxQueryLength = saved.maxQueryLength;
+	res.nbJunctions = saved.nbJunctions;
+	res.nbPruned = saved.nbPruned;
+	if (!plan.spill) {
+		JunctionSystem js(refs);
+		js.load(getRegionFile(region));
+		if (js.size() != res.nbJunctions) {
+			return false;
+		}
+		res.js.append(js);
+	}
+	res.done = true;
+	return true;
 }
 
 int portcullis::JunctionBuilder::main(int argc, char *argv[]) {
@@ -361,6 +1085,17 @@ int portcullis::JunctionBuilder::main(int argc, char *argv[]) {
 	string prepDir;
 	string output;
 	uint16_t threads;
+	string maxMemory;
+	bool checkpoint;
+	uint32_t maxAlignments;
+	bool longReads;
+	uint32_t anchorWindow;
+	bool singleCell;
+	string barcodeTag;
+	bool skipUnspliced;
+	string regionsFile;
+	PruneSettings prune;
+	bool detectStrand;
 	bool extra;
 	bool separate;
 	string strandSpecific;
@@ -377,19 +1112,50 @@ int portcullis::JunctionBuilder::main(int argc, char *argv[]) {
 	po::options_description system_options("System options", w.ws_col, (unsigned) ((double) w.ws_col / 1.5));
 	system_options.add_options()
 	("threads,t", po::value<uint16_t>(&threads)->default_value(1),
-	 "The number of threads to use.  Note that increasing the number of threads will also increase memory requirements.")
+	 "The number of threads to use.  Note that increasing the number of threads will also increase memory requirements.  Threads beyond the number of target sequences help calculate junction metrics for the sequences being read.")
+	("max_memory", po::value<string>(&maxMemory)->default_value(""),
+	 "Try to keep peak memory usage below this limit, e.g. \"512M\" or \"16G\".  Portcullis estimates memory requirements from the BAM index and reduces the number of threads, splits target sequences into regions, and writes junctions to disk as each region completes as necessary.  The estimate is approximate so leave some headroom.  Numbers without a suffix are taken as megabytes.  By default there is no limit.")
+	("checkpoint", po::bool_switch(&checkpoint)->default_value(false),
+	 "Keep each completed region in a directory next to the output until the run finishes.  If the run is interrupted, rerunning the same command with this option only processes the regions that had not finished.  Not available with --extra.")
+	("max_alignments", po::value<uint32_t>(&maxAlignments)->default_value(DEFAULT_JUNC_MAX_ALIGNMENTS),
+	 "The most alignments to keep for each junction when calculating its anchor, mismatch and junction anchor depth metrics.  Junctions with more supporting alignments use a random sample of this size, which bounds memory and CPU time at very deeply covered junctions.  Alignment counts, entropy and read strand counts always use every alignment.  0 keeps every alignment.")
+	("long_reads", po::bool_switch(&longReads)->default_value(false),
+	 "Tune for long reads, such as PacBio or Nanopore reads aligned with minimap2.  Each read is stored once, without its optional fields, and shared by all the junctions it supports.  Alignment match and mismatch metrics only look at the bases near each intron (see --anchor_window), so that sequencing errors far from the splice site don't swamp them.")
+	("anchor_window", po::value<uint32_t>(&anchorWindow)->default_value(0),
+	 "Only use this many bases either side of each intron when calculating alignment match and mismatch metrics.  0 uses the whole anchors, or 50bp with --long_reads.  Must be 0 or at least 10.")
+	("single_cell", po::bool_switch(&singleCell)->default_value(false),
+	 "Single cell mode.  As well as the usual junction metrics, which are calculated once from all reads, count the reads supporting each junction from each cell barcode.  The counts are saved as a junction by cell matrix in Matrix Market format, <output>.cells.mtx, with the barcodes in <output>.cells.barcodes.tsv and the junctions in <output>.cells.junctions.tsv.  Reads without a barcode only count towards the junction metrics.  Not available with --checkpoint, and --max_memory will not split the work into regions.")
+	("barcode_tag", po::value<string>(&barcodeTag)->default_value(DEFAULT_BARCODE_TAG),
+	 "The BAM tag holding the cell barcode in single cell mode.")
+	("skip_unspliced", po::bool_switch(&skipUnspliced)->default_value(false),
+	 "Only read the parts of the BAM that hold spliced alignments, seeking past the blocks that hold nothing but unspliced alignments.  These are counted from the spliced block index created by portcullis prep, so the output is the same as a full read.  Most useful when spliced reads are sparse or clustered.  Falls back to reading the whole BAM if the index is missing or out of date, or if --max_memory splits target sequences into regions.")
+	("regions", po::value<string>(&regionsFile)->default_value(""),
+	 "Only process alignments overlapping the regions in this BED file, such as the loci targeted by a capture or amplicon panel.  Only the first three columns are used.  Target sequences without any regions are skipped entirely.")
 	("separate", po::bool_switch(&separate)->default_value(false),
 	 "Separate spliced from unspliced reads.  Creates two new BAM files.")
 	("orientation", po::value<string>(&orientation)->default_value(orientationToString(Orientation::UNKNOWN)),
 	 "The orientation of the reads that produced the BAM alignments: \"F\" (Single-end forward orientation); \"R\" (single-end reverse orientation); \"FR\" (paired-end, with reads sequenced towards center of fragment -> <-.  This is usual setting for most Illumina paired end sequencing); \"RF\" (paired-end, reads sequenced away from center of fragment <- ->); \"FF\" (paired-end, reads both sequenced in forward orientation); \"RR\" (paired-end, reads both sequenced in reverse orientation); \"UNKNOWN\" (default, portcullis will workaround any calculations requiring orientation information)")
 	("strandedness", po::value<string>(&strandSpecific)->default_value(strandednessToString(Strandedness::UNKNOWN)),
 	 "Whether BAM alignments were generated using a type of strand specific RNAseq library: \"unstranded\" (Standard Illumina); \"firststrand\" (dUTP, NSR, NNSR); \"secondstrand\" (Ligation, Standard SOLiD, flux sim reads); \"UNKNOWN\" (default, portcullis will workaround any calculations requiring strandedness information)")
+	("detect_strand", po::bool_switch(&detectStrand)->default_value(false),
+	 "Before looking for junctions, sample spliced reads from across the genome to work out the strandedness and orientation of the library, and use them wherever --strandedness or --orientation were left as UNKNOWN.  This usually takes a few seconds.  \"portcullis strand\" runs the same check on its own.")
 	("use_csi,c", po::bool_switch(&useCsi)->default_value(false),
 	 "Whether to use CSI indexing rather than BAI indexing.  CSI has the advantage that it supports very long target sequences (probably not an issue unless you are working on huge genomes).  BAI has the advantage that it is more widely supported (useful for viewing in genome browsers).")
 	("verbose,v", po::bool_switch(&verbose)->default_value(false),
 	 "Print extra information")
 	("help", po::bool_switch(&help)->default_value(false), "Produce help message")
 	;
+	po::options_description prune_options("Pruning options", w.ws_col, (unsigned) ((double) w.ws_col / 1.5));
+	prune_options.add_options()
+	("prune_min_reads", po::value<uint32_t>(&prune.minReads)->default_value(0),
+	 "Drop junctions supported by fewer than this many split reads before calculating their metrics.  Dropped junctions are only counted.  0 disables this check.")
+	("prune_min_anchor", po::value<uint32_t>(&prune.minAnchor)->default_value(0),
+	 "Drop junctions whose longest minimum anchor (max_min_anc) is shorter than this before calculating their metrics.  0 disables this check.")
+	("prune_min_intron", po::value<uint32_t>(&prune.minIntron)->default_value(0),
+	 "Drop junctions with introns shorter than this before calculating their metrics.  0 disables this check.")
+	("prune_max_intron", po::value<uint32_t>(&prune.maxIntron)->default_value(0),
+	 "Drop junctions with introns longer than this before calculating their metrics.  0 disables this check.")
+	;
 	po::options_description output_options("Output options", w.ws_col, (unsigned) ((double) w.ws_col / 1.5));
 	output_options.add_options()
 	("output,o", po::value<string>(&output)->default_value(DEFAULT_JUNC_OUTPUT),
@@ -414,7 +1180,7 @@ int portcullis::JunctionBuilder::main(int argc, char *argv[]) {
 	p.add("prep_data_dir", 1);
 	// Combine non-positional options
 	po::options_description display_options;
-	display_options.add(system_options).add(output_options);
+	display_options.add(system_options).add(prune_options).add(output_options);
 	// Combine non-positional options
 	po::options_description cmdline_options;
 	cmdline_options.add(display_options).add(hidden_options);
@@ -435,16 +1201,27 @@ int portcullis::JunctionBuilder::main(int argc, char *argv[]) {
 		prepDir = vm["prep_data_dir"].as<string>();
 	}
 	auto_cpu_timer timer(1, "\nPortcullis junc completed.\nTotal runtime: %ws\n\n");
+	runReport.begin("junc");
 	cout << "Running portcullis in junction builder mode" << endl
 		 << "------------------------------------------" << endl << endl;
 	// Do the work ...
 	JunctionBuilder jb(prepDir, output);
 	jb.setThreads(threads);
+	jb.setMaxMemory(maxMemory.empty() ? 0 : JunctionBuilder::parseMemory(maxMemory));
+	jb.setCheckpoint(checkpoint);
+	jb.setMaxAlignments(maxAlignments);
+	jb.setLongReads(longReads);
+	jb.setAnchorWindow(anchorWindow);
+	jb.setBarcodeTag(singleCell ? barcodeTag : "");
+	jb.setSkipUnspliced(skipUnspliced);
+	jb.setRegionsFile(regionsFile);
+	jb.setPrune(prune);
 	jb.setExtra(extra);
 	jb.setSeparate(separate);
 	jb.setSource(source);
 	jb.setStrandSpecific(strandednessFromString(strandSpecific));
 	jb.setOrientation(orientationFromString(orientation));
+	jb.setDetectStrand(detectStrand);
 	jb.setUseCsi(useCsi);
 	jb.setOutputExonGFF(exongff);
 	jb.setOutputIntronGFF(introngff);
@@ -456,8 +1233,9 @@ int portcullis::JunctionBuilder::main(int argc, char *argv[]) {
 
 // ********* Thread Pool ************
 
-portcullis::JBThreadPool::JBThreadPool(JunctionBuilder* jb, const uint16_t threads) : terminate(false), stopped(false) {
+portcullis::JBThreadPool::JBThreadPool(JunctionBuilder* jb, const uint16_t threads, const uint16_t finaliserThreads) : terminate(false), stopped(false) {
 	junctionBuilder = jb;
+	this->finaliserThreads = finaliserThreads;
 	// Create number of required threads and add them to the thread pool vector.
 	for (int i = 0; i < threads; i++) {
 		// Add the thread onto the thread pool (providing an index so we can get the the correct BAM reader again)
@@ -465,7 +1243,7 @@ portcullis::JBThreadPool::JBThreadPool(JunctionBuilder* jb, const uint16_t threa
 	}
 }
 
-void portcullis::JBThreadPool::enqueue(const int32_t index) {
+void portcullis::JBThreadPool::enqueue(const size_t index) {
 	// Scope based locking.
 	{
 		// Put unique lock on task mutex.
@@ -478,18 +1256,29 @@ void portcullis::JBThreadPool::enqueue(const int32_t index) {
 }
 
 void portcullis::JBThreadPool::invoke() {
+	PORTCULLIS_THREAD_NAME("junc worker");
 	// Create the genome mapper
 	GenomeMapper gmap(junctionBuilder->getPreparedFiles().getGenomeFilePath());
-	// Load the fasta index
-	gmap.loadFastaIndex();
-	// Create a BAM reader for this thread
 	BamReader reader(junctionBuilder->getPreparedFiles().getSortedBamFilePath());
-	// Open the BAM file... this will load the index, which might take some time on large BAMs
-	reader.open();
-	int32_t id;
+	{
+		PORTCULLIS_TRACE("open", "setup");
+		// Load the fasta index
+		gmap.loadFastaIndex();
+		// Open the BAM file... this will load the index, which might take some time on large BAMs
+		reader.open();
+	}
+	std::unique_ptr<JunctionFinaliser> finaliser;
+	if (finaliserThreads > 0) {
+		finaliser.reset(new JunctionFinaliser(junctionBuilder->getPreparedFiles().getGenomeFilePath(),
+				junctionBuilder->getOrientation(), junctionBuilder->getEffectiveAnchorWindow(),
+				finaliserThreads, JUNC_FINALISE_QUEUE_SIZE));
+	}
+	size_t id;
 	while (true) {
 		// Scope based locking.
 		{
+			// Covers both contention on the mutex and waiting for work
+			PORTCULLIS_TRACE("wait", "queue");
 			// Put unique lock on task mutex.
 			unique_lock<mutex> lock(tasksMutex);
 			// Wait until queue is not empty or termination signal is sent.
@@ -504,12 +1293,13 @@ void portcullis::JBThreadPool::invoke() {
 			}
 			// Get next task in the queue.
 			id = tasks.front();
-			cout << "   - " << junctionBuilder->getRefName(id) << endl;
+			cout << "   - " << junctionBuilder->getRegionName(id) << endl;
 			// Remove it from the queue.
 			tasks.pop();
 		}
 		// Execute the task.
-		junctionBuilder->findJuncs(reader, gmap, id);
+		PORTCULLIS_TRACE(junctionBuilder->getRegionName(id), "task");
+		junctionBuilder->findJuncs(reader, gmap, finaliser.get(), id);
 	}
 }
 
@@ -540,3 +1330,86 @@ portcullis::JBThreadPool::~JBThreadPool() {
 		shutDown();
 	}
 }
+
+
+// ********* Junction Finaliser ************
+
+portcullis::JunctionFinaliser::JunctionFinaliser(const path& genomeFile, const Orientation orientation, const uint32_t anchorWindow,
+		const uint16_t threads, const size_t capacity) :
+	active(0), terminate(false), stopped(false) {
+	this->genomeFile = genomeFile;
+	this->orientation = orientation;
+	this->anchorWindow = anchorWindow;
+	this->capacity = capacity;
+	for (uint16_t i = 0; i < threads; i++) {
+		threadPool.emplace_back(thread(&portcullis::JunctionFinaliser::invoke, this));
+	}
+}
+
+void portcullis::JunctionFinaliser::push(JunctionPtr junction) {
+	{
+		unique_lock<mutex> lock(junctionsMutex);
+		notFull.wait(lock, [this] {
+			return junctions.size() < capacity;
+		});
+		junctions.push(junction);
+	}
+	notEmpty.notify_one();
+}
+
+void portcullis::JunctionFinaliser::wait() {
+	unique_lock<mutex> lock(junctionsMutex);
+	idle.wait(lock, [this] {
+		return junctions.empty() && active == 0;
+	});
+}
+
+void portcullis::JunctionFinaliser::invoke() {
+	PORTCULLIS_THREAD_NAME("junc finaliser");
+	GenomeMapper gmap(genomeFile);
+	gmap.loadFastaIndex();
+	while (true) {
+		JunctionPtr j;
+		{
+			unique_lock<mutex> lock(junctionsMutex);
+			notEmpty.wait(lock, [this] {
+				return !junctions.empty() || terminate;
+			});
+			if (terminate && junctions.empty()) {
+				return;
+			}
+			j = junctions.front();
+			junctions.pop();
+			active++;
+		}
+		notFull.notify_one();
+		j->calcMetrics(orientation);
+		j->processJunctionWindow(gmap, anchorWindow);
+		j->clearAlignments();
+		{
+			unique_lock<mutex> lock(junctionsMutex);
+			active--;
+			if (junctions.empty() && active == 0) {
+				idle.notify_all();
+			}
+		}
+	}
+}
+
+void portcullis::JunctionFinaliser::shutDown() {
+	{
+		unique_lock<mutex> lock(junctionsMutex);
+		terminate = true;
+	}
+	notEmpty.notify_all();
+	for (thread & thread : threadPool) {
+		thread.join();
+	}
+	stopped = true;
+}
+
+portcullis::JunctionFinaliser::~JunctionFinaliser() {
+	if (!stopped) {
+		shutDown();
+	}
+}
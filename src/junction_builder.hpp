@@ -51,9 +51,11 @@ namespace po = boost::program_options;
 #include <portcullis/intron.hpp>
 #include <portcullis/junction.hpp>
 #include <portcullis/junction_system.hpp>
+#include <portcullis/bam/region_list.hpp>
 using portcullis::Intron;
 using portcullis::Junction;
 using portcullis::JunctionSystem;
+using portcullis::bam::RegionList;
 
 #include "prepare.hpp"
 using portcullis::PreparedFiles;
@@ -65,11 +67,62 @@ namespace portcullis {
 const string DEFAULT_JUNC_OUTPUT = "portcullis_junc/portcullis";
 const string DEFAULT_JUNC_SOURCE = "portcullis";
 const uint16_t DEFAULT_JUNC_THREADS = 1;
+const uint32_t DEFAULT_JUNC_MAX_ALIGNMENTS = 0;
+
+// Bases either side of the intron used for alignment match statistics in long
+// read mode.  Must be at least 10 as the hamming scores use 10bp of anchor.
+const uint32_t DEFAULT_JUNC_LONG_READ_ANCHOR_WINDOW = 50;
+const uint32_t MIN_JUNC_ANCHOR_WINDOW = 10;
+
+// Most junctions waiting for metrics to be calculated by the finaliser threads
+// of a single task before the reader waits for them to catch up
+const size_t JUNC_FINALISE_QUEUE_SIZE = 1024;
+
+// Rough memory costs used to plan a run within --max_memory.  These are
+// deliberately on the generous side, the actual peak is reported at the end of
+// the run so they can be checked.
+const uint64_t JUNC_MEM_BASE = 32 * 1024 * 1024;			// Program, reference list and output buffers
+const uint64_t JUNC_MEM_WORKER = 8 * 1024 * 1024;		// BGZF buffers, genome index and stack per worker, plus the BAM index
+const uint64_t JUNC_MEM_PER_JUNCTION = 1024;				// Junction, intron and hash map entry
+const double JUNC_MEM_JUNCTIONS_PER_ALIGNMENT = 0.01;		// Distinct junctions expected per mapped alignment
+const uint64_t JUNC_MEM_PER_RETAINED_ALIGNMENT = 1024;	// Alignment copy held by a junction until its metrics are calculated
+const int32_t JUNC_MEM_RETAINED_WINDOW = 20000;			// Span of alignments each worker holds onto awaiting junction metrics
+const double JUNC_MEM_SPLICED_FRACTION = 0.3;				// Fraction of alignments assumed to be spliced
+const uint64_t JUNC_MEM_PER_SPLICED_READ = 48;			// Spliced read name hash kept with --extra
+const uint64_t JUNC_MEM_BAM_BYTES_PER_ALIGNMENT = 40;		// Used to guess alignment counts if the index has no stats
+const int32_t JUNC_MIN_REGION_SIZE = 1000000;
 
 typedef boost::error_info<struct JunctionBuilderError, string> JunctionBuilderErrorInfo;
 struct JunctionBuilderException: virtual boost::exception, virtual std::exception { };
 
+/**
+ * Cheap checks made on each junction once all of its alignments have been
+ * seen, before calculating its metrics.  Junctions that fail are dropped and
+ * only counted.  A threshold of 0 disables that check.
+ */
+struct PruneSettings {
+	uint32_t minReads = 0;		// Fewest supporting split reads
+	uint32_t minAnchor = 0;		// Shortest allowed longest minimum anchor (max_min_anc)
+	uint32_t minIntron = 0;		// Shortest intron
+	uint32_t maxIntron = 0;		// Longest intron
+
+	bool enabled() const {
+		return minReads > 0 || minAnchor > 0 || minIntron > 0 || maxIntron > 0;
+	}
+
+	bool keep(const Junction& j) const {
+		const uint32_t intronSize = j.getIntron()->size();
+		return j.getNbSplicedAlignments() >= minReads &&
+			   j.getMaxMinAnchor() >= minAnchor &&
+			   intronSize >= minIntron &&
+			   (maxIntron == 0 || intronSize <= maxIntron);
+	}
+};
+
 struct RegionResult {
+	int32_t seq = 0;
+	int32_t start = 0;
+	int32_t end = 0;
 	uint64_t splicedCount = 0;
 	uint64_t unsplicedCount = 0;
 	uint64_t sumQueryLengths = 0;
@@ -77,8 +130,30 @@ struct RegionResult {
 	int32_t maxQueryLength = 0;
 	string name;
 	JunctionSystem js;
+	size_t nbJunctions = 0;	// Kept when the junctions are spilled to disk
+	size_t nbPruned = 0;
+	bool done = false;		// Reloaded from a checkpoint
 };
 
+/**
+ * How a junc run is laid out to stay within a memory budget.  Work is split
+ * into regions of each reference sequence that are processed by a pool of
+ * worker threads.  When spilling, each region's junctions are written to disk
+ * as soon as it completes and the output is then assembled one reference
+ * sequence at a time, so only the largest reference needs to fit in memory.
+ */
+struct MemoryPlan {
+	uint64_t budget = 0;			// 0 means no budget was given
+	uint16_t threads = 1;			// Concurrently active regions
+	int32_t regionSize = 0;		// 0 processes each reference sequence whole
+	bool spill = false;
+	uint64_t alignments = 0;		// Estimated from the BAM index
+	uint64_t junctions = 0;		// Estimated
+	uint64_t peak = 0;			// Estimated peak memory in bytes
+};
+
+class JunctionFinaliser;
+
 class JunctionBuilder {
 private:
 
@@ -96,6 +171,26 @@ private:
 	bool outputIntronGFF;
 	string source;
 	bool verbose;
+	uint64_t maxMemory;
+	bool checkpoint;
+	bool detectStrand;
+	uint32_t maxAlignments;
+	bool longReads;
+	uint32_t anchorWindow;
+	string barcodeTag;
+	bool skipUnspliced;
+	path regionsFile;
+	PruneSettings prune;
+
+	// How the work is split up, decided from maxMemory
+	MemoryPlan plan;
+
+	// Targeted regions loaded from regionsFile, only alignments overlapping
+	// these are processed
+	RegionList targetRegions;
+
+	// Where the spliced alignments are in the BAM, loaded with skipUnspliced
+	SplicedBlockIndex splicedIndex;
 
 	// The set of distinct junctions found in the BAM file
 	JunctionSystem junctionSystem;
@@ -107,7 +202,7 @@ private:
 	// Map of reference sequence indicies to reference sequences
 	shared_ptr<RefSeqPtrIndexMap> refMap;
 
-	// Results from threads
+	// Results from threads, one per region
 	vector<RegionResult> results;
 
 
@@ -126,16 +221,92 @@ protected:
 		return path(outputDir.string() + "/" + outputPrefix + ".unmapped.bam");
 	}
 
+	path getReportFile() {
+		return path(outputDir.string() + "/" + outputPrefix + ".report.json");
+	}
+
 	path getAssociatedIndexFile(path bamFile) {
 		return path(bamFile.string() + ".bai");
 	}
 
+	/**
+	 * Directory holding per region results when spilling or checkpointing
+	 */
+	path getRegionDir() {
+		return path(outputDir.string() + "/" + outputPrefix + ".regions");
+	}
+
+	path getRegionFile(size_t region) {
+		return getRegionDir() / ("region_" + lexical_cast<string>(region) + ".junctions.tab");
+	}
+
+	/**
+	 * Written last when a region completes, so its presence marks the region
+	 * as finished
+	 */
+	path getRegionDoneFile(size_t region) {
+		return getRegionDir() / ("region_" + lexical_cast<string>(region) + ".done");
+	}
+
+	path getFingerprintFile() {
+		return getRegionDir() / "fingerprint";
+	}
+
+	/**
+	 * Describes the input and settings that the per region results depend on
+	 */
+	string fingerprint();
+
+	/**
+	 * Creates the region directory.  When checkpointing, regions completed by
+	 * an earlier run with the same fingerprint are reloaded and marked as done.
+	 * Anything else in the directory is discarded.
+	 */
+	void prepareRegionDir();
+
+	void saveRegion(const size_t region);
+
+	bool loadRegion(const size_t region);
+
+	/**
+	 * Estimates how much memory the run will need and decides the number of
+	 * threads, the region size and whether to spill to stay within maxMemory
+	 */
+	void planMemory();
+
+	/**
+	 * Samples the BAM to fill in the strandedness and orientation if unknown
+	 */
+	void detectProtocol();
+
+	/**
+	 * Loads the regions of interest from regionsFile
+	 */
+	void loadTargetRegions();
+
+	/**
+	 * Loads the spliced block index written by prep, or turns off
+	 * skipUnspliced with a warning if it can't be used
+	 */
+	void loadSplicedIndex();
+
+	/**
+	 * Splits the reference sequences into regions according to the plan
+	 */
+	void createRegions();
+
 	void separateBams();
 
 	void findJunctions();
 
 	void calcExtraMetrics();
 
+	/**
+	 * Assembles the output from the spilled regions one reference sequence at
+	 * a time
+	 */
+	StrandCounts saveSpilled();
+
 
 public:
 
@@ -146,7 +317,31 @@ public:
 
 	string getRefName(const int32_t seqId) { return refs->at(seqId)->name; }
 
-	void findJuncs(BamReader& reader, GenomeMapper& gmap, const int32_t seq);
+	string getRegionName(const size_t region) {
+		const RegionResult& r = results[region];
+		return plan.regionSize == 0 ? r.name : r.name + ":" + lexical_cast<string>(r.start + 1) + "-" + lexical_cast<string>(r.end);
+	}
+
+	/**
+	 * Finds and analyses all junctions in a region.  If a finaliser is given,
+	 * metrics for junctions that can receive no more alignments are calculated
+	 * on its threads, otherwise they are calculated inline.
+	 */
+	void findJuncs(BamReader& reader, GenomeMapper& gmap, JunctionFinaliser* finaliser, const size_t region);
+
+	/**
+	 * findJuncs for a given strandedness, choosing the orientation
+	 */
+	template<Strandedness S>
+	void findJuncsFor(BamReader& reader, GenomeMapper& gmap, JunctionFinaliser* finaliser, const size_t region);
+
+	/**
+	 * findJuncs with the library protocol, which is fixed for the whole run,
+	 * known at compile time so the strand and proper pair logic applied to
+	 * each record doesn't have to branch on it
+	 */
+	template<Strandedness S, Orientation O>
+	void findJuncsFor(BamReader& reader, GenomeMapper& gmap, JunctionFinaliser* finaliser, const size_t region);
 
 	PreparedFiles& getPreparedFiles() { return prepData; }
 
@@ -174,6 +369,152 @@ public:
 		this->verbose = verbose;
 	}
 
+	uint64_t getMaxMemory() const {
+		return maxMemory;
+	}
+
+	/**
+	 * Sets the memory budget in bytes, 0 for no budget
+	 */
+	void setMaxMemory(uint64_t maxMemory) {
+		this->maxMemory = maxMemory;
+	}
+
+	uint32_t getMaxAlignments() const {
+		return maxAlignments;
+	}
+
+	/**
+	 * Most alignments each junction keeps for calculating its anchor, mismatch
+	 * and junction anchor depth metrics, 0 for no limit
+	 */
+	void setMaxAlignments(uint32_t maxAlignments) {
+		this->maxAlignments = maxAlignments;
+	}
+
+	bool isLongReads() const {
+		return longReads;
+	}
+
+	/**
+	 * Whether the alignments come from long reads.  Junctions then share one
+	 * compact copy of each read between them, and only the bases near each
+	 * intron are used for the alignment match statistics.
+	 */
+	void setLongReads(bool longReads) {
+		this->longReads = longReads;
+	}
+
+	/**
+	 * Bases either side of the intron used for the alignment match statistics,
+	 * as set by the user.  0 means use the default for the type of read.
+	 */
+	uint32_t getAnchorWindow() const {
+		return anchorWindow;
+	}
+
+	void setAnchorWindow(uint32_t anchorWindow) {
+		if (anchorWindow > 0 && anchorWindow < MIN_JUNC_ANCHOR_WINDOW) {
+			BOOST_THROW_EXCEPTION(JunctionBuilderException() << JunctionBuilderErrorInfo(string(
+									  "Anchor window must be 0 or at least ") + lexical_cast<string>(MIN_JUNC_ANCHOR_WINDOW)));
+		}
+		this->anchorWindow = anchorWindow;
+	}
+
+	/**
+	 * The anchor window actually used: whatever the user set, otherwise the
+	 * long read default in long read mode, otherwise the whole anchors
+	 */
+	uint32_t getEffectiveAnchorWindow() const {
+		return anchorWindow > 0 ? anchorWindow : longReads ? DEFAULT_JUNC_LONG_READ_ANCHOR_WINDOW : 0;
+	}
+
+	const string& getBarcodeTag() const {
+		return barcodeTag;
+	}
+
+	/**
+	 * Turns on single cell mode, where the reads supporting each junction are
+	 * also counted per cell barcode, taken from this tag.  The counts are saved
+	 * as a junction by cell matrix alongside the junctions.  Empty for normal
+	 * bulk mode.
+	 */
+	void setBarcodeTag(const string& barcodeTag) {
+		if (!barcodeTag.empty() && barcodeTag.size() != 2) {
+			BOOST_THROW_EXCEPTION(JunctionBuilderException() << JunctionBuilderErrorInfo(string(
+									  "Barcode tag must be two characters long: ") + barcodeTag));
+		}
+		this->barcodeTag = barcodeTag;
+	}
+
+	bool isSkipUnspliced() const {
+		return skipUnspliced;
+	}
+
+	/**
+	 * Whether to only read the parts of the BAM holding spliced alignments,
+	 * using the spliced block index written by prep.  The unspliced alignments
+	 * skipped over are counted from the index, so the output is unchanged.
+	 */
+	void setSkipUnspliced(bool skipUnspliced) {
+		this->skipUnspliced = skipUnspliced;
+	}
+
+	const path& getRegionsFile() const {
+		return regionsFile;
+	}
+
+	/**
+	 * Restricts the analysis to alignments overlapping the regions in this BED
+	 * file, such as the loci targeted by a capture panel.  Empty to process
+	 * every target sequence.
+	 */
+	void setRegionsFile(const path& regionsFile) {
+		this->regionsFile = regionsFile;
+	}
+
+	const PruneSettings& getPrune() const {
+		return prune;
+	}
+
+	void setPrune(const PruneSettings& prune) {
+		this->prune = prune;
+	}
+
+	bool isCheckpoint() const {
+		return checkpoint;
+	}
+
+	/**
+	 * Whether to keep each completed region on disk so an interrupted run can
+	 * be resumed
+	 */
+	void setCheckpoint(bool checkpoint) {
+		this->checkpoint = checkpoint;
+	}
+
+	bool isDetectStrand() const {
+		return detectStrand;
+	}
+
+	/**
+	 * Whether to sample the BAM for the library protocol before the main pass
+	 * when the strandedness or orientation is unknown
+	 */
+	void setDetectStrand(bool detectStrand) {
+		this->detectStrand = detectStrand;
+	}
+
+	const MemoryPlan& getMemoryPlan() const {
+		return plan;
+	}
+
+	/**
+	 * Parses a memory size such as "512M", "16G" or "1.5T".  Numbers without a
+	 * suffix are taken as megabytes.
+	 */
+	static uint64_t parseMemory(const string& size);
+
 	bool isSeparate() const {
 		return separate;
 	}
@@ -258,17 +599,61 @@ public:
 	static int main(int argc, char *argv[]);
 };
 
+/**
+ * Calculates metrics for junctions that can receive no more alignments on a set
+ * of helper threads, so that a single task can use more than one core.  Each
+ * thread has its own genome mapper.  The queue is bounded so the reader cannot
+ * get far ahead and hold on to the alignments of many unfinished junctions.
+ */
+class JunctionFinaliser {
+public:
+
+	JunctionFinaliser(const path& genomeFile, const Orientation orientation, const uint32_t anchorWindow,
+			const uint16_t threads, const size_t capacity);
+
+	~JunctionFinaliser();
+
+	// Adds a junction to the queue, waiting if the queue is full
+	void push(JunctionPtr junction);
+
+	// Waits until all junctions pushed so far are finished
+	void wait();
+
+	void shutDown();
+
+private:
+
+	path genomeFile;
+	Orientation orientation;
+	uint32_t anchorWindow;
+	size_t capacity;
+
+	vector<thread> threadPool;
+	queue<JunctionPtr> junctions;
+	size_t active;
+
+	mutex junctionsMutex;
+	condition_variable notEmpty;
+	condition_variable notFull;
+	condition_variable idle;
+
+	bool terminate;
+	bool stopped;
+
+	void invoke();
+};
+
 class JBThreadPool {
 public:
 
-	// Constructor.
-	JBThreadPool(JunctionBuilder* jb, const uint16_t threads);
+	// Constructor.  Each thread gets finaliserThreads helper threads.
+	JBThreadPool(JunctionBuilder* jb, const uint16_t threads, const uint16_t finaliserThreads);
 
 	// Destructor.
 	~JBThreadPool();
 
 	// Adds task to a task queue.
-	void enqueue(const int32_t index);
+	void enqueue(const size_t index);
 
 	// Shut down the pool.
 	void shutDown();
@@ -278,11 +663,13 @@ private:
 	// JunctionBuider
 	JunctionBuilder* junctionBuilder;
 
+	uint16_t finaliserThreads;
+
 	// Thread pool storage.
 	vector<thread> threadPool;
 
 	// Queue to keep track of incoming tasks and task index.
-	queue<int32_t> tasks;
+	queue<size_t> tasks;
 
 	// Task queue mutex.
 	mutex tasksMutex;
@@ -18,6 +18,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <algorithm>
 #include <regex>
 #include <fstream>
 #include <string>
@@ -62,10 +63,13 @@ namespace po = boost::program_options;
 #include <portcullis/junction_system.hpp>
 #include <portcullis/portcullis_fs.hpp>
 #include <portcullis/python_helper.hpp>
+#include <portcullis/run_report.hpp>
 using portcullis::PortcullisFS;
 using portcullis::Intron;
 using portcullis::IntronHasher;
 using portcullis::PyHelper;
+using portcullis::StageTimer;
+using portcullis::runReport;
 
 #include "junction_filter.hpp"
 #include "prepare.hpp"
@@ -80,6 +84,7 @@ portcullis::JunctionFilter::JunctionFilter(const path& _prepDir, const path& _ju
     initial = _initial;
     filterFile = "";
     referenceFile = "";
+    regionsFile = "";
     saveBad = false;
     threads = 1;
     maxLength = 0;
@@ -90,6 +95,11 @@ portcullis::JunctionFilter::JunctionFilter(const path& _prepDir, const path& _ju
     verbose = false;
     threshold = DEFAULT_FILTER_THRESHOLD;
     smote = true;
+    icote = false;
+    histBins = 0;
+    earlyExit = false;
+    exactMargin = DEFAULT_FILTER_EXACT_MARGIN;
+    trainBudget = DEFAULT_FILTER_TRAIN_BUDGET;
     enn = true;
 }
 
@@ -194,13 +204,47 @@ void portcullis::JunctionFilter::filter() {
     cout << "Loading junctions from " << junctionFile.string() << " ...";
     cout.flush();
     // Load junction system
+    StageTimer loadStage("loadJunctions");
     JunctionSystem originalJuncs(junctionFile);
+    loadStage.setRecords(originalJuncs.size());
+    loadStage.stop();
     cout << " done." << endl
             << "Found " << originalJuncs.getJunctions().size() << " junctions." << endl << endl;
 
     // Also keep a shortcut to the list of junctions
     JunctionList currentJuncs = originalJuncs.getJunctions();
 
+    // Junctions outside of the target regions are dropped before filtering
+    // and don't appear in any of the output
+    size_t nbOutsideRegions = 0;
+    if (!regionsFile.empty()) {
+        // Target sequences as recorded in the junction file
+        RefSeqPtrList refs;
+        for (auto & j : currentJuncs) {
+            const RefSeq& ref = j->getIntron()->ref;
+            if (ref.index >= (int32_t) refs.size()) {
+                refs.resize(ref.index + 1);
+            }
+            if (!refs[ref.index]) {
+                refs[ref.index] = make_shared<RefSeq>(ref);
+            }
+        }
+        size_t nbUnknown = 0;
+        RegionList regions = RegionList::loadBed(regionsFile, refs, nbUnknown);
+        JunctionList inRegions;
+        for (auto & j : currentJuncs) {
+            const IntronPtr intron = j->getIntron();
+            if (regions.overlaps(intron->ref.index, intron->start, intron->end + 1)) {
+                inRegions.push_back(j);
+            }
+        }
+        nbOutsideRegions = currentJuncs.size() - inRegions.size();
+        currentJuncs = inRegions;
+        cout << "Kept " << currentJuncs.size() << " junctions overlapping " << regions.size() << " target regions from: " << regionsFile.string() << endl
+                << "Dropped " << nbOutsideRegions << " junctions outside of the target regions." << endl << endl;
+    }
+    const JunctionList inputJuncs = currentJuncs;
+
     unordered_set<string> ref;
     if (!referenceFile.empty()) {
         cout << "Loading junctions from reference: " << referenceFile.string() << " ...";
@@ -338,7 +382,10 @@ void portcullis::JunctionFilter::filter() {
             }
 
 	    cout << "Executing python script." << endl;
-            PyHelper::getInstance().execute(rf_script.string(), (int) args.size(), char_args);
+            {
+                StageTimer stage("initialRuleFilter");
+                PyHelper::getInstance().execute(rf_script.string(), (int) args.size(), char_args);
+            }
 	    cout << "Executed Python script" << endl << endl;
 
 
@@ -420,18 +467,34 @@ void portcullis::JunctionFilter::filter() {
                 }
                 cout << "Confirming intron length L95 is: " << mf.L95 << endl;
 
+                // On very large sets train on a stratified sample and keep the rest to check the model
+                JunctionList heldPos;
+                JunctionList heldNeg;
+                if (trainBudget > 0 && pos.size() + neg.size() > trainBudget) {
+                    sampleTrainingSet(pos, neg, heldPos, heldNeg);
+                }
+
                 cout << "Feature learning from training set ...";
                 cout.flush();
+                StageTimer learnStage("featureLearning");
+                learnStage.setRecords(pos.size() + neg.size());
                 mf.trainCodingPotentialModel(pos);
                 mf.trainSplicingModels(pos, neg);
+                learnStage.stop();
                 cout << " done." << endl << endl;
 
                 cout << "Training Random Forest" << endl
                         << "----------------------" << endl << endl;
-                shared_ptr<Forest> forest = mf.trainInstance(pos, neg, output.string() + ".selftrain", DEFAULT_SELFTRAIN_TREES, threads, true, true, smote, enn, saveFeatures);
+                StageTimer trainStage("trainInstance");
+                shared_ptr<Forest> forest = mf.trainInstance(pos, neg, output.string() + ".selftrain", DEFAULT_SELFTRAIN_TREES, threads, true, true, smote, enn, saveFeatures, icote, histBins);
                 forest->saveToFile();
+                trainStage.stop();
                 modelFile = output.string() + ".selftrain.forest";
                 cout << endl;
+
+                if (!heldPos.empty() || !heldNeg.empty()) {
+                    reportHeldOutPerformance(heldPos, heldNeg, mf);
+                }
             }
         }
     }
@@ -443,7 +506,10 @@ void portcullis::JunctionFilter::filter() {
                 << "----------------------------------------------------" << endl << endl;
         JunctionList passJuncs;
         JunctionList failJuncs;
+        StageTimer stage("forestPredict");
+        stage.setRecords(currentJuncs.size());
         forestPredict(currentJuncs, passJuncs, failJuncs, mf);
+        stage.stop();
         printFilteringResults(currentJuncs, passJuncs, failJuncs, string("Random Forest filtering results"));
         // Reset currentJuncs
         currentJuncs.clear();
@@ -483,7 +549,11 @@ void portcullis::JunctionFilter::filter() {
                 char_args[i] = strdup(args[i].c_str());
             }
 
-            PyHelper::getInstance().execute(rf_script.string(), (int) args.size(), char_args);
+            {
+                StageTimer stage("ruleFilter");
+                stage.setRecords(currentJuncs.size());
+                PyHelper::getInstance().execute(rf_script.string(), (int) args.size(), char_args);
+            }
 
             // Load junction system
             JunctionSystem posSystem(path(output.string() + ".rules_out.passed.junctions.tab"));
@@ -572,18 +642,23 @@ void portcullis::JunctionFilter::filter() {
                 }
             }
         }
-        filteredJuncs.calcJunctionStats();
+        {
+            StageTimer stage("calcJunctionStats");
+            stage.setRecords(filteredJuncs.size());
+            filteredJuncs.calcJunctionStats();
+        }
         cout << " done." << endl << endl;
         if (!referenceFile.empty()) {
             cout << "Brought back " << refKeptJuncs.size() << " junctions that were discarded by filters but were present in reference file." << endl;
             cout << "Your sample contains " << inref << " / " << ref.size() << " (" << ((double) inref / (double) ref.size()) * 100.0 << "%) junctions from the reference." << endl << endl;
         }
     }
-    printFilteringResults(originalJuncs.getJunctions(),
+    printFilteringResults(inputJuncs,
             filteredJuncs.getJunctions(),
             discardedJuncs.getJunctions(),
             string("Overall results"));
     cout << endl << "Saving junctions passing filter to disk:" << endl;
+    StageTimer saveStage("saveAll");
     filteredJuncs.saveAll(outputDir.string() + "/" + outputPrefix + ".pass", source + "_pass", true, this->outputExonGFF, this->outputIntronGFF);
     if (saveBad) {
         cout << "Saving junctions failing filter to disk:" << endl;
@@ -593,15 +668,79 @@ void portcullis::JunctionFilter::filter() {
             refKeptJuncs.saveAll(outputDir.string() + "/" + outputPrefix + ".ref", source + "_ref", true, this->outputExonGFF, this->outputIntronGFF);
         }
     }
+    saveStage.stop();
+    runReport.setCounter("junctions_in", originalJuncs.size());
+    if (!regionsFile.empty()) {
+        runReport.setSetting("regions", regionsFile.string());
+        runReport.setCounter("junctions_outside_regions", nbOutsideRegions);
+    }
+    runReport.setCounter("junctions_pass", filteredJuncs.size());
+    runReport.setCounter("junctions_fail", discardedJuncs.size());
+    runReport.setSetting("threads", lexical_cast<string>(threads));
+    path reportFile = outputDir.string() + "/" + outputPrefix + ".report.json";
+    runReport.save(reportFile);
+    cout << "Run report saved to: " << reportFile << endl;
 }
 
 void portcullis::JunctionFilter::undersample(JunctionList& jl, size_t size) {
+    if (jl.size() <= size) return;
+    // Partial Fisher-Yates: the first size entries end up a uniform sample
     std::mt19937 rng(12345);
-    while (jl.size() > size) {
-        std::uniform_int_distribution<int> gen(0, jl.size()); // uniform, unbiased
-        int i = gen(rng);
-        jl.erase(jl.begin() + i);
+    for (size_t i = 0; i < size; i++) {
+        std::uniform_int_distribution<size_t> gen(i, jl.size() - 1);
+        std::swap(jl[i], jl[gen(rng)]);
+    }
+    jl.resize(size);
+}
+
+void portcullis::JunctionFilter::sampleTrainingSet(JunctionList& pos, JunctionList& neg, JunctionList& heldPos, JunctionList& heldNeg) {
+    auto_cpu_timer timer(1, " = Wall time taken: %ws\n\n");
+    const size_t total = pos.size() + neg.size();
+    size_t posBudget = (size_t)((double)trainBudget * (double)pos.size() / (double)total + 0.5);
+    // Rounding can leave a very rare class with no budget at all, so give each class at least one junction
+    if (!pos.empty() && !neg.empty() && trainBudget >= 2) {
+        posBudget = std::min(std::max(posBudget, (size_t)1), (size_t)trainBudget - 1);
     }
+    const size_t negBudget = trainBudget - posBudget;
+    cout << "Drawing stratified training sample of at most " << trainBudget << " junctions (by intron size and splice site type) ...";
+    cout.flush();
+    StratifiedSampler sampler;
+    JunctionList sampledPos;
+    JunctionList sampledNeg;
+    sampler.sample(pos, posBudget, sampledPos, heldPos);
+    sampler.sample(neg, negBudget, sampledNeg, heldNeg);
+    pos = sampledPos;
+    neg = sampledNeg;
+    cout << " done." << endl
+            << "Training on " << pos.size() << " positive and " << neg.size() << " negative junctions, holding out "
+            << heldPos.size() << " positive and " << heldNeg.size() << " negative junctions." << endl;
+}
+
+void portcullis::JunctionFilter::reportHeldOutPerformance(const JunctionList& heldPos, const JunctionList& heldNeg, ModelFeatures& mf) {
+    auto_cpu_timer timer(1, " = Wall time taken: %ws\n\n");
+    cout << "Checking self-trained model against " << heldPos.size() + heldNeg.size() << " held out junctions" << endl;
+    JunctionList held;
+    held.reserve(heldPos.size() + heldNeg.size());
+    held.insert(held.end(), heldPos.begin(), heldPos.end());
+    held.insert(held.end(), heldNeg.begin(), heldNeg.end());
+    Data* heldData = mf.juncs2FeatureVectors(held);
+    // Predict with a fresh copy of the saved model so the out of bag predictions made during training aren't added in
+    shared_ptr<ForestProbability> f = ModelFeatures::loadForest(modelFile, heldData, threads);
+    f->run(false);
+    JunctionList pass;
+    JunctionList fail;
+    for (size_t i = 0; i < held.size(); i++) {
+        if (1.0 - f->getPredictions()[i][0] >= threshold) {
+            pass.push_back(held[i]);
+        } else {
+            fail.push_back(held[i]);
+        }
+    }
+    delete heldData;
+    shared_ptr<Performance> p = calcPerformance(pass, fail);
+    cout << "Held out performance at threshold " << threshold << ":" << endl
+            << Performance::longHeader() << endl
+            << p->toLongString() << endl;
 }
 
 void portcullis::JunctionFilter::printFilteringResults(const JunctionList& in, const JunctionList& pass, const JunctionList& fail, const string& prefix) {
@@ -657,39 +796,40 @@ void portcullis::JunctionFilter::forestPredict(const JunctionList& all, Junction
     }
 
     cout << "Initialising random forest" << endl;
-    shared_ptr<Forest> f = make_shared<ForestProbability>();
-    vector<string> catVars;
-    f->init(
-            "Genuine", // Dependant variable name
-            MEM_DOUBLE, // Memory mode
-            testingData, // Data object
-            0, // M Try (0 == use default)
-            "", // Output prefix
-            DEFAULT_SELFTRAIN_TREES, // Number of trees (will be overwritten when loading the model)
-            1234567890, // Seed for random generator
-            threads, // Number of threads
-            IMP_GINI, // Importance measure
-            train ? DEFAULT_MIN_NODE_SIZE_PROBABILITY : DEFAULT_MIN_NODE_SIZE_CLASSIFICATION, // Min node size
-            //DEFAULT_MIN_NODE_SIZE_CLASSIFICATION,
-            "", // Status var name
-            true, // Prediction mode
-            true, // Replace
-            catVars, // Unordered categorical variable names (vector<string>)
-            false, // Memory saving
-            DEFAULT_SPLITRULE, // Split rule
-            false, // predall
-            1.0); // Sample fraction
-    f->setVerboseOut(&cerr);
-    // Load trees from saved model
-    f->loadFromFile(modelFile.string());
-    cout << "Making predictions" << endl;
-    f->run(verbose);
-    // Make sure score is saved back with the junction
-    for (size_t i = 0; i < all.size(); i++) {
-        //cout << f->getPredictions()[i][0] << endl;
-        double score = 1.0 - f->getPredictions()[i][0];
-        all[i]->setScore(score);
+    shared_ptr<ForestProbability> f = ModelFeatures::loadForest(modelFile, testingData, threads);
+    StageTimer stage("predict");
+    stage.setRecords(all.size());
+    // The threshold sweep against the genuine file needs exact scores for every junction
+    bool useEarlyExit = earlyExit && (genuineFile.empty() || !exists(genuineFile));
+    if (useEarlyExit) {
+        cout << "Making predictions with early exit (batches of " << DEFAULT_EARLY_EXIT_BATCH << " trees, exact margin " << exactMargin << ")" << endl;
+        // Class 0 is the non-genuine class, so junctions pass when its probability is at most 1 - threshold
+        vector<double> probabilities;
+        vector<size_t> treesUsed;
+        f->predictEarlyExit(testingData, 0, 1.0 - threshold, exactMargin,
+                DEFAULT_EARLY_EXIT_BATCH, probabilities, treesUsed);
+        size_t early = 0;
+        size_t totalTrees = 0;
+        for (size_t i = 0; i < all.size(); i++) {
+            all[i]->setScore(1.0 - probabilities[i]);
+            if (treesUsed[i] < f->getNumTrees()) early++;
+            totalTrees += treesUsed[i];
+        }
+        cout << early << " / " << all.size() << " junctions decided before evaluating all " << f->getNumTrees()
+             << " trees.  Mean trees evaluated per junction: " << (all.empty() ? 0.0 : (double)totalTrees / (double)all.size()) << endl
+             << "Scores of junctions decided early are estimates from the trees evaluated so far" << endl;
+    }
+    else {
+        cout << "Making predictions" << endl;
+        f->run(verbose);
+        // Make sure score is saved back with the junction
+        for (size_t i = 0; i < all.size(); i++) {
+            //cout << f->getPredictions()[i][0] << endl;
+            double score = 1.0 - f->getPredictions()[i][0];
+            all[i]->setScore(score);
+        }
     }
+    stage.stop();
     if (!genuineFile.empty() && exists(genuineFile)) {
         vector<double> thresholds;
         for (double i = 0.0; i <= 1.0; i += 0.01) {
@@ -703,7 +843,7 @@ void portcullis::JunctionFilter::forestPredict(const JunctionList& all, Junction
         for (auto & t : thresholds) {
             JunctionList pjl;
             JunctionList fjl;
-            categorise(f, all, pjl, fjl, t);
+            categorise(all, pjl, fjl, t);
             shared_ptr<Performance> perf = calcPerformance(pjl, fjl);
             double mcc = perf->getMCC();
             double f1 = perf->getF1Score();
@@ -723,13 +863,13 @@ void portcullis::JunctionFilter::forestPredict(const JunctionList& all, Junction
     }
     //threshold = calcGoodThreshold(f, all);
     cout << "Threshold set at " << threshold << endl;
-    categorise(f, all, pass, fail, threshold);
+    categorise(all, pass, fail, threshold);
     delete testingData;
 }
 
-void portcullis::JunctionFilter::categorise(shared_ptr<Forest> f, const JunctionList& all, JunctionList& pass, JunctionList& fail, double t) {
+void portcullis::JunctionFilter::categorise(const JunctionList& all, JunctionList& pass, JunctionList& fail, double t) {
     for (size_t i = 0; i < all.size(); i++) {
-        if ((1.0 - f->getPredictions()[i][0]) >= t) {
+        if (all[i]->getScore() >= t) {
             pass.push_back(all[i]);
         } else {
             fail.push_back(all[i]);
@@ -757,6 +897,7 @@ int portcullis::JunctionFilter::main(int argc, char *argv[]) {
     path genuineFile;
     path filterFile;
     path referenceFile;
+    path regionsFile;
     path output;
     uint16_t threads;
     bool no_ml;
@@ -772,6 +913,11 @@ int portcullis::JunctionFilter::main(int argc, char *argv[]) {
     string source;
     path initial;
     bool no_smote;
+    bool icote;
+    uint16_t hist_bins;
+    bool early_exit;
+    double exact_margin;
+    uint32_t train_budget;
     bool enn;
     double threshold;
     bool verbose;
@@ -806,6 +952,8 @@ int portcullis::JunctionFilter::main(int argc, char *argv[]) {
             "If you wish to custom rule-based filter the junctions file, use this option to provide a list of the rules you wish to use.  By default we don't filter using a rule-based method, we instead filter via a self-trained random forest model.  See manual for more details.")
             ("reference,r", po::value<path>(&referenceFile),
             "Reference annotation of junctions in BED format.  Any junctions found by the junction analysis tool will be preserved if found in this reference file regardless of any other filtering criteria.  If you need to convert a reference annotation from GTF or GFF to BED format portcullis contains scripts for this.")
+            ("regions", po::value<path>(&regionsFile),
+            "Only keep junctions whose intron overlaps a region in this BED file, such as the loci targeted by a capture or amplicon panel.  Junctions elsewhere are dropped before filtering and don't appear in any of the output.  Only the first three columns are used.")
             ("no_ml,n", po::bool_switch(&no_ml)->default_value(false),
             "Disables machine learning filtering")
             ("max_length", po::value<uint32_t>(&max_length)->default_value(0),
@@ -818,6 +966,12 @@ int portcullis::JunctionFilter::main(int argc, char *argv[]) {
             "The threshold score at which we determine a junction to be genuine or not.  Increase value towards 1.0 to increase precision, decrease towards 0.0 to increase sensitivity.  We generally find that increasing sensitivity helps when using high coverage data, or when the aligner has already performed some form of junction filtering.")
             ("training_rule", po::value<path>(&initial)->default_value("balanced"),
             "Pre-set to use for the self-training. Currently supported: balanced, precise. Default: balanced.")
+            ("early_exit", po::bool_switch(&early_exit)->default_value(false),
+            "Speeds up classification of large junction sets by evaluating the random forest in batches of trees and stopping for each junction as soon as its pass / fail decision against the threshold can no longer change.  Pass / fail calls are unaffected, but the score column of junctions decided early is an estimate.")
+            ("exact_margin", po::value<double>(&exact_margin)->default_value(DEFAULT_FILTER_EXACT_MARGIN),
+            "When using --early_exit, junctions whose score may lie within this distance of the threshold are scored exactly with all trees.  Set to 1.0 to get exact scores for every junction.")
+            ("train_budget", po::value<uint32_t>(&train_budget)->default_value(DEFAULT_FILTER_TRAIN_BUDGET),
+            "Maximum number of junctions used to self-train the random forest.  When the initial training set is larger, a sample stratified by intron size and splice site type is drawn and the model's performance on the held out junctions is reported.  Default (0) is to train on all junctions.")
             ;
     // Hidden options, will be allowed both on command line and
     // in config file, but will not be shown to the user.
@@ -827,6 +981,10 @@ int portcullis::JunctionFilter::main(int argc, char *argv[]) {
             ("junction_file", po::value<path>(&junctionFile), "Path to the junction tab file to process.")
             ("no_smote", po::bool_switch(&no_smote)->default_value(false),
             "Use this flag to disable synthetic oversampling")
+            ("icote", po::bool_switch(&icote)->default_value(false),
+            "Use the Immune Centroids Oversampling Technique (ICOTE) instead of SMOTE to oversample the negative set.  Needs no neighbour graph, but each generation compares every antibody with every junction being oversampled, so like a brute force nearest neighbour search the cost grows with the square of that set (times the number of generations).")
+            ("hist_bins", po::value<uint16_t>(&hist_bins)->default_value(0),
+            "If non-zero, train the self-trained forest in histogram mode, quantizing each feature into at most this many bins (2-256).  Much faster on large junction sets, at a small cost in split precision.")
             ("enn", po::bool_switch(&enn)->default_value(false),
             "Use this flag to enable Edited Nearest Neighbour to clean decision region")
             ("genuine,g", po::value<path>(&genuineFile),
@@ -861,6 +1019,7 @@ int portcullis::JunctionFilter::main(int argc, char *argv[]) {
         return 1;
     }
     auto_cpu_timer timer(1, "\nPortcullis junction filter completed.\nTotal runtime: %ws\n\n");
+    runReport.begin("filt");
     cout << "Running portcullis in junction filter mode" << endl
             << "------------------------------------------" << endl << endl;
     // Create the prepare class
@@ -888,8 +1047,14 @@ int portcullis::JunctionFilter::main(int argc, char *argv[]) {
     filter.setSaveFeatures(save_features);
     filter.setSaveLayers(save_layers);
     filter.setReferenceFile(referenceFile);
+    filter.setRegionsFile(regionsFile);
     filter.setThreshold(threshold);
     filter.setSmote(!no_smote);
+    filter.setIcote(icote);
+    filter.setHistBins(hist_bins);
+    filter.setEarlyExit(early_exit);
+    filter.setExactMargin(exact_margin);
+    filter.setTrainBudget(train_budget);
     filter.setENN(enn);
     filter.filter();
     return 0;
@@ -47,12 +47,16 @@ using boost::filesystem::create_directory;
 using boost::filesystem::symbolic_link_exists;
 
 #include <portcullis/bam/genome_mapper.hpp>
+#include <portcullis/bam/region_list.hpp>
 using portcullis::bam::GenomeMapper;
+using portcullis::bam::RegionList;
 
 #include <portcullis/ml/performance.hpp>
 #include <portcullis/ml/model_features.hpp>
+#include <portcullis/ml/stratified_sampler.hpp>
 using portcullis::ml::Performance;
 using portcullis::ml::ModelFeatures;
+using portcullis::ml::StratifiedSampler;
 
 #include <portcullis/intron.hpp>
 #include <portcullis/portcullis_fs.hpp>
@@ -82,6 +86,9 @@ namespace portcullis {
     const uint16_t DEFAULT_FILTER_THREADS = 1;
     const uint16_t DEFAULT_SELFTRAIN_TREES = 250;
     const double DEFAULT_FILTER_THRESHOLD = 0.5;
+    const double DEFAULT_FILTER_EXACT_MARGIN = 0.0;
+    const uint16_t DEFAULT_EARLY_EXIT_BATCH = 10;
+    const uint32_t DEFAULT_FILTER_TRAIN_BUDGET = 0;
 
     class JunctionFilter {
     private:
@@ -92,6 +99,7 @@ namespace portcullis {
         path filterFile;
         path genuineFile;
         path referenceFile;
+        path regionsFile;
         path output;
         bool train;
         uint16_t threads;
@@ -108,6 +116,11 @@ namespace portcullis {
         string source;
         double threshold;
         bool smote;
+        bool icote;
+        uint16_t histBins;
+        bool earlyExit;
+        double exactMargin;
+        uint32_t trainBudget;
         bool enn;
         bool precise;
         bool verbose;
@@ -186,6 +199,18 @@ namespace portcullis {
             this->referenceFile = referenceFile;
         }
 
+        path getRegionsFile() const {
+            return regionsFile;
+        }
+
+        /**
+         * Only keep junctions whose intron overlaps a region in this BED file.
+         * Empty to keep junctions anywhere.
+         */
+        void setRegionsFile(path regionsFile) {
+            this->regionsFile = regionsFile;
+        }
+
         bool isTrain() const {
             return train;
         }
@@ -266,6 +291,46 @@ namespace portcullis {
             this->smote = smote;
         }
 
+        bool isIcote() const {
+            return icote;
+        }
+
+        void setIcote(bool icote) {
+            this->icote = icote;
+        }
+
+        uint16_t getHistBins() const {
+            return histBins;
+        }
+
+        void setHistBins(uint16_t histBins) {
+            this->histBins = histBins;
+        }
+
+        bool isEarlyExit() const {
+            return earlyExit;
+        }
+
+        void setEarlyExit(bool earlyExit) {
+            this->earlyExit = earlyExit;
+        }
+
+        double getExactMargin() const {
+            return exactMargin;
+        }
+
+        void setExactMargin(double exactMargin) {
+            this->exactMargin = exactMargin;
+        }
+
+        uint32_t getTrainBudget() const {
+            return trainBudget;
+        }
+
+        void setTrainBudget(uint32_t trainBudget) {
+            this->trainBudget = trainBudget;
+        }
+
         bool doSaveFeatures() const {
             return this->saveFeatures;
         }
@@ -358,7 +423,7 @@ namespace portcullis {
 
         void doRuleBasedFiltering(const path& ruleFile, const JunctionList& all, JunctionList& pass, JunctionList& fail);
 
-        void categorise(shared_ptr<Forest> f, const JunctionList& all, JunctionList& pass, JunctionList& fail, double t);
+        void categorise(const JunctionList& all, JunctionList& pass, JunctionList& fail, double t);
 
         void createPositiveSet(const JunctionList& all, JunctionList& pos, JunctionList& unlabelled, ModelFeatures& mf);
 
@@ -368,6 +433,21 @@ namespace portcullis {
 
         void undersample(JunctionList& jl, size_t size);
 
+        /**
+         * Replaces pos and neg with a stratified sample of at most trainBudget
+         * junctions in total, shared between them in proportion to their sizes
+         * with at least one junction for each non empty class.
+         * The junctions left out are returned in heldPos and heldNeg.
+         */
+        void sampleTrainingSet(JunctionList& pos, JunctionList& neg, JunctionList& heldPos, JunctionList& heldNeg);
+
+        /**
+         * Scores the junctions held out of training with the self-trained forest
+         * saved to the model file and reports how well it separates them at the
+         * current threshold.
+         */
+        void reportHeldOutPerformance(const JunctionList& heldPos, const JunctionList& heldNeg, ModelFeatures& mf);
+
 	std::tuple<vector<string>, vector<string>> find_jsons(path ruleset);
 
 	static bool sort_jsons(string& json1, string& json2);
@@ -40,17 +40,27 @@ using boost::to_upper_copy;
 using boost::timer::auto_cpu_timer;
 namespace po = boost::program_options;
 
+#include <portcullis/instrument.hpp>
 #include <portcullis/portcullis_fs.hpp>
+#include <portcullis/run_report.hpp>
+#include <portcullis/strand_sampler.hpp>
+using portcullis::DEFAULT_BARCODE_TAG;
 using portcullis::PortcullisFS;
+using portcullis::runReport;
+using portcullis::StageTimer;
+using portcullis::StrandSample;
+using portcullis::StrandSampler;
 
 #include "junction_builder.hpp"
 #include "prepare.hpp"
 #include "junction_filter.hpp"
 #include "bam_filter.hpp"
+#include "train.hpp"
 using portcullis::JunctionBuilder;
 using portcullis::Prepare;
 using portcullis::JunctionFilter;
 using portcullis::BamFilter;
+using portcullis::Train;
 
 typedef boost::error_info<struct PortcullisError, string> PortcullisErrorInfo;
 
@@ -70,7 +80,9 @@ enum class Mode {
     JUNC,
     FILTER,
     BAM_FILT,
-    FULL
+    FULL,
+    TRAIN,
+    STRAND
 };
 
 void print_backtrace(int depth = 0) {
@@ -120,6 +132,10 @@ Mode parseMode(string mode) {
         return Mode::BAM_FILT;
     } else if (upperMode == string("FULL")) {
         return Mode::FULL;
+    } else if (upperMode == string("TRAIN")) {
+        return Mode::TRAIN;
+    } else if (upperMode == string("STRAND")) {
+        return Mode::STRAND;
     } else {
         BOOST_THROW_EXCEPTION(PortcullisException() << PortcullisErrorInfo(string(
                 "Could not recognise mode string: ") + mode));
@@ -145,7 +161,11 @@ string modes() {
             " - junc    - Step 2: Perform junction analysis on prepared data\n" +
             " - filt    - Step 3: Discard unlikely junctions\n" +
             " - bamfilt - Step 4: Filters a BAM to remove any reads associated with invalid\n" +
-            "             junctions";
+            "             junctions\n" +
+            " - train   - Trains a random forest model from labelled junctions, optionally\n" +
+            "             assessing it with k-fold cross validation\n" +
+            " - strand  - Quickly works out the strandedness and orientation of the reads in\n" +
+            "             prepared data";
 }
 
 string fulltitle() {
@@ -167,6 +187,7 @@ int mainFull(int argc, char *argv[]) {
     path genomeFile;
     path outputDir;
     path referenceFile;
+    path regionsFile;
     string strandSpecific;
     string orientation;
     uint16_t threads;
@@ -180,6 +201,11 @@ int mainFull(int argc, char *argv[]) {
     bool exongff;
     bool introngff;
     bool bamFilter;
+    bool detectStrand;
+    bool longReads;
+    bool skipUnspliced;
+    bool singleCell;
+    string barcodeTag;
     string source;
     uint32_t max_length;
     uint32_t mincov;
@@ -231,6 +257,18 @@ int mainFull(int argc, char *argv[]) {
             "The orientation of the reads that produced the BAM alignments: \"F\" (Single-end forward orientation); \"R\" (single-end reverse orientation); \"FR\" (paired-end, with reads sequenced towards center of fragment -> <-.  This is usual setting for most Illumina paired end sequencing); \"RF\" (paired-end, reads sequenced away from center of fragment <- ->); \"FF\" (paired-end, reads both sequenced in forward orientation); \"RR\" (paired-end, reads both sequenced in reverse orientation); \"UNKNOWN\" (default, portcullis will workaround any calculations requiring orientation information)")
             ("strandedness", po::value<string>(&strandSpecific)->default_value(strandednessToString(Strandedness::UNKNOWN)),
             "Whether BAM alignments were generated using a type of strand specific RNAseq library: \"unstranded\" (Standard Illumina); \"firststrand\" (dUTP, NSR, NNSR); \"secondstrand\" (Ligation, Standard SOLiD, flux sim reads); \"UNKNOWN\" (default, portcullis will workaround any calculations requiring strandedness information)")
+            ("detect_strand", po::bool_switch(&detectStrand)->default_value(false),
+            "Sample spliced reads before junction analysis to work out the strandedness and orientation of the library, and use them wherever --strandedness or --orientation were left as UNKNOWN.")
+            ("long_reads", po::bool_switch(&longReads)->default_value(false),
+            "Tune junction analysis for long reads, such as PacBio or Nanopore reads aligned with minimap2.  See \"portcullis junc --help\".")
+            ("single_cell", po::bool_switch(&singleCell)->default_value(false),
+            "Also count the reads supporting each junction per cell barcode, and save them as a junction by cell matrix.  See \"portcullis junc --help\".")
+            ("barcode_tag", po::value<string>(&barcodeTag)->default_value(DEFAULT_BARCODE_TAG),
+            "The BAM tag holding the cell barcode in single cell mode.")
+            ("regions", po::value<path>(&regionsFile),
+            "Only analyse alignments and junctions overlapping the regions in this BED file, such as the loci targeted by a capture or amplicon panel.  Passed on to junc, filt and bamfilt.")
+            ("skip_unspliced", po::bool_switch(&skipUnspliced)->default_value(false),
+            "Only read the parts of the BAM that hold spliced alignments during junction analysis.  See \"portcullis junc --help\".")
             ("separate", po::bool_switch(&separate)->default_value(false),
             "Separate spliced from unspliced reads.")
             ("extra", po::bool_switch(&extra)->default_value(false),
@@ -324,6 +362,7 @@ int mainFull(int argc, char *argv[]) {
     prep.setVerbose(verbose);
     // Prep the input to produce a usable indexed and sorted bam plus, indexed
     // genome and queryable coverage information
+    runReport.begin("prep");
     prep.prepare(transformedBams, genomeFile);
 
     // ************ Identify all junctions and calculate metrics ***********
@@ -338,6 +377,11 @@ int mainFull(int argc, char *argv[]) {
     jb.setSeparate(false); // Run in fast mode
     jb.setStrandSpecific(strandednessFromString(strandSpecific));
     jb.setOrientation(orientationFromString(orientation));
+    jb.setDetectStrand(detectStrand);
+    jb.setLongReads(longReads);
+    jb.setBarcodeTag(singleCell ? barcodeTag : "");
+    jb.setSkipUnspliced(skipUnspliced);
+    jb.setRegionsFile(regionsFile);
     jb.setExtra(extra);
     jb.setSeparate(separate);
     jb.setSource(source);
@@ -345,6 +389,7 @@ int mainFull(int argc, char *argv[]) {
     jb.setOutputExonGFF(exongff);
     jb.setOutputIntronGFF(introngff);
     jb.setVerbose(verbose);
+    runReport.begin("junc");
     jb.process();
 
     // ************ Use default filtering strategy *************
@@ -366,6 +411,8 @@ int mainFull(int argc, char *argv[]) {
     filter.setSaveBad(saveBad);
     filter.setSaveLayers(save_layers);
     filter.setSaveFeatures(save_features);
+    filter.setRegionsFile(regionsFile);
+    runReport.begin("filt");
     filter.filter();
 
     // *********** BAM filter *********
@@ -379,7 +426,9 @@ int mainFull(int argc, char *argv[]) {
         //bamFilter.setStrandSpecific(strandednessFromString(strandSpecific));
         //bamFilter.setOrientation(orientationFromString(orientation));
         bamFilter.setUseCsi(useCsi);
+        bamFilter.setRegionsFile(regionsFile);
         bamFilter.setVerbose(verbose);
+        runReport.begin("bamfilt");
         bamFilter.filter();
     }
 
@@ -393,6 +442,122 @@ int mainFull(int argc, char *argv[]) {
     return 0;
 }
 
+string strandtitle() {
+    return string("Portcullis Strand Detection Mode Help");
+}
+
+string stranddescription() {
+    return string("Samples spliced reads from across the genome and compares their strand with the\n") +
+            "strand suggested by the splice sites of their junctions, to work out the\n" +
+            "strandedness and orientation of the library.  Stops as soon as the answer is\n" +
+            "stable, so usually only takes a few seconds.";
+}
+
+string strandusage() {
+    return string("portcullis strand [options] <prep_data_dir>");
+}
+
+int mainStrand(int argc, char *argv[]) {
+    // Portcullis args
+    path prepDir;
+    path output;
+    int32_t windowSize;
+    uint64_t minReads;
+    uint32_t maxWindows;
+    bool verbose;
+    bool help;
+    struct winsize w;
+    ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+    // Declare the supported options.
+    po::options_description generic_options("Options", w.ws_col, (unsigned) ((double) w.ws_col / 1.5));
+    generic_options.add_options()
+            ("output,o", po::value<path>(&output)->default_value("portcullis_strand"),
+            "Output prefix.  The run report is saved to <output>.report.json.")
+            ("window_size", po::value<int32_t>(&windowSize)->default_value(portcullis::DEFAULT_STRAND_WINDOW_SIZE),
+            "Size in bp of each window sampled.")
+            ("min_reads", po::value<uint64_t>(&minReads)->default_value(portcullis::DEFAULT_STRAND_MIN_READS),
+            "Keep sampling until at least this many spliced reads at junctions with a known splice site strand have been seen and the answer has stopped changing.")
+            ("max_windows", po::value<uint32_t>(&maxWindows)->default_value(portcullis::DEFAULT_STRAND_MAX_WINDOWS),
+            "The most windows to sample.")
+            ("verbose,v", po::bool_switch(&verbose)->default_value(false),
+            "Print extra information")
+            ("help", po::bool_switch(&help)->default_value(false), "Produce help message")
+            ;
+    // Hidden options, will be allowed both on command line and
+    // in config file, but will not be shown to the user.
+    po::options_description hidden_options("Hidden options");
+    hidden_options.add_options()
+            ("prep_data_dir", po::value<path>(&prepDir), "Path to directory containing prepared data.")
+            ;
+    // Positional option for the input bam file
+    po::positional_options_description p;
+    p.add("prep_data_dir", 1);
+    // Combine non-positional options for use at the command line
+    po::options_description cmdline_options;
+    cmdline_options.add(generic_options).add(hidden_options);
+    // Parse command line
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(cmdline_options).positional(p).run(), vm);
+    po::notify(vm);
+    // Output help information the exit if requested
+    if (help || argc <= 1) {
+        cout << strandtitle() << endl << endl
+                << stranddescription() << endl << endl
+                << "Usage: " << strandusage() << endl
+                << generic_options << endl << endl;
+        return 1;
+    }
+    PreparedFiles prepData(prepDir);
+    if (!exists(prepData.getSortedBamFilePath())) {
+        BOOST_THROW_EXCEPTION(PortcullisException() << PortcullisErrorInfo(string(
+                "Could not find prepared BAM file at: ") + prepData.getSortedBamFilePath().string()));
+    }
+    auto_cpu_timer timer(1, "\nPortcullis strand detection completed.\nTotal runtime: %ws\n\n");
+    runReport.begin("strand");
+    cout << "Running portcullis in strand detection mode" << endl
+            << "-------------------------------------------" << endl << endl;
+    StrandSampler sampler(prepData.getSortedBamFilePath(), prepData.getGenomeFilePath());
+    sampler.setWindowSize(windowSize);
+    sampler.setMinReads(minReads);
+    sampler.setMaxWindows(maxWindows);
+    sampler.setVerbose(verbose);
+    StrandSample s;
+    {
+        StageTimer stage("detectStrand");
+        s = sampler.sample();
+        stage.setRecords(s.splicedReads);
+    }
+    cout << endl;
+    JunctionSystem::determineStrandedness(s.counts, true);
+    cout << "Pair orientation of mapped pairs (from the leftmost mate):" << endl
+            << " - FR (-> <-): " << s.pairsFR << endl
+            << " - RF (<- ->): " << s.pairsRF << endl
+            << " - FF (-> ->): " << s.pairsFF << endl << endl;
+    cout << "Sampled " << s.splicedReads << " spliced reads (" << s.informativeReads() << " at junctions with a known splice site strand) from " << s.windows << " windows" << endl;
+    if (s.converged) {
+        cout << "Result converged" << endl << endl;
+    } else {
+        cerr << "Warning: result did not converge.  Treat it with caution." << endl << endl;
+    }
+    cout << "Orientation: " << orientationToString(s.orientation) << " (" << orientationToLongString(s.orientation) << ")" << endl
+            << "Strandedness: " << strandednessToString(s.strandedness) << " (" << strandednessToLongString(s.strandedness) << ")" << endl << endl;
+    if (!output.parent_path().empty() && !exists(output.parent_path())) {
+        create_directories(output.parent_path());
+    }
+    runReport.setCounter("windows", s.windows);
+    runReport.setCounter("spliced_reads", s.splicedReads);
+    runReport.setCounter("informative_reads", s.informativeReads());
+    runReport.setCounter("pairs_fr", s.pairsFR);
+    runReport.setCounter("pairs_rf", s.pairsRF);
+    runReport.setCounter("pairs_ff", s.pairsFF);
+    runReport.setSetting("converged", s.converged ? "true" : "false");
+    runReport.setSetting("orientation", orientationToString(s.orientation));
+    runReport.setSetting("strandedness", strandednessToString(s.strandedness));
+    runReport.save(output.string() + ".report.json");
+    cout << "Run report saved to: " << output.string() << ".report.json" << endl;
+    return 0;
+}
+
 void handler(int sig) {
 
     // print out signal to stderr
@@ -449,6 +614,8 @@ int main(int argc, char *argv[]) {
 #endif
         portcullis::pfs = PortcullisFS(argv[0]);
         portcullis::pfs.setVersion(PACKAGE_VERSION);
+        portcullis::runReport.setVersion(PACKAGE_VERSION);
+        PORTCULLIS_THREAD_NAME("main");
         // End if verbose was requested at this level, outputting file system details.
         if (verbose) {
             cout << endl
@@ -471,7 +638,14 @@ int main(int argc, char *argv[]) {
             cout << PACKAGE_NAME << " " << PACKAGE_VERSION << endl;
             return 0;
         } else {
-            cout << "Portcullis V" << PACKAGE_VERSION << endl << endl;
+            // bamfilt may be streaming alignments to stdout, so keep the banner off it
+            bool streaming = false;
+            for (int i = 2; i < argc; i++) {
+                if (string(argv[i]) == "--stdout") {
+                    streaming = true;
+                }
+            }
+            (streaming ? cerr : cout) << "Portcullis V" << PACKAGE_VERSION << endl << endl;
         }
         // If we've got this far parse the command line properly
         Mode mode = parseMode(modeStr);
@@ -490,6 +664,10 @@ int main(int argc, char *argv[]) {
             BamFilter::main(modeArgC, modeArgV);
         } else if (mode == Mode::FULL) {
             mainFull(modeArgC, modeArgV);
+        } else if (mode == Mode::TRAIN) {
+            Train::main(modeArgC, modeArgV);
+        } else if (mode == Mode::STRAND) {
+            mainStrand(modeArgC, modeArgV);
         } else {
             BOOST_THROW_EXCEPTION(PortcullisException() << PortcullisErrorInfo(string(
                     "Unrecognised portcullis mode: ") + modeStr));
@@ -49,7 +49,10 @@ namespace po = boost::program_options;
 #include <portcullis/bam/bam_master.hpp>
 #include <portcullis/bam/genome_mapper.hpp>
 #include <portcullis/portcullis_fs.hpp>
+#include <portcullis/run_report.hpp>
 using portcullis::PortcullisFS;
+using portcullis::StageTimer;
+using portcullis::runReport;
 using namespace portcullis::bam;
 
 #include "prepare.hpp"
@@ -79,6 +82,7 @@ void portcullis::PreparedFiles::clean() {
 	bfs::remove(getSortedBamFilePath());
 	bfs::remove(getBamIndexFilePath(false));
 	bfs::remove(getBamIndexFilePath(true));
+	bfs::remove(getSplicedIndexFilePath());
 	bfs::remove(getGenomeFilePath());
 	bfs::remove(getGenomeIndexFilePath());
 	bfs::remove(getBcfFilePath());
@@ -108,6 +112,7 @@ bool portcullis::Prepare::copy(const path& from, const path& to, const string& m
 		}
 		else {
 			auto_cpu_timer timer(1, string(" - Copy ") + msg + " - Wall time taken: %ws\n\n");
+			StageTimer stage("copy");
 			cout << "Copying from " << from << " to " << to << " ... ";
 			cout.flush();
 			std::ifstream  src(from.string(), std::ios::binary);
@@ -134,6 +139,7 @@ bool portcullis::Prepare::genomeIndex() {
 	}
 	else {
 		auto_cpu_timer timer(1, " - Genome Index - Wall time taken: %ws\n\n");
+		StageTimer stage("genomeIndex");
 		cout << "Indexing genome " << genomeFile << " ... ";
 		cout.flush();
 		// Create the index
@@ -159,6 +165,7 @@ bool portcullis::Prepare::bamMerge(vector<path> bamFiles) {
 	}
 	else {
 		auto_cpu_timer timer(1, " - BAM Merge - Wall time taken: %ws\n\n");
+		StageTimer stage("bamMerge");
 		cout << "Found " << bamFiles.size() << " BAM files." << endl;
 		vector<path> mergeIn;
 		// Sort the individual inputs if necessary
@@ -214,6 +221,7 @@ bool portcullis::Prepare::bamSort(const path& input, const path& output) {
 		}
 		else {
 			auto_cpu_timer timer(1, " - BAM Sort - Wall time taken: %ws\n\n");
+			StageTimer stage("bamSort");
 			// Sort the BAM file by coordinate
             string sortCmd = BamHelper::createSortBamCmd(unsortedBam, sortedBam, false, threads, "2G");
 			cout << "Sorting BAM using command \"" << sortCmd << "\" ... ";
@@ -244,6 +252,7 @@ bool portcullis::Prepare::bamIndex(const bool copied) {
 	}
 	else if (!indexedBamExists) {
 		auto_cpu_timer timer(1, " - BAM Index - Wall time taken: %ws\n\n");
+		StageTimer stage("bamIndex");
 		// Create BAM index
 		string indexCmd = BamHelper::createIndexBamCmd(sortedBam, useCsi);
 		cout << "Indexing BAM using command \"" << indexCmd << "\" ... ";
@@ -259,6 +268,31 @@ bool portcullis::Prepare::bamIndex(const bool copied) {
 	return bfs::exists(indexedFile) || bfs::symbolic_link_exists(indexedFile);
 }
 
+void portcullis::Prepare::splicedIndex() {
+	const path sortedBam = output->getSortedBamFilePath();
+	const path indexFile = output->getSplicedIndexFilePath();
+	if (bfs::exists(indexFile)) {
+		SplicedBlockIndex idx;
+		try {
+			idx.load(indexFile);
+			if (idx.matches(sortedBam)) {
+				if (verbose) cout << "Prepped spliced block index detected: " << indexFile << endl;
+				return;
+			}
+		}
+		catch (SplicedIndexException&) {
+			// Rebuild it below
+		}
+	}
+	auto_cpu_timer timer(1, " - Spliced block index - Wall time taken: %ws\n\n");
+	StageTimer stage("splicedIndex");
+	cout << "Indexing spliced alignments in BAM ... ";
+	cout.flush();
+	SplicedBlockIndex::build(sortedBam).save(indexFile);
+	cout << "done." << endl
+		 << "Spliced block index created at: " << indexFile << endl;
+}
+
 void portcullis::Prepare::prepare(vector<path> bamFiles, const path& originalGenomeFile) {
 	if (verbose) {
 		cout << "Configured portcullis prep to use the following settings: " << endl
@@ -329,6 +363,17 @@ void portcullis::Prepare::prepare(vector<path> bamFiles, const path& originalGen
 		BOOST_THROW_EXCEPTION(PrepareException() << PrepareErrorInfo(string(
 								  "Failed to index: ") + output->getSortedBamFilePath().string()));
 	}
+	splicedIndex();
+	for (auto & f : bamFiles) {
+		runReport.addInput(f);
+	}
+	runReport.addInput(originalGenomeFile);
+	runReport.addOutput(output->getSortedBamFilePath());
+	runReport.addOutput(output->getBamIndexFilePath(useCsi));
+	runReport.addOutput(output->getSplicedIndexFilePath());
+	runReport.setCounter("bam_files", bamFiles.size());
+	runReport.setSetting("threads", lexical_cast<string>(threads));
+	runReport.save(output->getReportFilePath());
 }
 
 vector<path> portcullis::Prepare::globFiles(vector<path> input) {
@@ -447,6 +492,7 @@ int portcullis::Prepare::main(int argc, char *argv[]) {
 	// Glob the input bam files
 	vector<path> transformedBams = globFiles(bamFiles);
 	auto_cpu_timer timer(1, "\nPortcullis prep completed.\nTotal runtime: %ws\n\n");
+	runReport.begin("prep");
 	cout << "Running portcullis in prepare mode" << endl
 		 << "----------------------------------" << endl << endl;
 	// Create the prepare class
@@ -44,7 +44,10 @@ using bfs::path;
 namespace po = boost::program_options;
 
 #include <portcullis/bam/bam_master.hpp>
+#include <portcullis/bam/spliced_index.hpp>
 using portcullis::bam::Strandedness;
+using portcullis::bam::SplicedBlockIndex;
+using portcullis::bam::SplicedIndexException;
 
 #include <portcullis/portcullis_fs.hpp>
 using portcullis::PortcullisFS;
@@ -123,6 +126,13 @@ public:
 		return path(getSortedBamFilePath().string() + (useCsi ? CSI_EXTENSION : BAI_EXTENSION));
 	}
 
+	/**
+	 * Sidecar recording where the spliced alignments are in the sorted BAM
+	 */
+	path getSplicedIndexFilePath() const {
+		return SplicedBlockIndex::getIndexFile(getSortedBamFilePath());
+	}
+
 	path getBcfFilePath() const {
 		return path(getSortedBamFilePath().string() + BCF_EXTENSION);
 	}
@@ -139,6 +149,10 @@ public:
 		return path(getGenomeFilePath().string() + FASTA_INDEX_EXTENSION);
 	}
 
+	path getReportFilePath() const {
+		return path(prepDir.string() + "/" + PORTCULLIS + ".report.json");
+	}
+
 	bool valid(bool useCsi) const;
 
 	void clean();
@@ -239,6 +253,12 @@ protected:
 
 	bool bamIndex(const bool copied);
 
+	/**
+	 * Creates the spliced block index for the sorted BAM if it is missing or
+	 * out of date
+	 */
+	void splicedIndex();
+
 	/**
 	 * Checks whether the specified indexing method can support the genome sequence lengths
 	 * @param genomeFile
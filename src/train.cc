@@ -20,6 +20,9 @@
 #include <iomanip>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
 #include <vector>
 using std::ifstream;
 using std::vector;
@@ -28,6 +31,8 @@ using std::cerr;
 using std::endl;
 using std::shared_ptr;
 using std::make_shared;
+using std::lock_guard;
+using std::thread;
 
 #include <boost/program_options.hpp>
 #include <boost/lexical_cast.hpp>
@@ -46,20 +51,28 @@ namespace po = boost::program_options;
 #include <ranger/ForestClassification.h>
 #include <ranger/ForestRegression.h>
 
+#include <portcullis/ml/data_view.hpp>
 #include <portcullis/ml/performance.hpp>
 #include <portcullis/ml/k_fold.hpp>
+using portcullis::ml::DataView;
 using portcullis::ml::Performance;
 using portcullis::ml::PerformanceList;
 using portcullis::ml::KFold;
 
 #include <portcullis/junction_system.hpp>
+#include <portcullis/run_report.hpp>
 using portcullis::JunctionSystem;
 using portcullis::JunctionList;
+using portcullis::RunReport;
+using portcullis::StageTimer;
+using portcullis::TaskRecord;
+using portcullis::runReport;
 
 #include "train.hpp"
 using portcullis::Train;
 
-portcullis::Train::Train(const path& _junctionFile, const path& _refFile) {
+portcullis::Train::Train(const path& _prepDir, const path& _junctionFile, const path& _refFile) {
+	prepData.setPrepDir(_prepDir);
 	junctionFile = _junctionFile;
 	refFile = _refFile;
 	outputPrefix = "";
@@ -67,22 +80,113 @@ portcullis::Train::Train(const path& _junctionFile, const path& _refFile) {
 	trees = DEFAULT_TRAIN_TREES;
 	threads = DEFAULT_TRAIN_THREADS;
 	fraction = DEFAULT_TRAIN_FRACTION;
-	regressionMode = false;
+	bins = DEFAULT_TRAIN_BINS;
 	verbose = false;
+	nextFold = 1;
 }
 
-
-
-
-void portcullis::Train::testInstance(shared_ptr<Forest> f, const JunctionList& x) {
-	// Convert testing set junctions into feature vector
-	ModelFeatures mf;
-	Data* testingData = mf.juncs2FeatureVectors(x);
+void portcullis::Train::testInstance(ForestPtr f, Data* testingData) {
 	vector<string> catvars;
 	f->setPredictionMode(true);
 	f->setData(testingData, "Genuine", "", catvars);
 	f->run(false);
-	delete testingData;
+}
+
+void portcullis::Train::setFoldFeatures(ModelFeatures& foldMf, const JunctionList& junctions, const vector<size_t>& rows, DataView& view) {
+	const vector<size_t> cols = foldMf.getLabelDerivedColumns();
+	vector<vector<double>> values(cols.size(), vector<double>(rows.size()));
+	vector<double> row;
+	for (size_t i = 0; i < rows.size(); i++) {
+		foldMf.calcLabelDerivedFeatures(junctions[rows[i]], row);
+		for (size_t c = 0; c < cols.size(); c++) {
+			values[c][i] = row[c];
+		}
+	}
+	for (size_t c = 0; c < cols.size(); c++) {
+		view.overrideColumn(cols[c], values[c]);
+	}
+}
+
+void portcullis::Train::cvWorker(Data* allData, const JunctionList& junctions, const ModelFeatures& mf,
+								 const vector<uint16_t>& foldOf, uint16_t treeThreads, PerformanceList& perfs, ostream& resout) {
+	while (true) {
+		uint16_t fold = 0;
+		{
+			lock_guard<mutex> lock(cvMutex);
+			if (nextFold > folds) {
+				return;
+			}
+			fold = nextFold++;
+		}
+		// Create index views into the shared feature matrix for this fold
+		vector<size_t> trainIdx, testIdx;
+		for (size_t i = 0; i < foldOf.size(); i++) {
+			if (foldOf[i] == fold) {
+				testIdx.push_back(i);
+			}
+			else {
+				trainIdx.push_back(i);
+			}
+		}
+		DataView trainData(allData, trainIdx);
+		DataView testData(allData, testIdx);
+		cpu_timer timer;
+		double cpuStart = RunReport::threadCpuTime();
+		// Learn the label derived feature models from the training rows only, so
+		// the test rows' labels don't leak into their own features
+		JunctionList trainPos, trainNeg;
+		for (auto i : trainIdx) {
+			if (junctions[i]->isGenuine()) {
+				trainPos.push_back(junctions[i]);
+			}
+			else {
+				trainNeg.push_back(junctions[i]);
+			}
+		}
+		ModelFeatures foldMf;
+		foldMf.features = mf.features;
+		foldMf.initGenomeMapper(prepData.getGenomeFilePath());
+		if (!trainPos.empty()) {
+			foldMf.calcIntronThreshold(trainPos);
+		}
+		foldMf.trainCodingPotentialModel(trainPos);
+		foldMf.trainSplicingModels(trainPos, trainNeg);
+		setFoldFeatures(foldMf, junctions, trainIdx, trainData);
+		setFoldFeatures(foldMf, junctions, testIdx, testData);
+		// Train on this particular set
+		ForestPtr f = ModelFeatures::trainForest(&trainData, outputPrefix.string(), trees, treeThreads, false, false, bins);
+		// Test model instance
+		testInstance(f, &testData);
+		// Ranger appends test predictions after the out of bag predictions made
+		// during training
+		const size_t offset = f->getPredictions().size() - testIdx.size();
+		uint32_t tp = 0, tn = 0, fp = 0, fn = 0;
+		for (size_t j = 0; j < testIdx.size(); j++) {
+			double pred = f->getPredictions()[offset + j][0];
+			bool p = std::isnan(pred) ? false : pred == 1.0;
+			bool r = testData.get(j, 0) == 1.0;
+			if (r) {
+				if (p) tp++; else fn++;
+			}
+			else {
+				if (p) fp++; else tn++;
+			}
+		}
+		shared_ptr<Performance> p = make_shared<Performance>(tp, tn, fp, fn);
+		TaskRecord task;
+		task.stage = "crossValidation";
+		task.name = "fold" + lexical_cast<string>(fold);
+		task.wall = timer.elapsed().wall / 1e9;
+		task.cpu = RunReport::threadCpuTime() - cpuStart;
+		task.records = trainIdx.size() + testIdx.size();
+		runReport.addTask(task);
+		// Stream results out as soon as each fold completes
+		lock_guard<mutex> lock(cvMutex);
+		cout << fold << "\t" << p->toLongString() << endl;
+		resout << fold << "\t" << p->toLongString() << endl;
+		resout.flush();
+		perfs.add(p);
+	}
 }
 
 void portcullis::Train::train() {
@@ -103,6 +207,10 @@ void portcullis::Train::train() {
 		BOOST_THROW_EXCEPTION(TrainException() << TrainErrorInfo(string(
 								  "Junctions input file does not exist")));
 	}
+	if (!bfs::exists(prepData.getGenomeFilePath())) {
+		BOOST_THROW_EXCEPTION(TrainException() << TrainErrorInfo(string(
+								  "Could not find prepared genome file at: ") + prepData.getGenomeFilePath().string()));
+	}
 	if (!bfs::exists(refFile) && !bfs::symbolic_link_exists(refFile)) {
 		BOOST_THROW_EXCEPTION(TrainException() << TrainErrorInfo(string(
 								  "Reference file does not exist")));
@@ -111,10 +219,17 @@ void portcullis::Train::train() {
 		BOOST_THROW_EXCEPTION(TrainException() << TrainErrorInfo(string(
 								  "Fraction: ") + lexical_cast<string>(fraction) + ". Valid values for \"fraction\" are between 0.0 and 1.0"));
 	}
+	if (bins == 1 || bins > 256) {
+		BOOST_THROW_EXCEPTION(TrainException() << TrainErrorInfo(string(
+								  "Bins: ") + lexical_cast<string>(bins) + ". Valid values for \"bins\" are 0 (exact splits) or between 2 and 256"));
+	}
 	// Load junction data
+	StageTimer loadStage("loadJunctions");
 	JunctionSystem js;
 	js.load(junctionFile, true);
 	JunctionList all_junctions = js.getJunctions();
+	loadStage.setRecords(all_junctions.size());
+	loadStage.stop();
 	cout << "Loaded " << all_junctions.size() << " junctions from " << junctionFile << endl;
 	// Load reference data
 	vector<bool> genuine;
@@ -136,9 +251,39 @@ void portcullis::Train::train() {
 	else {
 		junctions = all_junctions;
 	}
+	JunctionList pos, neg;
+	for (auto & j : junctions) {
+		if (j->isGenuine()) {
+			pos.push_back(j);
+		}
+		else {
+			neg.push_back(j);
+		}
+	}
+	if (pos.empty() || neg.empty()) {
+		BOOST_THROW_EXCEPTION(TrainException() << TrainErrorInfo(string(
+								  "Reference data must mark at least one junction as genuine and one as not genuine")));
+	}
+	// Learn the genome based feature models from the labelled set, as filter does
+	// from its initial training set
+	ModelFeatures mf;
+	mf.initGenomeMapper(prepData.getGenomeFilePath());
+	mf.calcIntronThreshold(pos);
+	cout << "Feature learning from training set ...";
+	cout.flush();
+	StageTimer learnStage("featureLearning");
+	learnStage.setRecords(pos.size() + neg.size());
+	mf.trainCodingPotentialModel(pos);
+	mf.trainSplicingModels(pos, neg);
+	learnStage.stop();
+	cout << " done." << endl;
+	// Build the feature matrix once, the full model and every fold use views
+	// into it.  Folds replace the label derived columns with their own.
+	cout << "Converting " << junctions.size() << " junctions into feature vectors" << endl;
+	Data* allData = mf.juncs2FeatureVectors(junctions);
 	if (!outputPrefix.empty()) {
 		cout << "Training on full dataset" << endl;
-		ForestPtr f = ModelFeatures().trainInstance(junctions, JunctionList(), outputPrefix.string(), trees, threads, false, true, false, false);
+		ForestPtr f = mf.trainForest(allData, outputPrefix.string(), trees, threads, false, verbose, bins);
 		f->saveToFile();
 		f->writeOutput(&cout);
 	}
@@ -146,50 +291,48 @@ void portcullis::Train::train() {
 	// Makes no sense to do cross validation on less than 2-fold
 	if (folds >= 2) {
 		// Setup k fold cross validation to estimate real performance
-		KFold<JunctionList::const_iterator> kf(folds, junctions.begin(), junctions.end());
-		JunctionList test, train;
+		vector<size_t> indices(junctions.size());
+		std::iota(indices.begin(), indices.end(), 0);
+		KFold<vector<size_t>::const_iterator> kf(folds, indices.begin(), indices.end());
+		vector<uint16_t> foldOf(junctions.size(), 0);
+		for (uint16_t i = 1; i <= folds; i++) {
+			vector<size_t> train, test;
+			kf.getFold(i, back_inserter(train), back_inserter(test));
+			for (auto t : test) {
+				foldOf[t] = i;
+			}
+		}
+		// Split the thread budget between concurrently running folds and the
+		// trees within each fold
+		const uint16_t parallelFolds = std::min(folds, threads);
+		const uint16_t treeThreads = std::max(1, threads / parallelFolds);
 		PerformanceList perfs;
-		cout << endl << "Starting " << folds << "-fold cross validation" << endl;
+		cout << endl << "Starting " << folds << "-fold cross validation, running " << parallelFolds
+			 << " folds concurrently with " << treeThreads << " thread(s) each" << endl;
 		std::ofstream resout(outputPrefix.string() + ".cv_results");
 		cout << "Fold\t" << Performance::longHeader() << endl;
 		resout << "Fold\t" << Performance::longHeader() << endl;
-		for (uint16_t i = 1; i <= folds; i++) {
-			cout << i << "\t";
-			resout << i << "\t";
-			cout.flush();
-			resout.flush();
-			// Populate train and test for this step
-			kf.getFold(i, back_inserter(train), back_inserter(test));
-			// Train on this particular set
-			ForestPtr f = ModelFeatures().trainInstance(train, JunctionList(), outputPrefix.string(), trees, threads, false, false, false, false);
-			// Test model instance
-			testInstance(f, test);
-			uint32_t tp = 0, tn = 0, fp = 0, fn = 0;
-			for (size_t j = 0; j < test.size(); j++) {
-				double pred = f->getPredictions()[j][0];
-				bool p = std::isnan(pred) ? false : pred == 1.0;
-				bool r = test[j]->isGenuine();
-				//cout << pred << " " << p << " " << r << endl;
-				if (r) {
-					if (p) tp++; else fn++;
-				}
-				else {
-					if (p) fp++; else tn++;
-				}
-			}
-			shared_ptr<Performance> p = make_shared<Performance>(tp, tn, fp, fn);
-			cout << p->toLongString() << endl;
-			resout << p->toLongString() << endl;
-			perfs.add(p);
-			// Clear the train and test vectors in preparation for the next step
-			train.clear();
-			test.clear();
+		StageTimer cvStage("crossValidation");
+		nextFold = 1;
+		vector<thread> workers;
+		for (uint16_t i = 0; i < parallelFolds; i++) {
+			workers.push_back(thread(&Train::cvWorker, this, allData, std::cref(junctions), std::cref(mf), std::cref(foldOf), treeThreads,
+									 std::ref(perfs), std::ref(resout)));
+		}
+		for (auto & w : workers) {
+			w.join();
 		}
+		cvStage.stop();
 		cout << "Cross validation completed" << endl << endl;
 		perfs.outputMeanPerformance(resout);
 		resout.close();
 		cout << endl << "Saved cross validation results to file " << outputPrefix.string() << ".cv_results" << endl;
 	}
+	delete allData;
+	runReport.addInput(refFile);
+	runReport.setCounter("junctions", junctions.size());
+	runReport.setSetting("threads", lexical_cast<string>(threads));
+	runReport.save(outputPrefix.string() + ".report.json");
 }
 
 void portcullis::Train::getRandomSubset(const JunctionList& in, JunctionList& out) {
@@ -207,6 +350,7 @@ void portcullis::Train::getRandomSubset(const JunctionList& in, JunctionList& ou
 
 int portcullis::Train::main(int argc, char *argv[]) {
 	// Portcullis args
+	path prepDir;
 	path junctionFile;
 	path output;
 	path refFile;
@@ -214,12 +358,13 @@ int portcullis::Train::main(int argc, char *argv[]) {
 	uint16_t trees;
 	uint16_t threads;
 	double fraction;
+	uint16_t bins;
 	bool verbose;
 	bool help;
 	struct winsize w;
 	ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
 	// Declare the supported options.
-	po::options_description generic_options(helpMessage(), w.ws_col, (unsigned)((double)w.ws_col / 1.7));
+	po::options_description generic_options("Options", w.ws_col, (unsigned)((double)w.ws_col / 1.7));
 	generic_options.add_options()
 	("output,o", po::value<path>(&output)->default_value(DEFAULT_TRAIN_OUTPUT),
 	 "File name prefix for the random forest produced by this tool.")
@@ -230,9 +375,11 @@ int portcullis::Train::main(int argc, char *argv[]) {
 	("trees,n", po::value<uint16_t>(&trees)->default_value(DEFAULT_TRAIN_TREES),
 	 "The number of trees to build in the random forest.  More trees will produce better results but at computational expense.")
 	("threads,t", po::value<uint16_t>(&threads)->default_value(DEFAULT_TRAIN_THREADS),
-	 "The number of threads to use during training.")
+	 "The number of threads to use during training.  During cross validation threads are shared between folds running concurrently and the trees within each fold.")
 	("fraction,f", po::value<double>(&fraction)->default_value(1.0),
 	 "Fraction of the input data to use of training.  Note this is NOT the training / testing set ratio.  This is essentially a method for subsampling the data.")
+	("bins,b", po::value<uint16_t>(&bins)->default_value(DEFAULT_TRAIN_BINS),
+	 "If non-zero, train in histogram mode: each feature is quantized once into at most this many bins (2-256) and splits are found from per-bin class histograms.  Much faster on large junction sets, at a small cost in split precision.  0 finds exact splits.")
 	("verbose,v", po::bool_switch(&verbose)->default_value(false),
 	 "Print extra information")
 	("help", po::bool_switch(&help)->default_value(false), "Produce help message")
@@ -241,10 +388,12 @@ int portcullis::Train::main(int argc, char *argv[]) {
 	// in config file, but will not be shown to the user.
 	po::options_description hidden_options("Hidden options");
 	hidden_options.add_options()
+	("prep_data_dir", po::value<path>(&prepDir), "Path to directory containing prepared data.")
 	("junction-file", po::value<path>(&junctionFile), "Path to the junction file to process.")
 	;
-	// Positional option for the input bam file
+	// Positional options for the prepared data and junction file
 	po::positional_options_description p;
+	p.add("prep_data_dir", 1);
 	p.add("junction-file", 1);
 	// Combine non-positional options
 	po::options_description cmdline_options;
@@ -255,19 +404,24 @@ int portcullis::Train::main(int argc, char *argv[]) {
 	po::notify(vm);
 	// Output help information the exit if requested
 	if (help || argc <= 1) {
-		cout << generic_options << endl;
+		cout << title() << endl << endl
+			 << description() << endl << endl
+			 << "Usage: " << usage() << endl << endl
+			 << generic_options << endl;
 		return 1;
 	}
 	auto_cpu_timer timer(1, "\nPortcullis training completed.\nTotal runtime: %ws\n\n");
+	runReport.begin("train");
 	cout << "Running portcullis in training mode" << endl
 		 << "-----------------------------------" << endl << endl;
 	// Create the prepare class
-	Train trainer(junctionFile, refFile);
+	Train trainer(prepDir, junctionFile, refFile);
 	trainer.setOutputPrefix(output);
 	trainer.setFolds(folds);
 	trainer.setTrees(trees);
 	trainer.setThreads(threads);
 	trainer.setFraction(fraction);
+	trainer.setBins(bins);
 	trainer.setVerbose(verbose);
 	trainer.train();
 	return 0;
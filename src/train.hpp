@@ -0,0 +1,191 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+using std::mutex;
+using std::ostream;
+using std::string;
+using std::vector;
+
+#include <boost/exception/all.hpp>
+#include <boost/filesystem/path.hpp>
+using boost::filesystem::path;
+
+#include <ranger/Data.h>
+#include <ranger/Forest.h>
+
+#include <portcullis/ml/data_view.hpp>
+#include <portcullis/ml/model_features.hpp>
+#include <portcullis/ml/performance.hpp>
+#include <portcullis/junction.hpp>
+using portcullis::ml::DataView;
+using portcullis::ml::ForestPtr;
+using portcullis::ml::ModelFeatures;
+using portcullis::ml::PerformanceList;
+using portcullis::JunctionList;
+
+#include "prepare.hpp"
+using portcullis::PreparedFiles;
+
+namespace portcullis {
+
+typedef boost::error_info<struct TrainError, string> TrainErrorInfo;
+struct TrainException: virtual boost::exception, virtual std::exception { };
+
+const string DEFAULT_TRAIN_OUTPUT = "portcullis_train/portcullis";
+const uint16_t DEFAULT_TRAIN_FOLDS = 5;
+const uint16_t DEFAULT_TRAIN_TREES = 100;
+const uint16_t DEFAULT_TRAIN_THREADS = 1;
+const double DEFAULT_TRAIN_FRACTION = 1.0;
+const uint16_t DEFAULT_TRAIN_BINS = 0;
+
+class Train {
+
+private:
+
+	PreparedFiles prepData;
+	path junctionFile;
+	path refFile;
+	path outputPrefix;
+	uint16_t folds;
+	uint16_t trees;
+	uint16_t threads;
+	double fraction;
+	uint16_t bins;
+	bool verbose;
+
+	// Shared state for cross validation workers
+	mutex cvMutex;
+	uint16_t nextFold;
+
+protected:
+
+	/**
+	 * Takes a worker's share of the cross validation folds until none are
+	 * left.  Results are written to the output streams as soon as each fold
+	 * completes.  The label derived features in allData were learned from
+	 * every junction, so each fold relearns them from its training rows only.
+	 */
+	void cvWorker(Data* allData, const JunctionList& junctions, const ModelFeatures& mf,
+				  const vector<uint16_t>& foldOf, uint16_t treeThreads, PerformanceList& perfs, ostream& resout);
+
+	/**
+	 * Replaces the label derived feature columns of a fold's view with values
+	 * calculated by the fold's own models
+	 * @param foldMf Feature models learned from the fold's training rows
+	 * @param junctions All junctions, in feature matrix row order
+	 * @param rows The rows of the feature matrix in the view
+	 * @param view The view to update
+	 */
+	static void setFoldFeatures(ModelFeatures& foldMf, const JunctionList& junctions, const vector<size_t>& rows, DataView& view);
+
+	void getRandomSubset(const JunctionList& in, JunctionList& out);
+
+public:
+
+	Train(const path& _prepDir, const path& _junctionFile, const path& _refFile);
+
+	virtual ~Train() {
+	}
+
+	path getOutputPrefix() const {
+		return outputPrefix;
+	}
+
+	void setOutputPrefix(path outputPrefix) {
+		this->outputPrefix = outputPrefix;
+	}
+
+	uint16_t getFolds() const {
+		return folds;
+	}
+
+	void setFolds(uint16_t folds) {
+		this->folds = folds;
+	}
+
+	uint16_t getTrees() const {
+		return trees;
+	}
+
+	void setTrees(uint16_t trees) {
+		this->trees = trees;
+	}
+
+	uint16_t getThreads() const {
+		return threads;
+	}
+
+	void setThreads(uint16_t threads) {
+		this->threads = threads < 1 ? 1 : threads;
+	}
+
+	double getFraction() const {
+		return fraction;
+	}
+
+	void setFraction(double fraction) {
+		this->fraction = fraction;
+	}
+
+	uint16_t getBins() const {
+		return bins;
+	}
+
+	void setBins(uint16_t bins) {
+		this->bins = bins;
+	}
+
+	bool isVerbose() const {
+		return verbose;
+	}
+
+	void setVerbose(bool verbose) {
+		this->verbose = verbose;
+	}
+
+	/**
+	 * Tests a trained forest against the given data
+	 * @param f The trained forest
+	 * @param testingData The data to test, first column is the genuine flag
+	 */
+	static void testInstance(ForestPtr f, Data* testingData);
+
+	void train();
+
+	static string title() {
+		return string("Portcullis Training Mode Help");
+	}
+
+	static string description() {
+		return string("Trains a random forest model from a junction file and a set of labels\n") +
+			   "indicating which junctions are genuine.  Optionally estimates the model's\n" +
+			   "performance using k-fold cross validation.";
+	}
+
+	static string usage() {
+		return string("portcullis train [options] -r <reference> <prep_data_dir> <junction-file>");
+	}
+
+	static int main(int argc, char *argv[]);
+};
+}
@@ -17,12 +17,16 @@
 
 #include <gtest/gtest.h>
 
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
 using std::cout;
 using std::endl;
+using std::string;
 using std::stringstream;
+using std::vector;
 
 
 #include <boost/algorithm/string.hpp>
@@ -34,8 +38,11 @@ using bfs::path;
 #include <portcullis/bam/bam_master.hpp>
 #include <portcullis/bam/bam_alignment.hpp>
 #include <portcullis/bam/bam_reader.hpp>
+#include <portcullis/bam/cigar_editor.hpp>
 #include <portcullis/bam/depth_parser.hpp>
 #include <portcullis/bam/genome_mapper.hpp>
+#include <portcullis/bam/region_list.hpp>
+#include <portcullis/bam/spliced_index.hpp>
 using namespace portcullis::bam;
 
 /**        
@@ -246,3 +253,302 @@ TEST(bam, padding3) {
     EXPECT_EQ(paddedQueryInRegion, "CAXXX");
     EXPECT_EQ(paddedGenomicInRegion, "CAAAG");
 }
+
+TEST(bam, padding_mid_op) {
+    
+    // Region starts part way through the first match op, as it does when only a
+    // window next to the junction is compared
+    vector<CigarOp> cigar = CigarOp::createFullCigarFromString("10M5N4M");
+    
+    const string query = "ACGTACGTAATTTT";
+    const string genomic = "CGTTA";
+    
+    BamAlignment ba;
+    ba.setCigar(cigar);
+    ba.setRefId(2);
+    ba.setPosition(100);
+    ba.setAlignedLength(19);
+    
+    int32_t left = 105;
+    int32_t right = 109;
+    const string paddedQueryInRegion = ba.getPaddedQuerySeq(query, 105, 109, left, right, false, true);
+    const string paddedGenomicInRegion = ba.getPaddedGenomeSeq(genomic, 105, 109, left, right, false, true);
+    
+    EXPECT_EQ(left, 105);
+    EXPECT_EQ(right, 109);
+    EXPECT_EQ(paddedQueryInRegion, "CGTAA");
+    EXPECT_EQ(paddedGenomicInRegion, "CGTTA");
+    
+    // Without trimming the straddling op is skipped whole
+    EXPECT_EQ(ba.getPaddedQuerySeq(query, 105, 109, left, right, false), "");
+}
+
+namespace {
+// Builds a record with the given cigar, sequence, increasing qualities and NM, MD and XS tags
+bam1_t* makeRecord(int32_t pos, const vector<uint32_t>& cigar, const string& seq) {
+    bam1_t* b = bam_init1();
+    b->core.tid = 0;
+    b->core.pos = pos;
+    b->core.l_qname = 2;
+    b->core.n_cigar = cigar.size();
+    b->core.l_qseq = seq.size();
+    b->l_data = 2 + 4 * cigar.size() + (seq.size() + 1) / 2 + seq.size();
+    b->m_data = b->l_data;
+    b->data = (uint8_t*)calloc(b->m_data, 1);
+    b->data[0] = 'r';
+    memcpy(bam_get_cigar(b), cigar.data(), 4 * cigar.size());
+    uint8_t* s = bam_get_seq(b);
+    for (size_t i = 0; i < seq.size(); i++) {
+        s[i / 2] |= seq_nt16_table[(int)seq[i]] << ((~i & 1) << 2);
+        bam_get_qual(b)[i] = i;
+    }
+    int32_t nm = 7;
+    bam_aux_append(b, "NM", 'i', 4, (uint8_t*)&nm);
+    bam_aux_append(b, "MD", 'Z', 4, (uint8_t*)"3T6");
+    char xs = '+';
+    bam_aux_append(b, "XS", 'A', 1, (uint8_t*)&xs);
+    return b;
+}
+
+string cigarString(const bam1_t* b) {
+    stringstream ss;
+    for (uint32_t i = 0; i < b->core.n_cigar; i++) {
+        ss << bam_cigar_oplen(bam_get_cigar(b)[i]) << bam_cigar_opchr(bam_get_cigar(b)[i]);
+    }
+    return ss.str();
+}
+
+string seqString(const bam1_t* b) {
+    string s;
+    for (int32_t i = 0; i < b->core.l_qseq; i++) {
+        s += seq_nt16_str[bam_seqi(bam_get_seq(b), i)];
+    }
+    return s;
+}
+}
+
+TEST(bam, cigar_clip_hard) {
+    // 2S3M10N4M10N3M: clip the first anchor and junction
+    vector<uint32_t> cigar = {
+        bam_cigar_gen(2, BAM_CSOFT_CLIP), bam_cigar_gen(3, BAM_CMATCH), bam_cigar_gen(10, BAM_CREF_SKIP),
+        bam_cigar_gen(4, BAM_CMATCH), bam_cigar_gen(10, BAM_CREF_SKIP), bam_cigar_gen(3, BAM_CMATCH)
+    };
+    bam1_t* b = makeRecord(100, cigar, "ACGTACGTACGT");
+    CigarEditor::clip(b, 3, 5, true);
+    EXPECT_EQ(cigarString(b), "5H4M10N3M");
+    EXPECT_EQ(b->core.pos, 113);
+    EXPECT_EQ(seqString(b), "CGTACGT");
+    EXPECT_EQ(bam_get_qual(b)[0], 5);
+    EXPECT_EQ(bam_get_qual(b)[6], 11);
+    // MD and NM describe the unclipped alignment, other tags are kept
+    EXPECT_EQ(bam_aux_get(b, "NM"), nullptr);
+    EXPECT_EQ(bam_aux_get(b, "MD"), nullptr);
+    EXPECT_EQ(bam_aux2A(bam_aux_get(b, "XS")), '+');
+    EXPECT_EQ(b->core.bin, hts_reg2bin(113, 130, 14, 5));
+    // Now the right hand side, merging with the existing hard clip
+    CigarEditor::clip(b, 1, 1, true);
+    EXPECT_EQ(cigarString(b), "5H4M3H");
+    EXPECT_EQ(b->core.pos, 113);
+    EXPECT_EQ(seqString(b), "CGTA");
+    EXPECT_EQ(bam_aux2A(bam_aux_get(b, "XS")), '+');
+    EXPECT_EQ(b->l_data, bam_get_aux(b) + 4 - b->data);
+    bam_destroy1(b);
+}
+
+TEST(bam, cigar_clip_keeps_md) {
+    // Hard clipping an existing soft clip removes no aligned bases, so MD and NM still hold
+    vector<uint32_t> cigar = {
+        bam_cigar_gen(2, BAM_CSOFT_CLIP), bam_cigar_gen(5, BAM_CMATCH), bam_cigar_gen(10, BAM_CREF_SKIP),
+        bam_cigar_gen(5, BAM_CMATCH)
+    };
+    bam1_t* b = makeRecord(100, cigar, "ACGTACGTACGT");
+    CigarEditor::clip(b, 1, 3, true);
+    EXPECT_EQ(cigarString(b), "2H5M10N5M");
+    EXPECT_EQ(b->core.pos, 100);
+    EXPECT_EQ(bam_aux2i(bam_aux_get(b, "NM")), 7);
+    EXPECT_EQ(string(bam_aux2Z(bam_aux_get(b, "MD"))), "3T6");
+    EXPECT_EQ(bam_aux2A(bam_aux_get(b, "XS")), '+');
+    bam_destroy1(b);
+}
+
+TEST(bam, cigar_clip_soft) {
+    vector<uint32_t> cigar = {
+        bam_cigar_gen(1, BAM_CHARD_CLIP), bam_cigar_gen(3, BAM_CMATCH), bam_cigar_gen(10, BAM_CREF_SKIP),
+        bam_cigar_gen(2, BAM_CMATCH), bam_cigar_gen(1, BAM_CINS), bam_cigar_gen(2, BAM_CMATCH),
+        bam_cigar_gen(10, BAM_CREF_SKIP), bam_cigar_gen(3, BAM_CMATCH), bam_cigar_gen(2, BAM_CSOFT_CLIP)
+    };
+    bam1_t* b = makeRecord(50, cigar, "ACGTACGTACGTA");
+    CigarEditor::clip(b, 3, 5, false);
+    EXPECT_EQ(cigarString(b), "1H3S2M1I2M5S");
+    EXPECT_EQ(b->core.pos, 63);
+    EXPECT_EQ(seqString(b), "ACGTACGTACGTA");
+    EXPECT_EQ(bam_aux_get(b, "NM"), nullptr);
+    EXPECT_EQ(bam_aux_get(b, "MD"), nullptr);
+    EXPECT_EQ(bam_aux2A(bam_aux_get(b, "XS")), '+');
+    bam_destroy1(b);
+}
+
+TEST(bam, protocol_strand) {
+    const Strand P = Strand::POSITIVE;
+    const Strand N = Strand::NEGATIVE;
+    // Arguments are first mate, reverse
+    EXPECT_EQ((protocolStrand<Strandedness::FIRSTSTRAND, Orientation::FR>(true, true)), P);
+    EXPECT_EQ((protocolStrand<Strandedness::FIRSTSTRAND, Orientation::FR>(true, false)), N);
+    EXPECT_EQ((protocolStrand<Strandedness::FIRSTSTRAND, Orientation::FR>(false, true)), N);
+    EXPECT_EQ((protocolStrand<Strandedness::FIRSTSTRAND, Orientation::FR>(false, false)), P);
+    EXPECT_EQ((protocolStrand<Strandedness::FIRSTSTRAND, Orientation::RF>(true, true)), N);
+    EXPECT_EQ((protocolStrand<Strandedness::FIRSTSTRAND, Orientation::RF>(false, true)), P);
+    EXPECT_EQ((protocolStrand<Strandedness::FIRSTSTRAND, Orientation::SE>(false, true)), P);
+    EXPECT_EQ((protocolStrand<Strandedness::FIRSTSTRAND, Orientation::FF>(true, false)), N);
+    EXPECT_EQ((protocolStrand<Strandedness::SECONDSTRAND, Orientation::FR>(true, true)), N);
+    EXPECT_EQ((protocolStrand<Strandedness::SECONDSTRAND, Orientation::FR>(false, true)), P);
+    EXPECT_EQ((protocolStrand<Strandedness::SECONDSTRAND, Orientation::RF>(true, true)), P);
+    EXPECT_EQ((protocolStrand<Strandedness::SECONDSTRAND, Orientation::RF>(false, false)), P);
+    EXPECT_EQ((protocolStrand<Strandedness::SECONDSTRAND, Orientation::SE>(false, true)), N);
+    EXPECT_EQ((protocolStrand<Strandedness::SECONDSTRAND, Orientation::FF>(true, false)), P);
+    EXPECT_EQ((protocolStrand<Strandedness::UNSTRANDED, Orientation::FR>(true, true)), Strand::UNKNOWN);
+    EXPECT_EQ((protocolStrand<Strandedness::FIRSTSTRAND, Orientation::UNKNOWN>(true, true)), Strand::UNKNOWN);
+    // Run time lookup finds the same function
+    EXPECT_EQ(strandFunction(Strandedness::SECONDSTRAND, Orientation::RF)(true, true), P);
+    EXPECT_EQ(strandFunction(Strandedness::UNKNOWN, Orientation::FR)(true, true), Strand::UNKNOWN);
+}
+
+TEST(bam, compact_copy) {
+    vector<uint32_t> cigar = {
+        bam_cigar_gen(3, BAM_CMATCH), bam_cigar_gen(10, BAM_CREF_SKIP), bam_cigar_gen(4, BAM_CMATCH)
+    };
+    bam1_t* b = makeRecord(50, cigar, "ACGTACG");
+    b->core.flag = BAM_FREVERSE;
+    BamAlignment ba(b, false, Strandedness::FIRSTSTRAND, Orientation::SE);
+    BamAlignmentPtr copy = ba.compactCopy();
+    // Everything but the optional fields is kept
+    EXPECT_EQ(copy->getRaw()->l_data, b->l_data - bam_get_l_aux(b));
+    EXPECT_EQ(bam_aux_get(copy->getRaw(), "NM"), nullptr);
+    EXPECT_EQ(cigarString(copy->getRaw()), "3M10N4M");
+    EXPECT_EQ(copy->getQuerySeq(), "ACGTACG");
+    EXPECT_EQ(copy->getCigarAsString(), ba.getCigarAsString());
+    EXPECT_EQ(copy->getStart(), 50);
+    EXPECT_EQ(copy->getEnd(), ba.getEnd());
+    EXPECT_EQ(copy->getStrand(), Strand::POSITIVE);
+    EXPECT_TRUE(copy->isReverseStrand());
+    bam_destroy1(b);
+}
+
+TEST(bam, spliced_index) {
+    const path bamFile = RESOURCESDIR "/clipped3.bam";
+    SplicedBlockIndex idx = SplicedBlockIndex::build(bamFile);
+    EXPECT_TRUE(idx.matches(bamFile));
+    // Survives a round trip to disk
+    const path indexFile = bfs::temp_directory_path() / bfs::unique_path("%%%%%%%%.spliced");
+    idx.save(indexFile);
+    SplicedBlockIndex loaded;
+    loaded.load(indexFile);
+    bfs::remove(indexFile);
+    BamReader reader(bamFile);
+    reader.open();
+    ASSERT_EQ(loaded.size(), (size_t) reader.getHeader()->n_targets);
+    uint64_t totalSpliced = 0;
+    for (int32_t i = 0; i < reader.getHeader()->n_targets; i++) {
+        const int32_t length = reader.getHeader()->target_len[i];
+        uint64_t spliced = 0, unspliced = 0, sum = 0;
+        reader.setRegion(i, 0, length);
+        while (reader.next()) {
+            const BamAlignment& al = reader.current();
+            (al.isSplicedRead() ? spliced : unspliced)++;
+            sum += al.getLength();
+        }
+        // Reading just the ranges finds every spliced alignment, and the index
+        // accounts for the unspliced alignments skipped over
+        const SplicedRefIndex& r = loaded.getRef(i);
+        uint64_t rangeSpliced = 0, rangeUnspliced = 0, rangeSum = 0;
+        reader.setRegion(i, 0, length, r.ranges);
+        while (reader.next()) {
+            const BamAlignment& al = reader.current();
+            (al.isSplicedRead() ? rangeSpliced : rangeUnspliced)++;
+            rangeSum += al.getLength();
+        }
+        EXPECT_EQ(rangeSpliced, spliced);
+        EXPECT_EQ(rangeUnspliced + r.unsplicedCount, unspliced);
+        EXPECT_EQ(rangeSum + r.sumQueryLengths, sum);
+        totalSpliced += spliced;
+    }
+    reader.close();
+    EXPECT_GT(totalSpliced, (uint64_t) 0);
+}
+
+TEST(bam, region_list) {
+    RefSeqPtrList refs;
+    refs.push_back(make_shared<RefSeq>(0, "chr1", 1000));
+    refs.push_back(make_shared<RefSeq>(1, "chr2", 500));
+    const path bedFile = bfs::temp_directory_path() / bfs::unique_path("%%%%%%%%.bed");
+    std::ofstream bed(bedFile.string());
+    bed << "track name=panel" << endl
+        << "chr2\t100\t200\tgeneA" << endl
+        << "chr1\t300\t400" << endl
+        << "chrUn\t0\t10" << endl
+        << "chr1\t350\t450" << endl   // Overlaps
+        << "chr1\t450\t460" << endl   // Touches
+        << "chr1\t600\t2000" << endl; // Runs off the end
+    bed.close();
+    size_t nbUnknown = 0;
+    RegionList regions = RegionList::loadBed(bedFile, refs, nbUnknown);
+    bfs::remove(bedFile);
+    EXPECT_EQ(nbUnknown, (size_t) 1);
+    ASSERT_EQ(regions.size(), (size_t) 3);
+    EXPECT_EQ(regions[0].seq, 0);
+    EXPECT_EQ(regions[0].start, 300);
+    EXPECT_EQ(regions[0].end, 460);
+    EXPECT_EQ(regions[1].end, 1000);
+    EXPECT_EQ(regions[2].seq, 1);
+    EXPECT_EQ(regions.totalLength(), (uint64_t) 660);
+    EXPECT_TRUE(regions.overlaps(0, 459, 500));
+    EXPECT_FALSE(regions.overlaps(0, 460, 600));
+    EXPECT_FALSE(regions.overlaps(1, 0, 100));
+    EXPECT_EQ(regions.getRegions(1).size(), (size_t) 1);
+    EXPECT_EQ(regions.getSeqs(), vector<int32_t>({0, 1}));
+}
+
+TEST(bam, multi_region) {
+    const path bamFile = RESOURCESDIR "/clipped3.bam";
+    BamReader reader(bamFile);
+    reader.open();
+    const int32_t length = reader.getHeader()->target_len[0];
+    struct Hit {
+        string name;
+        int32_t start;
+        int32_t end;
+    };
+    vector<Hit> all;
+    reader.setRegion(0, 0, length);
+    while (reader.next()) {
+        const BamAlignment& al = reader.current();
+        all.push_back(Hit{al.deriveName(), al.getPosition(), bam_endpos(al.getRaw())});
+    }
+    ASSERT_GT(all.size(), (size_t) 100);
+    // Overlapping, touching and widely separated regions around the alignments
+    const int32_t a = all[all.size() / 4].start;
+    const int32_t b = all[all.size() * 3 / 4].start;
+    RegionList regions;
+    regions.add(0, a, a + 50);
+    regions.add(0, a + 25, a + 100);
+    regions.add(0, a + 100, a + 120);
+    regions.add(0, b, b + 10);
+    regions.merge();
+    ASSERT_EQ(regions.size(), (size_t) 2);
+    vector<string> expected;
+    for (const auto & h : all) {
+        if (regions.overlaps(0, h.start, h.end)) {
+            expected.push_back(h.name + ":" + std::to_string(h.start));
+        }
+    }
+    vector<string> found;
+    reader.setRegions(regions);
+    while (reader.next()) {
+        const BamAlignment& al = reader.current();
+        found.push_back(al.deriveName() + ":" + std::to_string(al.getPosition()));
+    }
+    reader.close();
+    EXPECT_FALSE(expected.empty());
+    EXPECT_LT(expected.size(), all.size());
+    EXPECT_EQ(found, expected);
+}
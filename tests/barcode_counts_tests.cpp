@@ -0,0 +1,62 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <utility>
+#include <vector>
+using std::make_pair;
+using std::pair;
+using std::vector;
+
+#include <portcullis/barcode_counts.hpp>
+using portcullis::BarcodeCounts;
+using portcullis::BarcodeDictionary;
+
+TEST(barcode_counts, dictionary_merge) {
+    BarcodeDictionary a;
+    EXPECT_EQ(a.add("AAAC-1"), 0);
+    EXPECT_EQ(a.add("AAAG-1"), 1);
+    EXPECT_EQ(a.add("AAAC-1"), 0);
+    EXPECT_EQ(a.size(), 2);
+
+    BarcodeDictionary b;
+    b.add("TTTT-1");
+    b.add("AAAG-1");
+    const vector<uint32_t> mapping = a.merge(b);
+    EXPECT_EQ(mapping, vector<uint32_t>({2, 1}));
+    EXPECT_EQ(a.size(), 3);
+    EXPECT_EQ(a.get(2), "TTTT-1");
+}
+
+TEST(barcode_counts, compact_and_remap) {
+    BarcodeCounts c;
+    EXPECT_TRUE(c.empty());
+    // Enough to trigger folding part way through
+    for (uint32_t i = 0; i < 100; i++) {
+        c.add(i % 3 == 0 ? 5 : 2);
+    }
+    c.add(0);
+    c.compact();
+    const vector<pair<uint32_t, uint32_t>> expected = {make_pair(0, 1), make_pair(2, 66), make_pair(5, 34)};
+    EXPECT_EQ(c.getCounts(), expected);
+
+    // Renumbering keeps the counts sorted by id
+    c.remap({7, 0, 3, 0, 0, 1});
+    const vector<pair<uint32_t, uint32_t>> remapped = {make_pair(1, 34), make_pair(3, 66), make_pair(7, 1)};
+    EXPECT_EQ(c.getCounts(), remapped);
+}
@@ -0,0 +1,137 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+#include <boost/timer/timer.hpp>
+using boost::timer::cpu_timer;
+
+#include <htslib/sam.h>
+
+#include <portcullis/bam/genome_mapper.hpp>
+#include <portcullis/junction_system.hpp>
+
+namespace portcullis {
+namespace bench {
+
+/**
+ * Passed to every benchmark.  The benchmark does its setup, then runs the code
+ * being measured inside a "while (state.keepRunning())" loop.  Only the loop is
+ * timed.  The harness keeps doubling the number of iterations until a run takes
+ * at least the minimum time, so a single iteration may be anything from a few
+ * nanoseconds to a full pass over a BAM file.
+ */
+class State {
+private:
+	uint64_t iterations;
+	uint64_t count;
+	uint64_t items;
+	cpu_timer timer;
+
+public:
+
+	State(uint64_t _iterations) : iterations(_iterations), count(0), items(0) {
+		timer.stop();
+	}
+
+	bool keepRunning() {
+		if (count == 0) {
+			timer.start();
+		}
+		if (count == iterations) {
+			timer.stop();
+			return false;
+		}
+		count++;
+		return true;
+	}
+
+	uint64_t getIterations() const { return iterations; }
+
+	/**
+	 * Number of items (records, junctions, rows ...) processed in the whole
+	 * run.  Defaults to the number of iterations if never set.
+	 */
+	void setItemsProcessed(uint64_t _items) { items = _items; }
+
+	uint64_t getItemsProcessed() const { return items == 0 ? iterations : items; }
+
+	double getElapsedNs() const { return (double)timer.elapsed().wall; }
+};
+
+typedef std::function<void(State&)> BenchFunc;
+
+struct Benchmark {
+	string name;
+	BenchFunc func;
+};
+
+vector<Benchmark>& registry();
+
+// **** Shared inputs, loaded once on first use and kept for the whole run ****
+
+/**
+ * Raw records from the S.pombe test BAM, decoded by htslib but not yet wrapped
+ * in a BamAlignment
+ */
+const vector<bam1_t*>& spombeRecords();
+
+/**
+ * Genome mapper over an indexed copy of the S.pombe chromosome III fasta
+ */
+const portcullis::bam::GenomeMapper& spombeGenome();
+
+/**
+ * Genome mapper over an indexed copy of the A.thaliana chromosome 4 fasta
+ */
+const portcullis::bam::GenomeMapper& arthaGenome();
+
+/**
+ * Junctions found in the S.pombe test BAM.  The supporting alignments are kept
+ * so the anchor-level calculations can be rerun.
+ */
+portcullis::JunctionSystem& spombeJunctions();
+
+struct Registrar {
+	Registrar(const string& name, BenchFunc func) {
+		registry().push_back({name, func});
+	}
+};
+
+/**
+ * Stops the compiler from optimising away a value that is computed but never
+ * otherwise used
+ */
+template<class T>
+inline void doNotOptimize(const T& value) {
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+}
+}
+
+#define PORTCULLIS_BENCHMARK(NAME) \
+	static void NAME(portcullis::bench::State& state); \
+	static portcullis::bench::Registrar NAME##_registrar(#NAME, NAME); \
+	static void NAME(portcullis::bench::State& state)
@@ -0,0 +1,235 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+#include <boost/filesystem.hpp>
+namespace bfs = boost::filesystem;
+using bfs::path;
+
+#include <portcullis/bam/bam_alignment.hpp>
+#include <portcullis/bam/bam_master.hpp>
+#include <portcullis/bam/bam_reader.hpp>
+#include <portcullis/bam/genome_mapper.hpp>
+#include <portcullis/junction.hpp>
+#include <portcullis/junction_system.hpp>
+using portcullis::bam::BamAlignment;
+using portcullis::bam::BamReader;
+using portcullis::bam::GenomeMapper;
+using portcullis::bam::Orientation;
+using portcullis::bam::Strandedness;
+using portcullis::JunctionPtr;
+using portcullis::JunctionSystem;
+
+#include "bench.hpp"
+using portcullis::bench::State;
+using portcullis::bench::arthaGenome;
+using portcullis::bench::doNotOptimize;
+using portcullis::bench::spombeGenome;
+using portcullis::bench::spombeJunctions;
+using portcullis::bench::spombeRecords;
+
+namespace {
+
+// Indexes a copy of the given fasta in the temp directory so the resources
+// directory is left untouched
+GenomeMapper* indexGenome(const string& name) {
+	bfs::create_directories("temp");
+	path in(string(RESOURCESDIR) + "/" + name);
+	path out(path("temp") / name);
+	if (!bfs::exists(out)) {
+		bfs::copy_file(in, out);
+	}
+	GenomeMapper* gmap = new GenomeMapper(out);
+	if (!bfs::exists(gmap->getFastaIndexFile())) {
+		gmap->buildFastaIndex();
+	}
+	gmap->loadFastaIndex();
+	return gmap;
+}
+
+}
+
+const vector<bam1_t*>& portcullis::bench::spombeRecords() {
+	static vector<bam1_t*> records;
+	if (records.empty()) {
+		BamReader reader(path(RESOURCESDIR "/spombe.gsnap.III.25K.bam"));
+		reader.open();
+		while (reader.next()) {
+			records.push_back(bam_dup1(reader.current().getRaw()));
+		}
+		reader.close();
+	}
+	return records;
+}
+
+const GenomeMapper& portcullis::bench::spombeGenome() {
+	static GenomeMapper* gmap = indexGenome("spombe.III.fa");
+	return *gmap;
+}
+
+const GenomeMapper& portcullis::bench::arthaGenome() {
+	static GenomeMapper* gmap = indexGenome("artha_chr4.fa");
+	return *gmap;
+}
+
+JunctionSystem& portcullis::bench::spombeJunctions() {
+	static JunctionSystem* js = nullptr;
+	if (js == nullptr) {
+		BamReader reader(path(RESOURCESDIR "/spombe.gsnap.III.25K.bam"));
+		reader.open();
+		js = new JunctionSystem(reader.createRefList());
+		reader.close();
+		for (auto b : spombeRecords()) {
+			BamAlignment al(b, false, Strandedness::UNKNOWN, Orientation::UNKNOWN);
+			js->addJunctions(al);
+		}
+		for (size_t i = 0; i < js->size(); i++) {
+			JunctionPtr j = js->getJunctionAt(i);
+			j->calcMetrics(Orientation::UNKNOWN);
+			j->processJunctionWindow(spombeGenome());
+		}
+	}
+	return *js;
+}
+
+// Wraps each raw record in a BamAlignment, which decodes the cigar, strand and
+// alignment span
+PORTCULLIS_BENCHMARK(bam_decode) {
+	const vector<bam1_t*>& records = spombeRecords();
+	size_t i = 0;
+	while (state.keepRunning()) {
+		BamAlignment al(records[i], false, Strandedness::UNKNOWN, Orientation::UNKNOWN);
+		doNotOptimize(al.getEnd());
+		if (++i == records.size()) i = 0;
+	}
+}
+
+// Decodes each record into the same alignment, as BamReader::next does, with
+// a stranded paired protocol so the strand of records without an XS tag is
+// derived from the protocol
+PORTCULLIS_BENCHMARK(bam_decode_stranded) {
+	const vector<bam1_t*>& records = spombeRecords();
+	BamAlignment al;
+	al.setProtocol(Strandedness::FIRSTSTRAND, Orientation::FR);
+	size_t i = 0;
+	while (state.keepRunning()) {
+		al.setRaw(records[i]);
+		doNotOptimize(al.getStrand());
+		if (++i == records.size()) i = 0;
+	}
+}
+
+// As bam_decode_stranded with the protocol fixed at compile time
+PORTCULLIS_BENCHMARK(bam_decode_stranded_fixed) {
+	const vector<bam1_t*>& records = spombeRecords();
+	BamAlignment al;
+	size_t i = 0;
+	while (state.keepRunning()) {
+		al.setRaw<Strandedness::FIRSTSTRAND, Orientation::FR>(records[i]);
+		doNotOptimize(al.getStrand());
+		if (++i == records.size()) i = 0;
+	}
+}
+
+// Alignment statistics for each junction, including portcullis' own proper
+// pair check of every supporting alignment
+PORTCULLIS_BENCHMARK(alignment_stats) {
+	JunctionSystem& js = spombeJunctions();
+	size_t i = 0;
+	uint64_t items = 0;
+	while (state.keepRunning()) {
+		JunctionPtr j = js.getJunctionAt(i);
+		j->calcAlignmentStats(Orientation::FR);
+		items += j->getNbSplicedAlignments();
+		if (++i == js.size()) i = 0;
+	}
+	state.setItemsProcessed(items);
+}
+
+// Reads the whole test BAM from disk, including BGZF decompression
+PORTCULLIS_BENCHMARK(bam_read) {
+	uint64_t items = 0;
+	while (state.keepRunning()) {
+		BamReader reader(path(RESOURCESDIR "/spombe.gsnap.III.25K.bam"));
+		reader.open();
+		while (reader.next()) {
+			items++;
+		}
+		reader.close();
+	}
+	state.setItemsProcessed(items);
+}
+
+// Inserts every alignment in the test BAM into a fresh junction system
+PORTCULLIS_BENCHMARK(junction_insert) {
+	const vector<bam1_t*>& records = spombeRecords();
+	vector<BamAlignment> alignments;
+	alignments.reserve(records.size());
+	for (auto b : records) {
+		alignments.emplace_back(b, false, Strandedness::UNKNOWN, Orientation::UNKNOWN);
+	}
+	BamReader reader(path(RESOURCESDIR "/spombe.gsnap.III.25K.bam"));
+	reader.open();
+	auto refs = reader.createRefList();
+	reader.close();
+	uint64_t items = 0;
+	while (state.keepRunning()) {
+		JunctionSystem js(refs);
+		for (const auto& al : alignments) {
+			js.addJunctions(al);
+		}
+		doNotOptimize(js.size());
+		items += alignments.size();
+	}
+	state.setItemsProcessed(items);
+}
+
+// Fetches the anchors for each junction and recomputes the mismatch statistics
+// of every supporting alignment
+PORTCULLIS_BENCHMARK(anchor_mismatch) {
+	JunctionSystem& js = spombeJunctions();
+	const GenomeMapper& gmap = spombeGenome();
+	size_t i = 0;
+	while (state.keepRunning()) {
+		js.getJunctionAt(i)->processJunctionWindow(gmap);
+		if (++i == js.size()) i = 0;
+	}
+}
+
+// Random 100bp fetches across A.thaliana chromosome 4
+PORTCULLIS_BENCHMARK(genome_fetch) {
+	const GenomeMapper& gmap = arthaGenome();
+	std::mt19937 rng(1234);
+	// Chr4 is a little over 18.5Mbp long
+	std::uniform_int_distribution<int> dist(0, 18000000);
+	vector<int> starts(4096);
+	for (auto& s : starts) {
+		s = dist(rng);
+	}
+	size_t i = 0;
+	while (state.keepRunning()) {
+		string seq = gmap.fetchBases("Chr4", starts[i], starts[i] + 99);
+		doNotOptimize(seq.size());
+		i = (i + 1) & 4095;
+	}
+}
@@ -0,0 +1,99 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+using std::string;
+using std::stringstream;
+using std::vector;
+
+#include <portcullis/junction.hpp>
+#include <portcullis/junction_system.hpp>
+#include <portcullis/ml/markov_model.hpp>
+using portcullis::ml::KmerMarkovModel;
+using portcullis::Junction;
+using portcullis::JunctionSystem;
+
+#include "bench.hpp"
+using portcullis::bench::State;
+using portcullis::bench::doNotOptimize;
+using portcullis::bench::spombeJunctions;
+
+namespace {
+
+vector<string> randomSeqs(size_t n, size_t len, uint32_t seed) {
+	const char bases[] = "ACGT";
+	std::mt19937 rng(seed);
+	std::uniform_int_distribution<int> dist(0, 3);
+	vector<string> seqs(n);
+	for (auto& s : seqs) {
+		s.resize(len);
+		for (auto& c : s) {
+			c = bases[dist(rng)];
+		}
+	}
+	return seqs;
+}
+
+}
+
+// Scores 200bp sequences against a 5th order kmer model, as done for the
+// coding potential feature
+PORTCULLIS_BENCHMARK(markov_score) {
+	KmerMarkovModel model;
+	model.train(randomSeqs(1000, 200, 1), 5);
+	vector<string> seqs = randomSeqs(1024, 200, 2);
+	size_t i = 0;
+	while (state.keepRunning()) {
+		doNotOptimize(model.getScore(seqs[i]));
+		i = (i + 1) & 1023;
+	}
+}
+
+// Parses junction table rows produced by the S.pombe junctions
+PORTCULLIS_BENCHMARK(junction_parse) {
+	JunctionSystem& js = spombeJunctions();
+	vector<string> lines;
+	for (size_t i = 0; i < js.size(); i++) {
+		stringstream ss;
+		ss << *(js.getJunctionAt(i));
+		lines.push_back(ss.str());
+	}
+	size_t i = 0;
+	while (state.keepRunning()) {
+		doNotOptimize(Junction::parse(lines[i]));
+		if (++i == lines.size()) i = 0;
+	}
+}
+
+// Formats each junction as a tab row, a BED line and a junction GFF entry
+PORTCULLIS_BENCHMARK(junction_output) {
+	JunctionSystem& js = spombeJunctions();
+	stringstream ss;
+	size_t i = 0;
+	while (state.keepRunning()) {
+		ss.str("");
+		Junction& j = *(js.getJunctionAt(i));
+		ss << j << "\n";
+		j.outputBED(ss, "portcullis", true);
+		j.outputJunctionGFF(ss, "portcullis");
+		doNotOptimize(ss.tellp());
+		if (++i == js.size()) i = 0;
+	}
+}
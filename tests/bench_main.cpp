@@ -0,0 +1,140 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <regex>
+#include <string>
+#include <vector>
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::ofstream;
+using std::ostream;
+using std::string;
+using std::vector;
+
+#include <boost/program_options.hpp>
+namespace po = boost::program_options;
+
+#include "bench.hpp"
+using portcullis::bench::Benchmark;
+using portcullis::bench::State;
+
+vector<Benchmark>& portcullis::bench::registry() {
+	static vector<Benchmark> benchmarks;
+	return benchmarks;
+}
+
+struct BenchResult {
+	string name;
+	uint64_t iterations;
+	double nsPerOp;
+	double itemsPerSec;
+};
+
+static BenchResult runBenchmark(const Benchmark& b, double minTime) {
+	uint64_t iterations = 1;
+	while (true) {
+		State state(iterations);
+		b.func(state);
+		double ns = state.getElapsedNs();
+		// Stop when the run was long enough or the iteration count is absurd
+		if (ns >= minTime * 1e9 || iterations >= (1ULL << 40)) {
+			BenchResult r;
+			r.name = b.name;
+			r.iterations = iterations;
+			r.nsPerOp = ns / iterations;
+			r.itemsPerSec = ns > 0 ? state.getItemsProcessed() / (ns / 1e9) : 0.0;
+			return r;
+		}
+		// Aim a little past the minimum time based on this run, but always at
+		// least double so fast benchmarks converge quickly
+		uint64_t next = ns > 0 ? (uint64_t)(iterations * (minTime * 1e9 * 1.2) / ns) : iterations * 10;
+		iterations = std::max(iterations * 2, std::min(next, iterations * 100));
+	}
+}
+
+static void writeJson(ostream& out, const vector<BenchResult>& results) {
+	out << "{" << endl
+		<< "  \"benchmarks\": [" << endl;
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchResult& r = results[i];
+		out << "    {\"name\": \"" << r.name << "\", "
+			<< "\"iterations\": " << r.iterations << ", "
+			<< std::fixed << std::setprecision(3)
+			<< "\"ns_per_op\": " << r.nsPerOp << ", "
+			<< "\"items_per_sec\": " << r.itemsPerSec << "}"
+			<< (i + 1 < results.size() ? "," : "") << endl;
+	}
+	out << "  ]" << endl
+		<< "}" << endl;
+}
+
+int main(int argc, char *argv[]) {
+	string filter;
+	double minTime;
+	string output;
+	bool list;
+	po::options_description desc("Portcullis microbenchmarks.\n\nUsage: bench_portcullis [options]\n\nOptions");
+	desc.add_options()
+			("filter,f", po::value<string>(&filter)->default_value(".*"),
+			"Only run benchmarks whose name matches this regular expression.")
+			("min_time,t", po::value<double>(&minTime)->default_value(0.5),
+			"Minimum time in seconds to spend timing each benchmark.")
+			("output,o", po::value<string>(&output),
+			"Write the results as JSON to this file as well as a table to stdout.")
+			("list,l", po::bool_switch(&list)->default_value(false),
+			"List the available benchmarks and exit.")
+			("help", "Produce help message")
+			;
+	po::variables_map vm;
+	po::store(po::parse_command_line(argc, argv, desc), vm);
+	po::notify(vm);
+	if (vm.count("help")) {
+		cout << desc << endl;
+		return 0;
+	}
+	std::regex re(filter);
+	vector<BenchResult> results;
+	for (const auto& b : portcullis::bench::registry()) {
+		if (!std::regex_search(b.name, re)) {
+			continue;
+		}
+		if (list) {
+			cout << b.name << endl;
+			continue;
+		}
+		BenchResult r = runBenchmark(b, minTime);
+		cout << std::left << std::setw(28) << r.name
+			 << std::right << std::setw(14) << std::fixed << std::setprecision(1) << r.nsPerOp << " ns/op"
+			 << std::setw(18) << std::setprecision(0) << r.itemsPerSec << " items/s"
+			 << std::setw(12) << r.iterations << " its" << endl;
+		results.push_back(r);
+	}
+	if (!output.empty()) {
+		ofstream out(output.c_str());
+		if (!out) {
+			cerr << "Could not open " << output << " for writing" << endl;
+			return 1;
+		}
+		writeJson(out, results);
+	}
+	return 0;
+}
@@ -0,0 +1,143 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+#include <ranger/DataDouble.h>
+
+#include <portcullis/ml/enn.hpp>
+#include <portcullis/ml/knn.hpp>
+#include <portcullis/ml/model_features.hpp>
+#include <portcullis/ml/smote.hpp>
+using portcullis::ml::ENN;
+using portcullis::ml::ForestPtr;
+using portcullis::ml::KNN;
+using portcullis::ml::ModelFeatures;
+using portcullis::ml::Smote;
+
+#include "bench.hpp"
+using portcullis::bench::State;
+using portcullis::bench::doNotOptimize;
+
+namespace {
+
+const size_t ROWS = 2000;
+const size_t COLS = 20;
+
+// Two overlapping gaussian clouds, with the first quarter of the rows
+// belonging to the positive class
+struct Synthetic {
+	vector<double> data;
+	vector<bool> labels;
+
+	Synthetic(size_t rows, size_t cols, uint32_t seed) : data(rows * cols), labels(rows) {
+		std::mt19937 rng(seed);
+		std::normal_distribution<double> dist(0.0, 1.0);
+		for (size_t i = 0; i < rows; i++) {
+			labels[i] = i < rows / 4;
+			for (size_t j = 0; j < cols; j++) {
+				data[i * cols + j] = dist(rng) + (labels[i] ? 1.5 : 0.0);
+			}
+		}
+	}
+
+	// Copies the matrix into a ranger data object with the label as the
+	// first column
+	Data* toData() const {
+		vector<string> names;
+		names.push_back("Genuine");
+		for (size_t j = 0; j < COLS; j++) {
+			names.push_back("f" + std::to_string(j));
+		}
+		const size_t rows = labels.size();
+		Data* d = new DataDouble(names, rows, COLS + 1);
+		bool error = false;
+		for (size_t i = 0; i < rows; i++) {
+			d->set(0, i, labels[i] ? 1.0 : 0.0, error);
+			for (size_t j = 0; j < COLS; j++) {
+				d->set(j + 1, i, data[i * COLS + j], error);
+			}
+		}
+		return d;
+	}
+};
+
+}
+
+// Finds the 5 nearest neighbours of every row
+PORTCULLIS_BENCHMARK(knn) {
+	Synthetic s(ROWS, COLS, 1);
+	uint64_t items = 0;
+	while (state.keepRunning()) {
+		KNN knn(5, 1, s.data.data(), ROWS, COLS);
+		knn.execute();
+		doNotOptimize(knn.getResults().size());
+		items += ROWS;
+	}
+	state.setItemsProcessed(items);
+}
+
+// Oversamples the positive rows two fold
+PORTCULLIS_BENCHMARK(smote) {
+	Synthetic s(ROWS / 4, COLS, 2);
+	uint64_t items = 0;
+	while (state.keepRunning()) {
+		Smote smote(5, 2, 1, s.data.data(), ROWS / 4, COLS);
+		smote.execute();
+		items += ROWS / 4;
+	}
+	state.setItemsProcessed(items);
+}
+
+// Flags rows whose neighbourhood disagrees with their label
+PORTCULLIS_BENCHMARK(enn) {
+	Synthetic s(ROWS, COLS, 3);
+	uint64_t items = 0;
+	while (state.keepRunning()) {
+		ENN enn(5, 1, s.data.data(), ROWS, COLS, s.labels);
+		vector<bool> results;
+		doNotOptimize(enn.execute(results));
+		items += ROWS;
+	}
+	state.setItemsProcessed(items);
+}
+
+// Predicts a batch of rows with a 100 tree forest trained on the same
+// distribution
+PORTCULLIS_BENCHMARK(forest_predict) {
+	static Synthetic train(ROWS, COLS, 4);
+	static unique_ptr<Data> trainData(train.toData());
+	static ForestPtr f = ModelFeatures::trainForest(trainData.get(), "temp/bench_forest", 100, 1, false, false, 0);
+	Synthetic test(ROWS / 2, COLS, 5);
+	unique_ptr<Data> testData(test.toData());
+	vector<string> catvars;
+	f->setPredictionMode(true);
+	uint64_t items = 0;
+	while (state.keepRunning()) {
+		f->setData(testData.get(), "Genuine", "", catvars);
+		f->run(false);
+		doNotOptimize(f->getPredictions().size());
+		items += ROWS / 2;
+	}
+	state.setItemsProcessed(items);
+}
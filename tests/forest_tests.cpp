@@ -0,0 +1,198 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+#include <boost/filesystem.hpp>
+namespace bfs = boost::filesystem;
+
+#include <ranger/DataDouble.h>
+#include <ranger/ForestProbability.h>
+
+#include <portcullis/ml/data_view.hpp>
+#include <portcullis/ml/model_features.hpp>
+using portcullis::ml::DataView;
+using portcullis::ml::DataViewException;
+using portcullis::ml::ForestPtr;
+using portcullis::ml::ModelFeatures;
+
+namespace {
+
+// Label followed by features with at most "levels" distinct integer values.  The label depends on
+// the first two features plus some noise.
+Data* makeData(size_t rows, size_t cols, size_t levels, uint32_t seed) {
+    vector<string> names;
+    names.push_back("Genuine");
+    for (size_t j = 0; j < cols; j++) {
+        names.push_back("f" + std::to_string(j));
+    }
+    Data* d = new DataDouble(names, rows, cols + 1);
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<size_t> level(0, levels - 1);
+    std::uniform_real_distribution<double> noise(0.0, 1.0);
+    bool error = false;
+    for (size_t i = 0; i < rows; i++) {
+        double f0 = level(rng);
+        double f1 = level(rng);
+        d->set(1, i, f0, error);
+        d->set(2, i, f1, error);
+        for (size_t j = 2; j < cols; j++) {
+            d->set(j + 1, i, level(rng), error);
+        }
+        bool genuine = f0 + f1 >= levels - 1;
+        if (noise(rng) < 0.1) genuine = !genuine;
+        d->set(0, i, genuine ? 1.0 : 0.0, error);
+    }
+    return d;
+}
+
+// Predicts data with a fresh forest loaded from file
+vector<vector<double>> predict(const string& forestFile, Data* data) {
+    ForestProbability f;
+    vector<string> catVars;
+    f.init("Genuine", MEM_DOUBLE, data, 0, "", 10, 1234567890, 1, IMP_GINI, DEFAULT_MIN_NODE_SIZE_PROBABILITY,
+            "", true, true, catVars, false, DEFAULT_SPLITRULE, false, 1.0);
+    f.loadFromFile(forestFile);
+    f.run(false);
+    return f.getPredictions();
+}
+
+}
+
+TEST(forest, bin_lossless) {
+
+    // 500 rows with 5 distinct values, which fit into 16 bins
+    unique_ptr<Data> d(makeData(500, 2, 5, 1));
+    d->bin(16);
+    ASSERT_TRUE(d->isBinned());
+    for (size_t col = 1; col < 3; col++) {
+        EXPECT_EQ(5, d->getNumUniqueDataValues(col));
+        for (size_t i = 0; i < 5; i++) {
+            EXPECT_EQ((double)i, d->getUniqueDataValue(col, i));
+        }
+        for (size_t row = 0; row < 500; row++) {
+            EXPECT_EQ(d->get(row, col), d->getUniqueDataValue(col, d->getBin(row, col)));
+        }
+    }
+}
+
+TEST(forest, bin_quantiles) {
+
+    // 1000 distinct values in reverse order into 4 bins
+    vector<string> names = {"Genuine", "f0"};
+    Data* raw = new DataDouble(names, 1000, 2);
+    unique_ptr<Data> d(raw);
+    bool error = false;
+    for (size_t i = 0; i < 1000; i++) {
+        d->set(0, i, i % 2, error);
+        d->set(1, i, 999.0 - i, error);
+    }
+    d->bin(4);
+
+    // Upper edges are the quartiles and each bin holds a quarter of the rows
+    ASSERT_EQ(4, d->getNumUniqueDataValues(1));
+    EXPECT_EQ(249.0, d->getUniqueDataValue(1, 0));
+    EXPECT_EQ(499.0, d->getUniqueDataValue(1, 1));
+    EXPECT_EQ(749.0, d->getUniqueDataValue(1, 2));
+    EXPECT_EQ(999.0, d->getUniqueDataValue(1, 3));
+    vector<size_t> counts(4, 0);
+    for (size_t row = 0; row < 1000; row++) {
+        size_t bin = d->getBin(row, 1);
+        counts[bin]++;
+        EXPECT_LE(d->get(row, 1), d->getUniqueDataValue(1, bin));
+        if (bin > 0) {
+            EXPECT_GT(d->get(row, 1), d->getUniqueDataValue(1, bin - 1));
+        }
+    }
+    for (size_t bin = 0; bin < 4; bin++) {
+        EXPECT_EQ(250, counts[bin]);
+    }
+}
+
+TEST(forest, histogram_matches_exact) {
+
+    bfs::create_directories("temp");
+
+    // Few unique values so the bins are lossless and both modes see the same candidate splits
+    unique_ptr<Data> exactData(makeData(2000, 4, 8, 2));
+    unique_ptr<Data> histData(makeData(2000, 4, 8, 2));
+    ForestPtr exact = ModelFeatures::trainForest(exactData.get(), "temp/forest_exact", 20, 1, true, false, 0);
+    ForestPtr hist = ModelFeatures::trainForest(histData.get(), "temp/forest_hist", 20, 1, true, false, 16);
+
+    EXPECT_EQ(exact->getSplitVarIDs(), hist->getSplitVarIDs());
+    EXPECT_EQ(exact->getSplitValues(), hist->getSplitValues());
+    EXPECT_EQ(exact->getChildNodeIDs(), hist->getChildNodeIDs());
+    EXPECT_EQ(exact->getOverallPredictionError(), hist->getOverallPredictionError());
+
+    exact->saveToFile("temp/forest_exact.forest");
+    hist->saveToFile("temp/forest_hist.forest");
+    unique_ptr<Data> testData(makeData(500, 4, 8, 3));
+    vector<vector<double>> exactPred = predict("temp/forest_exact.forest", testData.get());
+    vector<vector<double>> histPred = predict("temp/forest_hist.forest", testData.get());
+    ASSERT_EQ(500, exactPred.size());
+    EXPECT_EQ(exactPred, histPred);
+}
+
+TEST(forest, predict_held_out) {
+
+    bfs::create_directories("temp");
+
+    // Train and save, as self-training does, then predict rows the forest has not seen
+    unique_ptr<Data> trainData(makeData(1000, 4, 8, 4));
+    ForestPtr trained = ModelFeatures::trainForest(trainData.get(), "temp/forest_held", 20, 1, true, false, 0);
+    trained->saveToFile("temp/forest_held.forest");
+    unique_ptr<Data> heldData(makeData(300, 4, 8, 5));
+    shared_ptr<ForestProbability> f = ModelFeatures::loadForest("temp/forest_held.forest", heldData.get(), 1);
+    f->run(false);
+
+    // One prediction per held out row, probabilities sum to 1 and match a separately loaded forest
+    const vector<vector<double>>& pred = f->getPredictions();
+    vector<vector<double>> expected = predict("temp/forest_held.forest", heldData.get());
+    ASSERT_EQ(300, pred.size());
+    for (size_t i = 0; i < pred.size(); i++) {
+        ASSERT_EQ(2, pred[i].size());
+        EXPECT_NEAR(1.0, pred[i][0] + pred[i][1], 1e-9);
+        EXPECT_NEAR(expected[i][0], pred[i][0], 1e-12);
+        EXPECT_NEAR(expected[i][1], pred[i][1], 1e-12);
+    }
+}
+
+TEST(forest, view_override_column) {
+    unique_ptr<Data> all(makeData(10, 3, 4, 7));
+    vector<size_t> rows = {8, 2, 5};
+    DataView view(all.get(), rows);
+    view.overrideColumn(2, {0.5, 1.5, 2.5});
+    for (size_t i = 0; i < rows.size(); i++) {
+        // Other columns still come from the parent
+        EXPECT_EQ(all->get(rows[i], 1), view.get(i, 1));
+        EXPECT_EQ(all->get(rows[i], 3), view.get(i, 3));
+        EXPECT_EQ(0.5 + i, view.get(i, 2));
+    }
+    // The parent is untouched
+    DataView other(all.get(), rows);
+    EXPECT_EQ(all->get(8, 2), other.get(0, 2));
+    EXPECT_THROW(view.overrideColumn(1, {1.0}), DataViewException);
+}
@@ -0,0 +1,120 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <vector>
+using std::set;
+using std::vector;
+
+#include <htslib/sam.h>
+
+#include <portcullis/intron.hpp>
+#include <portcullis/junction.hpp>
+#include <portcullis/junction_lookup.hpp>
+using portcullis::Intron;
+using portcullis::Junction;
+using portcullis::JunctionList;
+using portcullis::JunctionLookup;
+
+namespace {
+const RefSeq r0(0, "seq_0", 1000000);
+const RefSeq r3(3, "seq_3", 1000);
+
+void addJunction(JunctionList& list, const RefSeq& ref, int32_t start, int32_t end) {
+    shared_ptr<Intron> l(new Intron(ref, start, end));
+    list.push_back(make_shared<Junction>(l, start - 10, end + 10));
+}
+
+// Record with a cigar but no sequence, enough for the lookup to walk
+bam1_t* makeRecord(int32_t tid, int32_t pos, const vector<uint32_t>& cigar) {
+    bam1_t* b = bam_init1();
+    b->core.tid = tid;
+    b->core.pos = pos;
+    b->core.l_qname = 1;
+    b->core.n_cigar = cigar.size();
+    b->l_data = b->m_data = 1 + 4 * cigar.size();
+    b->data = (uint8_t*)calloc(b->m_data, 1);
+    memcpy(b->data + 1, cigar.data(), 4 * cigar.size());
+    return b;
+}
+}
+
+TEST(junction_lookup, contains) {
+    // Check every tree size up to a few levels deep against a plain set
+    for (int32_t n = 0; n < 70; n++) {
+        JunctionList list;
+        set<std::pair<int32_t, int32_t>> expected;
+        for (int32_t i = 0; i < n; i++) {
+            int32_t start = 100 + i * 37;
+            addJunction(list, r0, start, start + 50 + (i % 3));
+            expected.insert(std::make_pair(start, start + 50 + (i % 3)));
+        }
+        JunctionLookup lookup(list);
+        EXPECT_EQ(lookup.size(), (size_t)n);
+        for (int32_t start = 90; start < 100 + n * 37; start++) {
+            for (int32_t end = start + 49; end < start + 54; end++) {
+                bool found = expected.count(std::make_pair(start, end)) > 0;
+                EXPECT_EQ(lookup.contains(0, start, end), found);
+            }
+        }
+        EXPECT_FALSE(lookup.contains(1, 100, 150));
+        EXPECT_FALSE(lookup.contains(-1, 100, 150));
+    }
+}
+
+TEST(junction_lookup, raw_cigar) {
+    JunctionList list;
+    addJunction(list, r3, 20, 119);
+    addJunction(list, r3, 130, 229);
+    addJunction(list, r3, 500, 998);
+    JunctionLookup lookup(list);
+    EXPECT_EQ(lookup.size(), 3);
+
+    // 10M100N10M100N10M from 10 spans introns 20-119 and 130-229
+    vector<uint32_t> msr = {
+        bam_cigar_gen(10, BAM_CMATCH), bam_cigar_gen(100, BAM_CREF_SKIP), bam_cigar_gen(10, BAM_CMATCH),
+        bam_cigar_gen(100, BAM_CREF_SKIP), bam_cigar_gen(10, BAM_CMATCH)
+    };
+    bam1_t* b = makeRecord(3, 10, msr);
+    EXPECT_TRUE(lookup.containsAny(b));
+    bam_destroy1(b);
+
+    // Deletions move the intron, insertions and soft clips don't
+    vector<uint32_t> shifted = {
+        bam_cigar_gen(5, BAM_CSOFT_CLIP), bam_cigar_gen(5, BAM_CMATCH), bam_cigar_gen(2, BAM_CINS),
+        bam_cigar_gen(3, BAM_CMATCH), bam_cigar_gen(2, BAM_CDEL), bam_cigar_gen(100, BAM_CREF_SKIP),
+        bam_cigar_gen(10, BAM_CMATCH)
+    };
+    b = makeRecord(3, 10, shifted);
+    EXPECT_TRUE(lookup.containsAny(b));
+    b->core.pos = 11;
+    EXPECT_FALSE(lookup.containsAny(b));
+    b->core.tid = 0;
+    b->core.pos = 10;
+    EXPECT_FALSE(lookup.containsAny(b));
+    bam_destroy1(b);
+
+    // Introns running off the end of the reference are clamped as in JunctionSystem
+    vector<uint32_t> overhang = {bam_cigar_gen(10, BAM_CMATCH), bam_cigar_gen(600, BAM_CREF_SKIP), bam_cigar_gen(10, BAM_CMATCH)};
+    b = makeRecord(3, 490, overhang);
+    EXPECT_TRUE(lookup.containsAny(b));
+    bam_destroy1(b);
+}
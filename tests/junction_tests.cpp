@@ -17,6 +17,7 @@
 
 #include <gtest/gtest.h>
 
+#include <cstring>
 #include <iostream>
 using std::cout;
 using std::endl;
@@ -25,10 +26,13 @@ using std::endl;
 
 #include <portcullis/intron.hpp>
 #include <portcullis/junction.hpp>
+#include <portcullis/junction_system.hpp>
+using portcullis::AlignmentInfo;
 using portcullis::CanonicalSS;
 using portcullis::Intron;
 using portcullis::Junction;
 using portcullis::JunctionException;
+using portcullis::JunctionSystem;
 
 bool is_critical( JunctionException const& ex ) { return true; }
 
@@ -146,3 +150,103 @@ TEST(junction, coverage2) {
     
     EXPECT_LT(cvg2, 0);
 }
+
+TEST(junction, multiple_junctions) {
+    
+    // One read spanning two junctions.  The right anchor of the first junction
+    // is the left anchor of the second.
+    shared_ptr<vector<RefSeqPtr>> refs = make_shared<vector<RefSeqPtr>>();
+    refs->push_back(make_shared<RefSeq>(0, "seq_0", 1000));
+    
+    for (bool compact : {false, true}) {
+        JunctionSystem js(refs);
+        js.setCompactAlignments(compact);
+        
+        // 10M50N20M30N10M without sequence or qualities
+        const vector<uint32_t> cigar = {
+            bam_cigar_gen(10, BAM_CMATCH), bam_cigar_gen(50, BAM_CREF_SKIP), bam_cigar_gen(20, BAM_CMATCH),
+            bam_cigar_gen(30, BAM_CREF_SKIP), bam_cigar_gen(10, BAM_CMATCH)
+        };
+        bam1_t* b = bam_init1();
+        b->core.tid = 0;
+        b->core.pos = 100;
+        b->core.l_qname = 2;
+        b->core.n_cigar = cigar.size();
+        b->l_data = 2 + 4 * cigar.size();
+        b->m_data = b->l_data;
+        b->data = (uint8_t*)calloc(b->m_data, 1);
+        b->data[0] = 'r';
+        memcpy(bam_get_cigar(b), cigar.data(), 4 * cigar.size());
+        BamAlignment ba(b, true, Strandedness::UNKNOWN, Orientation::UNKNOWN);
+        bam_destroy1(b);
+        
+        EXPECT_TRUE(js.addJunctions(ba));
+        EXPECT_EQ(js.size(), 2);
+        
+        JunctionPtr j1 = js.getJunctionAt(0);
+        EXPECT_EQ(j1->getIntron()->start, 110);
+        EXPECT_EQ(j1->getIntron()->end, 159);
+        EXPECT_EQ(j1->getLeftAncStart(), 100);
+        EXPECT_EQ(j1->getRightAncEnd(), 179);
+        EXPECT_EQ(j1->getNbSplicedAlignments(), 1);
+        
+        JunctionPtr j2 = js.getJunctionAt(1);
+        EXPECT_EQ(j2->getIntron()->start, 180);
+        EXPECT_EQ(j2->getIntron()->end, 209);
+        EXPECT_EQ(j2->getLeftAncStart(), 160);
+        EXPECT_EQ(j2->getRightAncEnd(), 219);
+        EXPECT_EQ(j2->getNbSplicedAlignments(), 1);
+    }
+}
+
+TEST(junction, match_stats_straddling_exon) {
+    
+    // A doubly spliced read, 30M20N20M30N10M at 100, whose first exon
+    // (100-129) straddles the left anchor start of the second junction
+    // (intron 170-199).  The junction's left anchor starts at 120 because
+    // another read's anchor reaches back that far.
+    string genome;
+    while (genome.size() < 300) genome += "ACGTTGCA";
+    const string seq = genome.substr(100, 30) + genome.substr(150, 20) + genome.substr(200, 10);
+    const vector<uint32_t> cigar = {
+        bam_cigar_gen(30, BAM_CMATCH), bam_cigar_gen(20, BAM_CREF_SKIP), bam_cigar_gen(20, BAM_CMATCH),
+        bam_cigar_gen(30, BAM_CREF_SKIP), bam_cigar_gen(10, BAM_CMATCH)
+    };
+    bam1_t* b = bam_init1();
+    b->core.tid = 0;
+    b->core.pos = 100;
+    b->core.l_qname = 2;
+    b->core.n_cigar = cigar.size();
+    b->core.l_qseq = seq.size();
+    b->l_data = 2 + 4 * cigar.size() + (seq.size() + 1) / 2 + seq.size();
+    b->m_data = b->l_data;
+    b->data = (uint8_t*)calloc(b->m_data, 1);
+    b->data[0] = 'r';
+    memcpy(bam_get_cigar(b), cigar.data(), 4 * cigar.size());
+    for (size_t i = 0; i < seq.size(); i++) {
+        bam_get_seq(b)[i / 2] |= seq_nt16_table[(int)seq[i]] << ((~i & 1) << 2);
+    }
+    BamAlignmentPtr ba = make_shared<BamAlignment>(b, true, Strandedness::UNKNOWN, Orientation::UNKNOWN);
+    bam_destroy1(b);
+    
+    Intron intron(rd5, 170, 199);
+    const string ancLeft = genome.substr(120, 50);
+    const string ancRight = genome.substr(200, 10);
+    
+    // Whole anchors: the straddling exon is skipped, so only the skip and the
+    // second exon are compared, as before anchor windows were added
+    AlignmentInfo whole(ba);
+    whole.calcMatchStats(intron, 120, 209, ancLeft, ancRight, false);
+    EXPECT_EQ(whole.totalUpstreamMismatches, 20);
+    EXPECT_EQ(whole.totalUpstreamMatches, 20);
+    EXPECT_EQ(whole.upstreamMatches, 20);
+    EXPECT_EQ(whole.totalDownstreamMatches, 10);
+    
+    // Anchor window: the part of the straddling exon inside the window counts
+    AlignmentInfo windowed(ba);
+    windowed.calcMatchStats(intron, 120, 209, ancLeft, ancRight, true);
+    EXPECT_EQ(windowed.totalUpstreamMismatches, 20);
+    EXPECT_EQ(windowed.totalUpstreamMatches, 30);
+    EXPECT_EQ(windowed.upstreamMatches, 20);
+    EXPECT_EQ(windowed.totalDownstreamMatches, 10);
+}
@@ -0,0 +1,124 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <vector>
+using std::cout;
+using std::endl;
+using std::vector;
+
+#include <portcullis/ml/knn.hpp>
+#include <portcullis/ml/neighbour_graph.hpp>
+#include <portcullis/ml/enn.hpp>
+#include <portcullis/ml/smote.hpp>
+using portcullis::ml::KNN;
+using portcullis::ml::NeighbourGraph;
+using portcullis::ml::ENN;
+using portcullis::ml::Smote;
+
+namespace {
+// 10 rows x 3 cols, first 4 rows positive, the rest negative.  All pairwise
+// distances are distinct so neighbour order is unambiguous.
+double data[] = {
+    0.0, 0.0, 0.0,
+    1.0, 0.1, 0.0,
+    0.2, 2.0, 0.0,
+    3.0, 0.3, 0.1,
+    10.0, 0.0, 0.5,
+    11.0, 0.7, 0.0,
+    10.3, 2.5, 0.0,
+    14.0, 0.4, 1.1,
+    12.2, 1.3, 0.2,
+    9.0, 6.0, 0.9
+};
+const vector<bool> labels = {true, true, true, true, false, false, false, false, false, false};
+}
+
+TEST(knn, flat) {
+    KNN knn(3, 2, data, 10, 3);
+    knn.execute();
+    EXPECT_EQ(knn.getResults().size(), 30);
+    for (size_t i = 0; i < 10; i++) {
+        // Every row is its own nearest neighbour
+        EXPECT_EQ(knn.getNNs(i)[0], i);
+    }
+    EXPECT_EQ(knn.getNNs(0)[1], 1);
+    EXPECT_EQ(knn.getNNs(0)[2], 2);
+}
+
+TEST(knn, graph_matches_knn) {
+    KNN knn(4, 1, data, 10, 3);
+    knn.execute();
+    NeighbourGraph graph(4, 3, 3);
+    graph.addRows(data, 10, labels);
+    EXPECT_EQ(graph.getNbRows(), 10);
+    EXPECT_EQ(graph.getNbRows(true), 4);
+    EXPECT_EQ(graph.getNbRows(false), 6);
+    uint32_t buf[4];
+    for (size_t i = 0; i < 10; i++) {
+        EXPECT_EQ(graph.getNNs(i, 4, buf), 4);
+        for (size_t j = 0; j < 4; j++) {
+            EXPECT_EQ(buf[j], knn.getNNs(i)[j]);
+        }
+        // Same class lists only contain rows of that class
+        for (size_t j = 0; j < graph.getNbNNs(i, labels[i]); j++) {
+            EXPECT_EQ(labels[graph.getNNs(i, labels[i])[j]], labels[i]);
+        }
+    }
+}
+
+TEST(knn, graph_incremental) {
+    NeighbourGraph all(3, 2, 3);
+    all.addRows(data, 10, labels);
+    NeighbourGraph inc(3, 2, 3);
+    inc.addRows(data, 6, vector<bool>(labels.begin(), labels.begin() + 6));
+    inc.addRows(&data[18], 4, false);
+    EXPECT_EQ(inc.getNbRows(), 10);
+    for (size_t i = 0; i < 10; i++) {
+        for (bool l : {false, true}) {
+            EXPECT_EQ(inc.getNbNNs(i, l), all.getNbNNs(i, l));
+            for (size_t j = 0; j < all.getNbNNs(i, l); j++) {
+                EXPECT_EQ(inc.getNNs(i, l)[j], all.getNNs(i, l)[j]);
+            }
+        }
+    }
+}
+
+TEST(knn, graph_resamplers) {
+    NeighbourGraph graph(3, 1, 3);
+    graph.addRows(data, 10, labels);
+    Smote smote(graph, false, 2);
+    smote.execute();
+    EXPECT_EQ(smote.getNbSynthRows(), 12);
+    // Synthetic rows are interpolated between negative rows so must lie in
+    // their bounding box
+    for (size_t i = 0; i < smote.getNbSynthRows(); i++) {
+        EXPECT_GE(smote.getSynth(i, 0), 9.0);
+        EXPECT_LE(smote.getSynth(i, 0), 14.0);
+    }
+    vector<bool> l = labels;
+    ENN enn1(3, 1, data, 10, 3, l);
+    vector<bool> r1;
+    uint32_t d1 = enn1.execute(r1);
+    ENN enn2(3, graph);
+    vector<bool> r2;
+    uint32_t d2 = enn2.execute(r2);
+    EXPECT_EQ(d1, d2);
+    EXPECT_EQ(r1, r2);
+}
@@ -0,0 +1,118 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+#include <thread>
+using std::string;
+using std::stringstream;
+using std::thread;
+
+#include <portcullis/instrument.hpp>
+#include <portcullis/run_report.hpp>
+using portcullis::Instrument;
+using portcullis::ProbeStats;
+using portcullis::RunReport;
+using portcullis::StageRecord;
+using portcullis::StageTimer;
+using portcullis::TaskRecord;
+
+TEST(run_report, nested_stages) {
+    RunReport report;
+    report.begin("test");
+    {
+        StageTimer outer("outer", report);
+        {
+            StageTimer inner("inner", report);
+            inner.setRecords(10);
+        }
+        // Stages opened on other threads don't nest inside this one
+        thread t([&report] {
+            StageTimer worker("worker", report);
+        });
+        t.join();
+        StageTimer early("early", report);
+        early.stop();
+        early.stop();
+    }
+    vector<StageRecord> stages = report.getStages();
+    ASSERT_EQ(4, stages.size());
+    EXPECT_EQ("outer/inner", stages[0].name);
+    EXPECT_EQ(10, stages[0].records);
+    EXPECT_EQ("worker", stages[1].name);
+    EXPECT_EQ("outer/early", stages[2].name);
+    EXPECT_EQ("outer", stages[3].name);
+    EXPECT_LE(stages[3].start, stages[0].start);
+}
+
+TEST(run_report, json) {
+    RunReport report;
+    report.begin("test");
+    report.setVersion("1.0");
+    report.setCounter("alignments", 5);
+    report.addCounter("alignments", 2);
+    report.setSetting("name", "a \"quoted\"\tvalue");
+    TaskRecord task;
+    task.stage = "find";
+    task.name = "chr1";
+    task.records = 7;
+    report.addTask(task);
+    {
+        StageTimer stage("find", report);
+        stage.setRecords(7);
+    }
+    EXPECT_EQ(7, report.getCounter("alignments"));
+    EXPECT_EQ(0, report.getCounter("missing"));
+    stringstream ss;
+    report.write(ss);
+    string json = ss.str();
+    EXPECT_NE(string::npos, json.find("\"mode\": \"test\""));
+    EXPECT_NE(string::npos, json.find("\"alignments\": 7"));
+    EXPECT_NE(string::npos, json.find("a \\\"quoted\\\"\\tvalue"));
+    EXPECT_NE(string::npos, json.find("{\"name\": \"find\""));
+    EXPECT_NE(string::npos, json.find("\"records_per_s\""));
+    EXPECT_NE(string::npos, json.find("{\"stage\": \"find\", \"name\": \"chr1\""));
+}
+
+TEST(run_report, instrument) {
+    ProbeStats stats;
+    stats.add(1);
+    stats.add(3);
+    stats.add(1000);
+    EXPECT_EQ(3, stats.count);
+    EXPECT_EQ(1004, stats.totalNs);
+    EXPECT_EQ(1000, stats.maxNs);
+    EXPECT_EQ(1, stats.histogram[0]);
+    EXPECT_EQ(1, stats.histogram[1]);
+    EXPECT_EQ(1, stats.histogram[9]);
+
+    Instrument::reset();
+    size_t id = Instrument::registerProbe("test::probe");
+    EXPECT_EQ(id, Instrument::registerProbe("test::probe"));
+    Instrument::record(id, 100);
+    Instrument::trace("task \"1\"", "task", 1000, 3000);
+    stringstream probes;
+    Instrument::writeProbes(probes);
+    EXPECT_NE(string::npos, probes.str().find("\"test::probe\": {\"count\": 1, \"total_ns\": 100"));
+    stringstream trace;
+    Instrument::writeTrace(trace);
+    EXPECT_NE(string::npos, trace.str().find("{\"name\": \"task \\\"1\\\"\", \"cat\": \"task\", \"ph\": \"X\""));
+    EXPECT_NE(string::npos, trace.str().find("\"ts\": 1.000, \"dur\": 2.000"));
+    Instrument::reset();
+}
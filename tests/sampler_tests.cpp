@@ -0,0 +1,106 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <vector>
+using std::cout;
+using std::endl;
+using std::vector;
+
+#include <portcullis/intron.hpp>
+#include <portcullis/junction.hpp>
+#include <portcullis/ml/stratified_sampler.hpp>
+using portcullis::CanonicalSS;
+using portcullis::Intron;
+using portcullis::Junction;
+using portcullis::JunctionList;
+using portcullis::JunctionPtr;
+using portcullis::ml::StratifiedSampler;
+
+namespace {
+const RefSeq rs(0, "seq_0", 1000000);
+
+JunctionPtr makeJunction(int32_t start, int32_t intronSize, bool canonical) {
+    shared_ptr<Intron> l(new Intron(rs, start, start + intronSize - 1));
+    JunctionPtr j = make_shared<Junction>(l, start - 10, start + intronSize + 10);
+    if (canonical) {
+        j->setDonorAndAcceptorMotif("GT", "AG");
+    }
+    return j;
+}
+}
+
+TEST(sampler, intron_size_bin) {
+    EXPECT_EQ(StratifiedSampler::intronSizeBin(0), 0);
+    EXPECT_EQ(StratifiedSampler::intronSizeBin(1), 0);
+    EXPECT_EQ(StratifiedSampler::intronSizeBin(2), 1);
+    EXPECT_EQ(StratifiedSampler::intronSizeBin(1000), 9);
+    EXPECT_EQ(StratifiedSampler::intronSizeBin(UINT32_MAX), 31);
+}
+
+TEST(sampler, cap) {
+    vector<size_t> sizes = {10, 0, 2, 5};
+    // 2 fits whole, then 9 left for two strata
+    EXPECT_EQ(StratifiedSampler::capFor(sizes, 11), 4);
+    EXPECT_EQ(StratifiedSampler::capFor(sizes, 100), 10);
+    EXPECT_EQ(StratifiedSampler::capFor(sizes, 0), 0);
+}
+
+TEST(sampler, sample) {
+    JunctionList in;
+    for (int32_t i = 0; i < 100; i++) {
+        in.push_back(makeJunction(100 + i * 2000, 1000, true));
+    }
+    for (int32_t i = 0; i < 5; i++) {
+        in.push_back(makeJunction(500000 + i * 2000, 50, false));
+    }
+    StratifiedSampler sampler;
+    JunctionList sampled;
+    JunctionList held;
+    sampler.sample(in, 20, sampled, held);
+    EXPECT_EQ(sampled.size(), 20);
+    EXPECT_EQ(held.size(), 85);
+    // The rare stratum is kept whole
+    size_t rare = 0;
+    for (auto& j : sampled) {
+        if (j->getIntronSize() == 50) rare++;
+    }
+    EXPECT_EQ(rare, 5);
+    // Input order is kept in both outputs
+    for (size_t i = 1; i < sampled.size(); i++) {
+        EXPECT_LT(sampled[i - 1]->getIntron()->start, sampled[i]->getIntron()->start);
+    }
+    // Same seed, same sample
+    JunctionList sampled2;
+    JunctionList held2;
+    sampler.sample(in, 20, sampled2, held2);
+    EXPECT_EQ(sampled, sampled2);
+    // A budget covering the input keeps everything
+    JunctionList all;
+    JunctionList none;
+    sampler.sample(in, in.size(), all, none);
+    EXPECT_EQ(all.size(), in.size());
+    EXPECT_TRUE(none.empty());
+    // A zero budget takes nothing
+    JunctionList empty;
+    JunctionList rest;
+    sampler.sample(in, 0, empty, rest);
+    EXPECT_TRUE(empty.empty());
+    EXPECT_EQ(rest.size(), in.size());
+}
@@ -0,0 +1,87 @@
+#! /bin/sh
+
+# Runs the portcullis pipeline over synthetic datasets of increasing size and
+# across several thread counts, recording the stage timings and peak memory of
+# each step.  Generate a scaling curve with, for example:
+#
+#   make scaling SIZES="1000000 10000000 100000000" THREADS="1 4 16"
+#
+# Each step writes its own run report; everything is collected into
+# ${WORK}/scaling.tsv with one row per step and one per stage within it.
+#
+# Settings (environment variables):
+#   SIZES       Read counts to generate (default: 1000000)
+#   THREADS     Thread counts to run each step with (default: 1 4)
+#   WORK        Working directory (default: temp/scaling)
+#   SYNTH_ARGS  Extra arguments for synth_data, e.g. "-d 1000 -m 0.2 -c 25"
+#   FILT_ARGS   Extra arguments for portcullis filt, e.g. "--no_ml" on boxes
+#               without the python filtering environment
+#   KEEP        Keep the per-run outputs if set to 1 (default: 0)
+
+. ./compat.sh
+
+SYNTH=${SYNTH:-./synth_data}
+SIZES=${SIZES:-1000000}
+THREADS=${THREADS:-1 4}
+WORK=${WORK:-temp/scaling}
+SYNTH_ARGS=${SYNTH_ARGS:-}
+FILT_ARGS=${FILT_ARGS:-}
+KEEP=${KEEP:-0}
+
+mkdir -p ${WORK}/reports
+
+for size in ${SIZES}; do
+    data=${WORK}/data_${size}
+    if [ ! -f ${data}/reads.bam ]; then
+        ${SYNTH} -n ${size} -o ${data} ${SYNTH_ARGS}
+    fi
+
+    for t in ${THREADS}; do
+        run=${WORK}/run_${size}_t${t}
+        rep=${WORK}/reports/${size}_t${t}
+        rm -rf ${run}
+        mkdir -p ${run}
+
+        $PORTCULLIS prep -t ${t} -o ${run}/prep ${data}/genome.fa ${data}/reads.bam
+        cp ${run}/prep/portcullis.report.json ${rep}.prep.json
+
+        $PORTCULLIS junc -t ${t} -o ${run}/junc/portcullis ${run}/prep
+        cp ${run}/junc/portcullis.report.json ${rep}.junc.json
+
+        $PORTCULLIS junc -t ${t} --extra -o ${run}/junc_extra/portcullis ${run}/prep
+        cp ${run}/junc_extra/portcullis.report.json ${rep}.junc_extra.json
+
+        $PORTCULLIS filt -t ${t} ${FILT_ARGS} -o ${run}/filt/portcullis ${run}/prep ${run}/junc/portcullis.junctions.tab
+        cp ${run}/filt/portcullis.report.json ${rep}.filt.json
+
+        $PORTCULLIS bamfilt -t ${t} -o ${run}/filtered.bam ${run}/filt/portcullis.pass.junctions.tab ${run}/prep/portcullis.sorted.alignments.bam
+        cp ${run}/filtered.bam.report.json ${rep}.bamfilt.json
+
+        if [ "${KEEP}" != "1" ]; then
+            rm -rf ${run}
+        fi
+    done
+done
+
+# Flatten the reports into a single table
+python3 - ${WORK}/reports ${WORK}/scaling.tsv <<'PYEOF'
+import glob, json, os, sys
+
+steps = ["prep", "junc", "junc_extra", "filt", "bamfilt"]
+rows = []
+for f in glob.glob(os.path.join(sys.argv[1], "*.json")):
+    # Report files are named <reads>_t<threads>.<step>.json
+    key, step = os.path.basename(f)[:-5].split(".", 1)
+    size, threads = key.split("_t")
+    with open(f) as fh:
+        r = json.load(fh)
+    rows.append([size, threads, step, "", r["wall_s"], r["user_s"], r["system_s"], r["peak_rss_kb"], ""])
+    for s in r["stages"]:
+        rows.append([size, threads, step, s["name"], s["wall_s"], s["user_s"], s["system_s"], s["peak_rss_kb"], s.get("records", "")])
+
+with open(sys.argv[2], "w") as out:
+    out.write("reads\tthreads\tstep\tstage\twall_s\tuser_s\tsystem_s\tpeak_rss_kb\trecords\n")
+    for row in sorted(rows, key=lambda x: (int(x[0]), int(x[1]), steps.index(x[2]))):
+        out.write("\t".join(str(x) for x in row) + "\n")
+print("Scaling results written to " + sys.argv[2])
+PYEOF
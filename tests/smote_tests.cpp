@@ -32,7 +32,9 @@ using std::stringstream;
 namespace bfs = boost::filesystem;
 using bfs::path;
 
+#include <portcullis/ml/icote.hpp>
 #include <portcullis/ml/smote.hpp>
+using portcullis::ml::Icote;
 using portcullis::ml::Smote;
 
         
@@ -56,3 +58,41 @@ TEST(smote, simple) {
     //EXPECT_EQ(smote.getNbSynthRows(), 20);
 }
 
+
+TEST(icote, simple) {
+
+    double data[] = {
+        0.2, 0.4, 1.5, 2.3, 0.0,
+        0.3, 0.3, 2.6, 5.2, 0.1,
+        0.3, 0.3, 2.4, 5.2, 0.1,
+        0.1, 0.2, 0.5, 3.1, 0.3,
+        0.3, 0.3, 2.6, 5.2, 0.9,
+        0.3, 0.3, 2.6, 5.2, 0.1,
+        0.3, 0.7, 2.6, 5.2, 0.1,
+        0.2, 0.3, 2.6, 4.2, 0.1,
+        0.3, 0.8, 2.6, 2.2, 0.1,
+        1.3, 1.3, 2.6, 8.2, 0.8
+    };
+    // Make the last column constant
+    for (size_t i = 0; i < 10; i++) {
+        data[(i * 5) + 4] = 0.5;
+    }
+    Icote icote1(30, 1, data, 10, 5);
+    icote1.execute();
+    EXPECT_EQ(icote1.getNbSynthRows(), 300);
+    for (size_t i = 0; i < icote1.getNbSynthRows(); i++) {
+        EXPECT_GE(icote1.getSynth(i, 0), 0.1);
+        EXPECT_LE(icote1.getSynth(i, 0), 1.3);
+        EXPECT_GE(icote1.getSynth(i, 3), 2.2);
+        EXPECT_LE(icote1.getSynth(i, 3), 8.2);
+        EXPECT_EQ(icote1.getSynth(i, 4), 0.5);
+    }
+    // Results should not depend on the number of threads
+    Icote icote4(30, 4, data, 10, 5);
+    icote4.execute();
+    for (size_t i = 0; i < icote1.getNbSynthRows(); i++) {
+        for (size_t j = 0; j < 5; j++) {
+            EXPECT_EQ(icote1.getSynth(i, j), icote4.getSynth(i, j));
+        }
+    }
+}
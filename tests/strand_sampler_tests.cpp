@@ -0,0 +1,89 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <gtest/gtest.h>
+
+#include <portcullis/bam/bam_master.hpp>
+#include <portcullis/strand_sampler.hpp>
+using portcullis::bam::Orientation;
+using portcullis::bam::Strandedness;
+using portcullis::StrandSample;
+using portcullis::StrandSampler;
+
+TEST(strand_sampler, van_der_corput) {
+    EXPECT_DOUBLE_EQ(StrandSampler::vanDerCorput(0), 0.0);
+    EXPECT_DOUBLE_EQ(StrandSampler::vanDerCorput(1), 0.5);
+    EXPECT_DOUBLE_EQ(StrandSampler::vanDerCorput(2), 0.25);
+    EXPECT_DOUBLE_EQ(StrandSampler::vanDerCorput(3), 0.75);
+    EXPECT_DOUBLE_EQ(StrandSampler::vanDerCorput(5), 0.625);
+}
+
+TEST(strand_sampler, single_end) {
+    // Junctions count unpaired reads as R2
+    StrandSample s;
+    s.unpairedReads = 1000;
+    s.counts.r2PosWhenSsPos = 20;
+    s.counts.r2NegWhenSsPos = 480;
+    s.counts.r2PosWhenSsNeg = 490;
+    s.counts.r2NegWhenSsNeg = 10;
+    StrandSampler::decide(s);
+    EXPECT_EQ(s.orientation, Orientation::SE);
+    EXPECT_EQ(s.strandedness, Strandedness::FIRSTSTRAND);
+}
+
+TEST(strand_sampler, paired_unstranded) {
+    StrandSample s;
+    s.pairedReads = 1000;
+    s.pairsFR = 400;
+    s.pairsRF = 10;
+    s.counts.r1PosWhenSsPos = 250;
+    s.counts.r1NegWhenSsPos = 240;
+    s.counts.r1PosWhenSsNeg = 260;
+    s.counts.r1NegWhenSsNeg = 250;
+    s.counts.r2PosWhenSsPos = 250;
+    s.counts.r2NegWhenSsPos = 240;
+    s.counts.r2PosWhenSsNeg = 260;
+    s.counts.r2NegWhenSsNeg = 250;
+    StrandSampler::decide(s);
+    EXPECT_EQ(s.orientation, Orientation::FR);
+    EXPECT_EQ(s.strandedness, Strandedness::UNSTRANDED);
+}
+
+TEST(strand_sampler, paired_firststrand) {
+    // dUTP: R1 runs against the transcript, R2 with it
+    StrandSample s;
+    s.pairedReads = 1000;
+    s.pairsFR = 400;
+    s.counts.r1NegWhenSsPos = 250;
+    s.counts.r1PosWhenSsNeg = 250;
+    s.counts.r2PosWhenSsPos = 250;
+    s.counts.r2NegWhenSsNeg = 250;
+    StrandSampler::decide(s);
+    EXPECT_EQ(s.orientation, Orientation::FR);
+    EXPECT_EQ(s.strandedness, Strandedness::FIRSTSTRAND);
+    EXPECT_EQ(s.informativeReads(), 1000);
+    // The same reads from an RF library are named from the other mate
+    s.pairsRF = 800;
+    StrandSampler::decide(s);
+    EXPECT_EQ(s.orientation, Orientation::RF);
+    EXPECT_EQ(s.strandedness, Strandedness::SECONDSTRAND);
+    // Same strand mates can't have mates disagreeing about the transcript
+    s.pairsFF = 2000;
+    StrandSampler::decide(s);
+    EXPECT_EQ(s.orientation, Orientation::FF);
+    EXPECT_EQ(s.strandedness, Strandedness::UNKNOWN);
+}
@@ -0,0 +1,430 @@
+//  ********************************************************************
+//  This file is part of Portcullis.
+//
+//  Portcullis is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Portcullis is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with Portcullis.  If not, see <http://www.gnu.org/licenses/>.
+//  *******************************************************************
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::ofstream;
+using std::string;
+using std::stringstream;
+using std::vector;
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+namespace bfs = boost::filesystem;
+namespace po = boost::program_options;
+using bfs::path;
+
+#include <htslib/kstring.h>
+#include <htslib/sam.h>
+
+#include <portcullis/bam/bam_writer.hpp>
+using portcullis::bam::BamWriter;
+
+/**
+ * Generates a synthetic genome, a splice model over it and a coordinate sorted
+ * BAM of single end RNAseq alignments drawn from that model.  Everything is
+ * streamed so hundreds of millions of reads can be written without holding
+ * them in memory; only the genome itself is kept.  The output directory ends
+ * up with:
+ *  - genome.fa: the reference sequences
+ *  - junctions.bed: the true junctions, one per intron in the splice model
+ *  - reads.bam (+ .bai): the alignments
+ *
+ * Each chromosome carries a single gene model running along its whole length:
+ * alternating exons and introns with canonical GT-AG splice sites.  Most reads
+ * are sampled from the spliced transcript so a read spanning an exon boundary
+ * is split across the intron.  Some exons are made shorter than half a read,
+ * so reads crossing them are multiply spliced.  The rest of the reads fall
+ * unspliced in introns.
+ */
+
+namespace {
+
+struct Settings {
+	uint64_t reads;
+	uint64_t genomeSize;
+	uint32_t chromosomes;
+	double skew;
+	int32_t readLength;
+	double junctionDensity;
+	int32_t minIntron;
+	int32_t maxIntron;
+	double multiSplice;
+	double intronic;
+	double errorRate;
+	int32_t minAnchor;
+	uint32_t cells;
+	uint32_t seed;
+};
+
+struct Chromosome {
+	string name;
+	string seq;
+	vector<std::pair<int32_t, int32_t>> exons;	// [start, end) in genomic coordinates
+	uint64_t exonicLength;
+	uint64_t intronicLength;
+};
+
+struct Read {
+	int32_t pos;
+	string cigar;
+	string seq;
+	bool spliced;
+};
+
+const char BASES[] = "ACGT";
+
+void makeChromosome(Chromosome& c, int32_t length, const Settings& s, std::mt19937_64& rng) {
+	std::uniform_int_distribution<int> base(0, 3);
+	c.seq.resize(length);
+	for (auto& b : c.seq) {
+		b = BASES[base(rng)];
+	}
+	// Lay out the gene model.  The mean exon length is whatever is left of the
+	// spacing between junctions after taking away the mean intron.
+	const double spacing = 1000000.0 / s.junctionDensity;
+	const double meanIntron = (s.minIntron + s.maxIntron) / 2.0;
+	const double meanExon = std::max((double)s.readLength, spacing - meanIntron);
+	std::exponential_distribution<double> exonLen(1.0 / meanExon);
+	std::uniform_int_distribution<int32_t> shortExonLen(s.minAnchor * 2, std::max(s.minAnchor * 2, s.readLength / 2));
+	std::uniform_int_distribution<int32_t> intronLen(s.minIntron, s.maxIntron);
+	std::bernoulli_distribution isShort(s.multiSplice);
+	c.exons.clear();
+	c.exonicLength = 0;
+	c.intronicLength = 0;
+	int32_t pos = 0;
+	bool first = true;
+	while (true) {
+		int32_t el = !first && isShort(rng) ? shortExonLen(rng) : s.readLength + (int32_t)exonLen(rng);
+		first = false;
+		int32_t il = intronLen(rng);
+		// Finish with an exon at least a read long
+		if ((int64_t)pos + el + il + s.readLength * 2 >= length) {
+			c.exons.push_back(std::make_pair(pos, length));
+			c.exonicLength += length - pos;
+			break;
+		}
+		c.exons.push_back(std::make_pair(pos, pos + el));
+		c.exonicLength += el;
+		pos += el;
+		// Canonical donor and acceptor
+		c.seq[pos] = 'G';
+		c.seq[pos + 1] = 'T';
+		c.seq[pos + il - 2] = 'A';
+		c.seq[pos + il - 1] = 'G';
+		c.intronicLength += il;
+		pos += il;
+	}
+}
+
+/**
+ * Produces reads in genomic order from either the exonic (spliced transcript)
+ * or intronic coordinate space of a chromosome.  Start positions are drawn as
+ * a Poisson process so they come out sorted without buffering.
+ */
+class ReadStream {
+private:
+	const Chromosome& c;
+	const Settings& s;
+	bool exonic;
+	double t;		// Position in exonic or intronic coordinate space
+	double limit;
+	std::exponential_distribution<double> gap;
+	size_t k;		// Current exon (or exon before the current intron)
+	uint64_t offset;	// Coordinate space length before exon / intron k
+	bool hasNext;
+	Read next;
+
+	bool advance(std::mt19937_64& rng);
+
+public:
+	ReadStream(const Chromosome& _c, const Settings& _s, bool _exonic, uint64_t n) : c(_c), s(_s), exonic(_exonic) {
+		t = 0.0;
+		const uint64_t space = exonic ? c.exonicLength : c.intronicLength;
+		limit = space > (uint64_t)s.readLength ? (double)(space - s.readLength) : 0.0;
+		gap = std::exponential_distribution<double>(n > 0 && limit > 0.0 ? n / limit : 1.0);
+		k = 0;
+		offset = 0;
+		hasNext = n > 0 && limit > 0.0;
+	}
+
+	bool peek(std::mt19937_64& rng) {
+		return hasNext && (next.cigar.empty() ? advance(rng) : true);
+	}
+
+	const Read& get() const {
+		return next;
+	}
+
+	void pop() {
+		next.cigar.clear();
+	}
+};
+
+bool ReadStream::advance(std::mt19937_64& rng) {
+	while (true) {
+		t += gap(rng);
+		if (t >= limit) {
+			hasNext = false;
+			return false;
+		}
+		const uint64_t u = (uint64_t)t;
+		next.seq.clear();
+		next.spliced = false;
+		stringstream cigar;
+		if (exonic) {
+			while (u >= offset + (c.exons[k].second - c.exons[k].first)) {
+				offset += c.exons[k].second - c.exons[k].first;
+				k++;
+			}
+			int32_t gpos = c.exons[k].first + (int32_t)(u - offset);
+			next.pos = gpos;
+			int32_t remaining = s.readLength;
+			size_t e = k;
+			bool valid = true;
+			while (remaining > 0) {
+				int32_t m = std::min(remaining, c.exons[e].second - gpos);
+				// Aligners won't place tiny anchors, so drop reads that start
+				// with one and soft clip the end of those that finish with one
+				if (remaining == s.readLength && m < remaining && m < s.minAnchor) {
+					valid = false;
+					break;
+				}
+				cigar << m << "M";
+				next.seq += c.seq.substr(gpos, m);
+				remaining -= m;
+				if (remaining > 0) {
+					e++;
+					gpos = c.exons[e].first;
+					if (remaining < s.minAnchor) {
+						cigar << remaining << "S";
+						next.seq += c.seq.substr(gpos, remaining);
+						break;
+					}
+					cigar << (c.exons[e].first - c.exons[e - 1].second) << "N";
+					next.spliced = true;
+				}
+			}
+			if (!valid) {
+				continue;
+			}
+		}
+		else {
+			while (u >= offset + (c.exons[k + 1].first - c.exons[k].second)) {
+				offset += c.exons[k + 1].first - c.exons[k].second;
+				k++;
+			}
+			int32_t gpos = c.exons[k].second + (int32_t)(u - offset);
+			gpos = std::min(gpos, (int32_t)c.seq.size() - s.readLength);
+			next.pos = gpos;
+			cigar << s.readLength << "M";
+			next.seq = c.seq.substr(gpos, s.readLength);
+		}
+		next.cigar = cigar.str();
+		return true;
+	}
+}
+
+void writeGenome(const path& file, const vector<Chromosome>& chrs) {
+	ofstream out(file.c_str());
+	for (const auto& c : chrs) {
+		out << ">" << c.name << "\n";
+		for (size_t i = 0; i < c.seq.size(); i += 80) {
+			out << c.seq.substr(i, 80) << "\n";
+		}
+	}
+}
+
+void writeJunctions(const path& file, const vector<Chromosome>& chrs) {
+	ofstream out(file.c_str());
+	out << "track name=\"junctions\" description=\"Synthetic splice model\"" << endl;
+	uint64_t id = 0;
+	for (const auto& c : chrs) {
+		for (size_t i = 0; i + 1 < c.exons.size(); i++) {
+			out << c.name << "\t" << c.exons[i].second << "\t" << c.exons[i + 1].first
+				<< "\tjunc_" << id++ << "\t1000\t+" << endl;
+		}
+	}
+}
+
+bam_hdr_t* makeHeader(const vector<Chromosome>& chrs) {
+	stringstream text;
+	text << "@HD\tVN:1.0\tSO:coordinate\n";
+	for (const auto& c : chrs) {
+		text << "@SQ\tSN:" << c.name << "\tLN:" << c.seq.size() << "\n";
+	}
+	text << "@PG\tID:synth_data\tPN:synth_data\n";
+	string t = text.str();
+	bam_hdr_t* h = sam_hdr_parse(t.size(), t.c_str());
+	h->l_text = t.size();
+	h->text = (char*)malloc(t.size() + 1);
+	memcpy(h->text, t.c_str(), t.size() + 1);
+	return h;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+	Settings s;
+	path outputDir;
+	po::options_description desc("Generates a synthetic genome, splice model and coordinate sorted BAM for\nscaling tests.\n\nUsage: synth_data [options] -o <dir>\n\nOptions");
+	desc.add_options()
+			("output,o", po::value<path>(&outputDir)->default_value("synth"),
+			"Output directory.")
+			("reads,n", po::value<uint64_t>(&s.reads)->default_value(1000000),
+			"Number of reads to generate (approximate, reads are placed by a Poisson process).")
+			("genome_size,g", po::value<uint64_t>(&s.genomeSize)->default_value(100000000),
+			"Total genome length in bp.")
+			("chromosomes,c", po::value<uint32_t>(&s.chromosomes)->default_value(10),
+			"Number of chromosomes.")
+			("skew", po::value<double>(&s.skew)->default_value(1.0),
+			"Chromosome length skew.  Chromosome i gets a share of the genome proportional to 1/(i+1)^skew, so 0 gives equal lengths.")
+			("read_length,l", po::value<int32_t>(&s.readLength)->default_value(100),
+			"Read length.")
+			("junction_density,d", po::value<double>(&s.junctionDensity)->default_value(500.0),
+			"Junctions per Mbp.")
+			("min_intron", po::value<int32_t>(&s.minIntron)->default_value(50),
+			"Minimum intron length.")
+			("max_intron", po::value<int32_t>(&s.maxIntron)->default_value(2000),
+			"Maximum intron length.")
+			("multi_splice,m", po::value<double>(&s.multiSplice)->default_value(0.1),
+			"Fraction of internal exons shorter than half a read, which produce multiply spliced reads.")
+			("intronic", po::value<double>(&s.intronic)->default_value(0.05),
+			"Fraction of reads placed unspliced inside introns.")
+			("error_rate,e", po::value<double>(&s.errorRate)->default_value(0.005),
+			"Per base substitution rate.")
+			("min_anchor", po::value<int32_t>(&s.minAnchor)->default_value(8),
+			"Minimum aligned anchor length.  Reads starting with a shorter anchor are dropped, those ending with one are soft clipped.")
+			("cells", po::value<uint32_t>(&s.cells)->default_value(0),
+			"Tag each read with a CB cell barcode picked at random from this many cells.  0 for no barcodes.")
+			("seed", po::value<uint32_t>(&s.seed)->default_value(1),
+			"Random seed.")
+			("help", "Produce help message")
+			;
+	po::variables_map vm;
+	po::store(po::parse_command_line(argc, argv, desc), vm);
+	po::notify(vm);
+	if (vm.count("help")) {
+		cout << desc << endl;
+		return 0;
+	}
+	if (s.minIntron < 4 || s.maxIntron < s.minIntron || s.readLength < s.minAnchor * 2 || s.chromosomes == 0 || s.junctionDensity <= 0.0) {
+		cerr << "Invalid settings, see --help" << endl;
+		return 1;
+	}
+	bfs::create_directories(outputDir);
+	std::mt19937_64 rng(s.seed);
+	// Share the genome out across the chromosomes
+	vector<double> weights(s.chromosomes);
+	double sum = 0.0;
+	for (uint32_t i = 0; i < s.chromosomes; i++) {
+		weights[i] = 1.0 / std::pow(i + 1.0, s.skew);
+		sum += weights[i];
+	}
+	vector<Chromosome> chrs(s.chromosomes);
+	const int32_t minLength = (s.maxIntron + s.readLength) * 4;
+	for (uint32_t i = 0; i < s.chromosomes; i++) {
+		chrs[i].name = "chr" + std::to_string(i + 1);
+		makeChromosome(chrs[i], std::max(minLength, (int32_t)(s.genomeSize * weights[i] / sum)), s, rng);
+	}
+	uint64_t totalLength = 0;
+	uint64_t nbJunctions = 0;
+	for (const auto& c : chrs) {
+		totalLength += c.seq.size();
+		nbJunctions += c.exons.size() - 1;
+	}
+	cout << "Writing genome and splice model (" << nbJunctions << " junctions) to " << outputDir << endl;
+	writeGenome(outputDir / "genome.fa", chrs);
+	writeJunctions(outputDir / "junctions.bed", chrs);
+	// Stream the reads out chromosome by chromosome, merging the exonic and
+	// intronic streams to keep everything in coordinate order
+	bam_hdr_t* header = makeHeader(chrs);
+	BamWriter writer(outputDir / "reads.bam");
+	writer.open(header, true);
+	bam1_t* b = bam_init1();
+	kstring_t line = {0, 0, NULL};
+	std::uniform_real_distribution<double> unif(0.0, 1.0);
+	std::uniform_int_distribution<int> base(0, 2);
+	std::uniform_int_distribution<uint32_t> cell(0, s.cells > 0 ? s.cells - 1 : 0);
+	uint64_t id = 0, spliced = 0;
+	for (uint32_t i = 0; i < chrs.size(); i++) {
+		const Chromosome& c = chrs[i];
+		const uint64_t n = (uint64_t)((double)s.reads * c.seq.size() / totalLength);
+		const uint64_t ni = (uint64_t)(n * s.intronic);
+		ReadStream ex(c, s, true, n - ni);
+		ReadStream in(c, s, false, ni);
+		while (true) {
+			bool hasEx = ex.peek(rng);
+			bool hasIn = in.peek(rng);
+			if (!hasEx && !hasIn) {
+				break;
+			}
+			bool useEx = hasEx && (!hasIn || ex.get().pos <= in.get().pos);
+			ReadStream& rs = useEx ? ex : in;
+			Read r = rs.get();
+			rs.pop();
+			for (auto& x : r.seq) {
+				if (unif(rng) < s.errorRate) {
+					// Substitute with one of the other three bases
+					const char* p = strchr(BASES, x);
+					x = BASES[((p - BASES) + 1 + base(rng)) % 4];
+				}
+			}
+			const bool reverse = unif(rng) < 0.5;
+			stringstream sam;
+			sam << "r" << id++ << "\t" << (reverse ? 16 : 0) << "\t" << c.name << "\t" << r.pos + 1 << "\t60\t"
+				<< r.cigar << "\t*\t0\t0\t" << r.seq << "\t" << string(r.seq.size(), 'I') << "\tNH:i:1";
+			if (r.spliced) {
+				sam << "\tXS:A:+";
+				spliced++;
+			}
+			if (s.cells > 0) {
+				// 16bp barcodes in the 10x style, spelling out the cell number in base 4
+				string barcode(16, 'A');
+				for (uint32_t x = cell(rng), j = 0; j < 16; x /= 4, j++) {
+					barcode[15 - j] = BASES[x % 4];
+				}
+				sam << "\tCB:Z:" << barcode << "-1";
+			}
+			string str = sam.str();
+			line.l = 0;
+			kputsn(str.c_str(), str.size(), &line);
+			if (sam_parse1(&line, header, b) < 0) {
+				cerr << "Could not create alignment: " << str << endl;
+				return 1;
+			}
+			writer.write(b);
+		}
+	}
+	writer.close();
+	free(line.s);
+	bam_destroy1(b);
+	bam_hdr_destroy(header);
+	cout << "Wrote " << id << " alignments (" << spliced << " spliced) to " << (outputDir / "reads.bam") << endl;
+	return 0;
+}